@@ -53,6 +53,8 @@
 #include <locks.h>
 #include <scope.h>
 #include <matching.h>
+#include <regex_cache.h>
+#include <dbm_api.h>
 #include <instrumentation.h>
 #include <promises.h>
 #include <unix.h>
@@ -72,6 +74,8 @@
 #include <bootstrap.h>
 #include <misc_lib.h>
 #include <buffer.h>
+#include <profiler.h>
+#include <warm_worker.h>
 
 #include <mod_common.h>
 
@@ -120,6 +124,27 @@ static int CFA_BACKGROUND_LIMIT = 1;
 
 static Item *PROCESSREFRESH;
 
+/* Folded stacks are written here at the end of the run if --profile was given */
+static char *PROFILE_FILE = NULL;
+#define PROFILE_SUMMARY_TOP 20
+
+/* Serve runs for cf-execd from a forked copy of this process, see warm_agent.h */
+static bool WARM_WORKER = false;
+
+/* Start of the run, to report how long it takes to reach the first promise */
+static struct timespec RUN_STARTED;
+static bool FIRST_PROMISE_REACHED = false;
+
+/* Databases written many times per run, see BeginDBBatches() */
+static const dbid BATCHED_DBS[] =
+{
+    dbid_locks,
+    dbid_checksums,
+    dbid_performance,
+};
+
+static CF_DB *BATCHED_DB_HANDLES[sizeof(BATCHED_DBS) / sizeof(BATCHED_DBS[0])];
+
 static const char *AGENT_TYPESEQUENCE[] =
 {
     "meta",
@@ -153,6 +178,7 @@ static void FreeStringArray(int size, char **array);
 static void CheckAgentAccess(Rlist *list, const Policy *policy);
 static void KeepControlPromises(EvalContext *ctx, Policy *policy);
 static PromiseResult KeepAgentPromise(EvalContext *ctx, Promise *pp, void *param);
+static PromiseResult KeepAgentPromiseProfiled(EvalContext *ctx, Promise *pp, void *param);
 static int NewTypeContext(EvalContext *ctx, TypeSequence type);
 static void DeleteTypeContext(EvalContext *ctx, Bundle *bp, TypeSequence type);
 static void ClassBanner(EvalContext *ctx, TypeSequence type);
@@ -164,6 +190,11 @@ static int NoteBundleCompliance(const Bundle *bundle, int save_pr_kept, int save
 static void AllClassesReport(const EvalContext *ctx);
 static bool HasAvahiSupport(void);
 static int AutomaticBootstrap(GenericAgentConfig *config);
+static void BeginDBBatches(void);
+static void CommitDBBatches(void);
+static void FlushDBBatches(void);
+static void WriteProfile(void);
+static void NoteFirstPromise(void);
 
 /*******************************************************************/
 /* Command line options                                            */
@@ -195,6 +226,8 @@ static const struct option OPTIONS[] =
     {"legacy-output", no_argument, 0, 'l'},
     {"color", optional_argument, 0, 'C'},
     {"no-extensions", no_argument, 0, 'E'},
+    {"profile", optional_argument, 0, 'P'},
+    {"warm-worker", no_argument, 0, 'w'},
     {NULL, 0, 0, '\0'}
 };
 
@@ -216,6 +249,8 @@ static const char *HINTS[] =
     "Use legacy output format",
     "Enable colorized output. Possible values: 'always', 'auto', 'never'. If option is used, the default value is 'auto'",
     "Disable extension loading (used while upgrading)",
+    "Record time spent per bundle, promise and function, write it in folded stack format to the given file (default WORKDIR/state/cf-agent.folded) and print the costliest at the end of the run",
+    "Load the policy once and fork each run requested by cf-execd from it (started by cf-execd with warm_agent)",
     NULL
 };
 
@@ -225,6 +260,8 @@ int main(int argc, char *argv[])
 {
     int ret = 0;
 
+    clock_gettime(CLOCK_MONOTONIC, &RUN_STARTED);
+
     EvalContext *ctx = EvalContextNew();
 
     GenericAgentConfig *config = CheckOpts(ctx, argc, argv);
@@ -249,9 +286,17 @@ int main(int argc, char *argv[])
         policy = GenericAgentLoadPolicy(ctx, config);
     }
 
+    if (WARM_WORKER)
+    {
+        /* Returns in the process of each run */
+        WarmWorkerServe(ctx, policy, config, &RUN_STARTED);
+    }
+
     ThisAgentInit();
     BeginAudit();
+    BeginDBBatches();
     KeepPromises(ctx, policy, config);
+    EditSessionsCommit();
 
     if (ALLCLASSESREPORT)
     {
@@ -268,6 +313,7 @@ int main(int argc, char *argv[])
     Nova_NoteVarUsageDB(ctx);
     Nova_TrackExecution(config->input_file);
     PurgeLocks();
+    CommitDBBatches();
 
     if (config->agent_specific.agent.bootstrap_policy_server && !VerifyBootstrap(ctx))
     {
@@ -277,6 +323,19 @@ int main(int argc, char *argv[])
     }
 
     EndAudit(ctx, CFA_BACKGROUND);
+
+    if (ProfilerIsEnabled())
+    {
+        WriteProfile();
+    }
+
+    {
+        RegexCacheStats regex_stats;
+        RegexCacheGetStats(&regex_stats);
+        Log(LOG_LEVEL_VERBOSE, "Regex cache: %lu hits, %lu misses, %lu evictions, %zu entries",
+            regex_stats.hits, regex_stats.misses, regex_stats.evictions, regex_stats.size);
+    }
+
     EvalContextDestroy(ctx);
     GenericAgentConfigDestroy(config);
 
@@ -287,6 +346,93 @@ int main(int argc, char *argv[])
 /* Level 1                                                         */
 /*******************************************************************/
 
+/**
+ * Locks, checksums and performance data are written for nearly every
+ * promise. Group those writes into a few transactions instead of one
+ * synchronous commit each; see DBBeginBatch().
+ */
+static void BeginDBBatches(void)
+{
+    for (size_t i = 0; i < sizeof(BATCHED_DBS) / sizeof(BATCHED_DBS[0]); i++)
+    {
+        CF_DB *dbp;
+        if (OpenDB(&dbp, BATCHED_DBS[i]))
+        {
+            if (DBBeginBatch(dbp, 0, 0))
+            {
+                BATCHED_DB_HANDLES[i] = dbp;
+            }
+            /* The batch keeps the database open. */
+            CloseDB(dbp);
+        }
+    }
+}
+
+static void CommitDBBatches(void)
+{
+    for (size_t i = 0; i < sizeof(BATCHED_DBS) / sizeof(BATCHED_DBS[0]); i++)
+    {
+        if (BATCHED_DB_HANDLES[i] != NULL)
+        {
+            DBCommitBatch(BATCHED_DB_HANDLES[i]);
+            BATCHED_DB_HANDLES[i] = NULL;
+        }
+    }
+}
+
+/* For forked children, which leave with _exit() and skip CloseAllDBExit() */
+static void FlushDBBatches(void)
+{
+    for (size_t i = 0; i < sizeof(BATCHED_DBS) / sizeof(BATCHED_DBS[0]); i++)
+    {
+        if (BATCHED_DB_HANDLES[i] != NULL)
+        {
+            DBFlushBatch(BATCHED_DB_HANDLES[i]);
+        }
+    }
+}
+
+static void WriteProfile(void)
+{
+    FILE *fp = fopen(PROFILE_FILE, "w");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to write profile to '%s'. (fopen: %s)", PROFILE_FILE, GetErrorStr());
+    }
+    else
+    {
+        Writer *w = FileWriter(fp);
+        ProfilerWriteFolded(w);
+        WriterClose(w);
+        Log(LOG_LEVEL_NOTICE, "Profile written to '%s'", PROFILE_FILE);
+    }
+
+    Writer *out = FileWriter(stdout);
+    ProfilerWriteSummary(out, PROFILE_SUMMARY_TOP);
+    FileWriterDetach(out);
+
+    ProfilerStop();
+    free(PROFILE_FILE);
+    PROFILE_FILE = NULL;
+}
+
+static void NoteFirstPromise(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double milliseconds = (now.tv_sec - RUN_STARTED.tv_sec) * 1000.0 + (now.tv_nsec - RUN_STARTED.tv_nsec) / 1e6;
+
+    Log(LOG_LEVEL_VERBOSE, "First promise reached %.1f ms after the %s", milliseconds,
+        WARM_WORKER ? "run was requested" : "agent started");
+
+    if (WARM_WORKER)
+    {
+        WarmWorkerNoteFirstPromise(milliseconds);
+    }
+
+    FIRST_PROMISE_REACHED = true;
+}
+
 static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv)
 {
     extern char *optarg;
@@ -308,7 +454,7 @@ static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv)
     char **argv_new = TranslateOldBootstrapOptionsConcatenated(argc_new, argv_tmp);
     FreeStringArray(argc_new, argv_tmp);
 
-    while ((c = getopt_long(argc_new, argv_new, "dvnKIf:D:N:VxMB:b:hlC::E", OPTIONS, NULL)) != EOF)
+    while ((c = getopt_long(argc_new, argv_new, "dvnKIf:D:N:VxMB:b:hlC::EP::w", OPTIONS, NULL)) != EOF)
     {
         switch ((char) c)
         {
@@ -475,6 +621,23 @@ static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv)
             extension_libraries_disable();
             break;
 
+        case 'P':
+            free(PROFILE_FILE);
+            if (optarg)
+            {
+                PROFILE_FILE = xstrdup(optarg);
+            }
+            else
+            {
+                xasprintf(&PROFILE_FILE, "%s/state/cf-agent.folded", GetWorkDir());
+            }
+            ProfilerStart();
+            break;
+
+        case 'w':
+            WARM_WORKER = true;
+            break;
+
         default:
             {
                 Writer *w = FileWriter(stdout);
@@ -1188,6 +1351,8 @@ int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp)
     int save_pr_repaired = PR_REPAIRED;
     int save_pr_notkept = PR_NOTKEPT;
 
+    ProfilerEnter(PROFILE_FRAME_BUNDLE, bp->ns, bp->name);
+
     if (PROCESSREFRESH == NULL || (PROCESSREFRESH && IsRegexItemIn(ctx, PROCESSREFRESH, bp->name)))
     {
         DeleteItemList(PROCESSTABLE);
@@ -1218,13 +1383,16 @@ int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp)
             {
                 Promise *pp = SeqAt(sp->promises, ppi);
 
-                ExpandPromise(ctx, pp, KeepAgentPromise, NULL);
+                ProfilerEnter(PROFILE_FRAME_PROMISE, sp->name, pp->promiser);
+                ExpandPromise(ctx, pp, ProfilerIsEnabled() ? KeepAgentPromiseProfiled : KeepAgentPromise, NULL);
+                ProfilerLeave();
 
                 if (Abort())
                 {
                     //NoteClassUsage(EvalContextStackFrameIteratorSoft(ctx) , false);
                     DeleteTypeContext(ctx, bp, type);
                     NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept);
+                    ProfilerLeave();
                     return false;
                 }
             }
@@ -1236,6 +1404,7 @@ int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp)
 
     //NoteClassUsage(EvalContextStackFrameIteratorSoft(ctx) , false);
 
+    ProfilerLeave();
     return NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept);
 }
 
@@ -1375,10 +1544,24 @@ static PromiseResult DefaultVarPromise(EvalContext *ctx, const Promise *pp)
     return VerifyVarPromise(ctx, pp, true);
 }
 
+static PromiseResult KeepAgentPromiseProfiled(EvalContext *ctx, Promise *pp, void *param)
+{
+    ProfilerEnter(PROFILE_FRAME_ITERATION, NULL, pp->promiser);
+    PromiseResult result = KeepAgentPromise(ctx, pp, param);
+    ProfilerLeave();
+
+    return result;
+}
+
 static PromiseResult KeepAgentPromise(EvalContext *ctx, Promise *pp, ARG_UNUSED void *param)
 {
     assert(param == NULL);
 
+    if (!FIRST_PROMISE_REACHED)
+    {
+        NoteFirstPromise();
+    }
+
     char *sp = NULL;
     struct timespec start = BeginMeasure();
 
@@ -1570,6 +1753,8 @@ static void DeleteTypeContext(EvalContext *ctx, Bundle *bp, TypeSequence type)
 
     case TYPE_SEQUENCE_FILES:
 
+        /* Saved in this bundle, for the promises after to see the files and their outcome classes */
+        EditSessionsCommit();
         ConnectionsCleanup();
         break;
 
@@ -1673,6 +1858,7 @@ static PromiseResult ParallelFindAndVerifyFilesPromises(EvalContext *ctx, Promis
         {
             CFA_BACKGROUND++;
             Log(LOG_LEVEL_VERBOSE, "Spawning new process...");
+            EditSessionsCommit();
             child = fork();
 
             if (child == 0)
@@ -1680,6 +1866,8 @@ static PromiseResult ParallelFindAndVerifyFilesPromises(EvalContext *ctx, Promis
                 ALARM_PID = -1;
 
                 result = PromiseResultUpdate(result, FindAndVerifyFilesPromises(ctx, pp));
+                EditSessionsCommit();
+                FlushDBBatches();
 
                 Log(LOG_LEVEL_VERBOSE, "Exiting backgrounded promise");
                 PromiseRef(LOG_LEVEL_VERBOSE, pp);
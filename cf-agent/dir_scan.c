@@ -0,0 +1,682 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <dir_scan.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <rlist.h>
+#include <regex_cache.h>
+
+#ifdef HAVE_DIR_SCAN
+
+#define DIR_SCAN_MAX_THREADS 8
+/* Threads stop reading ahead while this many entries wait to be handled */
+#define DIR_SCAN_MAX_ENTRIES (256 * 1024)
+
+typedef enum
+{
+    DIR_SCAN_QUEUED,
+    DIR_SCAN_READING,
+    DIR_SCAN_DONE,
+    DIR_SCAN_RELEASED,
+    DIR_SCAN_DROPPED
+} DirScanState;
+
+struct DirScanNode_
+{
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    int rlevel;
+    DirScanState state;
+    bool dropped;               /* Dropped while it was being read */
+    int error;
+    DirScanEntry *entries;
+    size_t entry_count;
+    DirScanNode *next;          /* All nodes, they are freed with the scan */
+};
+
+/* Directories queued by one thread. The owner takes the newest one, which
+   keeps it in the subtree it is reading, others steal the oldest ones. */
+typedef struct
+{
+    pthread_mutex_t lock;
+    DirScanNode **items;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} DirScanQueue;
+
+typedef struct
+{
+    DirScan *scan;
+    size_t index;
+} DirScanThread;
+
+struct DirScan_
+{
+    DirScanOptions opts;
+    uid_t uid;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      /* Work queued, entries released or shutdown */
+    pthread_cond_t done;        /* A directory was read */
+    pthread_t *threads;
+    DirScanThread *thread_args;
+    size_t thread_count;
+    bool shutdown;
+
+    /* One queue per thread, the last one for the caller */
+    DirScanQueue *queues;
+    size_t queue_count;
+    size_t queued;
+    size_t live_entries;
+    DirScanNode *nodes;
+
+    size_t dirs_read;
+    size_t entries_read;
+    size_t dirs_dropped;
+};
+
+static void DirScanQueuePush(DirScanQueue *queue, DirScanNode *node)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->tail == queue->capacity)
+    {
+        if (queue->head > 0)
+        {
+            memmove(queue->items, queue->items + queue->head,
+                    (queue->tail - queue->head) * sizeof(DirScanNode *));
+            queue->tail -= queue->head;
+            queue->head = 0;
+        }
+        else
+        {
+            queue->capacity = (queue->capacity == 0) ? 64 : queue->capacity * 2;
+            queue->items = xrealloc(queue->items, queue->capacity * sizeof(DirScanNode *));
+        }
+    }
+
+    queue->items[queue->tail++] = node;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static DirScanNode *DirScanQueuePop(DirScanQueue *queue, bool newest)
+{
+    DirScanNode *node = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->head < queue->tail)
+    {
+        node = newest ? queue->items[--queue->tail] : queue->items[queue->head++];
+
+        if (queue->head == queue->tail)
+        {
+            queue->head = queue->tail = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return node;
+}
+
+static DirScanNode *DirScanTake(DirScan *scan, size_t self)
+{
+    size_t n = scan->thread_count + 1;
+
+    DirScanNode *node = DirScanQueuePop(&scan->queues[self], true);
+
+    for (size_t i = 1; (node == NULL) && (i < n); i++)
+    {
+        node = DirScanQueuePop(&scan->queues[(self + i) % n], false);
+    }
+
+    return node;
+}
+
+static DirScanNode *DirScanNodeNew(const char *path, const struct stat *sb, int rlevel)
+{
+    DirScanNode *node = xcalloc(1, sizeof(DirScanNode));
+    node->path = xstrdup(path);
+    node->dev = sb->st_dev;
+    node->ino = sb->st_ino;
+    node->rlevel = rlevel;
+    node->state = DIR_SCAN_QUEUED;
+    return node;
+}
+
+static void DirScanFreeEntries(DirScanEntry *entries, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+/* Pure version of the exclude_dirs/include_dirs match, the caller's
+   decision sets match variables and is made again on its own thread */
+static bool DirScanMatch(const Rlist *list, const char *path, const char *name)
+{
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        const char *pattern = RlistScalarValue(rp);
+
+        if ((strcmp(pattern, path) == 0) || (strcmp(pattern, name) == 0))
+        {
+            return true;
+        }
+
+        const CompiledRegex *rx = RegexCacheAcquire(pattern, PCRE_MULTILINE | PCRE_DOTALL, NULL, NULL);
+        if (rx == NULL)
+        {
+            continue;
+        }
+
+        bool match = false;
+        const char *subjects[2] = { path, name };
+        for (int i = 0; (i < 2) && !match; i++)
+        {
+            int ovector[3];
+            int len = strlen(subjects[i]);
+            match = (pcre_exec(rx->rx, rx->extra, subjects[i], len, 0, 0, ovector, 3) >= 0) &&
+                (ovector[0] == 0) && (ovector[1] == len);
+        }
+
+        RegexCacheRelease(rx);
+
+        if (match)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Whether the depth search is expected to enter subdirectory name */
+static bool DirScanWanted(const DirScan *scan, const DirScanNode *parent, const char *path, const char *name)
+{
+    const DirScanOptions *opts = &scan->opts;
+
+    if ((opts->depth <= 1) || (parent->rlevel > opts->depth) || (parent->rlevel + 1 > opts->rlevel_limit))
+    {
+        return false;
+    }
+
+    if (opts->exclude_dirs && DirScanMatch(opts->exclude_dirs, path, name))
+    {
+        return false;
+    }
+
+    if (opts->include_dirs && !DirScanMatch(opts->include_dirs, path, name))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/* Read a directory, queueing the subdirectories to read ahead for the
+   calling thread. Called without the lock held. */
+static void DirScanRead(DirScan *scan, DirScanNode *node, size_t self)
+{
+    const DirScanOptions *opts = &scan->opts;
+    DirScanEntry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    DirScanNode **children = NULL;
+    size_t child_count = 0;
+    char path[CF_BUFSIZE];
+    struct stat sb;
+
+    int flags = O_RDONLY | O_NOCTTY | O_DIRECTORY;
+    if (!opts->travlinks)
+    {
+        flags |= O_NOFOLLOW;
+    }
+
+    int fd = open(node->path, flags);
+    DIR *dirh = NULL;
+
+    if (fd == -1)
+    {
+        node->error = errno;
+    }
+    else if ((fstat(fd, &sb) == -1) || (sb.st_dev != node->dev) || (sb.st_ino != node->ino))
+    {
+        /* Replaced since it was stat'ed, leave it to the caller's checks */
+        node->error = ENOENT;
+        close(fd);
+    }
+    else if ((dirh = fdopendir(fd)) == NULL)
+    {
+        node->error = errno;
+        close(fd);
+    }
+
+    size_t pathlen = strlen(node->path);
+    const char *sep = ((pathlen > 0) && (node->path[pathlen - 1] == FILE_SEPARATOR)) ? "" : FILE_SEPARATOR_STR;
+
+    const struct dirent *dirp;
+    while ((dirh != NULL) && ((dirp = readdir(dirh)) != NULL))
+    {
+        if ((strcmp(dirp->d_name, ".") == 0) || (strcmp(dirp->d_name, "..") == 0))
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = (capacity == 0) ? 64 : capacity * 2;
+            entries = xrealloc(entries, capacity * sizeof(DirScanEntry));
+        }
+
+        DirScanEntry *entry = &entries[count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->name = xstrdup(dirp->d_name);
+
+        if (fstatat(fd, entry->name, &entry->lsb, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            entry->lstat_errno = errno;
+            continue;
+        }
+
+        struct stat target;
+        const struct stat *dsb = &entry->lsb;
+
+        if (S_ISLNK(entry->lsb.st_mode))
+        {
+            if (!opts->travlinks ||
+                ((entry->lsb.st_uid != 0) && (entry->lsb.st_uid != scan->uid)) ||
+                (fstatat(fd, entry->name, &target, 0) == -1))
+            {
+                continue;
+            }
+            dsb = &target;
+        }
+
+        if (!S_ISDIR(dsb->st_mode) || (opts->xdev && (dsb->st_dev != opts->rootdevice)))
+        {
+            continue;
+        }
+
+        if ((snprintf(path, sizeof(path), "%s%s%s", node->path, sep, entry->name) >= (int) sizeof(path)) ||
+            !DirScanWanted(scan, node, path, entry->name))
+        {
+            continue;
+        }
+
+        entry->child = DirScanNodeNew(path, dsb, node->rlevel + 1);
+        children = xrealloc(children, (child_count + 1) * sizeof(DirScanNode *));
+        children[child_count++] = entry->child;
+    }
+
+    if (dirh != NULL)
+    {
+        closedir(dirh);
+    }
+
+    pthread_mutex_lock(&scan->lock);
+
+    for (size_t i = 0; i < child_count; i++)
+    {
+        children[i]->next = scan->nodes;
+        scan->nodes = children[i];
+        if (node->dropped)
+        {
+            children[i]->state = DIR_SCAN_DROPPED;
+        }
+    }
+
+    scan->dirs_read++;
+    scan->entries_read += count;
+
+    bool dropped = node->dropped;
+    if (dropped)
+    {
+        DirScanFreeEntries(entries, count);
+        node->state = DIR_SCAN_DROPPED;
+        scan->dirs_dropped++;
+    }
+    else
+    {
+        node->entries = entries;
+        node->entry_count = count;
+        node->state = DIR_SCAN_DONE;
+        scan->live_entries += count;
+    }
+
+    pthread_cond_broadcast(&scan->done);
+    pthread_mutex_unlock(&scan->lock);
+
+    /* The entries may be released from here on, but the nodes stay */
+    if ((child_count > 0) && !dropped)
+    {
+        /* Reverse order, so that the owner continues with the first one */
+        for (size_t i = child_count; i > 0; i--)
+        {
+            DirScanQueuePush(&scan->queues[self], children[i - 1]);
+        }
+
+        pthread_mutex_lock(&scan->lock);
+        scan->queued += child_count;
+        pthread_cond_broadcast(&scan->wakeup);
+        pthread_mutex_unlock(&scan->lock);
+    }
+
+    free(children);
+}
+
+/* Called with the lock held */
+static void DirScanDrop(DirScan *scan, DirScanNode *node)
+{
+    switch (node->state)
+    {
+    case DIR_SCAN_QUEUED:
+        node->state = DIR_SCAN_DROPPED;
+        break;
+
+    case DIR_SCAN_READING:
+        node->dropped = true;
+        break;
+
+    case DIR_SCAN_DONE:
+        for (size_t i = 0; i < node->entry_count; i++)
+        {
+            if (node->entries[i].child != NULL)
+            {
+                DirScanDrop(scan, node->entries[i].child);
+            }
+        }
+
+        scan->live_entries -= node->entry_count;
+        DirScanFreeEntries(node->entries, node->entry_count);
+        node->entries = NULL;
+        node->entry_count = 0;
+        node->state = DIR_SCAN_DROPPED;
+        scan->dirs_dropped++;
+        pthread_cond_broadcast(&scan->wakeup);
+        break;
+
+    case DIR_SCAN_RELEASED:
+    case DIR_SCAN_DROPPED:
+        break;
+    }
+}
+
+static void *DirScanWorker(void *arg)
+{
+    DirScanThread *thread = arg;
+    DirScan *scan = thread->scan;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&scan->lock);
+        while (!scan->shutdown && ((scan->queued == 0) || (scan->live_entries >= DIR_SCAN_MAX_ENTRIES)))
+        {
+            pthread_cond_wait(&scan->wakeup, &scan->lock);
+        }
+        bool shutdown = scan->shutdown;
+        pthread_mutex_unlock(&scan->lock);
+
+        if (shutdown)
+        {
+            break;
+        }
+
+        DirScanNode *node = DirScanTake(scan, thread->index);
+        if (node == NULL)
+        {
+            /* Another thread took it and has yet to account for it */
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&scan->lock);
+        scan->queued--;
+        bool wanted = (node->state == DIR_SCAN_QUEUED);
+        if (wanted)
+        {
+            node->state = DIR_SCAN_READING;
+        }
+        pthread_mutex_unlock(&scan->lock);
+
+        if (wanted)
+        {
+            DirScanRead(scan, node, thread->index);
+        }
+    }
+
+    return NULL;
+}
+
+DirScan *DirScanNew(const DirScanOptions *opts, size_t threads)
+{
+    if (threads == 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (size_t) cpus : 1;
+#else
+        threads = 1;
+#endif
+    }
+
+    threads = MIN(threads, DIR_SCAN_MAX_THREADS);
+
+    DirScan *scan = xcalloc(1, sizeof(DirScan));
+
+    scan->opts = *opts;
+    scan->uid = getuid();
+    pthread_mutex_init(&scan->lock, NULL);
+    pthread_cond_init(&scan->wakeup, NULL);
+    pthread_cond_init(&scan->done, NULL);
+
+    scan->queue_count = threads + 1;
+    scan->queues = xcalloc(scan->queue_count, sizeof(DirScanQueue));
+    for (size_t i = 0; i < scan->queue_count; i++)
+    {
+        pthread_mutex_init(&scan->queues[i].lock, NULL);
+    }
+
+    scan->threads = xcalloc(threads, sizeof(pthread_t));
+    scan->thread_args = xcalloc(threads, sizeof(DirScanThread));
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        DirScanThread *thread = &scan->thread_args[scan->thread_count];
+        thread->scan = scan;
+        thread->index = scan->thread_count;
+
+        int ret = pthread_create(&scan->threads[scan->thread_count], NULL, &DirScanWorker, thread);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Unable to start directory reading thread. (pthread_create: %s)", GetErrorStrFromCode(ret));
+            break;
+        }
+
+        scan->thread_count++;
+    }
+
+    return scan;
+}
+
+DirScanNode *DirScanSubmit(DirScan *scan, const char *path, const struct stat *sb, int rlevel)
+{
+    DirScanNode *node = DirScanNodeNew(path, sb, rlevel);
+
+    pthread_mutex_lock(&scan->lock);
+    node->next = scan->nodes;
+    scan->nodes = node;
+    pthread_mutex_unlock(&scan->lock);
+
+    /* Threads that failed to start leave their queues unused */
+    DirScanQueuePush(&scan->queues[scan->thread_count], node);
+
+    pthread_mutex_lock(&scan->lock);
+    scan->queued++;
+    pthread_cond_signal(&scan->wakeup);
+    pthread_mutex_unlock(&scan->lock);
+
+    return node;
+}
+
+bool DirScanWait(DirScan *scan, DirScanNode *node, const DirScanEntry **entries, size_t *count)
+{
+    pthread_mutex_lock(&scan->lock);
+
+    if (node->state == DIR_SCAN_QUEUED)
+    {
+        /* Not worth waiting for a thread, it stays queued but is skipped */
+        node->state = DIR_SCAN_READING;
+        pthread_mutex_unlock(&scan->lock);
+
+        DirScanRead(scan, node, scan->thread_count);
+
+        pthread_mutex_lock(&scan->lock);
+    }
+
+    while (node->state == DIR_SCAN_READING)
+    {
+        pthread_cond_wait(&scan->done, &scan->lock);
+    }
+
+    assert(node->state == DIR_SCAN_DONE);
+
+    *entries = node->entries;
+    *count = node->entry_count;
+    int error = node->error;
+
+    pthread_mutex_unlock(&scan->lock);
+
+    if (error != 0)
+    {
+        errno = error;
+        return false;
+    }
+
+    return true;
+}
+
+DirScanNode *DirScanChild(DirScan *scan, DirScanNode *node, size_t i, const char *path, const struct stat *sb)
+{
+    pthread_mutex_lock(&scan->lock);
+
+    DirScanNode *child = node->entries[i].child;
+    node->entries[i].child = NULL;
+
+    if ((child != NULL) && ((child->dev != sb->st_dev) || (child->ino != sb->st_ino)))
+    {
+        DirScanDrop(scan, child);
+        child = NULL;
+    }
+
+    pthread_mutex_unlock(&scan->lock);
+
+    if (child == NULL)
+    {
+        child = DirScanSubmit(scan, path, sb, node->rlevel + 1);
+    }
+
+    return child;
+}
+
+void DirScanRelease(DirScan *scan, DirScanNode *node)
+{
+    pthread_mutex_lock(&scan->lock);
+
+    if (node->state == DIR_SCAN_DONE)
+    {
+        for (size_t i = 0; i < node->entry_count; i++)
+        {
+            if (node->entries[i].child != NULL)
+            {
+                DirScanDrop(scan, node->entries[i].child);
+            }
+        }
+
+        scan->live_entries -= node->entry_count;
+        DirScanFreeEntries(node->entries, node->entry_count);
+        node->entries = NULL;
+        node->entry_count = 0;
+        node->state = DIR_SCAN_RELEASED;
+        pthread_cond_broadcast(&scan->wakeup);
+    }
+    else
+    {
+        DirScanDrop(scan, node);
+    }
+
+    pthread_mutex_unlock(&scan->lock);
+}
+
+void DirScanDestroy(DirScan *scan)
+{
+    if (scan == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    scan->shutdown = true;
+    pthread_cond_broadcast(&scan->wakeup);
+    pthread_mutex_unlock(&scan->lock);
+
+    for (size_t i = 0; i < scan->thread_count; i++)
+    {
+        pthread_join(scan->threads[i], NULL);
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Read %zu directories with %zu entries on %zu threads, %zu of them were not needed",
+        scan->dirs_read, scan->entries_read, scan->thread_count, scan->dirs_dropped);
+
+    DirScanNode *node = scan->nodes;
+    while (node != NULL)
+    {
+        DirScanNode *next = node->next;
+        DirScanFreeEntries(node->entries, node->entry_count);
+        free(node->path);
+        free(node);
+        node = next;
+    }
+
+    for (size_t i = 0; i < scan->queue_count; i++)
+    {
+        free(scan->queues[i].items);
+        pthread_mutex_destroy(&scan->queues[i].lock);
+    }
+
+    pthread_cond_destroy(&scan->done);
+    pthread_cond_destroy(&scan->wakeup);
+    pthread_mutex_destroy(&scan->lock);
+    free(scan->queues);
+    free(scan->threads);
+    free(scan->thread_args);
+    free(scan);
+}
+
+#endif /* HAVE_DIR_SCAN */
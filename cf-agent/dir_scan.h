@@ -0,0 +1,110 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_DIR_SCAN_H
+#define CFENGINE_DIR_SCAN_H
+
+#include <cf3.defs.h>
+
+#if defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR) && !defined(__MINGW32__)
+# define HAVE_DIR_SCAN 1
+#endif
+
+#ifdef HAVE_DIR_SCAN
+
+/*
+ * Reading directory trees ahead of a depth search on a bounded pool of
+ * threads. The threads list each directory with fstatat() relative to its
+ * descriptor and go on to the subdirectories the search is expected to
+ * enter, while the caller consumes the results in its own order. Idle
+ * threads steal directories queued by the others.
+ *
+ * The threads only decide what to read ahead. Whether an entry is
+ * considered, followed or skipped is still decided by the caller, which
+ * may also ask for directories that were not read ahead.
+ */
+
+typedef struct DirScan_ DirScan;
+typedef struct DirScanNode_ DirScanNode;
+
+typedef struct
+{
+    int depth;                  /* Recursion depth, as in depth_search */
+    int rlevel_limit;           /* Deepest level the search enters at all */
+    bool travlinks;
+    bool xdev;
+    dev_t rootdevice;
+    const Rlist *include_dirs;
+    const Rlist *exclude_dirs;
+} DirScanOptions;
+
+typedef struct
+{
+    char *name;
+    struct stat lsb;            /* lstat() of the entry */
+    int lstat_errno;            /* errno if lstat() failed, lsb is unset then */
+    DirScanNode *child;         /* Subdirectory read ahead, or NULL */
+} DirScanEntry;
+
+/**
+ * @brief Start the threads reading ahead.
+ * @param threads Number of threads, 0 for one per CPU (at most 8).
+ */
+DirScan *DirScanNew(const DirScanOptions *opts, size_t threads);
+
+/**
+ * @brief Queue a directory, which must still have the identity in sb when
+ *        it is read.
+ * @param rlevel Recursion level of the directory, 0 for the base directory.
+ */
+DirScanNode *DirScanSubmit(DirScan *scan, const char *path, const struct stat *sb, int rlevel);
+
+/**
+ * @brief Get the entries of a directory, reading it on the calling thread
+ *        if no other thread has started yet.
+ * @return false if the directory could not be read, errno is set then.
+ */
+bool DirScanWait(DirScan *scan, DirScanNode *node, const DirScanEntry **entries, size_t *count);
+
+/**
+ * @brief Take over the subdirectory of entry i of a node returned by
+ *        DirScanWait(), or queue it if it was not read ahead or sb shows it
+ *        has been replaced since.
+ */
+DirScanNode *DirScanChild(DirScan *scan, DirScanNode *node, size_t i, const char *path, const struct stat *sb);
+
+/**
+ * @brief Free the entries of a directory once they have been handled. The
+ *        subdirectories read ahead that were not taken are dropped.
+ */
+void DirScanRelease(DirScan *scan, DirScanNode *node);
+
+/**
+ * @brief Stop the threads and log how much was read ahead.
+ */
+void DirScanDestroy(DirScan *scan);
+
+#endif /* HAVE_DIR_SCAN */
+
+#endif
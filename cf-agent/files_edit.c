@@ -33,6 +33,17 @@
 #include <files_editxml.h>
 #include <item_lib.h>
 #include <policy.h>
+#include <promises.h>
+#include <attributes.h>
+#include <rlist.h>
+#include <sequence.h>
+
+typedef struct EditSession_ EditSession;
+
+static bool EditSessionApplies(Attributes a);
+static EditContext *EditSessionGet(const char *filename, Attributes a);
+static EditSession *EditSessionOf(EditContext *ec);
+static PromiseResult EditSessionFinish(EvalContext *ctx, EditSession *session, Attributes a, const Promise *pp);
 
 /*****************************************************************************/
 
@@ -46,6 +57,14 @@ EditContext *NewEditContext(char *filename, Attributes a)
         return NULL;
     }
 
+    if (EditSessionApplies(a))
+    {
+        return EditSessionGet(filename, a);
+    }
+
+    /* Edits not made through a session must see the ones pending in it */
+    EditSessionCommitFile(filename);
+
     ec = xcalloc(1, sizeof(EditContext));
 
     ec->filename = filename;
@@ -89,6 +108,13 @@ EditContext *NewEditContext(char *filename, Attributes a)
 PromiseResult FinishEditContext(EvalContext *ctx, EditContext *ec, Attributes a, const Promise *pp)
 {
     PromiseResult result = PROMISE_RESULT_NOOP;
+
+    EditSession *session = EditSessionOf(ec);
+    if (session != NULL)
+    {
+        return EditSessionFinish(ctx, session, a, pp);
+    }
+
     if (DONTDO || (a.transaction.action == cfa_warn))
     {
         if (ec && (!CompareToFile(ctx, ec->file_start, ec->filename, a, pp, &result)) && (ec->num_edits > 0))
@@ -168,11 +194,320 @@ PromiseResult FinishEditContext(EvalContext *ctx, EditContext *ec, Attributes a,
     if (ec != NULL)
     {
         DeleteItemList(ec->file_start);
+        free(ec);
     }
 
     return result;
 }
 
+/*****************************************************************************/
+/* Edit sessions                                                             */
+/*****************************************************************************/
+
+/*
+ * Promises editing the same file with edit_line share one model of it, kept
+ * until EditSessionsCommit() is called at the end of the files promises of
+ * a bundle, so that the file is read, compared and saved (with its backup)
+ * once instead of once per promise. A promise whose edits did not change
+ * the model is kept right away, one whose edits did is reported repaired or
+ * failed once the file has been saved.
+ */
+
+/* Files kept in memory at once, the oldest is saved to make room */
+#define EDIT_SESSIONS_MAX 64
+
+struct EditSession_
+{
+    EditContext ec;
+    dev_t dev;
+    ino_t ino;
+    int joinlines;
+    Item *before;               /* The model before the current promise */
+    bool in_use;                /* By the current promise */
+    EvalContext *ctx;
+    Seq *changed_by;            /* Copies of the promises that changed the model */
+    Attributes save_attr;       /* Backup options of the last change */
+};
+
+static Seq *EDIT_SESSIONS = NULL;
+
+static bool ItemListsIdentical(const Item *list1, const Item *list2)
+{
+    while (list1 != NULL && list2 != NULL)
+    {
+        if (strcmp(list1->name, list2->name) != 0)
+        {
+            return false;
+        }
+        list1 = list1->next;
+        list2 = list2->next;
+    }
+
+    return list1 == NULL && list2 == NULL;
+}
+
+static Item *CopyItemList(const Item *list)
+{
+    Item *copy = NULL, *tail = NULL;
+
+    for (const Item *ip = list; ip != NULL; ip = ip->next)
+    {
+        Item *new = xcalloc(1, sizeof(Item));
+        new->name = xstrdup(ip->name);
+
+        if (tail == NULL)
+        {
+            copy = new;
+        }
+        else
+        {
+            tail->next = new;
+        }
+        tail = new;
+    }
+
+    return copy;
+}
+
+static void EditSessionCommit(EditSession *session)
+{
+    EditContext *ec = &session->ec;
+    bool saved = true;
+
+    if (SeqLength(session->changed_by) > 0 && !FileEqualsItemList(ec->filename, ec->file_start, session->save_attr.edits))
+    {
+        saved = SaveItemListAsFile(ec->file_start, ec->filename, session->save_attr);
+        if (saved)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Saved edits to file '%s'", ec->filename);
+        }
+    }
+
+    for (size_t i = 0; i < SeqLength(session->changed_by); i++)
+    {
+        const Promise *pp = SeqAt(session->changed_by, i);
+        Attributes a = { {0} };
+
+        a.classes = GetClassDefinitionConstraints(session->ctx, pp);
+        a.transaction = GetTransactionConstraints(session->ctx, pp);
+
+        if (saved)
+        {
+            cfPS(session->ctx, LOG_LEVEL_INFO, PROMISE_RESULT_CHANGE, pp, a, "Edit file '%s'", ec->filename);
+        }
+        else
+        {
+            cfPS(session->ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, a, "Unable to save file '%s' after editing", ec->filename);
+        }
+    }
+
+    SeqDestroy(session->changed_by);
+    DeleteItemList(ec->file_start);
+    DeleteItemList(session->before);
+    free(ec->filename);
+    free(session->save_attr.repository);
+    free(session);
+}
+
+static bool EditSessionApplies(Attributes a)
+{
+    /* Warnings and dry runs must not carry their edits over to later promises */
+    return a.haveeditline && !a.haveeditxml && !a.edit_template &&
+        !DONTDO && a.transaction.action != cfa_warn;
+}
+
+static ssize_t EditSessionFind(const struct stat *sb)
+{
+    for (size_t i = 0; EDIT_SESSIONS != NULL && i < SeqLength(EDIT_SESSIONS); i++)
+    {
+        const EditSession *session = SeqAt(EDIT_SESSIONS, i);
+        if (session->dev == sb->st_dev && session->ino == sb->st_ino)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void EditSessionRemove(size_t index)
+{
+    EditSession *session = SeqAt(EDIT_SESSIONS, index);
+    SeqRemove(EDIT_SESSIONS, index);
+    EditSessionCommit(session);
+}
+
+static EditContext *EditSessionGet(const char *filename, Attributes a)
+{
+    struct stat sb;
+
+    /* Keyed by inode, as links to the file are saved to it */
+    if (stat(filename, &sb) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "The proposed file '%s' could not be loaded. (stat: %s)", filename, GetErrorStr());
+        return NULL;
+    }
+
+    EditSession *session = NULL;
+    ssize_t index = EditSessionFind(&sb);
+
+    if (index != -1)
+    {
+        session = SeqAt(EDIT_SESSIONS, index);
+        if (session->joinlines != a.edits.joinlines)
+        {
+            /* The model was split into lines differently */
+            EditSessionRemove(index);
+            session = NULL;
+        }
+    }
+
+    if (session == NULL)
+    {
+        session = xcalloc(1, sizeof(EditSession));
+        if (!LoadFileAsItemList(&session->ec.file_start, filename, a.edits))
+        {
+            free(session);
+            return NULL;
+        }
+
+        session->ec.filename = xstrdup(filename);
+        session->dev = sb.st_dev;
+        session->ino = sb.st_ino;
+        session->joinlines = a.edits.joinlines;
+        session->changed_by = SeqNew(10, PromiseDestroy);
+
+        if (EDIT_SESSIONS == NULL)
+        {
+            EDIT_SESSIONS = SeqNew(EDIT_SESSIONS_MAX, NULL);
+        }
+        else if (SeqLength(EDIT_SESSIONS) >= EDIT_SESSIONS_MAX)
+        {
+            EditSessionRemove(0);
+        }
+        SeqAppend(EDIT_SESSIONS, session);
+    }
+
+    session->ec.num_edits = 0;
+    session->before = CopyItemList(session->ec.file_start);
+    session->in_use = true;
+
+    if (a.edits.empty_before_use)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Build file model from a blank slate (emptying)");
+        DeleteItemList(session->ec.file_start);
+        session->ec.file_start = NULL;
+    }
+
+    return &session->ec;
+}
+
+static EditSession *EditSessionOf(EditContext *ec)
+{
+    for (size_t i = 0; ec != NULL && EDIT_SESSIONS != NULL && i < SeqLength(EDIT_SESSIONS); i++)
+    {
+        EditSession *session = SeqAt(EDIT_SESSIONS, i);
+        if (&session->ec == ec)
+        {
+            return session;
+        }
+    }
+
+    return NULL;
+}
+
+static PromiseResult EditSessionFinish(EvalContext *ctx, EditSession *session, Attributes a, const Promise *pp)
+{
+    EditContext *ec = &session->ec;
+    PromiseResult result = PROMISE_RESULT_NOOP;
+
+    if (ec->num_edits > 0 && !ItemListsIdentical(session->before, ec->file_start))
+    {
+        /* Reported when the file is saved, this iteration of the promise is gone by then */
+        Log(LOG_LEVEL_VERBOSE, "Edited the model of file '%s', to be saved with the other edits", ec->filename);
+        SeqAppend(session->changed_by, DeRefCopyPromise(ctx, pp));
+        session->ctx = ctx;
+
+        free(session->save_attr.repository);
+        memset(&session->save_attr, 0, sizeof(session->save_attr));
+        session->save_attr.edits = a.edits;
+        session->save_attr.copy.backup = a.copy.backup;
+        session->save_attr.move_obstructions = a.move_obstructions;
+        session->save_attr.repository = a.repository ? xstrdup(a.repository) : NULL;
+    }
+    else
+    {
+        cfPS(ctx, LOG_LEVEL_VERBOSE, PROMISE_RESULT_NOOP, pp, a, "No edit changes to file '%s' need saving", ec->filename);
+    }
+
+    DeleteItemList(session->before);
+    session->before = NULL;
+    session->in_use = false;
+
+    return result;
+}
+
+void EditSessionCommitFile(const char *filename)
+{
+    struct stat sb;
+
+    if (EDIT_SESSIONS != NULL && stat(filename, &sb) != -1)
+    {
+        ssize_t index = EditSessionFind(&sb);
+
+        /* Not the file being edited, inserting a file into itself reads it from disk */
+        if (index != -1 && !((EditSession *) SeqAt(EDIT_SESSIONS, index))->in_use)
+        {
+            EditSessionRemove(index);
+        }
+    }
+}
+
+static void EditSessionCommitSource(const char *source)
+{
+    struct stat sb;
+
+    if (stat(source, &sb) != -1 && S_ISDIR(sb.st_mode))
+    {
+        EditSessionsCommit();
+    }
+    else
+    {
+        EditSessionCommitFile(source);
+    }
+}
+
+void EditSessionPrepare(const char *filename, Attributes a)
+{
+    bool only_edits_lines = EditSessionApplies(a) && !a.havecopy && !a.havelink && !a.haverename &&
+        !a.havedelete && !a.havechange && !a.touch && !a.transformer;
+
+    if (!only_edits_lines)
+    {
+        EditSessionCommitFile(filename);
+    }
+
+    /* Files this promise reads from must have their pending edits */
+    if (a.havecopy && a.copy.source &&
+        (a.copy.servers == NULL || strcmp(RlistScalarValue(a.copy.servers), "localhost") == 0))
+    {
+        EditSessionCommitSource(a.copy.source);
+    }
+
+    if (a.edit_template)
+    {
+        EditSessionCommitFile(a.edit_template);
+    }
+}
+
+void EditSessionsCommit(void)
+{
+    while (EDIT_SESSIONS != NULL && SeqLength(EDIT_SESSIONS) > 0)
+    {
+        EditSessionRemove(0);
+    }
+}
+
 /*********************************************************************/
 /* Level                                                             */
 /*********************************************************************/
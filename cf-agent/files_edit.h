@@ -30,6 +30,25 @@
 EditContext *NewEditContext(char *filename, Attributes a);
 PromiseResult FinishEditContext(EvalContext *ctx, EditContext *ec, Attributes a, const Promise *pp);
 
+/**
+ * @brief Save the pending edit_line edits of a file before a files promise
+ *        which does more to it than edit lines, and of the files it copies
+ *        from or expands as a template.
+ */
+void EditSessionPrepare(const char *filename, Attributes a);
+
+/**
+ * @brief Save the pending edit_line edits of a file before it is read.
+ */
+void EditSessionCommitFile(const char *filename);
+
+/**
+ * @brief Save the pending edit_line edits of all files and report the
+ *        promises that made them, at the end of the files promises of a
+ *        bundle.
+ */
+void EditSessionsCommit(void);
+
 #ifdef HAVE_LIBXML2
 int LoadFileAsXmlDoc(xmlDocPtr *doc, const char *file, EditDefaults ed);
 int SaveXmlDocAsFile(xmlDocPtr doc, const char *file, Attributes a);
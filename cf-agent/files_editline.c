@@ -28,6 +28,7 @@
 #include <env_context.h>
 #include <promises.h>
 #include <files_names.h>
+#include <files_edit.h>
 #include <vars.h>
 #include <item_lib.h>
 #include <sort.h>
@@ -974,7 +975,10 @@ static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, A
             }
 
             match_len = end_off - start_off;
-            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, a.replace.replace_value, replace);
+            Buffer *expanded = BufferNew();
+            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, a.replace.replace_value, expanded);
+            strlcpy(replace, BufferData(expanded), sizeof(replace));
+            BufferDestroy(&expanded);
 
             Log(LOG_LEVEL_VERBOSE, "Verifying replacement of '%s' with '%s', cutoff %d", pp->promiser, replace,
                   cutoff);
@@ -1238,6 +1242,8 @@ static int InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr,
     Item *loc = NULL;
     int preserve_block = a.sourcetype && strcmp(a.sourcetype, "file_preserve_block") == 0;
 
+    EditSessionCommitFile(pp->promiser);
+
     if ((fin = fopen(pp->promiser, "r")) == NULL)
     {
         cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_INTERRUPTED, pp, a, "Could not read file '%s'. (fopen: %s)", pp->promiser, GetErrorStr());
@@ -1281,7 +1287,10 @@ static int InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr,
         
         if (a.expandvars)
         {
-            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, buf, exp);
+            Buffer *expanded = BufferNew();
+            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, buf, expanded);
+            strlcpy(exp, BufferData(expanded), sizeof(exp));
+            BufferDestroy(&expanded);
         }
         else
         {
@@ -445,6 +445,12 @@ int CompareToFile(EvalContext *ctx, const Item *liststart, const char *file, Att
         return false;
     }
 
+    if (a.transaction.action != cfa_warn)
+    {
+        /* No differences to report, so stop reading at the first one */
+        return FileEqualsItemList(file, liststart, a.edits);
+    }
+
     if (!LoadFileAsItemList(&cmplist, file, a.edits))
     {
         return false;
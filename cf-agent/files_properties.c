@@ -44,14 +44,18 @@ static const char *SKIPFILES[] =
     NULL
 };
 
-static bool ConsiderFile(const char *nodename, const char *path, struct stat *stat)
+/* With report false, nothing is logged: the file is looked at again later */
+static bool ConsiderFile(const char *nodename, const char *path, struct stat *stat, bool report)
 {
     int i;
     const char *sp;
 
     if (strlen(nodename) < 1)
     {
-        Log(LOG_LEVEL_ERR, "Empty (null) filename detected in '%s'", path);
+        if (report)
+        {
+            Log(LOG_LEVEL_ERR, "Empty (null) filename detected in '%s'", path);
+        }
         return true;
     }
 
@@ -59,14 +63,20 @@ static bool ConsiderFile(const char *nodename, const char *path, struct stat *st
     {
         if (stat && (S_ISREG(stat->st_mode) || S_ISLNK(stat->st_mode)))
         {
-            Log(LOG_LEVEL_ERR, "Suspicious file '%s' found in '%s'", nodename, path);
+            if (report)
+            {
+                Log(LOG_LEVEL_ERR, "Suspicious file '%s' found in '%s'", nodename, path);
+            }
                 return false;
         }
     }
 
     if (strcmp(nodename, "...") == 0)
     {
-        Log(LOG_LEVEL_VERBOSE, "Possible DFS/FS cell node detected in '%s' ...", path);
+        if (report)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Possible DFS/FS cell node detected in '%s' ...", path);
+        }
         return true;
     }
 
@@ -74,7 +84,10 @@ static bool ConsiderFile(const char *nodename, const char *path, struct stat *st
     {
         if (strcmp(nodename, SKIPFILES[i]) == 0)
         {
-            Log(LOG_LEVEL_DEBUG, "Filename '%s/%s' is classified as ignorable", path, nodename);
+            if (report)
+            {
+                Log(LOG_LEVEL_DEBUG, "Filename '%s/%s' is classified as ignorable", path, nodename);
+            }
             return false;
         }
     }
@@ -104,7 +117,10 @@ static bool ConsiderFile(const char *nodename, const char *path, struct stat *st
 
     if (stat == NULL)
     {
-        Log(LOG_LEVEL_VERBOSE, "Couldn't stat '%s/%s'. (cf_lstat: %s)", path, nodename, GetErrorStr());
+        if (report)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Couldn't stat '%s/%s'. (cf_lstat: %s)", path, nodename, GetErrorStr());
+        }
         return true;
     }
 
@@ -113,6 +129,11 @@ static bool ConsiderFile(const char *nodename, const char *path, struct stat *st
         return false;
     }
 
+    if (!report)
+    {
+        return true;
+    }
+
     Log(LOG_LEVEL_ERR, "Suspicious looking file object '%s' masquerading as hidden file in '%s'", nodename, path);
 
     if (S_ISLNK(stat->st_mode))
@@ -134,14 +155,24 @@ bool ConsiderLocalFile(const char *filename, const char *directory)
     struct stat stat;
     if (lstat(filename, &stat) == -1)
     {
-        return ConsiderFile(filename, directory, NULL);
+        return ConsiderFile(filename, directory, NULL, true);
     }
     else
     {
-        return ConsiderFile(filename, directory, &stat);
+        return ConsiderFile(filename, directory, &stat, true);
     }
 }
 
+bool ConsiderLocalFileStat(const char *filename, const char *directory, struct stat *sb)
+{
+    return ConsiderFile(filename, directory, sb, true);
+}
+
+bool ConsiderLocalFileQuietly(const char *filename, const char *directory, struct stat *sb)
+{
+    return ConsiderFile(filename, directory, sb, false);
+}
+
 bool ConsiderAbstractFile(const char *filename, const char *directory, FileCopy fc, AgentConnection *conn)
 {
     struct stat stat;
@@ -151,10 +182,10 @@ bool ConsiderAbstractFile(const char *filename, const char *directory, FileCopy
 
     if (cf_lstat(buf, &stat, fc, conn) == -1)
     {
-        return ConsiderFile(filename, directory, NULL);
+        return ConsiderFile(filename, directory, NULL, true);
     }
     else
     {
-        return ConsiderFile(filename, directory, &stat);
+        return ConsiderFile(filename, directory, &stat, true);
     }
 }
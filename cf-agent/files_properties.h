@@ -36,6 +36,14 @@ void AddFilenameToListOfSuspicious(const char *filename);
  */
 bool ConsiderLocalFile(const char *filename, const char *path);
 
+/* As ConsiderLocalFile(), with the lstat() of #filename already at hand,
+ * NULL if it failed */
+bool ConsiderLocalFileStat(const char *filename, const char *path, struct stat *sb);
+
+/* As ConsiderLocalFileStat(), without logging: for looking ahead at files
+ * that are considered again when they are reached */
+bool ConsiderLocalFileQuietly(const char *filename, const char *path, struct stat *sb);
+
 bool ConsiderAbstractFile(const char *nodename, const char *path, FileCopy fc, AgentConnection *conn);
 
 #endif
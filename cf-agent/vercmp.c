@@ -62,7 +62,7 @@ static VersionCmpResult AndResults(VersionCmpResult lhs, VersionCmpResult rhs)
 static VersionCmpResult RunCmpCommand(EvalContext *ctx, const char *command, const char *v1, const char *v2, Attributes a,
                                       Promise *pp, PromiseResult *result)
 {
-    char expanded_command[CF_EXPANDSIZE];
+    Buffer *expanded_command = BufferNew();
 
     {
         VarRef *ref_v1 = VarRefParseFromScope("v1", "cf_pack_context");
@@ -80,28 +80,32 @@ static VersionCmpResult RunCmpCommand(EvalContext *ctx, const char *command, con
         VarRefDestroy(ref_v2);
     }
 
-    FILE *pfp = a.packages.package_commands_useshell ? cf_popen_sh(expanded_command, "w") : cf_popen(expanded_command, "w", true);
+    const char *cmd = BufferData(expanded_command);
+    FILE *pfp = a.packages.package_commands_useshell ? cf_popen_sh(cmd, "w") : cf_popen(cmd, "w", true);
 
     if (pfp == NULL)
     {
         cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, a, "Can not start package version comparison command '%s'. (cf_popen: %s)",
-             expanded_command, GetErrorStr());
+             cmd, GetErrorStr());
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+        BufferDestroy(&expanded_command);
         return VERCMP_ERROR;
     }
 
-    Log(LOG_LEVEL_VERBOSE, "Executing '%s'", expanded_command);
+    Log(LOG_LEVEL_VERBOSE, "Executing '%s'", cmd);
 
     int retcode = cf_pclose(pfp);
 
     if (retcode == -1)
     {
         cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, a, "Error during package version comparison command execution '%s'. (cf_pclose: %s)",
-            expanded_command, GetErrorStr());
+            cmd, GetErrorStr());
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+        BufferDestroy(&expanded_command);
         return VERCMP_ERROR;
     }
 
+    BufferDestroy(&expanded_command);
     return retcode == 0;
 }
 
@@ -198,6 +198,8 @@ static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, Promise *pp
         return PROMISE_RESULT_NOOP;
     }
 
+    EditSessionPrepare(path, a);
+
     EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "promiser", path, DATA_TYPE_STRING);
 
     thislock = AcquireLock(ctx, path, VUQNAME, CFSTARTTIME, a.transaction, pp, false);
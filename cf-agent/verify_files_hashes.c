@@ -63,7 +63,46 @@ static void DeleteIndexKey(char *key)
     free(key);
 }
 
-static ChecksumValue *NewHashValue(unsigned char digest[EVP_MAX_MD_SIZE + 1])
+/*
+ * The attribute digest of a checksum record is no longer used as such. It
+ * holds the stat of the file at the time its digest was recorded, so that
+ * files which have not changed since need not be hashed again. Records
+ * without it are all zeroes and never match.
+ */
+typedef struct
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    int64_t ctime;
+} ChecksumFileStat;
+
+static void ChecksumFileStatFromStat(ChecksumFileStat *fstat, const struct stat *sb)
+{
+    memset(fstat, 0, sizeof(ChecksumFileStat));
+
+    if (sb != NULL)
+    {
+        fstat->dev = (uint64_t) sb->st_dev;
+        fstat->ino = (uint64_t) sb->st_ino;
+        fstat->size = (uint64_t) sb->st_size;
+        fstat->mtime = (int64_t) sb->st_mtime;
+        fstat->ctime = (int64_t) sb->st_ctime;
+    }
+}
+
+static bool HashValueStatMatches(const ChecksumValue *chk_val, const struct stat *sb)
+{
+    ChecksumFileStat recorded, current;
+
+    memcpy(&recorded, chk_val->attr_digest, sizeof(ChecksumFileStat));
+    ChecksumFileStatFromStat(&current, sb);
+
+    return (recorded.ino != 0) && (memcmp(&recorded, &current, sizeof(ChecksumFileStat)) == 0);
+}
+
+static ChecksumValue *NewHashValue(unsigned char digest[EVP_MAX_MD_SIZE + 1], const struct stat *sb)
 {
     ChecksumValue *chk_val;
 
@@ -71,7 +110,16 @@ static ChecksumValue *NewHashValue(unsigned char digest[EVP_MAX_MD_SIZE + 1])
 
     memcpy(chk_val->mess_digest, digest, EVP_MAX_MD_SIZE + 1);
 
-/* memcpy(chk_val->attr_digest,attr,EVP_MAX_MD_SIZE+1); depricated */
+    /* A file modified within the current second may still change without
+       its mtime moving on, so its stat is not trustworthy yet */
+    time_t now = time(NULL);
+
+    if ((sb != NULL) && (sb->st_mtime < now) && (sb->st_ctime < now))
+    {
+        ChecksumFileStat fstat;
+        ChecksumFileStatFromStat(&fstat, sb);
+        memcpy(chk_val->attr_digest, &fstat, sizeof(ChecksumFileStat));
+    }
 
     return chk_val;
 }
@@ -81,18 +129,15 @@ static void DeleteHashValue(ChecksumValue *chk_val)
     free((char *) chk_val);
 }
 
-static int ReadHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char digest[EVP_MAX_MD_SIZE + 1])
+static int ReadHash(CF_DB *dbp, HashMethod type, const char *name, ChecksumValue *chk_val)
 {
     char *key;
     int size;
-    ChecksumValue chk_val;
 
     key = NewIndexKey(type, name, &size);
 
-    if (ReadComplexKeyDB(dbp, key, size, (void *) &chk_val, sizeof(ChecksumValue)))
+    if (ReadComplexKeyDB(dbp, key, size, (void *) chk_val, sizeof(ChecksumValue)))
     {
-        memset(digest, 0, EVP_MAX_MD_SIZE + 1);
-        memcpy(digest, chk_val.mess_digest, EVP_MAX_MD_SIZE + 1);
         DeleteIndexKey(key);
         return true;
     }
@@ -103,14 +148,15 @@ static int ReadHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char
     }
 }
 
-static int WriteHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char digest[EVP_MAX_MD_SIZE + 1])
+static int WriteHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                     const struct stat *sb)
 {
     char *key;
     ChecksumValue *value;
     int ret, keysize;
 
     key = NewIndexKey(type, name, &keysize);
-    value = NewHashValue(digest);
+    value = NewHashValue(digest, sb);
     ret = WriteComplexKeyDB(dbp, key, keysize, value, sizeof(ChecksumValue));
     DeleteIndexKey(key);
     DeleteHashValue(value);
@@ -128,15 +174,41 @@ static void DeleteHash(CF_DB *dbp, HashMethod type, const char *name)
 }
 
 
+/* Returns true and the recorded digest if the file has the same device,
+   inode, size, mtime and ctime as when its digest was recorded */
+
+bool FileHashUnchanged(const char *filename, const struct stat *sb, HashMethod type,
+                       unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    CF_DB *dbp;
+    ChecksumValue chk_val;
+    bool unchanged = false;
+
+    if (!OpenDB(&dbp, dbid_checksums))
+    {
+        return false;
+    }
+
+    if (ReadHash(dbp, type, filename, &chk_val) && HashValueStatMatches(&chk_val, sb))
+    {
+        memcpy(digest, chk_val.mess_digest, EVP_MAX_MD_SIZE + 1);
+        unchanged = true;
+    }
+
+    CloseDB(dbp);
+    return unchanged;
+}
+
 /* Returns false if filename never seen before, and adds a checksum
    to the database. Returns true if hashes do not match and also potentially
    updates database to the new value */
 
 int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type,
-                    Attributes attr, Promise *pp, PromiseResult *result)
+                    const struct stat *sb, Attributes attr, Promise *pp, PromiseResult *result)
 {
     int i, size = 21;
-    unsigned char dbdigest[EVP_MAX_MD_SIZE + 1];
+    ChecksumValue chk_val;
+    unsigned char *dbdigest = chk_val.mess_digest;
     CF_DB *dbp;
     char buffer[EVP_MAX_MD_SIZE * 4];
 
@@ -149,7 +221,7 @@ int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest
         return false;
     }
 
-    if (ReadHash(dbp, type, filename, dbdigest))
+    if (ReadHash(dbp, type, filename, &chk_val))
     {
         for (i = 0; i < size; i++)
         {
@@ -169,7 +241,7 @@ int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest
                     *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
 
                     DeleteHash(dbp, type, filename);
-                    WriteHash(dbp, type, filename, digest);
+                    WriteHash(dbp, type, filename, digest, sb);
                 }
                 else
                 {
@@ -182,6 +254,13 @@ int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest
             }
         }
 
+        /* Remember the stat the digest is good for, so the next run can
+           skip hashing the file if it stays the same */
+        if ((sb != NULL) && !HashValueStatMatches(&chk_val, sb))
+        {
+            WriteHash(dbp, type, filename, digest, sb);
+        }
+
         cfPS(ctx, LOG_LEVEL_VERBOSE, PROMISE_RESULT_NOOP, pp, attr, "File hash for %s is correct", filename);
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_NOOP);
         CloseDB(dbp);
@@ -194,7 +273,7 @@ int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest
              FileHashName(type));
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
         Log(LOG_LEVEL_DEBUG, "Storing checksum for '%s' in database '%s'", filename, HashPrintSafe(type, digest, buffer));
-        WriteHash(dbp, type, filename, digest);
+        WriteHash(dbp, type, filename, digest, sb);
 
         LogHashChange(filename, FILE_STATE_NEW, "New file found", pp);
 
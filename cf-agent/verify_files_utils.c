@@ -56,6 +56,7 @@
 #include <scope.h>
 #include <misc_lib.h>
 #include <abstract_dir.h>
+#include <dir_scan.h>
 #include <verify_files_hashes.h>
 #include <audit.h>
 #include <retcode.h>
@@ -101,7 +102,13 @@ static PromiseResult VerifySetUidGid(EvalContext *ctx, const char *file, struct
 static int VerifyFinderType(EvalContext *ctx, char *file, Attributes a, Promise *pp, PromiseResult *result);
 #endif
 static void VerifyFileChanges(const char *file, struct stat *sb, Attributes attr, Promise *pp);
-static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, Attributes attr, Promise *pp);
+static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, struct stat *sb, Attributes attr, Promise *pp);
+static int DepthSearchDir(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attributes attr,
+                          Promise *pp, dev_t rootdevice, PromiseResult *result);
+#ifdef HAVE_DIR_SCAN
+static int DepthSearchScanned(EvalContext *ctx, DirScan *scan, DirScanNode *node, char *name, struct stat *sb,
+                              int rlevel, Attributes attr, Promise *pp, dev_t rootdevice, PromiseResult *result);
+#endif
 
 void SetFileAutoDefineList(Rlist *auto_define_list)
 {
@@ -1466,7 +1473,10 @@ static bool TransformFile(EvalContext *ctx, char *file, Attributes attr, Promise
         return false;
     }
 
-    ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, attr.transformer, comm);
+    Buffer *expanded = BufferNew();
+    ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, attr.transformer, expanded);
+    strlcpy(comm, BufferData(expanded), sizeof(comm));
+    BufferDestroy(&expanded);
     Log(LOG_LEVEL_INFO, "Transforming '%s' ", comm);
 
     if (!IsExecutable(CommandArg0(comm)))
@@ -1948,7 +1958,7 @@ PromiseResult VerifyFileAttributes(EvalContext *ctx, const char *file, struct st
     if (attr.havechange && S_ISREG(dstat->st_mode))
 #endif
     {
-        result = PromiseResultUpdate(result, VerifyFileIntegrity(ctx, file, attr, pp));
+        result = PromiseResultUpdate(result, VerifyFileIntegrity(ctx, file, dstat, attr, pp));
     }
 
     if (attr.havechange)
@@ -2093,8 +2103,316 @@ PromiseResult VerifyFileAttributes(EvalContext *ctx, const char *file, struct st
     return result;
 }
 
+/* Hashes files for change detection ahead of VerifyFileIntegrity() while a
+   depth search is in progress */
+static FileHashPool *FILE_HASH_POOL = NULL;
+
+static bool FileHashPrefetchWanted(Attributes attr)
+{
+    if (DONTDO || !attr.havedepthsearch || !attr.havechange)
+    {
+        return false;
+    }
+
+    if ((attr.change.report_changes != FILE_CHANGE_REPORT_CONTENT_CHANGE) &&
+        (attr.change.report_changes != FILE_CHANGE_REPORT_ALL))
+    {
+        return false;
+    }
+
+    /* Files these act on are not known before VerifyFileLeaf() gets to them,
+       and file_select may run commands that should only run once per file */
+    return !attr.haveselect && (attr.transformer == NULL) && !attr.haverename && !attr.havedelete;
+}
+
+static void FileHashPrefetch(const char *file, struct stat *sb, HashMethod type)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+
+    if (!FileHashUnchanged(file, sb, type, digest))
+    {
+        FileHashPoolSubmit(FILE_HASH_POOL, file, sb, type);
+    }
+}
+
+static void FileHashPrefetchFile(const char *name, const char *leaf, struct stat *lsb, Attributes attr)
+{
+    char path[CF_BUFSIZE];
+
+    strcpy(path, name);
+    AddSlash(path);
+
+    if (!JoinPath(path, leaf))
+    {
+        return;
+    }
+
+    if (attr.change.hash == HASH_METHOD_BEST)
+    {
+        FileHashPrefetch(path, lsb, HASH_METHOD_MD5);
+        FileHashPrefetch(path, lsb, HASH_METHOD_SHA1);
+    }
+    else
+    {
+        FileHashPrefetch(path, lsb, attr.change.hash);
+    }
+}
+
+/* Queue the regular files of the current directory for hashing */
+static void FileHashPrefetchDir(const char *name, Attributes attr, dev_t rootdevice)
+{
+    Dir *dirh;
+    const struct dirent *dirp;
+    struct stat lsb;
+
+    if ((FILE_HASH_POOL == NULL) || !IsAbsoluteFileName(name))
+    {
+        return;
+    }
+
+    if ((dirh = DirOpen(".")) == NULL)
+    {
+        return;
+    }
+
+    for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
+    {
+        /* The search loop checks and reports the file again */
+        if ((lstat(dirp->d_name, &lsb) == -1) || !S_ISREG(lsb.st_mode) ||
+            !ConsiderLocalFileQuietly(dirp->d_name, name, &lsb))
+        {
+            continue;
+        }
+
+        if ((attr.recursion.xdev) && (DeviceBoundary(&lsb, rootdevice)))
+        {
+            continue;
+        }
+
+        FileHashPrefetchFile(name, dirp->d_name, &lsb, attr);
+    }
+
+    DirClose(dirh);
+}
+
+#ifdef HAVE_DIR_SCAN
+
+/* Queue the regular files of a directory read ahead for hashing */
+static void FileHashPrefetchEntries(const char *name, const DirScanEntry *entries, size_t count,
+                                    Attributes attr, dev_t rootdevice)
+{
+    if ((FILE_HASH_POOL == NULL) || !IsAbsoluteFileName(name))
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct stat lsb = entries[i].lsb;
+
+        if ((entries[i].lstat_errno != 0) || !S_ISREG(lsb.st_mode) ||
+            !ConsiderLocalFileQuietly(entries[i].name, name, &lsb))
+        {
+            continue;
+        }
+
+        if ((attr.recursion.xdev) && (DeviceBoundary(&lsb, rootdevice)))
+        {
+            continue;
+        }
+
+        FileHashPrefetchFile(name, entries[i].name, &lsb, attr);
+    }
+}
+
+/*
+ * depth_search with parallel => "true". Directories are read ahead on a pool
+ * of threads, the entries are then handled on this thread in the order and
+ * with the checks of DepthSearchDir(), so the outcome is the same.
+ */
+static int DepthSearchParallel(EvalContext *ctx, char *name, struct stat *sb, Attributes attr,
+                               Promise *pp, dev_t rootdevice, PromiseResult *result)
+{
+    DirScanOptions opts;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.depth = attr.recursion.depth;
+    opts.rlevel_limit = CF_RECURSION_LIMIT;
+    opts.travlinks = attr.recursion.travlinks;
+    opts.xdev = attr.recursion.xdev;
+    opts.rootdevice = rootdevice;
+    opts.include_dirs = attr.recursion.include_dirs;
+    opts.exclude_dirs = attr.recursion.exclude_dirs;
+
+    DirScan *scan = DirScanNew(&opts, 0);
+    DirScanNode *node = DirScanSubmit(scan, name, sb, 0);
+    int ret = DepthSearchScanned(ctx, scan, node, name, sb, 0, attr, pp, rootdevice, result);
+    DirScanDestroy(scan);
+
+    return ret;
+}
+
+static int DepthSearchScanned(EvalContext *ctx, DirScan *scan, DirScanNode *node, char *name, struct stat *sb,
+                              int rlevel, Attributes attr, Promise *pp, dev_t rootdevice, PromiseResult *result)
+{
+    const DirScanEntry *entries;
+    size_t count;
+    int goback;
+    char path[CF_BUFSIZE];
+    struct stat lsb;
+
+    if (rlevel > CF_RECURSION_LIMIT)
+    {
+        Log(LOG_LEVEL_WARNING, "Very deep nesting of directories (>%d deep) for '%s' (Aborting files)", rlevel, name);
+        DirScanRelease(scan, node);
+        return false;
+    }
+
+    if (!DirScanWait(scan, node, &entries, &count))
+    {
+        /* Leave it to the serial search to report what is wrong */
+        DirScanRelease(scan, node);
+        return DepthSearchDir(ctx, name, sb, rlevel, attr, pp, rootdevice, result);
+    }
+
+    /* Promise handlers still expect to run in the directory of the leaf */
+    if (!PushDirState(ctx, name, sb))
+    {
+        DirScanRelease(scan, node);
+        return false;
+    }
+
+    FileHashPrefetchEntries(name, entries, count, attr, rootdevice);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const DirScanEntry *entry = &entries[i];
+
+        lsb = entry->lsb;
+
+        if (!ConsiderLocalFileStat(entry->name, name, (entry->lstat_errno == 0) ? &lsb : NULL))
+        {
+            continue;
+        }
+
+        strcpy(path, name);
+        AddSlash(path);
+
+        if (!JoinPath(path, entry->name))
+        {
+            FileHashPoolDiscard(FILE_HASH_POOL, name);
+            DirScanRelease(scan, node);
+            return true;
+        }
+
+        if (entry->lstat_errno != 0)
+        {
+            errno = entry->lstat_errno;
+            Log(LOG_LEVEL_VERBOSE, "Recurse was looking at '%s' when an error occurred. (lstat: %s)", path, GetErrorStr());
+            continue;
+        }
+
+        if (S_ISLNK(lsb.st_mode))       /* should we ignore links? */
+        {
+            if (!KillGhostLink(ctx, path, attr, pp))
+            {
+                VerifyFileLeaf(ctx, path, &lsb, attr, pp, result);
+            }
+            else
+            {
+                continue;
+            }
+        }
+
+        /* See if we are supposed to treat links to dirs as dirs and descend */
+
+        if ((attr.recursion.travlinks) && (S_ISLNK(lsb.st_mode)))
+        {
+            if ((lsb.st_uid != 0) && (lsb.st_uid != getuid()))
+            {
+                Log(LOG_LEVEL_INFO,
+                    "File '%s' is an untrusted link: cfengine will not follow it with a destructive operation", path);
+                continue;
+            }
+
+            /* The link may have been handled above, so stat it now */
+
+            if (stat(entry->name, &lsb) == -1)
+            {
+                Log(LOG_LEVEL_ERR, "Recurse was working on '%s' when this failed. (stat: %s)", path, GetErrorStr());
+                continue;
+            }
+        }
+
+        if ((attr.recursion.xdev) && (DeviceBoundary(&lsb, rootdevice)))
+        {
+            Log(LOG_LEVEL_VERBOSE, "Skipping '%s' on different device - use xdev option to change this. (stat: %s)", path, GetErrorStr());
+            continue;
+        }
+
+        if (S_ISDIR(lsb.st_mode))
+        {
+            if (SkipDirLinks(ctx, path, entry->name, attr.recursion))
+            {
+                continue;
+            }
+
+            if ((attr.recursion.depth > 1) && (rlevel <= attr.recursion.depth))
+            {
+                Log(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
+                DirScanNode *child = DirScanChild(scan, node, i, path, &lsb);
+                goback = DepthSearchScanned(ctx, scan, child, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
+                if (!PopDirState(goback, name, sb, attr.recursion))
+                {
+                    FatalError(ctx, "Not safe to continue");
+                }
+            }
+        }
+
+        VerifyFileLeaf(ctx, path, &lsb, attr, pp, result);
+    }
+
+    /* Whatever was hashed ahead but not asked for is of no further use */
+    FileHashPoolDiscard(FILE_HASH_POOL, name);
+    DirScanRelease(scan, node);
+    return true;
+}
+
+#endif /* HAVE_DIR_SCAN */
+
 int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attributes attr,
                 Promise *pp, dev_t rootdevice, PromiseResult *result)
+{
+    bool hash_pool = (rlevel == 0) && (FILE_HASH_POOL == NULL) && FileHashPrefetchWanted(attr);
+    int ret;
+
+    if (hash_pool)
+    {
+        FILE_HASH_POOL = FileHashPoolNew(0);
+    }
+
+#ifdef HAVE_DIR_SCAN
+    if ((rlevel == 0) && attr.havedepthsearch && attr.recursion.parallel)
+    {
+        ret = DepthSearchParallel(ctx, name, sb, attr, pp, rootdevice, result);
+    }
+    else
+#endif
+    {
+        ret = DepthSearchDir(ctx, name, sb, rlevel, attr, pp, rootdevice, result);
+    }
+
+    if (hash_pool)
+    {
+        FileHashPoolDestroy(FILE_HASH_POOL);
+        FILE_HASH_POOL = NULL;
+    }
+
+    return ret;
+}
+
+static int DepthSearchDir(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attributes attr,
+                          Promise *pp, dev_t rootdevice, PromiseResult *result)
 {
     Dir *dirh;
     int goback;
@@ -2136,6 +2454,8 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
         return false;
     }
 
+    FileHashPrefetchDir(name, attr, rootdevice);
+
     for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
     {
         if (!ConsiderLocalFile(dirp->d_name, name))
@@ -2148,6 +2468,7 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
 
         if (!JoinPath(path, dirp->d_name))
         {
+            FileHashPoolDiscard(FILE_HASH_POOL, name);
             DirClose(dirh);
             return true;
         }
@@ -2206,7 +2527,7 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
             if ((attr.recursion.depth > 1) && (rlevel <= attr.recursion.depth))
             {
                 Log(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
-                goback = DepthSearch(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
+                goback = DepthSearchDir(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
                 if (!PopDirState(goback, name, sb, attr.recursion))
                 {
                     FatalError(ctx, "Not safe to continue");
@@ -2217,6 +2538,8 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
         VerifyFileLeaf(ctx, path, &lsb, attr, pp, result);
     }
 
+    /* Whatever was hashed ahead but not asked for is of no further use */
+    FileHashPoolDiscard(FILE_HASH_POOL, name);
     DirClose(dirh);
     return true;
 }
@@ -2629,7 +2952,24 @@ PromiseResult ScheduleLinkChildrenOperation(EvalContext *ctx, char *destination,
     return result;
 }
 
-static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, Attributes attr, Promise *pp)
+static void GetFileDigest(const char *file, struct stat *sb, HashMethod type, unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    if (FileHashPoolGet(FILE_HASH_POOL, file, sb, type, digest))
+    {
+        return;
+    }
+
+    if (FileHashUnchanged(file, sb, type, digest))
+    {
+        Log(LOG_LEVEL_DEBUG, "File '%s' is unchanged since its '%s' hash was recorded", file, FileHashName(type));
+        FileHashPoolSkipped(FILE_HASH_POOL);
+        return;
+    }
+
+    HashFile(file, digest, type);
+}
+
+static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, struct stat *sb, Attributes attr, Promise *pp)
 {
     unsigned char digest1[EVP_MAX_MD_SIZE + 1];
     unsigned char digest2[EVP_MAX_MD_SIZE + 1];
@@ -2648,11 +2988,11 @@ static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, Att
     {
         if (!DONTDO)
         {
-            HashFile(file, digest1, HASH_METHOD_MD5);
-            HashFile(file, digest2, HASH_METHOD_SHA1);
+            GetFileDigest(file, sb, HASH_METHOD_MD5, digest1);
+            GetFileDigest(file, sb, HASH_METHOD_SHA1, digest2);
 
-            one = FileHashChanged(ctx, file, digest1, HASH_METHOD_MD5, attr, pp, &result);
-            two = FileHashChanged(ctx, file, digest2, HASH_METHOD_SHA1, attr, pp, &result);
+            one = FileHashChanged(ctx, file, digest1, HASH_METHOD_MD5, sb, attr, pp, &result);
+            two = FileHashChanged(ctx, file, digest2, HASH_METHOD_SHA1, sb, attr, pp, &result);
 
             if (one || two)
             {
@@ -2664,9 +3004,9 @@ static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, Att
     {
         if (!DONTDO)
         {
-            HashFile(file, digest1, attr.change.hash);
+            GetFileDigest(file, sb, attr.change.hash, digest1);
 
-            if (FileHashChanged(ctx, file, digest1, attr.change.hash, attr, pp, &result))
+            if (FileHashChanged(ctx, file, digest1, attr.change.hash, sb, attr, pp, &result))
             {
                 changed = true;
             }
@@ -73,12 +73,18 @@ PromiseResult VerifyMethod(EvalContext *ctx, char *attrname, Attributes a, Promi
         if ((vp = ConstraintGetRvalValue(ctx, attrname, pp, RVAL_TYPE_FNCALL)))
         {
             fp = (FnCall *) vp;
-            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, fp->name, method_name);
+            Buffer *expanded = BufferNew();
+            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, fp->name, expanded);
+            strlcpy(method_name, BufferData(expanded), sizeof(method_name));
+            BufferDestroy(&expanded);
             args = fp->args;
         }
         else if ((vp = ConstraintGetRvalValue(ctx, attrname, pp, RVAL_TYPE_SCALAR)))
         {
-            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, (char *) vp, method_name);
+            Buffer *expanded = BufferNew();
+            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, (char *) vp, expanded);
+            strlcpy(method_name, BufferData(expanded), sizeof(method_name));
+            BufferDestroy(&expanded);
             args = NULL;
         }
         else
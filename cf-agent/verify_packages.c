@@ -956,12 +956,18 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
 
         if ((a.packages.package_delete_convention) && (a.packages.package_policy == PACKAGE_ACTION_DELETE))
         {
-            ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_delete_convention, reference);
+            Buffer *expanded = BufferNew();
+            ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_delete_convention, expanded);
+            strlcpy(reference, BufferData(expanded), sizeof(reference));
+            BufferDestroy(&expanded);
             strlcpy(id, reference, CF_EXPANDSIZE);
         }
         else if (a.packages.package_name_convention)
         {
-            ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_name_convention, reference);
+            Buffer *expanded = BufferNew();
+            ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_name_convention, expanded);
+            strlcpy(reference, BufferData(expanded), sizeof(reference));
+            BufferDestroy(&expanded);
             strlcpy(id, reference, CF_EXPANDSIZE);
         }
         else
@@ -1031,7 +1037,10 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
                     VarRef *ref_arch = VarRefParseFromScope("arch", "cf_pack_context_anyver");
                     EvalContextVariablePut(ctx, ref_arch, arch, DATA_TYPE_STRING);
 
-                    ExpandScalar(ctx, NULL, "cf_pack_context_anyver", a.packages.package_name_convention, refAnyVer);
+                    Buffer *expanded = BufferNew();
+                    ExpandScalar(ctx, NULL, "cf_pack_context_anyver", a.packages.package_name_convention, expanded);
+                    strlcpy(refAnyVer, BufferData(expanded), sizeof(refAnyVer));
+                    BufferDestroy(&expanded);
 
                     EvalContextVariableRemove(ctx, ref_name);
                     VarRefDestroy(ref_name);
@@ -1173,7 +1182,10 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
                 VarRef *ref_arch = VarRefParseFromScope("arch", "cf_pack_context_anyver");
                 EvalContextVariablePut(ctx, ref_arch, arch, DATA_TYPE_STRING);
 
-                ExpandScalar(ctx, NULL, "cf_pack_context_anyver", a.packages.package_name_convention, refAnyVer);
+                Buffer *expanded = BufferNew();
+                ExpandScalar(ctx, NULL, "cf_pack_context_anyver", a.packages.package_name_convention, expanded);
+                strlcpy(refAnyVer, BufferData(expanded), sizeof(refAnyVer));
+                BufferDestroy(&expanded);
 
                 EvalContextVariableRemove(ctx, ref_name);
                 VarRefDestroy(ref_name);
@@ -1251,7 +1263,10 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
                     VarRef *ref_arch = VarRefParseFromScope("arch", "cf_pack_context");
                     EvalContextVariablePut(ctx, ref_arch, inst_arch, DATA_TYPE_STRING);
 
-                    ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_delete_convention, reference2);
+                    Buffer *expanded = BufferNew();
+                    ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_delete_convention, expanded);
+                    strlcpy(reference2, BufferData(expanded), sizeof(reference2));
+                    BufferDestroy(&expanded);
                     id_del = reference2;
 
                     EvalContextVariableRemove(ctx, ref_name);
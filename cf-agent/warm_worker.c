@@ -0,0 +1,306 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <warm_worker.h>
+
+#include <warm_agent.h>
+#include <generic_agent.h>
+#include <env_context.h>
+#include <expand.h>
+#include <set.h>
+#include <sysinfo.h>
+
+#ifndef __MINGW32__
+# include <sys/un.h>
+#endif
+
+/* How often an idle worker checks for new policy and for cf-execd */
+#define WARM_WORKER_CHECK_INTERVAL 60
+
+#ifndef __MINGW32__
+
+static int WarmWorkerListen(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlcpy(addr.sun_path, path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path))
+    {
+        Log(LOG_LEVEL_ERR, "Socket path '%s' is too long", path);
+        return -1;
+    }
+
+    int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not create warm agent socket. (socket: %s)", GetErrorStr());
+        return -1;
+    }
+    fcntl(sd, F_SETFD, FD_CLOEXEC);
+
+    unlink(path);
+
+    /* Only the owner, i.e. cf-execd, may ask for runs */
+    mode_t old_umask = umask(077);
+    int ret = bind(sd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(old_umask);
+
+    if (ret == -1 || listen(sd, 4) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not listen on '%s'. (bind/listen: %s)", path, GetErrorStr());
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+static bool WarmWorkerReadRequest(int sd, bool *scheduled_run)
+{
+    char request[64];
+    size_t len = 0;
+
+    while (len < sizeof(request) - 1)
+    {
+        ssize_t n = read(sd, request + len, sizeof(request) - 1 - len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        len += n;
+
+        char *nl = memchr(request, '\n', len);
+        if (nl != NULL)
+        {
+            *nl = '\0';
+
+            if (strcmp(request, WARM_AGENT_REQUEST_RUN) == 0)
+            {
+                *scheduled_run = false;
+                return true;
+            }
+            if (strcmp(request, WARM_AGENT_REQUEST_SCHEDULED_RUN) == 0)
+            {
+                *scheduled_run = true;
+                return true;
+            }
+
+            Log(LOG_LEVEL_ERR, "Unknown request '%s' to warm agent", request);
+            return false;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Classes of the common bundles were defined when the policy was loaded,
+ * maybe hours before the run. Drop them, except those from the command line,
+ * load the persistent classes left by the runs since, and evaluate the common
+ * bundles again with the time classes of now.
+ */
+void WarmWorkerRefreshContext(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, bool scheduled_run)
+{
+    StringSet *stale = StringSetNew();
+
+    ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, NULL, false, true);
+    Class *cls = NULL;
+    while ((cls = ClassTableIteratorNext(iter)))
+    {
+        if (config->heap_soft && StringSetContains(config->heap_soft, cls->name))
+        {
+            continue;
+        }
+        if (strcmp(cls->name, "failsafe_fallback") == 0 || strcmp(cls->name, "opt_dry_run") == 0)
+        {
+            continue;
+        }
+        StringSetAdd(stale, ClassRefToString(cls->ns, cls->name));
+    }
+    ClassTableIteratorDestroy(iter);
+
+    StringSetIterator it = StringSetIteratorInit(stale);
+    const char *expr = NULL;
+    while ((expr = StringSetIteratorNext(&it)))
+    {
+        ClassRef ref = ClassRefParse(expr);
+        EvalContextClassRemove(ctx, ref.ns, ref.name);
+        ClassRefDestroy(ref);
+    }
+    StringSetDestroy(stale);
+
+    /* Runs are forked children, the worker only finds their persistent classes on disk */
+    EvalContextHeapPersistentLoadAll(ctx);
+
+    if (scheduled_run)
+    {
+        EvalContextClassPut(ctx, NULL, "scheduled_run", true, CONTEXT_SCOPE_NAMESPACE);
+    }
+
+    SetReferenceTime(ctx, true);
+    PolicyResolve(ctx, policy, config);
+}
+
+void WarmWorkerServe(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, struct timespec *run_started)
+{
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s/state/%s", GetWorkDir(), WARM_AGENT_SOCKET);
+    MapName(path);
+
+    if (GenericAgentIsPolicyReloadNeeded(config, policy))
+    {
+        /* The policy could not be validated, the agent is running failsafe.cf */
+        Log(LOG_LEVEL_ERR, "Policy in '%s' is not validated, not serving warm runs", config->input_file);
+        exit(EXIT_FAILURE);
+    }
+
+    int sd = WarmWorkerListen(path);
+    if (sd == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t parent = getppid();
+    Log(LOG_LEVEL_VERBOSE, "Warm agent serving runs on '%s'", path);
+
+    for (;;)
+    {
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+        {
+        }
+
+        if (getppid() != parent)
+        {
+            Log(LOG_LEVEL_VERBOSE, "cf-execd has exited, so does the warm agent");
+            break;
+        }
+
+        if (GenericAgentIsPolicyReloadNeeded(config, policy))
+        {
+            Log(LOG_LEVEL_VERBOSE, "Policy has changed, warm agent exiting to be restarted by cf-execd");
+            break;
+        }
+
+        fd_set rset;
+        FD_ZERO(&rset);
+        FD_SET(sd, &rset);
+        struct timeval tv = {
+            .tv_sec = WARM_WORKER_CHECK_INTERVAL,
+            .tv_usec = 0,
+        };
+
+        int ready = select(sd + 1, &rset, NULL, NULL, &tv);
+        if (ready == -1 && errno != EINTR)
+        {
+            Log(LOG_LEVEL_ERR, "Warm agent failed waiting for requests. (select: %s)", GetErrorStr());
+            break;
+        }
+        if (ready <= 0)
+        {
+            continue;
+        }
+
+        int conn = accept(sd, NULL, NULL);
+        if (conn == -1)
+        {
+            continue;
+        }
+
+        struct timespec requested;
+        clock_gettime(CLOCK_MONOTONIC, &requested);
+
+        bool scheduled_run = false;
+        if (!WarmWorkerReadRequest(conn, &scheduled_run))
+        {
+            close(conn);
+            continue;
+        }
+
+        if (GenericAgentIsPolicyReloadNeeded(config, policy))
+        {
+            static const char reload[] = WARM_AGENT_TAG " reload\n";
+            if (write(conn, reload, sizeof(reload) - 1) == -1)
+            {
+                Log(LOG_LEVEL_VERBOSE, "Could not refuse run to cf-execd. (write: %s)", GetErrorStr());
+            }
+            close(conn);
+            Log(LOG_LEVEL_VERBOSE, "Policy has changed, warm agent exiting to be restarted by cf-execd");
+            break;
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(sd);
+            dup2(conn, STDOUT_FILENO);
+            dup2(conn, STDERR_FILENO);
+            close(conn);
+
+            printf("%s pid %jd\n", WARM_AGENT_TAG, (intmax_t) getpid());
+            fflush(stdout);
+
+            WarmWorkerRefreshContext(ctx, policy, config, scheduled_run);
+            *run_started = requested;
+            return;
+        }
+
+        if (pid == -1)
+        {
+            Log(LOG_LEVEL_ERR, "Could not fork a warm agent run. (fork: %s)", GetErrorStr());
+        }
+        close(conn);
+    }
+
+    close(sd);
+    unlink(path);
+    exit(EXIT_SUCCESS);
+}
+
+void WarmWorkerNoteFirstPromise(double milliseconds)
+{
+    printf("%s first-promise %.1f\n", WARM_AGENT_TAG, milliseconds);
+    fflush(stdout);
+}
+
+#else /* __MINGW32__ */
+
+void WarmWorkerServe(ARG_UNUSED EvalContext *ctx, ARG_UNUSED Policy *policy,
+                     ARG_UNUSED GenericAgentConfig *config, ARG_UNUSED struct timespec *run_started)
+{
+    Log(LOG_LEVEL_ERR, "Warm agent is not supported on this platform");
+    exit(EXIT_FAILURE);
+}
+
+void WarmWorkerNoteFirstPromise(ARG_UNUSED double milliseconds)
+{
+}
+
+#endif /* __MINGW32__ */
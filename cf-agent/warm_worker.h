@@ -0,0 +1,54 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_WARM_WORKER_H
+#define CFENGINE_WARM_WORKER_H
+
+#include <generic_agent.h>
+
+/**
+ * @brief Serve runs for cf-execd from the discovered context and loaded
+ *        policy, see warm_agent.h.
+ *
+ * Returns only in the child forked for a run, with stdout and stderr
+ * connected to cf-execd, the time classes and common bundles re-evaluated,
+ * and @p run_started set to when the run was requested. The worker itself
+ * exits when the policy needs reloading or cf-execd has gone away.
+ */
+void WarmWorkerServe(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, struct timespec *run_started);
+
+/**
+ * @brief Bring the context of the worker up to date for a run: drop the soft
+ *        classes defined at load time, reload persistent classes and
+ *        evaluate the common bundles again.
+ */
+void WarmWorkerRefreshContext(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, bool scheduled_run);
+
+/**
+ * @brief Tell cf-execd how long a run took to reach its first promise.
+ */
+void WarmWorkerNoteFirstPromise(double milliseconds);
+
+#endif
@@ -40,13 +40,28 @@
 #include <bootstrap.h>
 #include <files_hashes.h>
 #include <item_lib.h>
+#include <warm_agent.h>
 
 #include <cf-windows-functions.h>
 
+#ifndef __MINGW32__
+# include <sys/un.h>
+#endif
+
 /*******************************************************************/
 
 static const int INF_LINES = -2;
 
+/* After a warm agent failed to start, wait this long before trying again */
+#define WARM_AGENT_RETRY (30 * SECONDS_PER_MINUTE)
+
+/* How long a warm agent may take to fork a run */
+#define WARM_AGENT_ACCEPT_TIMEOUT 60
+
+/* Only touched from the main thread, see WarmAgentKeep() */
+static pid_t WARM_AGENT_PID = 0;
+static time_t WARM_AGENT_FAILED_AT = 0;
+
 /*******************************************************************/
 
 static int CompareResult(const char *filename, const char *prev_file);
@@ -101,17 +116,37 @@ static bool TwinExists(void)
 }
 
 /* Buffer has to be at least CF_BUFSIZE bytes long */
-static void ConstructFailsafeCommand(bool scheduled_run, char *buffer)
+static void ConstructUpdateCommand(char *buffer)
 {
     bool twin_exists = TwinExists();
 
     snprintf(buffer, CF_BUFSIZE,
-             "\"%s/%s\" -f failsafe.cf "
+             "\"%s/%s\" -f failsafe.cf",
+             CFWORKDIR, twin_exists ? TwinFilename() : AgentFilename());
+}
+
+/* Buffer has to be at least CF_BUFSIZE bytes long */
+static void ConstructFailsafeCommand(bool scheduled_run, char *buffer)
+{
+    char update[CF_BUFSIZE];
+    ConstructUpdateCommand(update);
+
+    snprintf(buffer, CF_BUFSIZE,
+             "%s "
              "&& \"%s/%s\" -Dfrom_cfexecd%s",
-             CFWORKDIR, twin_exists ? TwinFilename() : AgentFilename(),
+             update,
              CFWORKDIR, AgentFilename(), scheduled_run ? ",scheduled_run" : "");
 }
 
+/*
+ * Warm runs only run the policy. There is no telling which part of a custom
+ * exec_command is its update step, so such commands are not replaced.
+ */
+static bool ExecCommandUpdatesPolicy(const char *exec_command)
+{
+    return strstr(exec_command, "failsafe.cf") || strstr(exec_command, "update.cf");
+}
+
 #ifndef __MINGW32__
 
 #if defined(__hpux) && defined(__GNUC__)
@@ -157,99 +192,192 @@ static bool IsReadReady(int fd, int timeout_sec)
 #pragma GCC diagnostic warning "-Wstrict-aliasing"
 #endif
 
-#endif  /* __MINGW32__ */
-
-void LocalExec(const ExecConfig *config)
+static void WarmAgentSocketPath(char *path, size_t size)
 {
-    time_t starttime = time(NULL);
+    snprintf(path, size, "%s/state/%s", CFWORKDIR, WARM_AGENT_SOCKET);
+    MapName(path);
+}
 
-    void *thread_name = ThreadUniqueName();
+static void WarmAgentStart(void)
+{
+    char agent[CF_BUFSIZE];
+    snprintf(agent, sizeof(agent), "%s/%s", CFWORKDIR, AgentFilename());
+    MapName(agent);
 
+    pid_t pid = fork();
+    if (pid == 0)
     {
-        char starttime_str[64];
-        cf_strtimestamp_local(starttime, starttime_str);
-
-        if (LEGACY_OUTPUT)
+        int fd = open(NULLFILE, O_RDWR, 0);
+        if (fd != -1)
         {
-            Log(LOG_LEVEL_VERBOSE, "------------------------------------------------------------------");
-            Log(LOG_LEVEL_VERBOSE, "  LocalExec(%sscheduled) at %s", config->scheduled_run ? "" : "not ", starttime_str);
-            Log(LOG_LEVEL_VERBOSE, "------------------------------------------------------------------");
-        }
-        else
-        {
-            Log(LOG_LEVEL_VERBOSE, "LocalExec(%sscheduled) at %s", config->scheduled_run ? "" : "not ", starttime_str);
+            dup2(fd, STDIN_FILENO);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
         }
+
+        char *argv[] = { agent, "--warm-worker", "-Dfrom_cfexecd", NULL };
+        execv(agent, argv);
+        _exit(EXIT_FAILURE);
     }
 
-/* Need to make sure we have LD_LIBRARY_PATH here or children will die  */
+    if (pid == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not start warm agent '%s'. (fork: %s)", agent, GetErrorStr());
+        WARM_AGENT_FAILED_AT = time(NULL);
+        return;
+    }
 
-    char cmd[CF_BUFSIZE];
-    if (strlen(config->exec_command) > 0)
+    Log(LOG_LEVEL_VERBOSE, "Started warm agent, pid %jd", (intmax_t) pid);
+    WARM_AGENT_PID = pid;
+}
+
+void WarmAgentStop(void)
+{
+    if (WARM_AGENT_PID > 0)
     {
-        strncpy(cmd, config->exec_command, CF_BUFSIZE - 1);
+        Log(LOG_LEVEL_VERBOSE, "Stopping warm agent, pid %jd", (intmax_t) WARM_AGENT_PID);
+        kill(WARM_AGENT_PID, SIGTERM);
+        waitpid(WARM_AGENT_PID, NULL, 0);
+        WARM_AGENT_PID = 0;
+    }
+}
 
-        if (!strstr(cmd, "-Dfrom_cfexecd"))
+void WarmAgentKeep(const ExecConfig *config)
+{
+    if (WARM_AGENT_PID > 0)
+    {
+        int status;
+        if (waitpid(WARM_AGENT_PID, &status, WNOHANG) == WARM_AGENT_PID)
         {
-            strcat(cmd, " -Dfrom_cfexecd");
+            if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+            {
+                /* It exits like this to have new policy loaded */
+                Log(LOG_LEVEL_VERBOSE, "Warm agent exited, restarting it");
+            }
+            else
+            {
+                Log(LOG_LEVEL_INFO, "Warm agent failed, running cf-agent for the next %d minutes",
+                    WARM_AGENT_RETRY / SECONDS_PER_MINUTE);
+                WARM_AGENT_FAILED_AT = time(NULL);
+            }
+            WARM_AGENT_PID = 0;
         }
     }
-    else
+
+    if (!config->warm_agent || ExecCommandUpdatesPolicy(config->exec_command))
     {
-        ConstructFailsafeCommand(config->scheduled_run, cmd);
+        WarmAgentStop();
+        return;
     }
 
-    char esc_command[CF_BUFSIZE];
-    strncpy(esc_command, MapName(cmd), CF_BUFSIZE - 1);
-
-    char line[CF_BUFSIZE];
-    snprintf(line, CF_BUFSIZE - 1, "_%jd_%s", (intmax_t) starttime, CanonifyName(ctime(&starttime)));
-
-    char filename[CF_BUFSIZE];
+    if (WARM_AGENT_PID == 0 && time(NULL) - WARM_AGENT_FAILED_AT >= WARM_AGENT_RETRY)
     {
-        char canonified_fq_name[CF_BUFSIZE];
+        WarmAgentStart();
+    }
+}
 
-        strlcpy(canonified_fq_name, config->fq_name, CF_BUFSIZE);
-        CanonifyNameInPlace(canonified_fq_name);
+/*
+ * Ask the warm agent for a run. Returns its output, to be read like the pipe
+ * from cf_popen_sh(), or NULL if the warm agent is not ready or declines.
+ */
+static FILE *WarmAgentRequest(bool scheduled_run, pid_t *pid)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    WarmAgentSocketPath(addr.sun_path, sizeof(addr.sun_path));
 
+    int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not create socket for warm agent. (socket: %s)", GetErrorStr());
+        return NULL;
+    }
+    fcntl(sd, F_SETFD, FD_CLOEXEC);
 
-        snprintf(filename, CF_BUFSIZE - 1, "%s/outputs/cf_%s_%s_%p", CFWORKDIR, canonified_fq_name, line, thread_name);
-        MapName(filename);
+    if (connect(sd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Warm agent is not ready, running cf-agent. (connect: %s)", GetErrorStr());
+        close(sd);
+        return NULL;
     }
 
+    char request[64];
+    int len = snprintf(request, sizeof(request), "%s\n",
+                       scheduled_run ? WARM_AGENT_REQUEST_SCHEDULED_RUN : WARM_AGENT_REQUEST_RUN);
+    if (write(sd, request, len) != len)
+    {
+        Log(LOG_LEVEL_ERR, "Could not send request to warm agent. (write: %s)", GetErrorStr());
+        close(sd);
+        return NULL;
+    }
 
-/* What if no more processes? Could sacrifice and exec() - but we need a sentinel */
+    FILE *pp = fdopen(sd, "r");
+    if (pp == NULL)
+    {
+        close(sd);
+        return NULL;
+    }
 
-    FILE *fp = fopen(filename, "w");
-    if (!fp)
+    char line[CF_BUFSIZE];
+    intmax_t run_pid;
+    if (!IsReadReady(sd, WARM_AGENT_ACCEPT_TIMEOUT) ||
+        CfReadLine(line, sizeof(line), pp) <= 0 ||
+        sscanf(line, WARM_AGENT_TAG " pid %jd", &run_pid) != 1)
     {
-        Log(LOG_LEVEL_ERR, "Couldn't open '%s' - aborting exec. (fopen: %s)", filename, GetErrorStr());
-        return;
+        Log(LOG_LEVEL_VERBOSE, "Warm agent declined the run, running cf-agent");
+        fclose(pp);
+        return NULL;
     }
 
-#if !defined(__MINGW32__)
-/*
- * Don't inherit this file descriptor on fork/exec
- */
+    *pid = (pid_t) run_pid;
+    return pp;
+}
 
-    if (fileno(fp) != -1)
+static void WarmAgentNote(const char *line, pid_t pid)
+{
+    double milliseconds;
+    if (sscanf(line, WARM_AGENT_TAG " first-promise %lf", &milliseconds) == 1)
     {
-        fcntl(fileno(fp), F_SETFD, FD_CLOEXEC);
+        Log(LOG_LEVEL_VERBOSE, "Warm agent run %jd reached its first promise %.1f ms after the request",
+            (intmax_t) pid, milliseconds);
     }
-#endif
+}
 
-    Log(LOG_LEVEL_VERBOSE, "Command => %s", cmd);
+#else /* __MINGW32__ */
 
-    FILE *pp = cf_popen_sh(esc_command, "r");
-    if (!pp)
+void WarmAgentKeep(ARG_UNUSED const ExecConfig *config)
+{
+}
+
+void WarmAgentStop(void)
+{
+}
+
+#endif  /* __MINGW32__ */
+
+static void CloseAgentOutput(FILE *pp, pid_t warm_pid)
+{
+    if (warm_pid > 0)
     {
-        Log(LOG_LEVEL_ERR, "Couldn't open pipe to command '%s'. (cf_popen: %s)", cmd, GetErrorStr());
-        fclose(fp);
-        return;
+        /* The run is a child of the warm agent, which reaps it */
+        fclose(pp);
     }
+    else
+    {
+        cf_pclose(pp);
+    }
+}
 
-    Log(LOG_LEVEL_VERBOSE, "Command is executing...%s", esc_command);
+/*
+ * Copy the output of an agent run to fp, adding the number of lines written
+ * to count. Returns false if the output could not be read.
+ */
+static bool ReadAgentOutput(const ExecConfig *config, const char *cmd, FILE *pp, pid_t warm_pid,
+                            FILE *fp, int *count)
+{
+    char line[CF_BUFSIZE];
 
-    int count = 0;
     for (;;)
     {
         if(!IsReadReady(fileno(pp), (config->agent_expireafter * SECONDS_PER_MINUTE)))
@@ -260,11 +388,15 @@ void LocalExec(const ExecConfig *config)
 
             Log(LOG_LEVEL_ERR, "%s", errmsg);
             fprintf(fp, "%s\n", errmsg);
-            count++;
+            (*count)++;
 
             pid_t pid_agent;
 
-            if(PipeToPid(&pid_agent, pp))
+            if (warm_pid > 0)
+            {
+                ProcessSignalTerminate(warm_pid);
+            }
+            else if(PipeToPid(&pid_agent, pp))
             {
                 ProcessSignalTerminate(pid_agent);
             }
@@ -286,10 +418,17 @@ void LocalExec(const ExecConfig *config)
         if (res == -1)
         {
             Log(LOG_LEVEL_ERR, "Unable to read output from command '%s'. (cfread: %s)", cmd, GetErrorStr());
-            cf_pclose(pp);
-            return;
+            return false;
         }
 
+#ifndef __MINGW32__
+        if (warm_pid > 0 && StringStartsWith(line, WARM_AGENT_TAG))
+        {
+            WarmAgentNote(line, warm_pid);
+            continue;
+        }
+#endif
+
         bool print = false;
 
         for (const char *sp = line; *sp != '\0'; sp++)
@@ -310,7 +449,7 @@ void LocalExec(const ExecConfig *config)
             ReplaceStr(line, line_escaped, sizeof(line_escaped), "%", "%%");
 
             fprintf(fp, "%s\n", line_escaped);
-            count++;
+            (*count)++;
 
             /* If we can't send mail, log to syslog */
 
@@ -330,7 +469,201 @@ void LocalExec(const ExecConfig *config)
         }
     }
 
-    cf_pclose(pp);
+    return true;
+}
+
+#ifndef __MINGW32__
+
+/* Buffer has to be at least CF_BUFSIZE bytes long */
+static void ConstructAgentCommand(bool scheduled_run, char *buffer)
+{
+    snprintf(buffer, CF_BUFSIZE,
+             "\"%s/%s\" -Dfrom_cfexecd%s",
+             CFWORKDIR, AgentFilename(), scheduled_run ? ",scheduled_run" : "");
+}
+
+/*
+ * The warm agent only runs the policy, so the update step of the failsafe
+ * command runs on its own first. New policy it pulls makes the warm agent
+ * decline the run and exit. Returns false if the run has to be skipped, as
+ * the failsafe command does when the update step fails.
+ */
+static bool RunUpdateStep(const ExecConfig *config, char *update_cmd, FILE *fp, int *count)
+{
+    Log(LOG_LEVEL_VERBOSE, "Update command => %s", update_cmd);
+
+    FILE *pp = cf_popen_sh(MapName(update_cmd), "r");
+    if (!pp)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't open pipe to command '%s'. (cf_popen: %s)", update_cmd, GetErrorStr());
+        return false;
+    }
+
+    bool read_ok = ReadAgentOutput(config, update_cmd, pp, 0, fp, count);
+    int status = cf_pclose(pp);
+
+    if (!read_ok || status != 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Update command failed, skipping the run");
+        return false;
+    }
+    return true;
+}
+
+#endif  /* __MINGW32__ */
+
+void LocalExec(const ExecConfig *config)
+{
+    time_t starttime = time(NULL);
+
+    void *thread_name = ThreadUniqueName();
+
+    {
+        char starttime_str[64];
+        cf_strtimestamp_local(starttime, starttime_str);
+
+        if (LEGACY_OUTPUT)
+        {
+            Log(LOG_LEVEL_VERBOSE, "------------------------------------------------------------------");
+            Log(LOG_LEVEL_VERBOSE, "  LocalExec(%sscheduled) at %s", config->scheduled_run ? "" : "not ", starttime_str);
+            Log(LOG_LEVEL_VERBOSE, "------------------------------------------------------------------");
+        }
+        else
+        {
+            Log(LOG_LEVEL_VERBOSE, "LocalExec(%sscheduled) at %s", config->scheduled_run ? "" : "not ", starttime_str);
+        }
+    }
+
+/* Need to make sure we have LD_LIBRARY_PATH here or children will die  */
+
+    bool warm = false;
+#ifndef __MINGW32__
+    warm = config->warm_agent;
+#endif
+
+    char cmd[CF_BUFSIZE];
+    /* Run before a warm run, which would skip it otherwise */
+    char update_cmd[CF_BUFSIZE] = "";
+
+    if (strlen(config->exec_command) > 0)
+    {
+        strncpy(cmd, config->exec_command, CF_BUFSIZE - 1);
+
+        if (!strstr(cmd, "-Dfrom_cfexecd"))
+        {
+            strcat(cmd, " -Dfrom_cfexecd");
+        }
+
+        if (warm && ExecCommandUpdatesPolicy(cmd))
+        {
+            Log(LOG_LEVEL_VERBOSE, "exec_command updates the policy, which a warm run would skip. Not using the warm agent");
+            warm = false;
+        }
+    }
+#ifndef __MINGW32__
+    else if (warm)
+    {
+        /* The failsafe command, split into its update step and the run */
+        ConstructUpdateCommand(update_cmd);
+        ConstructAgentCommand(config->scheduled_run, cmd);
+    }
+#endif
+    else
+    {
+        ConstructFailsafeCommand(config->scheduled_run, cmd);
+    }
+
+    char esc_command[CF_BUFSIZE];
+    strncpy(esc_command, MapName(cmd), CF_BUFSIZE - 1);
+
+    char line[CF_BUFSIZE];
+    snprintf(line, CF_BUFSIZE - 1, "_%jd_%s", (intmax_t) starttime, CanonifyName(ctime(&starttime)));
+
+    char filename[CF_BUFSIZE];
+    {
+        char canonified_fq_name[CF_BUFSIZE];
+
+        strlcpy(canonified_fq_name, config->fq_name, CF_BUFSIZE);
+        CanonifyNameInPlace(canonified_fq_name);
+
+
+        snprintf(filename, CF_BUFSIZE - 1, "%s/outputs/cf_%s_%s_%p", CFWORKDIR, canonified_fq_name, line, thread_name);
+        MapName(filename);
+    }
+
+
+/* What if no more processes? Could sacrifice and exec() - but we need a sentinel */
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't open '%s' - aborting exec. (fopen: %s)", filename, GetErrorStr());
+        return;
+    }
+
+#if !defined(__MINGW32__)
+/*
+ * Don't inherit this file descriptor on fork/exec
+ */
+
+    if (fileno(fp) != -1)
+    {
+        fcntl(fileno(fp), F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    int count = 0;
+    bool run = true;
+
+#ifndef __MINGW32__
+    if (update_cmd[0] != '\0')
+    {
+        run = RunUpdateStep(config, update_cmd, fp, &count);
+    }
+#endif
+
+    if (run)
+    {
+        /* Set if the run is forked by the warm agent instead of running cmd */
+        pid_t warm_pid = 0;
+        FILE *pp = NULL;
+
+#ifndef __MINGW32__
+        if (warm)
+        {
+            pp = WarmAgentRequest(config->scheduled_run, &warm_pid);
+        }
+#endif
+
+        if (pp)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Warm agent is executing the run, pid %jd", (intmax_t) warm_pid);
+        }
+        else
+        {
+            Log(LOG_LEVEL_VERBOSE, "Command => %s", cmd);
+
+            pp = cf_popen_sh(esc_command, "r");
+            if (!pp)
+            {
+                Log(LOG_LEVEL_ERR, "Couldn't open pipe to command '%s'. (cf_popen: %s)", cmd, GetErrorStr());
+                fclose(fp);
+                return;
+            }
+
+            Log(LOG_LEVEL_VERBOSE, "Command is executing...%s", esc_command);
+        }
+
+        bool read_ok = ReadAgentOutput(config, cmd, pp, warm_pid, fp, &count);
+        CloseAgentOutput(pp, warm_pid);
+
+        if (!read_ok)
+        {
+            fclose(fp);
+            return;
+        }
+    }
+
     Log(LOG_LEVEL_DEBUG, "Closing fp");
     fclose(fp);
 
@@ -29,5 +29,12 @@
 
 void LocalExec(const ExecConfig *config);
 
+/**
+ * @brief Start the warm agent if warm_agent is set and it is not running,
+ *        stop it if warm_agent is no longer set. Call from the main thread.
+ */
+void WarmAgentKeep(const ExecConfig *config);
+void WarmAgentStop(void);
+
 #endif
 
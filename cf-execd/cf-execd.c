@@ -389,6 +389,8 @@ void StartServer(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, E
     {
         while (!IsPendingTermination())
         {
+            WarmAgentKeep(exec_config);
+
             if (ScheduleRun(ctx, &policy, config, exec_config))
             {
                 Log(LOG_LEVEL_VERBOSE, "Sleeping for splaytime %d seconds", exec_config->splay_time);
@@ -401,6 +403,8 @@ void StartServer(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, E
                 }
             }
         }
+
+        WarmAgentStop();
     }
 }
 
@@ -54,6 +54,7 @@ static void ExecConfigResetDefault(ExecConfig *exec_config)
 
     exec_config->mail_max_lines = 30;
     exec_config->agent_expireafter = 10800;
+    exec_config->warm_agent = false;
     exec_config->splay_time = 0;
 
     StringSetClear(exec_config->schedule);
@@ -99,6 +100,7 @@ ExecConfig *ExecConfigCopy(const ExecConfig *config)
     copy->ip_address = xstrdup(config->ip_address);
     copy->mail_max_lines = config->mail_max_lines;
     copy->agent_expireafter = config->agent_expireafter;
+    copy->warm_agent = config->warm_agent;
 
     return copy;
 }
@@ -193,6 +195,11 @@ void ExecConfigUpdate(const EvalContext *ctx, const Policy *policy, ExecConfig *
                 exec_config->agent_expireafter = IntFromString(retval.item);
                 Log(LOG_LEVEL_DEBUG, "agent_expireafter %d", exec_config->agent_expireafter);
             }
+            else if (strcmp(cp->lval, CFEX_CONTROLBODY[EXEC_CONTROL_WARM_AGENT].lval) == 0)
+            {
+                exec_config->warm_agent = BooleanFromString(retval.item);
+                Log(LOG_LEVEL_DEBUG, "warm_agent %d", exec_config->warm_agent);
+            }
             else if (strcmp(cp->lval, CFEX_CONTROLBODY[EXEC_CONTROL_EXECUTORFACILITY].lval) == 0)
             {
                 exec_config->log_facility = xstrdup(retval.item);
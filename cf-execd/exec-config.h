@@ -33,6 +33,7 @@ typedef struct
     bool scheduled_run;
     char *exec_command;
     int agent_expireafter;
+    bool warm_agent;
 
     char *mail_server;
     char *mail_from_address;
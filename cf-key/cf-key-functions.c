@@ -127,6 +127,39 @@ int TrustKey(const char* pubkey)
     return (ok? 0 : 1);
 }
 
+int CompactDatabases(void)
+{
+    int failures = 0;
+
+    for (int id = 0; id < dbid_max; id++)
+    {
+        char *path = DBIdToPath(CFWORKDIR, id);
+        struct stat sb;
+
+        /* Don't create databases this host does not use */
+        if (stat(path, &sb) == -1)
+        {
+            free(path);
+            continue;
+        }
+
+        off_t old_size = sb.st_size;
+        if (CompactDB(id) && stat(path, &sb) == 0)
+        {
+            Log(LOG_LEVEL_NOTICE, "Compacted database '%s' from %jd to %jd bytes",
+                path, (intmax_t) old_size, (intmax_t) sb.st_size);
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Could not compact database '%s'", path);
+            failures++;
+        }
+        free(path);
+    }
+
+    return failures ? 1 : 0;
+}
+
 bool ShowHost(const char *hostkey, const char *address, bool incoming,
                      const KeyHostSeen *quality, void *ctx)
 {
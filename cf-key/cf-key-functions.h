@@ -41,6 +41,7 @@ RSA* LoadPublicKey(const char* filename);
 char* GetPubkeyDigest(const char* pubkey);
 int PrintDigest(const char* pubkey);
 int TrustKey(const char* pubkey);
+int CompactDatabases(void);
 bool ShowHost(const char *hostkey, const char *address, bool incoming, const KeyHostSeen *quality, void *ctx);
 void ShowLastSeenHosts();
 int RemoveKeys(const char *input, bool must_be_coherent);
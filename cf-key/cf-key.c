@@ -42,6 +42,7 @@
 int SHOWHOSTS = false;
 bool REMOVEKEYS = false;
 bool LICENSE_INSTALL = false;
+bool COMPACT_DATABASES = false;
 char LICENSE_SOURCE[MAX_FILENAME];
 const char *remove_keys_host;
 static char *print_digest_arg = NULL;
@@ -70,6 +71,7 @@ static const struct option OPTIONS[] =
     {"install-license", required_argument, 0, 'l'},
     {"print-digest", required_argument, 0, 'p'},
     {"trust-key", required_argument, 0, 't'},
+    {"compact-databases", no_argument, 0, 'c'},
     {"color", optional_argument, 0, 'C'},
     {NULL, 0, 0, '\0'}
 };
@@ -86,6 +88,7 @@ static const char *HINTS[] =
     "Install license without boostrapping (CFEngine Enterprise only)",
     "Print digest of the specified public key",
     "Make cf-serverd/cf-agent trust the specified public key",
+    "Compact the local databases, giving space of deleted records back to the file system. Run it while no other CFEngine process is using them",
     "Enable colorized output. Possible values: 'always', 'auto', 'never'. If option is used, the default value is 'auto'",
     NULL
 };
@@ -128,6 +131,11 @@ int main(int argc, char *argv[])
         return TrustKey(trust_key_arg);
     }
 
+    if (COMPACT_DATABASES)
+    {
+        return CompactDatabases();
+    }
+
     char *public_key_file, *private_key_file;
 
     if (KEY_PATH)
@@ -162,7 +170,7 @@ static GenericAgentConfig *CheckOpts(int argc, char **argv)
     int c;
     GenericAgentConfig *config = GenericAgentConfigNewDefault(AGENT_TYPE_KEYGEN);
 
-    while ((c = getopt_long(argc, argv, "dvf:VMp:sr:t:hl:C::", OPTIONS, &optindex)) != EOF)
+    while ((c = getopt_long(argc, argv, "dvf:VMp:sr:t:chl:C::", OPTIONS, &optindex)) != EOF)
     {
         switch ((char) c)
         {
@@ -208,6 +216,10 @@ static GenericAgentConfig *CheckOpts(int argc, char **argv)
             trust_key_arg = optarg;
             break;
 
+        case 'c':
+            COMPACT_DATABASES = true;
+            break;
+
         case 'h':
             {
                 Writer *w = FileWriter(stdout);
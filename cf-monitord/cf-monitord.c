@@ -41,6 +41,9 @@ typedef enum
     MONITOR_CONTROL_MONITOR_FACILITY,
     MONITOR_CONTROL_HISTOGRAMS,
     MONITOR_CONTROL_TCP_DUMP,
+    MONITOR_CONTROL_TCP_DUMP_COMMAND,
+    MONITOR_CONTROL_PACKET_SAMPLING,
+    MONITOR_CONTROL_PACKET_SAMPLE_RATE,
     MONITOR_CONTROL_NONE
 } MonitorControl;
 
@@ -275,6 +278,16 @@ static void KeepPromises(EvalContext *ctx, Policy *policy)
                 MonNetworkSnifferEnable(BooleanFromString(retval.item));
             }
 
+            if (strcmp(cp->lval, CFM_CONTROLBODY[MONITOR_CONTROL_PACKET_SAMPLING].lval) == 0)
+            {
+                MonNetworkSnifferEnableSampling(BooleanFromString(retval.item));
+            }
+
+            if (strcmp(cp->lval, CFM_CONTROLBODY[MONITOR_CONTROL_PACKET_SAMPLE_RATE].lval) == 0)
+            {
+                MonNetworkSnifferSetSampleRate((int) IntFromString(retval.item));
+            }
+
             if (strcmp(cp->lval, CFM_CONTROLBODY[MONITOR_CONTROL_FORGET_RATE].lval) == 0)
             {
                 sscanf(retval.item, "%lf", &FORGETRATE);
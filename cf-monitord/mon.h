@@ -57,9 +57,18 @@ void MonNetworkGatherData(double *cf_this);
 void MonNetworkSnifferInit(void);
 void MonNetworkSnifferOpen(void);
 void MonNetworkSnifferEnable(bool enable);
+void MonNetworkSnifferEnableSampling(bool enable);
+void MonNetworkSnifferSetSampleRate(int rate);
 void MonNetworkSnifferSniff(long iteration, double *cf_this);
 void MonNetworkSnifferGatherData(void);
 
+/**
+ * @brief Classify the packets of a capture file in pcap format, as the packet
+ *        sampler would have if it had seen them.
+ * @return False if the file could not be read.
+ */
+bool MonNetworkSnifferReplay(const char *filename, long iteration, double *cf_this);
+
 /* mon_processes.c */
 
 void MonProcessesGatherData(double *cf_this);
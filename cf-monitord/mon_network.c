@@ -30,12 +30,19 @@
 #include <files_interfaces.h>
 #include <files_lib.h>
 #include <pipes.h>
+#include <writer.h>
 
 /* Globals */
 
 Item *ALL_INCOMING;
 Item *MON_UDP4 = NULL, *MON_UDP6 = NULL, *MON_TCP4 = NULL, *MON_TCP6 = NULL;
 
+#ifdef __linux__
+/* Ports in the lists above, which only grow until MonNetworkInit() */
+static unsigned char LISTENING_UDP4[65536 / 8], LISTENING_UDP6[65536 / 8];
+static unsigned char LISTENING_TCP4[65536 / 8], LISTENING_TCP6[65536 / 8];
+#endif
+
 /*******************************************************************/
 /* Anomaly                                                         */
 /*******************************************************************/
@@ -106,6 +113,13 @@ void MonNetworkInit(void)
  
     MON_UDP4 = MON_UDP6 = MON_TCP4 = MON_TCP6 = NULL;
 
+#ifdef __linux__
+    memset(LISTENING_UDP4, 0, sizeof(LISTENING_UDP4));
+    memset(LISTENING_UDP6, 0, sizeof(LISTENING_UDP6));
+    memset(LISTENING_TCP4, 0, sizeof(LISTENING_TCP4));
+    memset(LISTENING_TCP6, 0, sizeof(LISTENING_TCP6));
+#endif
+
     for (int i = 0; i < ATTR; i++)
     {
         char vbuff[CF_BUFSIZE];
@@ -171,7 +185,474 @@ static void SetNetworkEntropyClasses(const char *service, const char *direction,
 
 /******************************************************************************/
 
-void MonNetworkGatherData(double *cf_this)
+/* The state is not replaced by a smaller one unless it is at least 40
+   minutes old. This mirrors the persistence of the maxima classes */
+
+static bool RetainOldState(const char *filename, int new_size, const char *name)
+{
+    struct stat statbuf;
+    time_t now = time(NULL);
+
+    if (stat(filename, &statbuf) != -1)
+    {
+        if ((new_size < statbuf.st_size) && (now < statbuf.st_mtime + 40 * 60))
+        {
+            Log(LOG_LEVEL_VERBOSE, "New state '%s' is smaller, retaining old for 40 mins longer", name);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/******************************************************************************/
+
+#ifdef __linux__
+/*
+ * Linux: read the socket tables netstat reads, /proc/net/{tcp,tcp6,udp,udp6},
+ * without running netstat. Only the sockets on the ports of ECGSOCKS are
+ * formatted, as netstat -an shows them, for the state files; the rest are
+ * counted in place.
+ */
+
+# define PROC_NET_TCP_LISTEN 10
+
+/* Socket states of include/net/tcp_states.h, as netstat names them */
+static const char *const PROC_NET_TCP_STATES[] =
+{
+    [1] = "ESTABLISHED",
+    [2] = "SYN_SENT",
+    [3] = "SYN_RECV",
+    [4] = "FIN_WAIT1",
+    [5] = "FIN_WAIT2",
+    [6] = "TIME_WAIT",
+    [7] = "CLOSE",
+    [8] = "CLOSE_WAIT",
+    [9] = "LAST_ACK",
+    [10] = "LISTEN",
+    [11] = "CLOSING",
+};
+
+typedef struct
+{
+    const char *path;
+    const char *proto;          /* as netstat names it */
+    int family;
+    bool tcp;
+    Item **listening;
+    unsigned char *listening_seen;
+} ProcNetTable;
+
+typedef struct
+{
+    unsigned char family;
+    unsigned char any_port;     /* netstat shows the port as '*' */
+    unsigned char addr[16];
+} RemoteAddress;
+
+/* Sockets of one ECGSOCKS port and direction */
+typedef struct
+{
+    Writer *lines;
+    int size;                   /* as ByteSizeList() of the lines */
+    RemoteAddress *remotes;
+    size_t remotes_len;
+    size_t remotes_cap;
+} PortSockets;
+
+static PortSockets IN_SOCKETS[ATTR];
+static PortSockets OUT_SOCKETS[ATTR];
+static int ECG_PORTS[ATTR];
+
+/* At most max_digits hex digits */
+static const char *ParseHexN(const char *s, int max_digits, unsigned long *value)
+{
+    const char *start = s;
+    unsigned long v = 0;
+
+    for (; s - start < max_digits; s++)
+    {
+        int digit;
+
+        if (*s >= '0' && *s <= '9')
+        {
+            digit = *s - '0';
+        }
+        else if (*s >= 'A' && *s <= 'F')
+        {
+            digit = *s - 'A' + 10;
+        }
+        else if (*s >= 'a' && *s <= 'f')
+        {
+            digit = *s - 'a' + 10;
+        }
+        else
+        {
+            break;
+        }
+
+        v = (v << 4) | digit;
+    }
+
+    *value = v;
+    return (s == start) ? NULL : s;
+}
+
+static const char *ParseHex(const char *s, unsigned long *value)
+{
+    return ParseHexN(s, 2 * sizeof(unsigned long), value);
+}
+
+/* An address as the kernel prints it: 32-bit words in host order, then the port */
+static const char *ParseAddress(const char *s, int family, unsigned char addr[16], unsigned *port)
+{
+    int words = (family == AF_INET6) ? 4 : 1;
+
+    for (int i = 0; i < words; i++)
+    {
+        unsigned long value;
+        const char *end = ParseHexN(s, 8, &value);
+
+        if (end != s + 8)
+        {
+            return NULL;
+        }
+
+        uint32_t v = value;
+        memcpy(addr + 4 * i, &v, 4);
+        s = end;
+    }
+
+    unsigned long value;
+    if (*s != ':' || (s = ParseHex(s + 1, &value)) == NULL)
+    {
+        return NULL;
+    }
+
+    *port = value;
+    return s;
+}
+
+static const char *SkipSpaces(const char *s)
+{
+    while (*s == ' ')
+    {
+        s++;
+    }
+    return s;
+}
+
+static void FormatAddress(char *buf, size_t size, int family, const unsigned char addr[16], unsigned port)
+{
+    char host[INET6_ADDRSTRLEN];
+
+    if (inet_ntop(family, addr, host, sizeof(host)) == NULL)
+    {
+        strlcpy(host, "?", sizeof(host));
+    }
+
+    if (port == 0)
+    {
+        snprintf(buf, size, "%s:*", host);
+    }
+    else
+    {
+        snprintf(buf, size, "%s:%u", host, port);
+    }
+}
+
+static void PortSocketsAdd(PortSockets *sockets, const char *line, int family,
+                           const unsigned char remote[16], unsigned remote_port)
+{
+    if (sockets->lines == NULL)
+    {
+        sockets->lines = StringWriter();
+    }
+
+    WriterWrite(sockets->lines, line);
+    WriterWriteChar(sockets->lines, '\n');
+    sockets->size += strlen(line);
+
+    if (sockets->remotes_len == sockets->remotes_cap)
+    {
+        sockets->remotes_cap = sockets->remotes_cap ? sockets->remotes_cap * 2 : 64;
+        sockets->remotes = xrealloc(sockets->remotes, sockets->remotes_cap * sizeof(RemoteAddress));
+    }
+
+    RemoteAddress *ra = &sockets->remotes[sockets->remotes_len++];
+    memset(ra, 0, sizeof(*ra));
+    ra->family = family;
+    ra->any_port = (remote_port == 0);
+    memcpy(ra->addr, remote, (family == AF_INET6) ? 16 : 4);
+}
+
+static int RemoteAddressCompare(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(RemoteAddress));
+}
+
+/* MonEntropyCalculate() of the number of sockets per remote address */
+static double RemoteAddressEntropy(RemoteAddress *remotes, size_t len)
+{
+    if (len == 0)
+    {
+        return 0.0;
+    }
+
+    qsort(remotes, len, sizeof(RemoteAddress), RemoteAddressCompare);
+
+    double S = 0.0;
+    int numclasses = 0;
+    size_t run = 1;
+
+    for (size_t i = 1; i <= len; i++)
+    {
+        if (i < len && memcmp(&remotes[i], &remotes[i - 1], sizeof(RemoteAddress)) == 0)
+        {
+            run++;
+            continue;
+        }
+
+        double q = ((double) run) / len;
+        S -= q * log(q);
+        numclasses++;
+        run = 1;
+    }
+
+    if (numclasses < 2)
+    {
+        return 0.0;
+    }
+
+    return S / log(numclasses);
+}
+
+static bool SaveStateData(const char *file, const char *data, size_t size)
+{
+    char new[CF_BUFSIZE];
+    snprintf(new, sizeof(new), "%s%s", file, CF_EDITED);
+    unlink(new);                /* Just in case of races */
+
+    FILE *fp = fopen(new, "w");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't write file '%s'. (fopen: %s)", new, GetErrorStr());
+        return false;
+    }
+
+    if (size > 0 && fwrite(data, 1, size, fp) != size)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't write file '%s'. (fwrite: %s)", new, GetErrorStr());
+        fclose(fp);
+        return false;
+    }
+
+    if (fclose(fp) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to close file '%s' while writing. (fclose: %s)", new, GetErrorStr());
+        return false;
+    }
+
+    if (rename(new, file) == -1)
+    {
+        Log(LOG_LEVEL_INFO, "Error while renaming file '%s' to '%s'. (rename: %s)", new, file, GetErrorStr());
+        return false;
+    }
+
+    return true;
+}
+
+static void SavePortSockets(PortSockets *sockets, const char *direction, int i)
+{
+    char filename[CF_BUFSIZE];
+    snprintf(filename, sizeof(filename), "%s/state/cf_%s.%s", CFWORKDIR,
+             strcmp(direction, "in") == 0 ? "incoming" : "outgoing", ECGSOCKS[i].name);
+    MapName(filename);
+
+    if (!RetainOldState(filename, sockets->size, ECGSOCKS[i].name))
+    {
+        MonEntropyClassesSet(CanonifyName(ECGSOCKS[i].name), direction,
+                             RemoteAddressEntropy(sockets->remotes, sockets->remotes_len));
+
+        if (sockets->lines)
+        {
+            SaveStateData(filename, StringWriterData(sockets->lines), StringWriterLength(sockets->lines));
+        }
+        else
+        {
+            SaveStateData(filename, "", 0);
+        }
+        Log(LOG_LEVEL_DEBUG, "Saved %s socket data in '%s'", direction, filename);
+    }
+
+    if (sockets->lines)
+    {
+        WriterClose(sockets->lines);
+        sockets->lines = NULL;
+    }
+    sockets->size = 0;
+    sockets->remotes_len = 0;
+}
+
+static void ReadProcNetTable(const ProcNetTable *table, FILE *fp, unsigned char *incoming_seen, double *cf_this)
+{
+    char buf[CF_BUFSIZE];
+
+    /* Header */
+    if (fgets(buf, sizeof(buf), fp) == NULL)
+    {
+        return;
+    }
+
+    while (fgets(buf, sizeof(buf), fp) != NULL)
+    {
+        unsigned char local[16] = { 0 }, remote[16] = { 0 };
+        unsigned local_port, remote_port;
+        unsigned long state, tx_queue, rx_queue;
+
+        const char *sp = strchr(buf, ':');
+        if (sp == NULL ||
+            (sp = ParseAddress(SkipSpaces(sp + 1), table->family, local, &local_port)) == NULL ||
+            (sp = ParseAddress(SkipSpaces(sp), table->family, remote, &remote_port)) == NULL ||
+            (sp = ParseHex(SkipSpaces(sp), &state)) == NULL ||
+            (sp = ParseHex(SkipSpaces(sp), &tx_queue)) == NULL || *sp != ':' ||
+            (sp = ParseHex(sp + 1, &rx_queue)) == NULL)
+        {
+            continue;
+        }
+
+        /* netstat shows no state for UDP sockets but connected ones, so as
+           before only TCP sockets are ever listening */
+        if (table->tcp && state == PROC_NET_TCP_LISTEN)
+        {
+            const unsigned char bit = 1 << (local_port % 8);
+            char port[16];
+            snprintf(port, sizeof(port), "%u", local_port);
+
+            if (!(incoming_seen[local_port / 8] & bit))
+            {
+                incoming_seen[local_port / 8] |= bit;
+                PrependItem(&ALL_INCOMING, port, NULL);
+            }
+
+            if (!(table->listening_seen[local_port / 8] & bit))
+            {
+                char address[INET6_ADDRSTRLEN];
+                inet_ntop(table->family, local, address, sizeof(address));
+                table->listening_seen[local_port / 8] |= bit;
+                PrependItem(table->listening, port, address);
+            }
+        }
+
+        for (int i = 0; i < ATTR; i++)
+        {
+            bool in = (local_port == ECG_PORTS[i]);
+            bool out = (remote_port == ECG_PORTS[i]);
+
+            if (!in && !out)
+            {
+                continue;
+            }
+
+            const char *state_name = "";
+            if (table->tcp && state < sizeof(PROC_NET_TCP_STATES) / sizeof(PROC_NET_TCP_STATES[0]) &&
+                PROC_NET_TCP_STATES[state])
+            {
+                state_name = PROC_NET_TCP_STATES[state];
+            }
+            else if (!table->tcp && state == 1)
+            {
+                state_name = "ESTABLISHED";
+            }
+
+            char local_address[INET6_ADDRSTRLEN + 8], remote_address[INET6_ADDRSTRLEN + 8];
+            FormatAddress(local_address, sizeof(local_address), table->family, local, local_port);
+            FormatAddress(remote_address, sizeof(remote_address), table->family, remote, remote_port);
+
+            char line[CF_MAXVARSIZE];
+            snprintf(line, sizeof(line), "%-5s %6lu %6lu %-23s %-23s %s", table->proto, rx_queue, tx_queue,
+                     local_address, remote_address, state_name);
+
+            if (in)
+            {
+                cf_this[ECGSOCKS[i].in]++;
+                PortSocketsAdd(&IN_SOCKETS[i], line, table->family, remote, remote_port);
+            }
+
+            if (out)
+            {
+                cf_this[ECGSOCKS[i].out]++;
+                PortSocketsAdd(&OUT_SOCKETS[i], line, table->family, remote, remote_port);
+            }
+        }
+    }
+}
+
+static bool MonNetworkGatherProcNet(double *cf_this)
+{
+    const ProcNetTable tables[] =
+    {
+        { "/proc/net/tcp", "tcp", AF_INET, true, &MON_TCP4, LISTENING_TCP4 },
+        { "/proc/net/tcp6", "tcp6", AF_INET6, true, &MON_TCP6, LISTENING_TCP6 },
+        { "/proc/net/udp", "udp", AF_INET, false, &MON_UDP4, LISTENING_UDP4 },
+        { "/proc/net/udp6", "udp6", AF_INET6, false, &MON_UDP6, LISTENING_UDP6 },
+    };
+
+    FILE *fp = fopen(tables[0].path, "r");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not open '%s', running netstat. (fopen: %s)", tables[0].path, GetErrorStr());
+        return false;
+    }
+
+    for (int i = 0; i < ATTR; i++)
+    {
+        ECG_PORTS[i] = atoi(ECGSOCKS[i].portnr);
+    }
+
+    DeleteItemList(ALL_INCOMING);
+    ALL_INCOMING = NULL;
+
+    unsigned char incoming_seen[65536 / 8];
+    memset(incoming_seen, 0, sizeof(incoming_seen));
+
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++)
+    {
+        if (t > 0)
+        {
+            fp = fopen(tables[t].path, "r");
+        }
+
+        if (fp == NULL)
+        {
+            /* e.g. no IPv6 */
+            Log(LOG_LEVEL_DEBUG, "Could not open '%s'. (fopen: %s)", tables[t].path, GetErrorStr());
+            continue;
+        }
+
+        ReadProcNetTable(&tables[t], fp, incoming_seen, cf_this);
+        fclose(fp);
+    }
+
+/* Now save the state for ShowState() */
+
+    for (int i = 0; i < ATTR; i++)
+    {
+        SavePortSockets(&IN_SOCKETS[i], "in", i);
+    }
+
+    for (int i = 0; i < ATTR; i++)
+    {
+        SavePortSockets(&OUT_SOCKETS[i], "out", i);
+    }
+
+    return true;
+}
+#endif /* __linux__ */
+
+/******************************************************************************/
+
+static void MonNetworkGatherNetstat(double *cf_this)
 {
     FILE *pp;
     char local[CF_BUFSIZE], remote[CF_BUFSIZE], comm[CF_BUFSIZE];
@@ -368,25 +849,16 @@ void MonNetworkGatherData(double *cf_this)
 
     cf_pclose(pp);
 
-/* Now save the state for ShowState() 
-   the state is not smaller than the last or at least 40 minutes
-   older. This mirrors the persistence of the maxima classes */
+/* Now save the state for ShowState() */
 
     for (i = 0; i < ATTR; i++)
     {
-        struct stat statbuf;
-        time_t now = time(NULL);
-
         Log(LOG_LEVEL_DEBUG, "save incoming '%s'", ECGSOCKS[i].name);
         snprintf(vbuff, CF_MAXVARSIZE, "%s/state/cf_incoming.%s", CFWORKDIR, ECGSOCKS[i].name);
-        if (stat(vbuff, &statbuf) != -1)
+        if (RetainOldState(vbuff, ByteSizeList(in[i]), ECGSOCKS[i].name))
         {
-            if ((ByteSizeList(in[i]) < statbuf.st_size) && (now < statbuf.st_mtime + 40 * 60))
-            {
-                Log(LOG_LEVEL_VERBOSE, "New state '%s' is smaller, retaining old for 40 mins longer", ECGSOCKS[i].name);
-                DeleteItemList(in[i]);
-                continue;
-            }
+            DeleteItemList(in[i]);
+            continue;
         }
 
         SetNetworkEntropyClasses(CanonifyName(ECGSOCKS[i].name), "in", in[i]);
@@ -397,20 +869,13 @@ void MonNetworkGatherData(double *cf_this)
 
     for (i = 0; i < ATTR; i++)
     {
-        struct stat statbuf;
-        time_t now = time(NULL);
-
         Log(LOG_LEVEL_DEBUG, "save outgoing '%s'", ECGSOCKS[i].name);
         snprintf(vbuff, CF_MAXVARSIZE, "%s/state/cf_outgoing.%s", CFWORKDIR, ECGSOCKS[i].name);
 
-        if (stat(vbuff, &statbuf) != -1)
+        if (RetainOldState(vbuff, ByteSizeList(out[i]), ECGSOCKS[i].name))
         {
-            if ((ByteSizeList(out[i]) < statbuf.st_size) && (now < statbuf.st_mtime + 40 * 60))
-            {
-                Log(LOG_LEVEL_VERBOSE, "New state '%s' is smaller, retaining old for 40 mins longer", ECGSOCKS[i].name);
-                DeleteItemList(out[i]);
-                continue;
-            }
+            DeleteItemList(out[i]);
+            continue;
         }
 
         SetNetworkEntropyClasses(CanonifyName(ECGSOCKS[i].name), "out", out[i]);
@@ -419,3 +884,17 @@ void MonNetworkGatherData(double *cf_this)
         DeleteItemList(out[i]);
     }
 }
+
+/******************************************************************************/
+
+void MonNetworkGatherData(double *cf_this)
+{
+#ifdef __linux__
+    if (MonNetworkGatherProcNet(cf_this))
+    {
+        return;
+    }
+#endif
+
+    MonNetworkGatherNetstat(cf_this);
+}
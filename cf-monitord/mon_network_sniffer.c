@@ -34,6 +34,19 @@
 #include <string_lib.h>
 #include <misc_lib.h>
 
+#ifdef HAVE_GETIFADDRS
+# include <ifaddrs.h>
+#endif
+
+#ifdef __linux__
+# include <sys/mman.h>
+# include <poll.h>
+# include <net/if_arp.h>
+# include <linux/if_ether.h>
+# include <linux/if_packet.h>
+# include <linux/filter.h>
+#endif
+
 typedef enum
 {
     IP_TYPES_ICMP,
@@ -49,6 +62,26 @@ typedef enum
 
 #define CF_TCPDUMP_COMM "/usr/sbin/tcpdump -t -n -v"
 
+#define CF_MAX_LOCAL_ADDRESSES 256
+
+#define CF_ETHERTYPE_IPV4 0x0800
+#define CF_ETHERTYPE_IPV6 0x86DD
+
+/* Link types of packet captures we can replay */
+#define CF_PCAP_LINKTYPE_ETHERNET 1
+#define CF_PCAP_LINKTYPE_RAW 101
+#define CF_PCAP_LINKTYPE_LINUX_SLL 113
+#define CF_PCAP_MAX_RECORD 262144
+
+#ifdef __linux__
+/* Frames only need to hold the headers the sampler classifies */
+# define SAMPLER_SNAPLEN 192
+# define SAMPLER_FRAME_SIZE 512
+# define SAMPLER_BLOCK_SIZE (64 * 1024)
+# define SAMPLER_BLOCK_NR 32
+# define SAMPLER_FRAME_NR (SAMPLER_BLOCK_SIZE / SAMPLER_FRAME_SIZE * SAMPLER_BLOCK_NR)
+#endif
+
 static const int SLEEPTIME = 2.5 * 60;  /* Should be a fraction of 5 minutes */
 
 static const char *TCPNAMES[CF_NETATTR] =
@@ -71,16 +104,62 @@ static FILE *TCPPIPE;
 static Item *NETIN_DIST[CF_NETATTR];
 static Item *NETOUT_DIST[CF_NETATTR];
 
+/* Packet sampler, reading packets in process instead of through tcpdump */
+
+typedef struct
+{
+    int family;
+    unsigned char addr[16];
+} LocalAddress;
+
+static bool SAMPLING;
+static int SAMPLE_RATE = 1;
+static unsigned long SAMPLE_SEEN;
+
+static LocalAddress LOCAL_ADDRESSES[CF_MAX_LOCAL_ADDRESSES];
+static int LOCAL_ADDRESSES_COUNT;
+
+#ifdef __linux__
+static int SAMPLER_FD = -1;
+static unsigned char *SAMPLER_RING;
+static unsigned int SAMPLER_NEXT;
+static bool SAMPLER_FILTERED;   /* The kernel drops all but one in SAMPLE_RATE */
+#endif
+
+static const enum observables PACKET_OBSERVABLES[CF_NETATTR][2] =
+{
+    { ob_icmp_in, ob_icmp_out },
+    { ob_udp_in, ob_udp_out },
+    { ob_dns_in, ob_dns_out },
+    { ob_tcpsyn_in, ob_tcpsyn_out },
+    { ob_tcpack_in, ob_tcpack_out },
+    { ob_tcpfin_in, ob_tcpfin_out },
+    { ob_tcpmisc_in, ob_tcpmisc_out },
+};
+
 /* Prototypes */
 
 static void Sniff(long iteration, double *cf_this);
 static void AnalyzeArrival(long iteration, char *arrival, double *cf_this);
 static void DePort(char *address);
+static void IncrementCounter(Item **list, char *name);
+#ifdef __linux__
+static bool SamplerOpen(void);
+static void SamplerSniff(long iteration, double *cf_this);
+#endif
 
 /* Implementation */
 
 void MonNetworkSnifferSniff(long iteration, double *cf_this)
 {
+#ifdef __linux__
+    if (SAMPLING)
+    {
+        SamplerSniff(iteration, cf_this);
+        return;
+    }
+#endif
+
     if (TCPDUMP)
     {
         Sniff(iteration, cf_this);
@@ -97,6 +176,19 @@ void MonNetworkSnifferOpen(void)
 {
     char tcpbuffer[CF_BUFSIZE];
 
+    if (SAMPLING)
+    {
+#ifdef __linux__
+        if (SamplerOpen())
+        {
+            return;
+        }
+#else
+        Log(LOG_LEVEL_ERR, "Packet sampling is only available on Linux");
+#endif
+        SAMPLING = false;
+    }
+
     if (TCPDUMP)
     {
         struct stat statbuf;
@@ -137,6 +229,23 @@ void MonNetworkSnifferEnable(bool enable)
 
 /******************************************************************************/
 
+void MonNetworkSnifferEnableSampling(bool enable)
+{
+    SAMPLING = enable;
+    Log(LOG_LEVEL_DEBUG, "use packet sampling = %d", SAMPLING);
+}
+
+/******************************************************************************/
+
+void MonNetworkSnifferSetSampleRate(int rate)
+{
+    SAMPLE_RATE = (rate > 1) ? rate : 1;
+    SAMPLE_SEEN = 0;
+    Log(LOG_LEVEL_DEBUG, "packet sample rate = 1/%d", SAMPLE_RATE);
+}
+
+/******************************************************************************/
+
 static void CfenvTimeOut(ARG_UNUSED int signum)
 {
     alarm(0);
@@ -402,6 +511,601 @@ static void AnalyzeArrival(long iteration, char *arrival, double *cf_this)
     }
 }
 
+/******************************************************************************/
+/* Packet sampler                                                             */
+/******************************************************************************/
+
+static void AddLocalAddress(int family, const void *addr)
+{
+    if (LOCAL_ADDRESSES_COUNT == CF_MAX_LOCAL_ADDRESSES)
+    {
+        return;
+    }
+
+    LocalAddress *local = &LOCAL_ADDRESSES[LOCAL_ADDRESSES_COUNT++];
+    local->family = family;
+    memcpy(local->addr, addr, (family == AF_INET) ? 4 : 16);
+}
+
+/* The interface addresses in binary, refreshed once per sampling period */
+
+static void LoadLocalAddresses(void)
+{
+    LOCAL_ADDRESSES_COUNT = 0;
+
+    for (const Item *ip = IPADDRESSES; ip != NULL; ip = ip->next)
+    {
+        unsigned char addr[16];
+
+        if (inet_pton(AF_INET, ip->name, addr) == 1)
+        {
+            AddLocalAddress(AF_INET, addr);
+        }
+        else if (inet_pton(AF_INET6, ip->name, addr) == 1)
+        {
+            AddLocalAddress(AF_INET6, addr);
+        }
+    }
+
+#ifdef HAVE_GETIFADDRS
+    /* IPADDRESSES only holds IPv4 addresses */
+    struct ifaddrs *ifaddr;
+
+    if (getifaddrs(&ifaddr) == 0)
+    {
+        for (struct ifaddrs *ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next)
+        {
+            if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET6)
+            {
+                AddLocalAddress(AF_INET6, &((struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr);
+            }
+        }
+        freeifaddrs(ifaddr);
+    }
+#endif
+}
+
+static bool IsLocalAddress(int family, const unsigned char *addr)
+{
+    size_t len = (family == AF_INET) ? 4 : 16;
+
+    for (int i = 0; i < LOCAL_ADDRESSES_COUNT; i++)
+    {
+        if (LOCAL_ADDRESSES[i].family == family && memcmp(LOCAL_ADDRESSES[i].addr, addr, len) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/******************************************************************************/
+
+static bool SampleThisPacket(void)
+{
+    return (++SAMPLE_SEEN % SAMPLE_RATE) == 0;
+}
+
+/* Count one sampled packet, which stands for SAMPLE_RATE packets */
+
+static void CountPacket(long iteration, IPTypes type, int family,
+                        const unsigned char *src, const unsigned char *dest, double *cf_this)
+{
+    char address[INET6_ADDRSTRLEN];
+
+    if (type == IP_TYPES_TCP_MISC)
+    {
+        /* Like tcpdump lines we cannot make sense of, undirected */
+        cf_this[ob_tcpmisc_in] += SAMPLE_RATE;
+        Log(LOG_LEVEL_DEBUG, "%ld: Miscellaneous undirected packet", iteration);
+
+        if (src != NULL && inet_ntop(family, src, address, sizeof(address)) != NULL)
+        {
+            IncrementCounter(&(NETIN_DIST[IP_TYPES_TCP_MISC]), address);
+        }
+        return;
+    }
+
+    if (IsLocalAddress(family, dest))
+    {
+        cf_this[PACKET_OBSERVABLES[type][0]] += SAMPLE_RATE;
+        if (inet_ntop(family, src, address, sizeof(address)) != NULL)
+        {
+            Log(LOG_LEVEL_DEBUG, "%ld: %s packet from '%s'", iteration, TCPNAMES[type], address);
+            IncrementCounter(&(NETIN_DIST[type]), address);
+        }
+    }
+    else if (IsLocalAddress(family, src))
+    {
+        cf_this[PACKET_OBSERVABLES[type][1]] += SAMPLE_RATE;
+        if (inet_ntop(family, dest, address, sizeof(address)) != NULL)
+        {
+            Log(LOG_LEVEL_DEBUG, "%ld: %s packet to '%s'", iteration, TCPNAMES[type], address);
+            IncrementCounter(&(NETOUT_DIST[type]), address);
+        }
+    }
+}
+
+/******************************************************************************/
+
+/* Classifies a packet in place, from its network header on, the same way as
+   AnalyzeArrival() does with tcpdump output */
+
+static void AnalyzePacket(long iteration, int ethertype, const unsigned char *data, size_t len, double *cf_this)
+{
+    int family;
+    const unsigned char *src, *dest;
+    const unsigned char *transport;
+    size_t transport_len;
+    int protocol;
+
+    if (ethertype == CF_ETHERTYPE_IPV4 && len >= 20 && (data[0] >> 4) == 4)
+    {
+        size_t header_len = (data[0] & 0x0F) * 4;
+        bool first_fragment = ((data[6] & 0x1F) | data[7]) == 0;
+
+        if (header_len < 20 || header_len > len)
+        {
+            CountPacket(iteration, IP_TYPES_TCP_MISC, AF_INET, NULL, NULL, cf_this);
+            return;
+        }
+
+        family = AF_INET;
+        protocol = data[9];
+        src = data + 12;
+        dest = data + 16;
+        transport = data + header_len;
+        transport_len = first_fragment ? len - header_len : 0;
+    }
+    else if (ethertype == CF_ETHERTYPE_IPV6 && len >= 40 && (data[0] >> 4) == 6)
+    {
+        size_t offset = 40;
+
+        family = AF_INET6;
+        protocol = data[6];
+        src = data + 8;
+        dest = data + 24;
+
+        /* Skip extension headers, as far as they were captured */
+        while (offset + 8 <= len)
+        {
+            if (protocol == IPPROTO_HOPOPTS || protocol == IPPROTO_ROUTING || protocol == IPPROTO_DSTOPTS)
+            {
+                protocol = data[offset];
+                offset += (data[offset + 1] + 1) * 8;
+            }
+            else if (protocol == IPPROTO_FRAGMENT)
+            {
+                bool first_fragment = ((data[offset + 2] << 8 | data[offset + 3]) & 0xFFF8) == 0;
+
+                protocol = data[offset];
+                offset += 8;
+                if (!first_fragment)
+                {
+                    offset = len;
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        transport = data + ((offset < len) ? offset : len);
+        transport_len = (offset < len) ? len - offset : 0;
+    }
+    else
+    {
+        CountPacket(iteration, IP_TYPES_TCP_MISC, 0, NULL, NULL, cf_this);
+        return;
+    }
+
+    switch (protocol)
+    {
+    case IPPROTO_TCP:
+        {
+            IPTypes type = IP_TYPES_TCP_ACK;
+
+            if (transport_len >= 14)
+            {
+                if (transport[13] & 0x02)
+                {
+                    type = IP_TYPES_TCP_SYN;
+                }
+                else if (transport[13] & 0x01)
+                {
+                    type = IP_TYPES_TCP_FIN;
+                }
+            }
+            CountPacket(iteration, type, family, src, dest, cf_this);
+        }
+        break;
+
+    case IPPROTO_UDP:
+        if (transport_len >= 4 &&
+            ((transport[0] << 8 | transport[1]) == 53 || (transport[2] << 8 | transport[3]) == 53))
+        {
+            CountPacket(iteration, IP_TYPES_DNS, family, src, dest, cf_this);
+        }
+        else
+        {
+            CountPacket(iteration, IP_TYPES_UDP, family, src, dest, cf_this);
+        }
+        break;
+
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+        CountPacket(iteration, IP_TYPES_ICMP, family, src, dest, cf_this);
+        break;
+
+    default:
+        CountPacket(iteration, IP_TYPES_TCP_MISC, family, src, dest, cf_this);
+        break;
+    }
+}
+
+/******************************************************************************/
+
+static void AnalyzeEthernetFrame(long iteration, const unsigned char *data, size_t len, double *cf_this)
+{
+    size_t offset = 12;
+
+    if (len < 14)
+    {
+        return;
+    }
+
+    int ethertype = data[offset] << 8 | data[offset + 1];
+
+    /* At most two VLAN tags */
+    for (int i = 0; i < 2 && (ethertype == 0x8100 || ethertype == 0x88A8) && offset + 6 <= len; i++)
+    {
+        offset += 4;
+        ethertype = data[offset] << 8 | data[offset + 1];
+    }
+
+    AnalyzePacket(iteration, ethertype, data + offset + 2, len - offset - 2, cf_this);
+}
+
+/******************************************************************************/
+
+static uint32_t PcapWord(uint32_t word, bool swapped)
+{
+    if (!swapped)
+    {
+        return word;
+    }
+
+    return ((word & 0xFF) << 24) | ((word & 0xFF00) << 8) | ((word >> 8) & 0xFF00) | (word >> 24);
+}
+
+bool MonNetworkSnifferReplay(const char *filename, long iteration, double *cf_this)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to open packet capture '%s'. (fopen: %s)", filename, GetErrorStr());
+        return false;
+    }
+
+    /* magic, version, thiszone, sigfigs, snaplen, linktype */
+    uint32_t header[6];
+    if (fread(header, sizeof(header), 1, fp) != 1)
+    {
+        Log(LOG_LEVEL_ERR, "Packet capture '%s' is too short", filename);
+        fclose(fp);
+        return false;
+    }
+
+    bool swapped;
+    switch (header[0])
+    {
+    case 0xA1B2C3D4:
+    case 0xA1B23C4D:
+        swapped = false;
+        break;
+
+    case 0xD4C3B2A1:
+    case 0x4D3CB2A1:
+        swapped = true;
+        break;
+
+    default:
+        Log(LOG_LEVEL_ERR, "'%s' is not a packet capture in pcap format", filename);
+        fclose(fp);
+        return false;
+    }
+
+    uint32_t linktype = PcapWord(header[5], swapped);
+    if (linktype != CF_PCAP_LINKTYPE_ETHERNET && linktype != CF_PCAP_LINKTYPE_RAW && linktype != CF_PCAP_LINKTYPE_LINUX_SLL)
+    {
+        Log(LOG_LEVEL_ERR, "Unsupported link type %u in packet capture '%s'", linktype, filename);
+        fclose(fp);
+        return false;
+    }
+
+    LoadLocalAddresses();
+
+    unsigned char *data = xmalloc(CF_PCAP_MAX_RECORD);
+    bool ok = true;
+
+    /* ts_sec, ts_usec, incl_len, orig_len */
+    uint32_t record[4];
+    while (fread(record, sizeof(record), 1, fp) == 1)
+    {
+        uint32_t len = PcapWord(record[2], swapped);
+
+        if (len > CF_PCAP_MAX_RECORD || (len > 0 && fread(data, len, 1, fp) != 1))
+        {
+            Log(LOG_LEVEL_ERR, "Packet capture '%s' is truncated or damaged", filename);
+            ok = false;
+            break;
+        }
+
+        if (!SampleThisPacket())
+        {
+            continue;
+        }
+
+        switch (linktype)
+        {
+        case CF_PCAP_LINKTYPE_ETHERNET:
+            AnalyzeEthernetFrame(iteration, data, len, cf_this);
+            break;
+
+        case CF_PCAP_LINKTYPE_RAW:
+            if (len > 0)
+            {
+                int ethertype = ((data[0] >> 4) == 6) ? CF_ETHERTYPE_IPV6 : CF_ETHERTYPE_IPV4;
+                AnalyzePacket(iteration, ethertype, data, len, cf_this);
+            }
+            break;
+
+        case CF_PCAP_LINKTYPE_LINUX_SLL:
+            if (len >= 16)
+            {
+                AnalyzePacket(iteration, data[14] << 8 | data[15], data + 16, len - 16, cf_this);
+            }
+            break;
+        }
+    }
+
+    free(data);
+    fclose(fp);
+    return ok;
+}
+
+/******************************************************************************/
+
+#ifdef __linux__
+
+/* Truncate packets to their headers and, if the kernel supports it, drop all
+   but a random one in SAMPLE_RATE before they are copied to the ring */
+
+static void SamplerAttachFilter(int fd)
+{
+    SAMPLER_FILTERED = false;
+
+# if defined(SKF_AD_RANDOM) && defined(BPF_MOD)
+    if (SAMPLE_RATE > 1)
+    {
+        struct sock_filter code[] =
+        {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RANDOM),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, SAMPLE_RATE),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+            BPF_STMT(BPF_RET | BPF_K, SAMPLER_SNAPLEN),
+            BPF_STMT(BPF_RET | BPF_K, 0),
+        };
+        struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == 0)
+        {
+            SAMPLER_FILTERED = true;
+            return;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "Kernel cannot sample packets, sampling them in process instead. (setsockopt: %s)",
+            GetErrorStr());
+    }
+# endif
+
+    struct sock_filter code[] =
+    {
+        BPF_STMT(BPF_RET | BPF_K, SAMPLER_SNAPLEN),
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to attach packet filter. (setsockopt: %s)", GetErrorStr());
+    }
+}
+
+/******************************************************************************/
+
+/* Like tcpdump, the lowest numbered interface that is up, other than loopback */
+static unsigned int SamplerDefaultInterface(int fd, char *name, size_t size)
+{
+    struct if_nameindex *interfaces = if_nameindex();
+    if (interfaces == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to list network interfaces. (if_nameindex: %s)", GetErrorStr());
+        return 0;
+    }
+
+    unsigned int index = 0;
+
+    for (struct if_nameindex *ifn = interfaces; ifn->if_index != 0; ifn++)
+    {
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strlcpy(ifr.ifr_name, ifn->if_name, sizeof(ifr.ifr_name));
+
+        if (ioctl(fd, SIOCGIFFLAGS, &ifr) == -1 || !(ifr.ifr_flags & IFF_UP) || (ifr.ifr_flags & IFF_LOOPBACK))
+        {
+            continue;
+        }
+
+        if (index == 0 || ifn->if_index < index)
+        {
+            index = ifn->if_index;
+            strlcpy(name, ifn->if_name, size);
+        }
+    }
+
+    if_freenameindex(interfaces);
+    return index;
+}
+
+/******************************************************************************/
+
+static bool SamplerOpen(void)
+{
+    /* No protocol yet, so that nothing is queued before the socket is bound */
+    int fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to open packet socket for sampling. (socket: %s)", GetErrorStr());
+        return false;
+    }
+
+    int version = TPACKET_V2;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to select packet ring version. (setsockopt: %s)", GetErrorStr());
+        close(fd);
+        return false;
+    }
+
+    SamplerAttachFilter(fd);
+
+    struct tpacket_req req =
+    {
+        .tp_block_size = SAMPLER_BLOCK_SIZE,
+        .tp_block_nr = SAMPLER_BLOCK_NR,
+        .tp_frame_size = SAMPLER_FRAME_SIZE,
+        .tp_frame_nr = SAMPLER_FRAME_NR,
+    };
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to set up packet ring. (setsockopt: %s)", GetErrorStr());
+        close(fd);
+        return false;
+    }
+
+    void *ring = mmap(NULL, (size_t) SAMPLER_BLOCK_SIZE * SAMPLER_BLOCK_NR, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to map packet ring. (mmap: %s)", GetErrorStr());
+        close(fd);
+        return false;
+    }
+
+    char ifname[IF_NAMESIZE] = "";
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = SamplerDefaultInterface(fd, ifname, sizeof(ifname));
+
+    if (sll.sll_ifindex == 0)
+    {
+        Log(LOG_LEVEL_ERR, "No network interface is up to sample packets on");
+        munmap(ring, (size_t) SAMPLER_BLOCK_SIZE * SAMPLER_BLOCK_NR);
+        close(fd);
+        return false;
+    }
+
+    if (bind(fd, (struct sockaddr *) &sll, sizeof(sll)) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to bind packet socket to interface '%s'. (bind: %s)", ifname, GetErrorStr());
+        munmap(ring, (size_t) SAMPLER_BLOCK_SIZE * SAMPLER_BLOCK_NR);
+        close(fd);
+        return false;
+    }
+
+    SAMPLER_FD = fd;
+    SAMPLER_RING = ring;
+    SAMPLER_NEXT = 0;
+
+    Log(LOG_LEVEL_VERBOSE, "Sampling one in %d packets on interface '%s'%s", SAMPLE_RATE, ifname,
+        SAMPLER_FILTERED ? ", filtered in the kernel" : "");
+    return true;
+}
+
+/******************************************************************************/
+
+static void SamplerFrame(long iteration, const struct tpacket2_hdr *hdr, double *cf_this)
+{
+    const struct sockaddr_ll *sll =
+        (const struct sockaddr_ll *) ((const unsigned char *) hdr + TPACKET_ALIGN(sizeof(struct tpacket2_hdr)));
+    const unsigned char *frame = (const unsigned char *) hdr;
+
+    if (!SAMPLER_FILTERED && !SampleThisPacket())
+    {
+        return;
+    }
+
+    if (sll->sll_hatype == ARPHRD_ETHER && hdr->tp_mac < hdr->tp_net)
+    {
+        AnalyzeEthernetFrame(iteration, frame + hdr->tp_mac, hdr->tp_snaplen, cf_this);
+    }
+    else if (hdr->tp_net >= hdr->tp_mac && hdr->tp_snaplen >= hdr->tp_net - hdr->tp_mac)
+    {
+        AnalyzePacket(iteration, ntohs(sll->sll_protocol), frame + hdr->tp_net,
+                      hdr->tp_snaplen - (hdr->tp_net - hdr->tp_mac), cf_this);
+    }
+}
+
+/******************************************************************************/
+
+static void SamplerSniff(long iteration, double *cf_this)
+{
+    time_t deadline = time(NULL) + SLEEPTIME;
+
+    Log(LOG_LEVEL_VERBOSE, "Sampling packets...");
+    LoadLocalAddresses();
+
+    while (!IsPendingTermination())
+    {
+        time_t now = time(NULL);
+        if (now >= deadline)
+        {
+            break;
+        }
+
+        struct tpacket2_hdr *hdr = (struct tpacket2_hdr *) (SAMPLER_RING + (size_t) SAMPLER_NEXT * SAMPLER_FRAME_SIZE);
+
+        if (!(*(volatile __u32 *) &hdr->tp_status & TP_STATUS_USER))
+        {
+            struct pollfd pfd = { .fd = SAMPLER_FD, .events = POLLIN };
+            poll(&pfd, 1, (deadline - now) * 1000);
+            continue;
+        }
+
+        __sync_synchronize();
+        SamplerFrame(iteration, hdr, cf_this);
+        __sync_synchronize();
+
+        /* Hand the frame back to the kernel */
+        *(volatile __u32 *) &hdr->tp_status = TP_STATUS_KERNEL;
+        SAMPLER_NEXT = (SAMPLER_NEXT + 1) % SAMPLER_FRAME_NR;
+    }
+
+    struct tpacket_stats stats;
+    socklen_t len = sizeof(stats);
+    if (getsockopt(SAMPLER_FD, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Packet sampler received %u packets, %u dropped for lack of room",
+            stats.tp_packets, stats.tp_drops);
+    }
+}
+
+#endif /* __linux__ */
+
 /******************************************************************************/
 
 static void SaveTCPEntropyData(Item *list, int i, char *inout)
@@ -36,9 +36,11 @@
 #include <unix.h>
 #include <man.h>
 #include <tls_server.h>                              /* ServerTLSInitialize */
+#include <server_event.h>
 
 
 static const size_t QUEUESIZE = 50;
+static const time_t EVENT_STATS_INTERVAL = 300;
 int NO_FORK = false;
 
 /*******************************************************************/
@@ -275,6 +277,7 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     int ret_val;
     CfLock thislock;
     time_t last_collect = 0;
+    time_t last_stats = 0;
     extern int COLLECT_WINDOW;
 
     struct sockaddr_storage cin;
@@ -349,10 +352,23 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     fcntl(sd, F_SETFD, FD_CLOEXEC);
 #endif
 
+    /* Threads do not survive fork(), so only start the pool now. */
+    if (CFD_WORKER_THREADS > 0)
+    {
+        ServerEventLoopStart(CFD_WORKER_THREADS);
+    }
+
     while (!IsPendingTermination())
     {
         time_t now = time(NULL);
 
+        if (now - last_stats >= EVENT_STATS_INTERVAL)
+        {
+            ServerEventLoopLogStats(LOG_LEVEL_VERBOSE);
+            ServerTLSLogStats(LOG_LEVEL_VERBOSE);
+            last_stats = now;
+        }
+
         /* Note that this loop logic is single threaded, but ACTIVE_THREADS
            might still change in threads pertaining to service handling */
 
@@ -434,6 +450,10 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
         }
     }
 
+    ServerEventLoopLogStats(LOG_LEVEL_VERBOSE);
+    ServerTLSLogStats(LOG_LEVEL_VERBOSE);
+    ServerEventLoopStop();
+
     PolicyDestroy(server_cfengine_policy);
 }
 
@@ -41,6 +41,7 @@
 #include <audit.h>
 #include <tls_server.h>
 #include <server_common.h>
+#include <server_event.h>
 
 #include <cf-windows-functions.h>
 
@@ -52,6 +53,7 @@ int CLOCK_DRIFT = 3600;  /* 1hr */
 int ACTIVE_THREADS;
 
 int CFD_MAXPROCESSES = 0;
+int CFD_WORKER_THREADS = 0;
 bool DENYBADCLOCKS = true;
 
 int MAXTRIES = 5;
@@ -75,7 +77,6 @@ static int BusyWithClassicConnection(EvalContext *ctx, ServerConnectionState *co
 static int VerifyConnection(ServerConnectionState *conn, char buf[CF_BUFSIZE]);
 static int CheckStoreKey(ServerConnectionState *conn, RSA *key);
 static ServerConnectionState *NewConn(EvalContext *ctx, int sd);
-static void DeleteConn(ServerConnectionState *conn);
 static int AuthenticationDialogue(ServerConnectionState *conn, char *recvbuffer, int recvlen);
 
 //******************************************************************/
@@ -298,6 +299,13 @@ static void SpawnConnection(EvalContext *ctx, int sd_accepted, char *ipaddr)
 
     Log(LOG_LEVEL_VERBOSE, "New connection...(from %s, sd %d)",
         conn->ipaddr, sd_accepted);
+
+    if (ServerEventLoopRunning())
+    {
+        ServerEventLoopAdd(conn);
+        return;
+    }
+
     Log(LOG_LEVEL_VERBOSE, "Spawning new thread...");
 
     ret = pthread_attr_init(&threadattrs);
@@ -361,6 +369,32 @@ void DisableSendDelays(int sockfd)
 /*********************************************************************/
 
 static void *HandleConnection(ServerConnectionState *conn)
+{
+    if (!ServerConnectionStart(conn))
+    {
+        return NULL;
+    }
+
+    while (ServerConnectionServe(conn))
+    {
+    }
+
+    ServerConnectionFinish(conn);
+    return NULL;
+}
+
+/*********************************************************************/
+
+/**
+ * @brief Admit a freshly accepted connection and negotiate its protocol.
+ *
+ * Counts the connection against maxconnections and, for TLS, completes the
+ * handshake. On failure the connection has been answered (if possible) and
+ * freed.
+ *
+ * @return true if the connection is ready for ServerConnectionServe()
+ */
+bool ServerConnectionStart(ServerConnectionState *conn)
 {
     int ret;
     char output[CF_BUFSIZE];
@@ -368,7 +402,7 @@ static void *HandleConnection(ServerConnectionState *conn)
     if (!ThreadLock(cft_server_children))
     {
         DeleteConn(conn);
-        return NULL;
+        return false;
     }
 
     ACTIVE_THREADS++;
@@ -387,11 +421,11 @@ static void *HandleConnection(ServerConnectionState *conn)
         {
         }
 
-        Log(LOG_LEVEL_ERR, "Too many threads (>=%d) -- increase server maxconnections?", CFD_MAXPROCESSES);
+        Log(LOG_LEVEL_ERR, "Too many connections (>=%d) -- increase server maxconnections?", CFD_MAXPROCESSES);
         snprintf(output, CF_BUFSIZE, "BAD: Server is currently too busy -- increase maxconnections or splaytime?");
         SendTransaction(&conn->conn_info, output, 0, CF_DONE);
         DeleteConn(conn);
-        return NULL;
+        return false;
     }
     else
     {
@@ -411,58 +445,68 @@ static void *HandleConnection(ServerConnectionState *conn)
     ret = ServerTLSPeek(&conn->conn_info);
     if (ret == -1)
     {
-        DeleteConn(conn);
-        return NULL;
-    }
-
-    switch (conn->conn_info.type)
-    {
-
-    case CF_PROTOCOL_CLASSIC:
-    {
-        while (BusyWithClassicConnection(conn->ctx, conn))
-        {
-        }
-        break;
+        ServerConnectionFinish(conn);
+        return false;
     }
 
-    case CF_PROTOCOL_TLS:
+    if (conn->conn_info.type == CF_PROTOCOL_TLS)
     {
         ret = ServerTLSSessionEstablish(conn);
         if (ret == -1)
         {
-            DeleteConn(conn);
-            return NULL;
-        }
-
-        while (BusyWithNewProtocol(conn->ctx, conn))
-        {
+            ServerConnectionFinish(conn);
+            return false;
         }
-        break;
     }
 
+    return true;
+}
+
+/**
+ * @brief Receive and answer a single request on an established connection.
+ *
+ * @return false once the connection should be closed
+ */
+bool ServerConnectionServe(ServerConnectionState *conn)
+{
+    switch (conn->conn_info.type)
+    {
+    case CF_PROTOCOL_CLASSIC:
+        return BusyWithClassicConnection(conn->ctx, conn);
+    case CF_PROTOCOL_TLS:
+        return BusyWithNewProtocol(conn->ctx, conn);
     default:
-        UnexpectedError("HandleConnection: ProtocolVersion %d!",
+        UnexpectedError("ServerConnectionServe: ProtocolVersion %d!",
                         conn->conn_info.type);
+        return false;
     }
+}
 
-    Log(LOG_LEVEL_INFO, "Connection from %s is closed, terminating thread",
-        conn->ipaddr);
-
-    if (!ThreadLock(cft_server_children))
-    {
-        DeleteConn(conn);
-        return NULL;
-    }
+/**
+ * @brief True if a request is already buffered in userspace, so waiting for
+ *        the socket to become readable would stall it.
+ */
+bool ServerConnectionHasPending(const ServerConnectionState *conn)
+{
+    return (conn->conn_info.type == CF_PROTOCOL_TLS &&
+            conn->conn_info.ssl != NULL &&
+            SSL_pending(conn->conn_info.ssl) > 0);
+}
 
-    ACTIVE_THREADS--;
+/**
+ * @brief Release a connection admitted by ServerConnectionStart().
+ */
+void ServerConnectionFinish(ServerConnectionState *conn)
+{
+    Log(LOG_LEVEL_INFO, "Connection from %s is closed", conn->ipaddr);
 
-    if (!ThreadUnlock(cft_server_children))
+    if (ThreadLock(cft_server_children))
     {
+        ACTIVE_THREADS--;
+        ThreadUnlock(cft_server_children);
     }
 
     DeleteConn(conn);
-    return NULL;
 }
 
 /*********************************************************************/
@@ -1693,7 +1737,7 @@ static ServerConnectionState *NewConn(EvalContext *ctx, int sd)
 
 /***************************************************************/
 
-static void DeleteConn(ServerConnectionState *conn)
+void DeleteConn(ServerConnectionState *conn)
 {
     /* Sockets should have already been closed by the client, so we are just
      * making sure here in case an error occured. */
@@ -1709,6 +1753,7 @@ static void DeleteConn(ServerConnectionState *conn)
     cf_closesocket(conn->conn_info.sd);
 
     free(conn->session_key);
+    AccessCacheDestroy(conn->access_cache);
 
     if (conn->conn_info.remote_key != NULL)
     {
@@ -37,6 +37,7 @@
 //*******************************************************************
 
 typedef struct Auth_ Auth;
+typedef struct AccessCache_ AccessCache;
 
 struct Auth_
 {
@@ -107,6 +108,7 @@ struct ServerConnectionState_
     int maproot;
     unsigned char *session_key;
     char encryption_type;
+    AccessCache *access_cache;  /* AccessControl() results for this peer */
 };
 
 typedef struct
@@ -124,6 +126,12 @@ void ServerEntryPoint(EvalContext *ctx, int sd_reply, char *ipaddr);
 void DeleteAuthList(Auth *ap);
 void PurgeOldConnections(Item **list, time_t now);
 
+bool ServerConnectionStart(ServerConnectionState *conn);
+bool ServerConnectionServe(ServerConnectionState *conn);
+bool ServerConnectionHasPending(const ServerConnectionState *conn);
+void ServerConnectionFinish(ServerConnectionState *conn);
+void DeleteConn(ServerConnectionState *conn);
+
 
 AgentConnection *ExtractCallBackChannel(ServerConnectionState *conn);
 
@@ -137,6 +145,7 @@ extern int CLOCK_DRIFT;
 extern int ACTIVE_THREADS;
 
 extern int CFD_MAXPROCESSES;
+extern int CFD_WORKER_THREADS;
 extern bool DENYBADCLOCKS;
 extern int MAXTRIES;
 extern bool LOGENCRYPT;
@@ -43,8 +43,202 @@ static const int CF_NOSIZE = -1;
 #include <net.h>                      /* SendTransaction,ReceiveTransaction */
 #include <tls_generic.h>              /* TLSSend */
 #include <rlist.h>
+#include <misc_lib.h>                  /* UnexpectedError */
+#include <map.h>
 #include <cf-serverd-enterprise-stubs.h>
 
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+#endif
+
+
+/*
+ * Admit rules indexed by path. AccessControl() finds the rules covering a
+ * file by looking up each of its parent directories, instead of walking the
+ * whole admit list, and keeps the per-rule host matching results for the
+ * lifetime of the connection.
+ */
+
+typedef struct
+{
+    Auth *auth;
+    size_t position;                 /* in SV.admit, first rule wins */
+    char *path;                      /* MapName()d rule path */
+} AdmitRule;
+
+#define ACCESS_RULE_CHECKED   0x01
+#define ACCESS_RULE_DANGLING  0x02   /* rule path does not exist */
+#define ACCESS_RULE_ALLOWED   0x04   /* host is in the rule's admit list */
+#define ACCESS_RULE_MAPROOT   0x08   /* host is in the rule's maproot list */
+
+struct AccessCache_
+{
+    unsigned long generation;
+    unsigned char *rules;            /* ACCESS_RULE_* flags per AdmitRule */
+    int denied;                      /* -1 unknown, else host in SV.deny */
+};
+
+static Map *ADMIT_INDEX = NULL;               /* rule path -> AdmitRule */
+static AdmitRule *ADMIT_RULES = NULL;
+static size_t ADMIT_RULES_COUNT = 0;
+static unsigned long ADMIT_INDEX_GENERATION = 0;
+
+void AdmitIndexBuild(void)
+{
+    MapDestroy(ADMIT_INDEX);
+    for (size_t i = 0; i < ADMIT_RULES_COUNT; i++)
+    {
+        free(ADMIT_RULES[i].path);
+    }
+    free(ADMIT_RULES);
+
+    ADMIT_RULES_COUNT = 0;
+    for (Auth *ap = SV.admit; ap != NULL; ap = ap->next)
+    {
+        ADMIT_RULES_COUNT++;
+    }
+
+    ADMIT_RULES = xcalloc(ADMIT_RULES_COUNT + 1, sizeof(AdmitRule));
+    ADMIT_INDEX = MapNew((MapHashFn) &StringHash,
+                         (MapKeyEqualFn) &StringSafeEqual, NULL, NULL);
+
+    size_t i = 0;
+    for (Auth *ap = SV.admit; ap != NULL; ap = ap->next, i++)
+    {
+        char transpath[CF_BUFSIZE];
+        strlcpy(transpath, ap->path, sizeof(transpath));
+        MapName(transpath);
+
+        ADMIT_RULES[i] = (AdmitRule) {
+            .auth = ap,
+            .position = i,
+            .path = xstrdup(transpath)
+        };
+
+        if (!MapHasKey(ADMIT_INDEX, ADMIT_RULES[i].path))
+        {
+            MapInsert(ADMIT_INDEX, ADMIT_RULES[i].path, &ADMIT_RULES[i]);
+        }
+    }
+
+    ADMIT_INDEX_GENERATION++;
+}
+
+void AccessCacheDestroy(AccessCache *cache)
+{
+    if (cache != NULL)
+    {
+        free(cache->rules);
+        free(cache);
+    }
+}
+
+static AccessCache *AccessCacheGet(ServerConnectionState *conn)
+{
+    AccessCache *cache = conn->access_cache;
+
+    if (cache == NULL)
+    {
+        cache = xcalloc(1, sizeof(AccessCache));
+        conn->access_cache = cache;
+    }
+    else if (cache->generation == ADMIT_INDEX_GENERATION)
+    {
+        return cache;
+    }
+
+    /* First use, or the policy was reloaded since. */
+    free(cache->rules);
+    cache->rules = xcalloc(ADMIT_RULES_COUNT + 1, 1);
+    cache->denied = -1;
+    cache->generation = ADMIT_INDEX_GENERATION;
+    return cache;
+}
+
+static unsigned char AdmitRuleCheck(EvalContext *ctx, ServerConnectionState *conn,
+                                    AccessCache *cache, const AdmitRule *rule)
+{
+    unsigned char flags = cache->rules[rule->position];
+    if (flags & ACCESS_RULE_CHECKED)
+    {
+        return flags;
+    }
+
+    flags = ACCESS_RULE_CHECKED;
+
+    struct stat statbuf;
+    if (stat(rule->path, &statbuf) == -1)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Warning cannot stat file object %s in admit/grant, or access list refers to dangling link",
+            rule->path);
+        flags |= ACCESS_RULE_DANGLING;
+    }
+    else
+    {
+        Auth *ap = rule->auth;
+
+        if ((IsMatchItemIn(ctx, ap->maproot, MapAddress(conn->ipaddr))) ||
+            (IsRegexItemIn(ctx, ap->maproot, conn->hostname)))
+        {
+            flags |= ACCESS_RULE_MAPROOT;
+        }
+
+        if ((IsMatchItemIn(ctx, ap->accesslist, MapAddress(conn->ipaddr)))
+            || (IsRegexItemIn(ctx, ap->accesslist, conn->hostname)))
+        {
+            flags |= ACCESS_RULE_ALLOWED;
+        }
+    }
+
+    cache->rules[rule->position] = flags;
+    return flags;
+}
+
+/**
+ * @brief Find the first rule in the admit list that covers #path: the path
+ *        itself, any of its parent directories, or "/". Rules whose path
+ *        does not exist are skipped.
+ */
+static const AdmitRule *AdmitRuleFind(EvalContext *ctx, ServerConnectionState *conn,
+                                      AccessCache *cache, char *path)
+{
+    const AdmitRule *match = NULL;
+    size_t path_len = strlen(path);
+
+    for (size_t i = 0; i <= path_len; i++)
+    {
+        const AdmitRule *rule = NULL;
+
+        if (i == path_len)
+        {
+            rule = MapGet(ADMIT_INDEX, path);
+        }
+        else if (path[i] == FILE_SEPARATOR)
+        {
+            path[i] = '\0';
+            rule = MapGet(ADMIT_INDEX, path);
+            path[i] = FILE_SEPARATOR;
+        }
+
+        if (rule != NULL &&
+            (match == NULL || rule->position < match->position) &&
+            !(AdmitRuleCheck(ctx, conn, cache, rule) & ACCESS_RULE_DANGLING))
+        {
+            match = rule;
+        }
+    }
+
+    const AdmitRule *root = MapGet(ADMIT_INDEX, "/");
+    if (root != NULL &&
+        (match == NULL || root->position < match->position) &&
+        !(AdmitRuleCheck(ctx, conn, cache, root) & ACCESS_RULE_DANGLING))
+    {
+        match = root;
+    }
+
+    return match;
+}
 
 void RefuseAccess(ServerConnectionState *conn, int size, char *errmesg)
 {
@@ -138,12 +332,10 @@ bool ResolveFilename(const char *req_path, char *res_path)
 
 int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState *conn, int encrypt)
 {
-    Auth *ap;
     int access = false;
     char transrequest[CF_BUFSIZE];
     struct stat statbuf;
     char translated_req_path[CF_BUFSIZE];
-    char transpath[CF_BUFSIZE];
 
 /*
  * /var/cfengine -> $workdir translation.
@@ -169,7 +361,7 @@ int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState
 
     Log(LOG_LEVEL_DEBUG, "AccessControl, match (%s,%s) encrypt request = %d", transrequest, conn->hostname, encrypt);
 
-    if (SV.admit == NULL)
+    if (SV.admit == NULL || ADMIT_INDEX == NULL)
     {
         Log(LOG_LEVEL_INFO, "cf-serverd access list is empty, no files are visible");
         return false;
@@ -177,83 +369,55 @@ int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState
 
     conn->maproot = false;
 
-    for (ap = SV.admit; ap != NULL; ap = ap->next)
-    {
-        int res = false;
-
-        Log(LOG_LEVEL_DEBUG, "Examining rule in access list (%s,%s)", transrequest, ap->path);
+    AccessCache *cache = AccessCacheGet(conn);
+    const AdmitRule *rule = AdmitRuleFind(ctx, conn, cache, transrequest);
 
-        strncpy(transpath, ap->path, CF_BUFSIZE - 1);
-        MapName(transpath);
-
-        if ((strlen(transrequest) > strlen(transpath)) && (strncmp(transpath, transrequest, strlen(transpath)) == 0)
-            && (transrequest[strlen(transpath)] == FILE_SEPARATOR))
-        {
-            res = true;         /* Substring means must be a / to link, else just a substring og filename */
-        }
+    if (rule != NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Found a matching rule in access list (%s in %s)", transrequest, rule->path);
 
-        /* Exact match means single file to admit */
+        unsigned char flags = AdmitRuleCheck(ctx, conn, cache, rule);
 
-        if (strcmp(transpath, transrequest) == 0)
+        if ((!encrypt) && (rule->auth->encrypt == true))
         {
-            res = true;
+            Log(LOG_LEVEL_ERR, "File %s requires encrypt connection...will not serve", rule->path);
         }
-
-        if (strcmp(transpath, "/") == 0)
-        {
-            res = true;
-        }
-
-        if (res)
+        else
         {
-            Log(LOG_LEVEL_VERBOSE, "Found a matching rule in access list (%s in %s)", transrequest, transpath);
-
-            if (stat(transpath, &statbuf) == -1)
+            if (flags & ACCESS_RULE_MAPROOT)
             {
-                Log(LOG_LEVEL_INFO,
-                      "Warning cannot stat file object %s in admit/grant, or access list refers to dangling link\n",
-                      transpath);
-                continue;
+                conn->maproot = true;
+                Log(LOG_LEVEL_VERBOSE, "Mapping root privileges to access non-root files");
             }
 
-            if ((!encrypt) && (ap->encrypt == true))
-            {
-                Log(LOG_LEVEL_ERR, "File %s requires encrypt connection...will not serve", transpath);
-                access = false;
-            }
-            else
+            if (flags & ACCESS_RULE_ALLOWED)
             {
-                Log(LOG_LEVEL_DEBUG, "Checking whether to map root privileges..");
-
-                if ((IsMatchItemIn(ctx, ap->maproot, MapAddress(conn->ipaddr))) ||
-                    (IsRegexItemIn(ctx, ap->maproot, conn->hostname)))
-                {
-                    conn->maproot = true;
-                    Log(LOG_LEVEL_VERBOSE, "Mapping root privileges to access non-root files");
-                }
-
-                if ((IsMatchItemIn(ctx, ap->accesslist, MapAddress(conn->ipaddr)))
-                    || (IsRegexItemIn(ctx, ap->accesslist, conn->hostname)))
-                {
-                    access = true;
-                    Log(LOG_LEVEL_DEBUG, "Access privileges - match found");
-                }
+                access = true;
+                Log(LOG_LEVEL_DEBUG, "Access privileges - match found");
             }
-            break;
         }
     }
 
-    if (strncmp(transpath, transrequest, strlen(transpath)) == 0)
+    if (access)
     {
-        for (ap = SV.deny; ap != NULL; ap = ap->next)
+        if (cache->denied == -1)
         {
-            if (IsRegexItemIn(ctx, ap->accesslist, conn->hostname))
+            cache->denied = false;
+            for (Auth *ap = SV.deny; ap != NULL; ap = ap->next)
             {
-                access = false;
-                Log(LOG_LEVEL_INFO, "Host %s explicitly denied access to %s", conn->hostname, transrequest);
-                break;
+                if (IsRegexItemIn(ctx, ap->accesslist, conn->hostname))
+                {
+                    cache->denied = true;
+                    break;
+                }
             }
         }
+
+        if (cache->denied)
+        {
+            access = false;
+            Log(LOG_LEVEL_INFO, "Host %s explicitly denied access to %s", conn->hostname, transrequest);
+        }
     }
 
     if (access)
@@ -991,36 +1155,127 @@ static void FailedTransfer(ConnectionInfo *connection)
     }
 }
 
+/* Check for source changes at least this often when sending big files */
+#define CF_GET_STAT_INTERVAL (1024 * 1024)
+
+static int SendFileBlock(ConnectionInfo *conn_info, char *buf, int len)
+{
+    switch (conn_info->type)
+    {
+    case CF_PROTOCOL_CLASSIC:
+        return SendSocketStream(conn_info->sd, buf, len);
+    case CF_PROTOCOL_TLS:
+        return TLSSend(conn_info->ssl, buf, len);
+    default:
+        UnexpectedError("SendFileBlock: ProtocolVersion %d!", conn_info->type);
+        return -1;
+    }
+}
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+/**
+ * Send len bytes of fd starting at offset straight from the page cache.
+ * Only possible in the classic protocol, where the stream is not encrypted.
+ * If the file has shrunk the remainder is padded with zeros, like the read()
+ * path does, so the client stays in sync with the block stream.
+ * @return 0 on success, -1 on error
+ */
+static int SendFileRangeDirect(int sd, int fd, off_t offset, off_t len)
+{
+    off_t sent = 0;
+
+    while (sent < len)
+    {
+        ssize_t ret = sendfile(sd, fd, &offset, len - sent);
+        if (ret == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (sendfile: %s)", GetErrorStr());
+            return -1;
+        }
+        if (ret == 0)
+        {
+            break;
+        }
+        sent += ret;
+    }
+
+    if (sent < len)
+    {
+        char zeros[CFNET_GET_BLOCKSIZE] = { 0 };
+        while (sent < len)
+        {
+            int chunk = MIN(len - sent, (off_t) sizeof(zeros));
+            if (SendSocketStream(sd, zeros, chunk) == -1)
+            {
+                return -1;
+            }
+            sent += chunk;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * The client reads its first block as MIN(blocksize, expected size) bytes
+ * and only then looks for CF_FAILEDSTR, so a failure reply must be exactly
+ * that long or the rest of it is left in the stream for the next file.
+ */
+static void SendFailedFileBlock(ConnectionInfo *conn_info, char *sendbuffer,
+                                int blocksize, const struct stat *sb, bool have_stat)
+{
+    int len = blocksize;
+    if (have_stat && sb->st_size < blocksize)
+    {
+        len = (int) sb->st_size;
+    }
+
+    snprintf(sendbuffer, CF_BUFSIZE, "%s", CF_FAILEDSTR);
+    if (len > 0 && SendFileBlock(conn_info, sendbuffer, len) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
+    }
+}
+
 void CfGetFile(ServerFileGetState *args)
 {
     int fd;
-    off_t n_read, total = 0, sendlen = 0, count = 0;
-    char sendbuffer[CF_BUFSIZE + 256], filename[CF_BUFSIZE];
+    off_t n_read, total = 0, sendlen = 0;
+    char filename[CF_BUFSIZE];
     struct stat sb;
-    int blocksize = 2048;
 
     ConnectionInfo *conn_info = &(args->connect)->conn_info;
 
+    /* Classic clients, and TLS clients that did not see the large_get
+     * feature, always read CFNET_GET_BLOCKSIZE blocks. */
+    int blocksize = CFNET_GET_BLOCKSIZE;
+    if (conn_info->type == CF_PROTOCOL_TLS && args->buf_size > CF_BUFSIZE)
+    {
+        blocksize = args->buf_size;
+    }
+
+    /* Allocated once per file, not zeroed per block. */
+    char *sendbuffer = xcalloc(1, MAX(blocksize, CF_BUFSIZE) + 256);
+
     TranslatePath(filename, args->replyfile);
 
-    stat(filename, &sb);
+    bool have_stat = (stat(filename, &sb) == 0);
 
-    Log(LOG_LEVEL_DEBUG, "CfGetFile('%s'), size = %" PRIdMAX, filename, (intmax_t) sb.st_size);
+    Log(LOG_LEVEL_DEBUG, "CfGetFile('%s'), size = %" PRIdMAX ", blocksize = %d",
+        filename, (intmax_t) sb.st_size, blocksize);
 
 /* Now check to see if we have remote permission */
 
     if (!TransferRights(filename, args, &sb))
     {
-        RefuseAccess(args->connect, args->buf_size, "");
-        snprintf(sendbuffer, CF_BUFSIZE, "%s", CF_FAILEDSTR);
-        if (conn_info->type == CF_PROTOCOL_CLASSIC)
-        {
-            SendSocketStream(conn_info->sd, sendbuffer, args->buf_size);
-        }
-        else if (conn_info->type == CF_PROTOCOL_TLS)
-        {
-            TLSSend(conn_info->ssl, sendbuffer, args->buf_size);
-        }
+        RefuseAccess(args->connect, MIN(args->buf_size, CF_BUFSIZE - CF_INBAND_OFFSET), "");
+        SendFailedFileBlock(conn_info, sendbuffer, blocksize, &sb, have_stat);
+        free(sendbuffer);
         return;
     }
 
@@ -1030,112 +1285,113 @@ void CfGetFile(ServerFileGetState *args)
     {
         Log(LOG_LEVEL_ERR, "Open error of file '%s'. (open: %s)",
             filename, GetErrorStr());
-        snprintf(sendbuffer, CF_BUFSIZE, "%s", CF_FAILEDSTR);
-        if (conn_info->type == CF_PROTOCOL_CLASSIC)
-        {
-            SendSocketStream(conn_info->sd, sendbuffer, args->buf_size);
-        }
-        else if (conn_info->type == CF_PROTOCOL_TLS)
-        {
-            TLSSend(conn_info->ssl, sendbuffer, args->buf_size);
-        }
+        SendFailedFileBlock(conn_info, sendbuffer, blocksize, &sb, have_stat);
     }
     else
     {
-        int div = 3;
-
-        if (sb.st_size > 10485760L) /* File larger than 10 MB, checks every 64kB */
+        /* Small files are checked every three blocks, big ones less often. */
+        off_t stat_interval = 3 * blocksize;
+        if (sb.st_size > 10485760L)
         {
-            div = 32;
+            stat_interval = MAX(stat_interval, CF_GET_STAT_INTERVAL);
         }
+        off_t next_stat = 0;
+
+#ifdef HAVE_POSIX_FADVISE
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
         while (true)
         {
-            memset(sendbuffer, 0, CF_BUFSIZE);
+            off_t savedlen = sb.st_size;
 
-            Log(LOG_LEVEL_DEBUG, "Now reading from disk...");
+            /* check the file is not changing at source */
 
-            if ((n_read = read(fd, sendbuffer, blocksize)) == -1)
+            if (total >= next_stat)   /* Don't do this too often */
             {
-                Log(LOG_LEVEL_ERR, "Read failed in GetFile. (read: %s)", GetErrorStr());
-                break;
+                if (stat(filename, &sb))
+                {
+                    Log(LOG_LEVEL_ERR, "Cannot stat file '%s'. (stat: %s)",
+                        filename, GetErrorStr());
+                    break;
+                }
+                next_stat = total + stat_interval;
             }
 
-            if (n_read == 0)
-            {
-                break;
-            }
-            else
+            if (sb.st_size != savedlen)
             {
-                off_t savedlen = sb.st_size;
+                snprintf(sendbuffer, CF_BUFSIZE, "%s%s: %s", CF_CHANGEDSTR1, CF_CHANGEDSTR2, filename);
 
-                /* check the file is not changing at source */
-
-                if (count++ % div == 0)   /* Don't do this too often */
+                if (SendFileBlock(conn_info, sendbuffer, blocksize) == -1)
                 {
-                    if (stat(filename, &sb))
-                    {
-                        Log(LOG_LEVEL_ERR, "Cannot stat file '%s'. (stat: %s)",
-                            filename, GetErrorStr());
-                        break;
-                    }
+                    Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
                 }
 
-                if (sb.st_size != savedlen)
-                {
-                    snprintf(sendbuffer, CF_BUFSIZE, "%s%s: %s", CF_CHANGEDSTR1, CF_CHANGEDSTR2, filename);
-
-                    if (conn_info->type == CF_PROTOCOL_CLASSIC)
-                    {
-                        if (SendSocketStream(conn_info->sd, sendbuffer, blocksize) == -1)
-                        {
-                            Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
-                        }
-                    }
-                    else if (conn_info->type == CF_PROTOCOL_TLS)
-                    {
-                        if (TLSSend(conn_info->ssl, sendbuffer, blocksize) == -1)
-                        {
-                            Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
-                        }
-                    }
+                Log(LOG_LEVEL_DEBUG, "Aborting transfer after %" PRIdMAX ": file is changing rapidly at source.", (intmax_t)total);
+                break;
+            }
 
-                    Log(LOG_LEVEL_DEBUG, "Aborting transfer after %" PRIdMAX ": file is changing rapidly at source.", (intmax_t)total);
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+            if (conn_info->type == CF_PROTOCOL_CLASSIC)
+            {
+                if (total >= savedlen)
+                {
                     break;
                 }
 
-                if ((savedlen - total) / blocksize > 0)
-                {
-                    sendlen = blocksize;
-                }
-                else if (savedlen != 0)
+                /* Up to the next change check; stays a multiple of blocksize
+                 * so a "changed" message lands on a block boundary. */
+                off_t chunk = MIN(savedlen - total, next_stat - total);
+                if (SendFileRangeDirect(conn_info->sd, fd, total, chunk) == -1)
                 {
-                    sendlen = (savedlen - total);
+                    break;
                 }
+                total += chunk;
+                continue;
             }
+#endif
 
-            total += n_read;
+            Log(LOG_LEVEL_DEBUG, "Now reading from disk...");
 
-            if (conn_info->type == CF_PROTOCOL_CLASSIC)
+            if ((n_read = read(fd, sendbuffer, blocksize)) == -1)
             {
-                if (SendSocketStream(conn_info->sd, sendbuffer, sendlen) == -1)
-                {
-                    Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
-                    break;
-                }
+                Log(LOG_LEVEL_ERR, "Read failed in GetFile. (read: %s)", GetErrorStr());
+                break;
             }
-            else if (conn_info->type == CF_PROTOCOL_TLS)
+
+            if (n_read == 0)
             {
-                if (TLSSend(conn_info->ssl, sendbuffer, sendlen) == -1)
-                {
-                    Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
-                    break;
-                }
+                break;
+            }
+
+            if ((savedlen - total) / blocksize > 0)
+            {
+                sendlen = blocksize;
+            }
+            else if (savedlen != 0)
+            {
+                sendlen = (savedlen - total);
+            }
+
+            if (n_read < sendlen)
+            {
+                /* Short read, the file shrank: pad the block as promised */
+                memset(sendbuffer + n_read, 0, sendlen - n_read);
+            }
+
+            total += n_read;
+
+            if (SendFileBlock(conn_info, sendbuffer, sendlen) == -1)
+            {
+                Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
+                break;
             }
         }
 
         close(fd);
     }
+
+    free(sendbuffer);
 }
 
 void CfEncryptGetFile(ServerFileGetState *args)
@@ -1267,39 +1523,35 @@ void CfEncryptGetFile(ServerFileGetState *args)
     close(fd);
 }
 
-int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
-/* Because we do not know the size or structure of remote datatypes,*/
-/* the simplest way to transfer the data is to convert them into */
-/* plain text and interpret them on the other side. */
+/**
+ * Fill cfst with the attributes of filename, already translated, for the
+ * SYNCH STAT reply. linkbuf, of CF_BUFSIZE, receives the target of a link.
+ * On failure the BAD: reply is left in sendbuffer.
+ */
+static bool StatFileAttributes(const char *filename, Stat *cfst, char *linkbuf, char *sendbuffer)
 {
-    Stat cfst;
     struct stat statbuf, statlinkbuf;
-    char linkbuf[CF_BUFSIZE], filename[CF_BUFSIZE];
     int islink = false;
 
-    TranslatePath(filename, ofilename);
-
-    memset(&cfst, 0, sizeof(Stat));
+    memset(cfst, 0, sizeof(Stat));
 
     if (strlen(ReadLastNode(filename)) > CF_MAXLINKSIZE)
     {
         snprintf(sendbuffer, CF_BUFSIZE, "BAD: Filename suspiciously long [%s]\n", filename);
         Log(LOG_LEVEL_ERR, "%s", sendbuffer);
-        SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
-        return -1;
+        return false;
     }
 
     if (lstat(filename, &statbuf) == -1)
     {
         snprintf(sendbuffer, CF_BUFSIZE, "BAD: unable to stat file %s", filename);
         Log(LOG_LEVEL_VERBOSE, "%s. (lstat: %s)", sendbuffer, GetErrorStr());
-        SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
-        return -1;
+        return false;
     }
 
-    cfst.cf_readlink = NULL;
-    cfst.cf_lmode = 0;
-    cfst.cf_nlink = CF_NOSIZE;
+    cfst->cf_readlink = NULL;
+    cfst->cf_lmode = 0;
+    cfst->cf_nlink = CF_NOSIZE;
 
     memset(linkbuf, 0, CF_BUFSIZE);
 
@@ -1307,30 +1559,29 @@ int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
     if (S_ISLNK(statbuf.st_mode))
     {
         islink = true;
-        cfst.cf_type = FILE_TYPE_LINK; /* pointless - overwritten */
-        cfst.cf_lmode = statbuf.st_mode & 07777;
-        cfst.cf_nlink = statbuf.st_nlink;
+        cfst->cf_type = FILE_TYPE_LINK; /* pointless - overwritten */
+        cfst->cf_lmode = statbuf.st_mode & 07777;
+        cfst->cf_nlink = statbuf.st_nlink;
 
         if (readlink(filename, linkbuf, CF_BUFSIZE - 1) == -1)
         {
             sprintf(sendbuffer, "BAD: unable to read link\n");
             Log(LOG_LEVEL_ERR, "%s. (readlink: %s)", sendbuffer, GetErrorStr());
-            SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
-            return -1;
+            return false;
         }
 
         Log(LOG_LEVEL_DEBUG, "readlink '%s'", linkbuf);
 
-        cfst.cf_readlink = linkbuf;
+        cfst->cf_readlink = linkbuf;
     }
 #endif /* !__MINGW32__ */
 
     if ((!islink) && (stat(filename, &statbuf) == -1))
     {
+        snprintf(sendbuffer, CF_BUFSIZE, "BAD: unable to stat file %s", filename);
         Log(LOG_LEVEL_VERBOSE, "BAD: unable to stat file '%s'. (stat: %s)",
             filename, GetErrorStr());
-        SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
-        return -1;
+        return false;
     }
 
     Log(LOG_LEVEL_DEBUG, "Getting size of link deref '%s'", linkbuf);
@@ -1347,48 +1598,48 @@ int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
 
     if (S_ISDIR(statbuf.st_mode))
     {
-        cfst.cf_type = FILE_TYPE_DIR;
+        cfst->cf_type = FILE_TYPE_DIR;
     }
 
     if (S_ISREG(statbuf.st_mode))
     {
-        cfst.cf_type = FILE_TYPE_REGULAR;
+        cfst->cf_type = FILE_TYPE_REGULAR;
     }
 
     if (S_ISSOCK(statbuf.st_mode))
     {
-        cfst.cf_type = FILE_TYPE_SOCK;
+        cfst->cf_type = FILE_TYPE_SOCK;
     }
 
     if (S_ISCHR(statbuf.st_mode))
     {
-        cfst.cf_type = FILE_TYPE_CHAR_;
+        cfst->cf_type = FILE_TYPE_CHAR_;
     }
 
     if (S_ISBLK(statbuf.st_mode))
     {
-        cfst.cf_type = FILE_TYPE_BLOCK;
+        cfst->cf_type = FILE_TYPE_BLOCK;
     }
 
     if (S_ISFIFO(statbuf.st_mode))
     {
-        cfst.cf_type = FILE_TYPE_FIFO;
+        cfst->cf_type = FILE_TYPE_FIFO;
     }
 
-    cfst.cf_mode = statbuf.st_mode & 07777;
-    cfst.cf_uid = statbuf.st_uid & 0xFFFFFFFF;
-    cfst.cf_gid = statbuf.st_gid & 0xFFFFFFFF;
-    cfst.cf_size = statbuf.st_size;
-    cfst.cf_atime = statbuf.st_atime;
-    cfst.cf_mtime = statbuf.st_mtime;
-    cfst.cf_ctime = statbuf.st_ctime;
-    cfst.cf_ino = statbuf.st_ino;
-    cfst.cf_dev = statbuf.st_dev;
-    cfst.cf_readlink = linkbuf;
+    cfst->cf_mode = statbuf.st_mode & 07777;
+    cfst->cf_uid = statbuf.st_uid & 0xFFFFFFFF;
+    cfst->cf_gid = statbuf.st_gid & 0xFFFFFFFF;
+    cfst->cf_size = statbuf.st_size;
+    cfst->cf_atime = statbuf.st_atime;
+    cfst->cf_mtime = statbuf.st_mtime;
+    cfst->cf_ctime = statbuf.st_ctime;
+    cfst->cf_ino = statbuf.st_ino;
+    cfst->cf_dev = statbuf.st_dev;
+    cfst->cf_readlink = linkbuf;
 
-    if (cfst.cf_nlink == CF_NOSIZE)
+    if (cfst->cf_nlink == CF_NOSIZE)
     {
-        cfst.cf_nlink = statbuf.st_nlink;
+        cfst->cf_nlink = statbuf.st_nlink;
     }
 
 #if !defined(__MINGW32__)
@@ -1401,26 +1652,51 @@ int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
 # endif
 #endif
     {
-        cfst.cf_makeholes = 1;  /* must have a hole to get checksum right */
+        cfst->cf_makeholes = 1;  /* must have a hole to get checksum right */
     }
     else
     {
-        cfst.cf_makeholes = 0;
+        cfst->cf_makeholes = 0;
+    }
+
+    return true;
+}
+
+/* Format cfst as the "OK: ..." line of the SYNCH STAT reply */
+static void StatFileFormat(const Stat *cfst, char *buffer, size_t size)
+{
+    Log(LOG_LEVEL_DEBUG, "OK: type = %d, mode = %" PRIoMAX ", lmode = %" PRIoMAX ", uid = %" PRIuMAX ", gid = %" PRIuMAX ", size = %" PRIdMAX ", atime=%" PRIdMAX ", mtime = %" PRIdMAX,
+            cfst->cf_type, (uintmax_t)cfst->cf_mode, (uintmax_t)cfst->cf_lmode, (intmax_t)cfst->cf_uid, (intmax_t)cfst->cf_gid, (intmax_t) cfst->cf_size,
+            (intmax_t) cfst->cf_atime, (intmax_t) cfst->cf_mtime);
+
+    snprintf(buffer, size, "OK: %d %ju %ju %ju %ju %jd %jd %jd %jd %d %d %d %jd",
+             cfst->cf_type, (uintmax_t)cfst->cf_mode, (uintmax_t)cfst->cf_lmode,
+             (uintmax_t)cfst->cf_uid, (uintmax_t)cfst->cf_gid, (intmax_t)cfst->cf_size,
+             (intmax_t) cfst->cf_atime, (intmax_t) cfst->cf_mtime, (intmax_t) cfst->cf_ctime,
+             cfst->cf_makeholes, cfst->cf_ino, cfst->cf_nlink, (intmax_t) cfst->cf_dev);
+}
+
+int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename)
+/* Because we do not know the size or structure of remote datatypes,*/
+/* the simplest way to transfer the data is to convert them into */
+/* plain text and interpret them on the other side. */
+{
+    Stat cfst;
+    char linkbuf[CF_BUFSIZE], filename[CF_BUFSIZE];
+
+    TranslatePath(filename, ofilename);
+
+    if (!StatFileAttributes(filename, &cfst, linkbuf, sendbuffer))
+    {
+        SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
+        return -1;
     }
 
     memset(sendbuffer, 0, CF_BUFSIZE);
 
     /* send as plain text */
 
-    Log(LOG_LEVEL_DEBUG, "OK: type = %d, mode = %" PRIoMAX ", lmode = %" PRIoMAX ", uid = %" PRIuMAX ", gid = %" PRIuMAX ", size = %" PRIdMAX ", atime=%" PRIdMAX ", mtime = %" PRIdMAX,
-            cfst.cf_type, (uintmax_t)cfst.cf_mode, (uintmax_t)cfst.cf_lmode, (intmax_t)cfst.cf_uid, (intmax_t)cfst.cf_gid, (intmax_t) cfst.cf_size,
-            (intmax_t) cfst.cf_atime, (intmax_t) cfst.cf_mtime);
-
-    snprintf(sendbuffer, CF_BUFSIZE, "OK: %d %ju %ju %ju %ju %jd %jd %jd %jd %d %d %d %jd",
-             cfst.cf_type, (uintmax_t)cfst.cf_mode, (uintmax_t)cfst.cf_lmode,
-             (uintmax_t)cfst.cf_uid, (uintmax_t)cfst.cf_gid, (intmax_t)cfst.cf_size,
-             (intmax_t) cfst.cf_atime, (intmax_t) cfst.cf_mtime, (intmax_t) cfst.cf_ctime,
-             cfst.cf_makeholes, cfst.cf_ino, cfst.cf_nlink, (intmax_t) cfst.cf_dev);
+    StatFileFormat(&cfst, sendbuffer, CF_BUFSIZE);
 
     SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
 
@@ -1609,6 +1885,101 @@ int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirn
 
 /**************************************************************/
 
+/**
+ * OPENDIRSTAT, like OPENDIR, but every name is followed by the two lines of
+ * the SYNCH STAT reply for it, so that the client needs no round trip per
+ * file. Entries the client may not access, or which could not be stat'ed, get
+ * a BAD: line instead; the client then asks with SYNCH STAT, which reports
+ * the error as before.
+ */
+int CfOpenDirectoryStat(EvalContext *ctx, ServerConnectionState *conn, char *sendbuffer, char *oldDirname)
+{
+    Dir *dirh;
+    const struct dirent *dirp;
+    int offset;
+    char dirname[CF_BUFSIZE];
+    char reqpath[CF_BUFSIZE], filename[CF_BUFSIZE], linkbuf[CF_BUFSIZE];
+    char attrs[CF_BUFSIZE];
+    Stat cfst;
+
+    TranslatePath(dirname, oldDirname);
+
+    if (!IsAbsoluteFileName(dirname))
+    {
+        sprintf(sendbuffer, "BAD: request to access a non-absolute filename\n");
+        SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
+        return -1;
+    }
+
+    if ((dirh = DirOpen(dirname)) == NULL)
+    {
+        Log(LOG_LEVEL_DEBUG, "Couldn't open dir '%s'", dirname);
+        snprintf(sendbuffer, CF_BUFSIZE, "BAD: cfengine, couldn't open dir %s\n", dirname);
+        SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE);
+        return -1;
+    }
+
+/* Pack name, attributes and link target of each entry for transmission */
+
+    memset(sendbuffer, 0, CF_BUFSIZE);
+
+    offset = 0;
+
+    for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
+    {
+        const char *name = dirp->d_name;
+        const char *link = "";
+
+        if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+        {
+            strcpy(attrs, "BAD: not a directory entry");
+        }
+        else if ((snprintf(reqpath, CF_BUFSIZE, "%s/%s", oldDirname, name) >= CF_BUFSIZE) ||
+                 (snprintf(filename, CF_BUFSIZE, "%s/%s", dirname, name) >= CF_BUFSIZE))
+        {
+            strcpy(attrs, "BAD: filename too long");
+        }
+        else if (!AccessControl(ctx, reqpath, conn, true))
+        {
+            strcpy(attrs, "BAD: access denied");
+        }
+        else if (StatFileAttributes(filename, &cfst, linkbuf, attrs))
+        {
+            StatFileFormat(&cfst, attrs, CF_BUFSIZE);
+            link = linkbuf;
+        }
+
+        size_t namelen = strlen(name) + 1;
+        size_t entrylen = namelen + strlen(attrs) + 1 + strlen("OK:") + strlen(link) + 1;
+
+        if (entrylen >= CF_BUFSIZE - CF_MAXLINKSIZE)
+        {
+            /* A long link target, SYNCH STAT sends it in its own transaction */
+            strcpy(attrs, "BAD: link target too long");
+            link = "";
+            entrylen = namelen + strlen(attrs) + 1 + strlen("OK:") + 1;
+        }
+
+        if (offset + entrylen >= CF_BUFSIZE - CF_MAXLINKSIZE)
+        {
+            SendTransaction(&conn->conn_info, sendbuffer, offset + 1, CF_MORE);
+            offset = 0;
+            memset(sendbuffer, 0, CF_BUFSIZE);
+        }
+
+        offset += sprintf(sendbuffer + offset, "%s", name) + 1;
+        offset += sprintf(sendbuffer + offset, "%s", attrs) + 1;
+        offset += sprintf(sendbuffer + offset, "OK:%s", link) + 1;
+    }
+
+    strcpy(sendbuffer + offset, CFD_TERMINATOR);
+    SendTransaction(&conn->conn_info, sendbuffer, offset + 2 + strlen(CFD_TERMINATOR), CF_DONE);
+    DirClose(dirh);
+    return 0;
+}
+
+/**************************************************************/
+
 int CfSecOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *dirname)
 {
     Dir *dirh;
@@ -39,6 +39,12 @@
 void RefuseAccess(ServerConnectionState *conn, int size, char *errmesg);
 int AllowedUser(char *user);
 int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState *conn, int encrypt);
+/**
+ * @brief Index SV.admit for AccessControl(), must be called whenever the
+ *        admit list changes. Per-connection caches are invalidated.
+ */
+void AdmitIndexBuild(void);
+void AccessCacheDestroy(AccessCache *cache);
 int MatchClasses(EvalContext *ctx, ServerConnectionState *conn);
 void Terminate(ConnectionInfo *connection);
 void DoExec(EvalContext *ctx, ServerConnectionState *conn, char *args);
@@ -47,6 +53,7 @@ void CfEncryptGetFile(ServerFileGetState *args);
 int StatFile(ServerConnectionState *conn, char *sendbuffer, char *ofilename);
 void ReplyServerContext(ServerConnectionState *conn, int encrypted, Item *classes);
 int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirname);
+int CfOpenDirectoryStat(EvalContext *ctx, ServerConnectionState *conn, char *sendbuffer, char *oldDirname);
 int CfSecOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *dirname);
 void GetServerLiteral(EvalContext *ctx, ServerConnectionState *conn, char *sendbuffer, char *recvbuffer, int encrypted);
 int GetServerQuery(ServerConnectionState *conn, char *recvbuffer, int encrypted);
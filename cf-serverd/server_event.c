@@ -0,0 +1,583 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <server_event.h>
+
+#include <misc_lib.h>                                     /* ProgrammingError */
+
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#define SERVER_EVENT_BATCH        64
+#define SERVER_EVENT_WAIT_MS      1000
+#define SERVER_EVENT_REAP_PERIOD  5                          /* seconds */
+#define SERVER_EVENT_STACK_SIZE   (1024 * 1024)
+
+typedef enum
+{
+    SERVER_EVENT_STATE_QUEUED,              /* waiting for a worker */
+    SERVER_EVENT_STATE_RUNNING,             /* owned by a worker */
+    SERVER_EVENT_STATE_PARKED               /* idle, armed in epoll */
+} ServerEventState;
+
+typedef struct ServerEvent_ ServerEvent;
+
+struct ServerEvent_
+{
+    ServerConnectionState *conn;
+    ServerEventState state;
+    bool established;                       /* ServerConnectionStart() done */
+    bool registered;                        /* fd has been added to epoll */
+    time_t last_active;
+    ServerEvent *queue_next;                /* ready queue */
+    ServerEvent *prev;                      /* all open connections */
+    ServerEvent *next;
+};
+
+/* Everything below is protected by LOOP.lock. */
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    bool running;
+    bool stop;
+    int epfd;
+
+    pthread_t poller;
+    pthread_t *workers;
+    size_t num_workers;
+
+    ServerEvent *queue_head;
+    ServerEvent *queue_tail;
+    ServerEvent *all;
+
+    ServerEventStats stats;
+} LOOP = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+    .epfd = -1,
+};
+
+/*********************************************************************/
+
+static void Enqueue(ServerEvent *ev)
+{
+    ev->state = SERVER_EVENT_STATE_QUEUED;
+    ev->queue_next = NULL;
+
+    if (LOOP.queue_tail != NULL)
+    {
+        LOOP.queue_tail->queue_next = ev;
+    }
+    else
+    {
+        LOOP.queue_head = ev;
+    }
+    LOOP.queue_tail = ev;
+
+    LOOP.stats.queue_depth++;
+    if (LOOP.stats.queue_depth > LOOP.stats.peak_queue_depth)
+    {
+        LOOP.stats.peak_queue_depth = LOOP.stats.queue_depth;
+    }
+
+    pthread_cond_signal(&LOOP.ready);
+}
+
+static ServerEvent *Dequeue(void)
+{
+    ServerEvent *ev = LOOP.queue_head;
+    if (ev != NULL)
+    {
+        LOOP.queue_head = ev->queue_next;
+        if (LOOP.queue_head == NULL)
+        {
+            LOOP.queue_tail = NULL;
+        }
+        ev->queue_next = NULL;
+        LOOP.stats.queue_depth--;
+    }
+    return ev;
+}
+
+static void Register(ServerEvent *ev)
+{
+    ev->prev = NULL;
+    ev->next = LOOP.all;
+    if (LOOP.all != NULL)
+    {
+        LOOP.all->prev = ev;
+    }
+    LOOP.all = ev;
+
+    LOOP.stats.connections++;
+    LOOP.stats.accepted++;
+    if (LOOP.stats.connections > LOOP.stats.peak_connections)
+    {
+        LOOP.stats.peak_connections = LOOP.stats.connections;
+    }
+}
+
+static void Unregister(ServerEvent *ev)
+{
+    if (ev->prev != NULL)
+    {
+        ev->prev->next = ev->next;
+    }
+    else
+    {
+        LOOP.all = ev->next;
+    }
+    if (ev->next != NULL)
+    {
+        ev->next->prev = ev->prev;
+    }
+    ev->prev = ev->next = NULL;
+
+    LOOP.stats.connections--;
+}
+
+/**
+ * @brief Wait in epoll for the next request on this connection. Must be
+ *        called with LOOP.lock held, so that the poller cannot reap the
+ *        connection before it is armed.
+ */
+static bool Park(ServerEvent *ev)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLONESHOT,
+        .data.ptr = ev,
+    };
+    int op = ev->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    ev->state = SERVER_EVENT_STATE_PARKED;
+    ev->last_active = time(NULL);
+
+    if (epoll_ctl(LOOP.epfd, op, ev->conn->conn_info.sd, &event) == -1)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Could not watch connection from '%s' for requests (epoll_ctl: %s)",
+            ev->conn->ipaddr, GetErrorStr());
+        ev->state = SERVER_EVENT_STATE_RUNNING;
+        return false;
+    }
+
+    ev->registered = true;
+    LOOP.stats.parked++;
+    return true;
+}
+
+/*********************************************************************/
+
+static void *ServerEventWorker(ARG_UNUSED void *arg)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&LOOP.lock);
+        while (LOOP.queue_head == NULL && !LOOP.stop)
+        {
+            pthread_cond_wait(&LOOP.ready, &LOOP.lock);
+        }
+        if (LOOP.stop)
+        {
+            pthread_mutex_unlock(&LOOP.lock);
+            break;
+        }
+
+        ServerEvent *ev = Dequeue();
+        bool is_new = !ev->established;
+        ev->state = SERVER_EVENT_STATE_RUNNING;
+        LOOP.stats.busy_workers++;
+        pthread_mutex_unlock(&LOOP.lock);
+
+        bool keep;
+        if (is_new)
+        {
+            /* ServerConnectionStart() frees the connection on failure. */
+            keep = ServerConnectionStart(ev->conn);
+            if (!keep)
+            {
+                ev->conn = NULL;
+            }
+        }
+        else
+        {
+            keep = ServerConnectionServe(ev->conn);
+        }
+
+        pthread_mutex_lock(&LOOP.lock);
+        LOOP.stats.busy_workers--;
+        if (is_new)
+        {
+            ev->established = keep;
+        }
+        else if (keep)
+        {
+            LOOP.stats.requests++;
+        }
+
+        if (keep && !LOOP.stop)
+        {
+            if (ServerConnectionHasPending(ev->conn))
+            {
+                /* Already decrypted data will never wake up epoll. */
+                ev->last_active = time(NULL);
+                Enqueue(ev);
+                pthread_mutex_unlock(&LOOP.lock);
+                continue;
+            }
+            if (Park(ev))
+            {
+                pthread_mutex_unlock(&LOOP.lock);
+                continue;
+            }
+        }
+        else if (keep)
+        {
+            /* Shutting down; ServerEventLoopStop() closes it. */
+            pthread_mutex_unlock(&LOOP.lock);
+            continue;
+        }
+
+        Unregister(ev);
+        pthread_mutex_unlock(&LOOP.lock);
+
+        if (ev->conn != NULL)
+        {
+            ServerConnectionFinish(ev->conn);
+        }
+        free(ev);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Close connections that stayed idle longer than a blocking thread
+ *        would have waited in recv(). Called with LOOP.lock held; the
+ *        reaped connections are returned for closing outside of the lock.
+ */
+static ServerEvent *ReapIdle(time_t now)
+{
+    ServerEvent *reaped = NULL;
+    ServerEvent *next;
+
+    for (ServerEvent *ev = LOOP.all; ev != NULL; ev = next)
+    {
+        next = ev->next;
+
+        if (ev->state == SERVER_EVENT_STATE_PARKED &&
+            now - ev->last_active > CONNTIMEOUT * 20)
+        {
+            struct epoll_event unused = { 0 };
+            epoll_ctl(LOOP.epfd, EPOLL_CTL_DEL, ev->conn->conn_info.sd, &unused);
+            LOOP.stats.parked--;
+            LOOP.stats.idle_timeouts++;
+            Unregister(ev);
+            ev->queue_next = reaped;
+            reaped = ev;
+        }
+    }
+
+    return reaped;
+}
+
+static void *ServerEventPoller(ARG_UNUSED void *arg)
+{
+    struct epoll_event events[SERVER_EVENT_BATCH];
+    time_t last_reap = time(NULL);
+
+    for (;;)
+    {
+        int n = epoll_wait(LOOP.epfd, events, SERVER_EVENT_BATCH,
+                           SERVER_EVENT_WAIT_MS);
+        if (n == -1 && errno != EINTR)
+        {
+            Log(LOG_LEVEL_ERR, "Waiting for connection events failed (epoll_wait: %s)",
+                GetErrorStr());
+            sleep(1);
+        }
+
+        time_t now = time(NULL);
+        ServerEvent *reaped = NULL;
+
+        pthread_mutex_lock(&LOOP.lock);
+        if (LOOP.stop)
+        {
+            pthread_mutex_unlock(&LOOP.lock);
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            ServerEvent *ev = events[i].data.ptr;
+            if (ev->state == SERVER_EVENT_STATE_PARKED)
+            {
+                LOOP.stats.parked--;
+                Enqueue(ev);
+            }
+        }
+
+        if (now - last_reap >= SERVER_EVENT_REAP_PERIOD)
+        {
+            reaped = ReapIdle(now);
+            last_reap = now;
+        }
+        pthread_mutex_unlock(&LOOP.lock);
+
+        while (reaped != NULL)
+        {
+            ServerEvent *ev = reaped;
+            reaped = ev->queue_next;
+
+            Log(LOG_LEVEL_VERBOSE, "Closing idle connection from '%s'",
+                ev->conn->ipaddr);
+            ServerConnectionFinish(ev->conn);
+            free(ev);
+        }
+    }
+
+    return NULL;
+}
+
+/*********************************************************************/
+
+static bool SpawnThread(pthread_t *tid, void *(*fn)(void *))
+{
+    pthread_attr_t attrs;
+
+    int ret = pthread_attr_init(&attrs);
+    if (ret != 0)
+    {
+        errno = ret;
+        Log(LOG_LEVEL_ERR, "Unable to initialize thread attributes (%s)",
+            GetErrorStr());
+        return false;
+    }
+
+    ret = pthread_attr_setstacksize(&attrs, SERVER_EVENT_STACK_SIZE);
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_WARNING, "Unable to set thread stack size (%s)",
+            GetErrorStr());
+        /* Continue with default thread stack size. */
+    }
+
+    ret = pthread_create(tid, &attrs, fn, NULL);
+    pthread_attr_destroy(&attrs);
+
+    if (ret != 0)
+    {
+        errno = ret;
+        Log(LOG_LEVEL_ERR, "Unable to spawn worker thread (pthread_create: %s)",
+            GetErrorStr());
+        return false;
+    }
+
+    return true;
+}
+
+bool ServerEventLoopStart(size_t workers)
+{
+    assert(workers > 0);
+
+    if (LOOP.running)
+    {
+        return true;
+    }
+
+    LOOP.epfd = epoll_create(SERVER_EVENT_BATCH);
+    if (LOOP.epfd == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to create event loop (epoll_create: %s)",
+            GetErrorStr());
+        return false;
+    }
+    fcntl(LOOP.epfd, F_SETFD, FD_CLOEXEC);
+
+    LOOP.stop = false;
+    LOOP.stats = (ServerEventStats) { 0 };
+    LOOP.workers = xcalloc(workers, sizeof(*LOOP.workers));
+    LOOP.num_workers = 0;
+
+    if (!SpawnThread(&LOOP.poller, ServerEventPoller))
+    {
+        goto fail;
+    }
+
+    for (size_t i = 0; i < workers; i++)
+    {
+        if (!SpawnThread(&LOOP.workers[i], ServerEventWorker))
+        {
+            if (LOOP.num_workers == 0)
+            {
+                pthread_mutex_lock(&LOOP.lock);
+                LOOP.stop = true;
+                pthread_mutex_unlock(&LOOP.lock);
+                pthread_join(LOOP.poller, NULL);
+                goto fail;
+            }
+            Log(LOG_LEVEL_WARNING, "Continuing with %zu worker threads",
+                LOOP.num_workers);
+            break;
+        }
+        LOOP.num_workers++;
+    }
+
+    LOOP.stats.workers = LOOP.num_workers;
+    LOOP.running = true;
+
+    Log(LOG_LEVEL_VERBOSE, "Serving connections from %zu worker threads",
+        LOOP.num_workers);
+    return true;
+
+  fail:
+    free(LOOP.workers);
+    LOOP.workers = NULL;
+    close(LOOP.epfd);
+    LOOP.epfd = -1;
+    return false;
+}
+
+void ServerEventLoopStop(void)
+{
+    if (!LOOP.running)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&LOOP.lock);
+    LOOP.stop = true;
+    pthread_cond_broadcast(&LOOP.ready);
+    pthread_mutex_unlock(&LOOP.lock);
+
+    pthread_join(LOOP.poller, NULL);
+    for (size_t i = 0; i < LOOP.num_workers; i++)
+    {
+        pthread_join(LOOP.workers[i], NULL);
+    }
+
+    /* No thread touches the connections anymore. */
+    ServerEvent *next;
+    for (ServerEvent *ev = LOOP.all; ev != NULL; ev = next)
+    {
+        next = ev->next;
+        if (ev->established)
+        {
+            ServerConnectionFinish(ev->conn);
+        }
+        else
+        {
+            /* Never admitted, so not counted in ACTIVE_THREADS. */
+            DeleteConn(ev->conn);
+        }
+        free(ev);
+    }
+
+    LOOP.all = NULL;
+    LOOP.queue_head = LOOP.queue_tail = NULL;
+    free(LOOP.workers);
+    LOOP.workers = NULL;
+    LOOP.num_workers = 0;
+    close(LOOP.epfd);
+    LOOP.epfd = -1;
+    LOOP.running = false;
+}
+
+bool ServerEventLoopRunning(void)
+{
+    return LOOP.running;
+}
+
+void ServerEventLoopAdd(ServerConnectionState *conn)
+{
+    ServerEvent *ev = xcalloc(1, sizeof(*ev));
+    ev->conn = conn;
+
+    pthread_mutex_lock(&LOOP.lock);
+    Register(ev);
+    Enqueue(ev);
+    pthread_mutex_unlock(&LOOP.lock);
+}
+
+void ServerEventLoopGetStats(ServerEventStats *stats)
+{
+    pthread_mutex_lock(&LOOP.lock);
+    *stats = LOOP.stats;
+    pthread_mutex_unlock(&LOOP.lock);
+}
+
+#else /* !HAVE_SYS_EPOLL_H */
+
+bool ServerEventLoopStart(ARG_UNUSED size_t workers)
+{
+    Log(LOG_LEVEL_WARNING,
+        "Event-driven connection handling is not supported on this platform, "
+        "spawning one thread per connection");
+    return false;
+}
+
+void ServerEventLoopStop(void)
+{
+}
+
+bool ServerEventLoopRunning(void)
+{
+    return false;
+}
+
+void ServerEventLoopAdd(ARG_UNUSED ServerConnectionState *conn)
+{
+    ProgrammingError("ServerEventLoopAdd: event loop not available");
+}
+
+void ServerEventLoopGetStats(ServerEventStats *stats)
+{
+    *stats = (ServerEventStats) { 0 };
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+void ServerEventLoopLogStats(LogLevel level)
+{
+    if (!ServerEventLoopRunning())
+    {
+        return;
+    }
+
+    ServerEventStats stats;
+    ServerEventLoopGetStats(&stats);
+
+    Log(level, "Connections: %zu open (peak %zu, %zu idle), "
+        "queue depth %zu (peak %zu), %zu/%zu workers busy, "
+        "%llu accepted, %llu requests, %llu idle timeouts",
+        stats.connections, stats.peak_connections, stats.parked,
+        stats.queue_depth, stats.peak_queue_depth,
+        stats.busy_workers, stats.workers,
+        stats.accepted, stats.requests, stats.idle_timeouts);
+}
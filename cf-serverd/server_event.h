@@ -0,0 +1,73 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_SERVER_EVENT_H
+#define CFENGINE_SERVER_EVENT_H
+
+
+#include <platform.h>
+
+#include <server.h>                                /* ServerConnectionState */
+
+
+/**
+ * Event-driven connection handling: a fixed pool of worker threads serves
+ * all connections. Between requests a connection is parked in an epoll set
+ * instead of holding a thread, so the number of concurrent connections is
+ * bounded by maxconnections rather than by thread stacks.
+ *
+ * Only available where epoll exists; elsewhere ServerEventLoopStart() fails
+ * and cf-serverd keeps spawning one thread per connection.
+ */
+
+typedef struct
+{
+    size_t connections;         /* currently open connections */
+    size_t peak_connections;
+    size_t parked;              /* idle connections waiting in epoll */
+    size_t queue_depth;         /* ready connections waiting for a worker */
+    size_t peak_queue_depth;
+    size_t workers;
+    size_t busy_workers;
+    unsigned long long accepted;
+    unsigned long long requests;
+    unsigned long long idle_timeouts;
+} ServerEventStats;
+
+bool ServerEventLoopStart(size_t workers);
+void ServerEventLoopStop(void);
+bool ServerEventLoopRunning(void);
+
+/**
+ * @brief Hand a newly accepted connection over to the worker pool, which
+ *        takes ownership of it.
+ */
+void ServerEventLoopAdd(ServerConnectionState *conn);
+
+void ServerEventLoopGetStats(ServerEventStats *stats);
+void ServerEventLoopLogStats(LogLevel level);
+
+
+#endif
@@ -25,6 +25,7 @@
 #include <server_transform.h>
 
 #include <server.h>
+#include <server_common.h>                                 /* AdmitIndexBuild */
 
 #include <misc_lib.h>
 #include <env_context.h>
@@ -86,6 +87,7 @@ typedef enum
     SERVER_CONTROL_TRUST_KEYS_FROM,
     SERVER_CONTROL_LISTEN,
     SERVER_CONTROL_ALLOWCIPHERS,
+    SERVER_CONTROL_WORKER_THREADS,
     SERVER_CONTROL_NONE
 } ServerControl;
 
@@ -108,6 +110,7 @@ extern bool SERVER_LISTEN;
 /*******************************************************************/
 
 extern int CFD_MAXPROCESSES;
+extern int CFD_WORKER_THREADS;
 extern int NO_FORK;
 extern bool DENYBADCLOCKS;
 extern int MAXTRIES;
@@ -130,6 +133,7 @@ void KeepPromises(EvalContext *ctx, Policy *policy, GenericAgentConfig *config)
     KeepContextBundles(ctx, policy);
     KeepControlPromises(ctx, policy, config);
     KeepPromiseBundles(ctx, policy);
+    AdmitIndexBuild();
 }
 
 /*******************************************************************/
@@ -251,6 +255,7 @@ static void KeepControlPromises(EvalContext *ctx, Policy *policy, GenericAgentCo
     Rval retval;
 
     CFD_MAXPROCESSES = 30;
+    CFD_WORKER_THREADS = 0;
     MAXTRIES = 5;
     DENYBADCLOCKS = true;
     CFRUNCOMMAND[0] = '\0';
@@ -322,6 +327,13 @@ static void KeepControlPromises(EvalContext *ctx, Policy *policy, GenericAgentCo
                 continue;
             }
 
+            if (strcmp(cp->lval, CFS_CONTROLBODY[SERVER_CONTROL_WORKER_THREADS].lval) == 0)
+            {
+                CFD_WORKER_THREADS = (int) IntFromString(retval.item);
+                Log(LOG_LEVEL_VERBOSE, "Setting workerthreads to %d", CFD_WORKER_THREADS);
+                continue;
+            }
+
             if (strcmp(cp->lval, CFS_CONTROLBODY[SERVER_CONTROL_CALL_COLLECT_INTERVAL].lval) == 0)
             {
                 COLLECT_INTERVAL = (int) 60 * IntFromString(retval.item);
@@ -87,6 +87,14 @@ bool ServerTLSInitialize()
      * always either write the whole amount or fail. */
     SSL_CTX_set_mode(SSLSERVERCONTEXT, SSL_MODE_AUTO_RETRY);
 
+    /* Let returning clients resume their previous session instead of doing
+     * a full handshake. The peer's certificate is kept with the session, so
+     * TLSVerifyPeer() checks the key the same way on resumed sessions. */
+    SSL_CTX_set_session_cache_mode(SSLSERVERCONTEXT, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(SSLSERVERCONTEXT,
+                                   (const unsigned char *) "cf-serverd",
+                                   strlen("cf-serverd"));
+
     /*
      * Create cert into memory and load it into SSL context.
      */
@@ -172,6 +180,30 @@ bool ServerTLSInitialize()
     return false;
 }
 
+void ServerTLSLogStats(LogLevel level)
+{
+    if (SSLSERVERCONTEXT == NULL)
+    {
+        return;
+    }
+
+    long handshakes = SSL_CTX_sess_accept_good(SSLSERVERCONTEXT);
+    long resumed = SSL_CTX_sess_hits(SSLSERVERCONTEXT);
+
+    PublicKeyCacheStats keys;
+    PublicKeyCacheGetStats(&keys);
+    unsigned long long lookups = keys.hits + keys.misses;
+
+    Log(level, "TLS: %ld handshakes, %ld resumed (%.1f%%), "
+        "%ld sessions cached; public key cache: %zu keys, "
+        "%llu/%llu hits (%.1f%%)",
+        handshakes, resumed,
+        handshakes > 0 ? 100.0 * resumed / handshakes : 0.0,
+        SSL_CTX_sess_number(SSLSERVERCONTEXT),
+        keys.entries, keys.hits, lookups,
+        lookups > 0 ? 100.0 * keys.hits / lookups : 0.0);
+}
+
 /**
  * @brief Set the connection type to CLASSIC or TLS.
 
@@ -241,8 +273,10 @@ int ServerNegotiateProtocol(const ConnectionInfo *conn_info)
     /* Send "CFE_v%d cf-serverd version". */
     char version_string[CF_MAXVARSIZE];
     int len = snprintf(version_string, sizeof(version_string),
-                       "CFE_v%d cf-serverd %s\n",
-                       SERVER_PROTOCOL_VERSION, VERSION);
+                       "CFE_v%d cf-serverd %s %s %s\n",
+                       SERVER_PROTOCOL_VERSION, VERSION,
+                       CFNET_FEATURE_LARGE_GET_STR,
+                       CFNET_FEATURE_OPENDIR_STAT_STR);
 
     ret = TLSSend(conn_info->ssl, version_string, len);
     if (ret != len)
@@ -409,7 +443,8 @@ int ServerTLSSessionEstablish(ServerConnectionState *conn)
     Log(LOG_LEVEL_VERBOSE, "TLS cipher negotiated: %s, %s",
         SSL_get_cipher_name(conn->conn_info.ssl),
         SSL_get_cipher_version(conn->conn_info.ssl));
-    Log(LOG_LEVEL_VERBOSE, "TLS session established, checking trust...");
+    Log(LOG_LEVEL_VERBOSE, "TLS session %s, checking trust...",
+        SSL_session_reused(conn->conn_info.ssl) ? "resumed" : "established");
 
     /* Send/Receive "CFE_v%d" version string and agree on version. */
     ret = ServerNegotiateProtocol(&conn->conn_info);
@@ -492,6 +527,7 @@ typedef enum
     PROTOCOL_COMMAND_EXEC = 0,
     PROTOCOL_COMMAND_GET,
     PROTOCOL_COMMAND_OPENDIR,
+    PROTOCOL_COMMAND_OPENDIR_STAT,
     PROTOCOL_COMMAND_SYNC,
     PROTOCOL_COMMAND_MD5,
     PROTOCOL_COMMAND_VERSION,
@@ -507,6 +543,7 @@ static const char *PROTOCOL_NEW[PROTOCOL_COMMAND_BAD + 1] =
     "EXEC",
     "GET",
     "OPENDIR",
+    "OPENDIRSTAT",
     "SYNCH",
     "MD5",
     "VERSION",
@@ -633,7 +670,8 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
         memset(filename, 0, CF_BUFSIZE);
         sscanf(recvbuffer, "GET %d %[^\n]", &(get_args.buf_size), filename);
 
-        if ((get_args.buf_size < 0) || (get_args.buf_size > CF_BUFSIZE))
+        /* Clients that saw the large_get feature may ask for big blocks */
+        if ((get_args.buf_size < 0) || (get_args.buf_size > CFNET_GET_BLOCKSIZE_MAX))
         {
             Log(LOG_LEVEL_INFO, "GET buffer out of bounds");
             RefuseAccess(conn, 0, recvbuffer);
@@ -656,9 +694,9 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
 
         memset(sendbuffer, 0, CF_BUFSIZE);
 
-        if (get_args.buf_size >= CF_BUFSIZE)
+        if (get_args.buf_size == CF_BUFSIZE)
         {
-            get_args.buf_size = 2048;
+            get_args.buf_size = CFNET_GET_BLOCKSIZE;
         }
 
         get_args.connect = conn;
@@ -692,6 +730,52 @@ bool BusyWithNewProtocol(EvalContext *ctx, ServerConnectionState *conn)
         CfOpenDirectory(conn, sendbuffer, filename);
         return true;
 
+    case PROTOCOL_COMMAND_OPENDIR_STAT:
+
+        memset(filename, 0, CF_BUFSIZE);
+        sscanf(recvbuffer, "OPENDIRSTAT %ld %[^\n]", &time_no_see, filename);
+
+        if (!conn->id_verified)
+        {
+            Log(LOG_LEVEL_INFO, "ID not verified");
+            RefuseAccess(conn, 0, recvbuffer);
+            return false;
+        }
+
+        if ((time_no_see == 0) || (filename[0] == '\0'))
+        {
+            break;
+        }
+
+        if (!AccessControl(ctx, filename, conn, true))
+        {
+            Log(LOG_LEVEL_INFO, "DIR access error");
+            RefuseAccess(conn, 0, recvbuffer);
+            return false;
+        }
+
+        /* The attributes are subject to the same clock check as SYNCH */
+        if ((tloc = time((time_t *) NULL)) == -1)
+        {
+            Log(LOG_LEVEL_INFO, "Couldn't read system clock. (time: %s)", GetErrorStr());
+            SendTransaction(&conn->conn_info, "BAD: clocks out of synch", 0, CF_DONE);
+            return true;
+        }
+
+        trem = (time_t) time_no_see;
+        drift = (int) (tloc - trem);
+
+        if (DENYBADCLOCKS && (drift * drift > CLOCK_DRIFT * CLOCK_DRIFT))
+        {
+            snprintf(conn->output, CF_BUFSIZE - 1, "BAD: Clocks are too far unsynchronized %ld/%ld\n", (long) tloc,
+                     (long) trem);
+            SendTransaction(&conn->conn_info, conn->output, 0, CF_DONE);
+            return true;
+        }
+
+        CfOpenDirectoryStat(ctx, conn, sendbuffer, filename);
+        return true;
+
     case PROTOCOL_COMMAND_SYNC:
 
         if (!conn->id_verified)
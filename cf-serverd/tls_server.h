@@ -39,6 +39,11 @@
 
 
 bool ServerTLSInitialize();
+/**
+ * @brief Log handshake and session resumption counts, and the hit rate of
+ *        the trusted public key cache.
+ */
+void ServerTLSLogStats(LogLevel level);
 int ServerTLSPeek(ConnectionInfo *conn_info);
 int ServerNegotiateProtocol(const ConnectionInfo *conn_info);
 int ServerIdentifyClient(const ConnectionInfo *conn_info,
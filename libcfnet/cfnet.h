@@ -29,6 +29,7 @@
 
 #include <platform.h>
 #include <openssl/ssl.h>
+#include <map.h>
 
 
 /* ************************************************ */
@@ -55,6 +56,23 @@
 /* The only protocol we support inside TLS, for now... */
 #define CFNET_PROTOCOL_VERSION 1
 
+/*
+ * Optional features of the TLS protocol. cf-serverd lists the names of the
+ * features it supports after its version in the "CFE_v%d cf-serverd VERSION"
+ * greeting; older clients ignore anything after the version.
+ */
+#define CFNET_FEATURE_LARGE_GET_STR "large_get"
+#define CFNET_FEATURE_LARGE_GET     (1 << 0)
+#define CFNET_FEATURE_OPENDIR_STAT_STR "opendir_stat"
+#define CFNET_FEATURE_OPENDIR_STAT     (1 << 1)
+
+/* Block size of the GET file transfer in the classic protocol */
+#define CFNET_GET_BLOCKSIZE        2048
+/* Block size requested by clients when the server supports large_get */
+#define CFNET_GET_BLOCKSIZE_LARGE  (256 * 1024)
+/* Largest block size a server accepts in a large_get GET request */
+#define CFNET_GET_BLOCKSIZE_MAX    (1024 * 1024)
+
 
 /* TODO Shouldn't this be in libutils? */
 typedef enum
@@ -113,6 +131,7 @@ typedef enum
 typedef struct
 {
     ProtocolVersion type;
+    int features;                     /* CFNET_FEATURE_* supported by peer */
     int sd;                           /* Socket descriptor */
     SSL *ssl;                         /* OpenSSL struct for TLS connections */
     RSA *remote_key;
@@ -135,6 +154,7 @@ typedef struct
     short error;
     char *this_server;
     Stat *cache;             /* Cache for network connection (SYNCH result) */
+    Map *cache_index;        /* cf_filename -> newest Stat in cache */
 } AgentConnection;
 
 
@@ -239,7 +239,7 @@ int TLSConnect(ConnectionInfo *conn_info, bool trust_server,
 {
     int ret;
 
-    ret = TLSTry(conn_info);
+    ret = TLSTry(conn_info, ipaddr);
     if (ret == -1)
     {
         return -1;
@@ -252,6 +252,7 @@ int TLSConnect(ConnectionInfo *conn_info, bool trust_server,
 
     if (ret == -1)                                      /* error */
     {
+        TLSClientSessionForget(ipaddr);
         return -1;
     }
 
@@ -279,6 +280,7 @@ int TLSConnect(ConnectionInfo *conn_info, bool trust_server,
         {
             Log(LOG_LEVEL_ERR, "TRUST FAILED, WARNING: possible MAN IN THE MIDDLE attack!");
             Log(LOG_LEVEL_ERR, "Rebootstrap the client if you really want to start trusting this new key.");
+            TLSClientSessionForget(ipaddr);
             return -1;
         }
     }
@@ -307,6 +309,9 @@ int TLSConnect(ConnectionInfo *conn_info, bool trust_server,
         return 0;
     }
 
+    /* Only resume sessions that led to a trusted, identified connection. */
+    TLSClientSessionSave(conn_info, ipaddr);
+
     return 1;
 }
 
@@ -445,6 +450,86 @@ void DisconnectServer(AgentConnection *conn)
 
 /*********************************************************************/
 
+/**
+ * Parse the "OK: type mode lmode ..." reply to SYNCH STAT, which is also the
+ * per-entry attribute line of OPENDIRSTAT, into cfst. The file type bits are
+ * added to the modes as the local stat() would set them.
+ */
+static bool ParseStatReply(const char *reply, Stat *cfst, const AgentConnection *conn)
+{
+    /* Use %?d here to avoid memory overflow attacks */
+    // use intmax_t here to provide enough space for large values coming over the protocol
+    intmax_t d1, d2, d3, d4, d5, d6, d7, d8, d9, d10, d11, d12 = 0, d13 = 0;
+    int ret = sscanf(reply, "OK: "
+           "%1" PRIdMAX     // 01 cfst.cf_type
+           " %5" PRIdMAX    // 02 cfst.cf_mode
+           " %14" PRIdMAX   // 03 cfst.cf_lmode
+           " %14" PRIdMAX   // 04 cfst.cf_uid
+           " %14" PRIdMAX   // 05 cfst.cf_gid
+           " %18" PRIdMAX   // 06 cfst.cf_size
+           " %14" PRIdMAX   // 07 cfst.cf_atime
+           " %14" PRIdMAX   // 08 cfst.cf_mtime
+           " %14" PRIdMAX   // 09 cfst.cf_ctime
+           " %1" PRIdMAX    // 10 cfst.cf_makeholes
+           " %14" PRIdMAX   // 11 cfst.cf_ino
+           " %14" PRIdMAX   // 12 cfst.cf_nlink
+           " %18" PRIdMAX,  // 13 cfst.cf_dev
+           &d1, &d2, &d3, &d4, &d5, &d6, &d7, &d8, &d9, &d10, &d11, &d12, &d13);
+
+    if (ret < 13)
+    {
+        Log(LOG_LEVEL_ERR, "Cannot read SYNCH reply from '%s', only %d/13 items parsed", conn->remoteip, ret );
+        return false;
+    }
+
+    memset(cfst, 0, sizeof(*cfst));
+    cfst->cf_type = (FileType) d1;
+    cfst->cf_mode = (mode_t) d2;
+    cfst->cf_lmode = (mode_t) d3;
+    cfst->cf_uid = (uid_t) d4;
+    cfst->cf_gid = (gid_t) d5;
+    cfst->cf_size = (off_t) d6;
+    cfst->cf_atime = (time_t) d7;
+    cfst->cf_mtime = (time_t) d8;
+    cfst->cf_ctime = (time_t) d9;
+    cfst->cf_makeholes = (char) d10;
+    cfst->cf_ino = d11;
+    cfst->cf_nlink = d12;
+    cfst->cf_dev = (dev_t)d13;
+
+    switch (cfst->cf_type)
+    {
+    case FILE_TYPE_REGULAR:
+        cfst->cf_mode |= (mode_t) S_IFREG;
+        break;
+    case FILE_TYPE_DIR:
+        cfst->cf_mode |= (mode_t) S_IFDIR;
+        break;
+    case FILE_TYPE_CHAR_:
+        cfst->cf_mode |= (mode_t) S_IFCHR;
+        break;
+    case FILE_TYPE_FIFO:
+        cfst->cf_mode |= (mode_t) S_IFIFO;
+        break;
+    case FILE_TYPE_SOCK:
+        cfst->cf_mode |= (mode_t) S_IFSOCK;
+        break;
+    case FILE_TYPE_BLOCK:
+        cfst->cf_mode |= (mode_t) S_IFBLK;
+        break;
+    case FILE_TYPE_LINK:
+        cfst->cf_mode |= (mode_t) S_IFLNK;
+        break;
+    }
+
+    if (cfst->cf_lmode != 0)
+    {
+        cfst->cf_lmode |= (mode_t) S_IFLNK;
+    }
+
+    return true;
+}
+
 int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, AgentConnection *conn)
 /* If a link, this reads readlink and sends it back in the same
    package. It then caches the value for each copy command */
@@ -530,46 +615,11 @@ int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, A
     {
         Stat cfst;
 
-        // use intmax_t here to provide enough space for large values coming over the protocol
-        intmax_t d1, d2, d3, d4, d5, d6, d7, d8, d9, d10, d11, d12 = 0, d13 = 0;
-        ret = sscanf(recvbuffer, "OK: "
-               "%1" PRIdMAX     // 01 cfst.cf_type
-               " %5" PRIdMAX    // 02 cfst.cf_mode
-               " %14" PRIdMAX   // 03 cfst.cf_lmode
-               " %14" PRIdMAX   // 04 cfst.cf_uid
-               " %14" PRIdMAX   // 05 cfst.cf_gid
-               " %18" PRIdMAX   // 06 cfst.cf_size
-               " %14" PRIdMAX   // 07 cfst.cf_atime
-               " %14" PRIdMAX   // 08 cfst.cf_mtime
-               " %14" PRIdMAX   // 09 cfst.cf_ctime
-               " %1" PRIdMAX    // 10 cfst.cf_makeholes
-               " %14" PRIdMAX   // 11 cfst.cf_ino
-               " %14" PRIdMAX   // 12 cfst.cf_nlink
-               " %18" PRIdMAX,  // 13 cfst.cf_dev
-               &d1, &d2, &d3, &d4, &d5, &d6, &d7, &d8, &d9, &d10, &d11, &d12, &d13);
-
-        if (ret < 13)
-        {
-            Log(LOG_LEVEL_ERR, "Cannot read SYNCH reply from '%s', only %d/13 items parsed", conn->remoteip, ret );
+        if (!ParseStatReply(recvbuffer, &cfst, conn))
+        {
             return -1;
         }
 
-        cfst.cf_type = (FileType) d1;
-        cfst.cf_mode = (mode_t) d2;
-        cfst.cf_lmode = (mode_t) d3;
-        cfst.cf_uid = (uid_t) d4;
-        cfst.cf_gid = (gid_t) d5;
-        cfst.cf_size = (off_t) d6;
-        cfst.cf_atime = (time_t) d7;
-        cfst.cf_mtime = (time_t) d8;
-        cfst.cf_ctime = (time_t) d9;
-        cfst.cf_makeholes = (char) d10;
-        cfst.cf_ino = d11;
-        cfst.cf_nlink = d12;
-        cfst.cf_dev = (dev_t)d13;
-
-        /* Use %?d here to avoid memory overflow attacks */
-
         memset(recvbuffer, 0, CF_BUFSIZE);
 
         if (ReceiveTransaction(&conn->conn_info, recvbuffer, NULL) == -1)
@@ -586,40 +636,10 @@ int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, A
             cfst.cf_readlink = NULL;
         }
 
-        switch (cfst.cf_type)
-        {
-        case FILE_TYPE_REGULAR:
-            cfst.cf_mode |= (mode_t) S_IFREG;
-            break;
-        case FILE_TYPE_DIR:
-            cfst.cf_mode |= (mode_t) S_IFDIR;
-            break;
-        case FILE_TYPE_CHAR_:
-            cfst.cf_mode |= (mode_t) S_IFCHR;
-            break;
-        case FILE_TYPE_FIFO:
-            cfst.cf_mode |= (mode_t) S_IFIFO;
-            break;
-        case FILE_TYPE_SOCK:
-            cfst.cf_mode |= (mode_t) S_IFSOCK;
-            break;
-        case FILE_TYPE_BLOCK:
-            cfst.cf_mode |= (mode_t) S_IFBLK;
-            break;
-        case FILE_TYPE_LINK:
-            cfst.cf_mode |= (mode_t) S_IFLNK;
-            break;
-        }
-
         cfst.cf_filename = xstrdup(file);
         cfst.cf_server = xstrdup(conn->this_server);
         cfst.cf_failed = false;
 
-        if (cfst.cf_lmode != 0)
-        {
-            cfst.cf_lmode |= (mode_t) S_IFLNK;
-        }
-
         NewClientCache(&cfst, conn);
 
         if ((cfst.cf_lmode != 0) && (strcmp(stattype, "link") == 0))
@@ -651,6 +671,155 @@ int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, A
 
 /*********************************************************************/
 
+/**
+ * Cache the attributes of an OPENDIRSTAT entry under the names the copy code
+ * stats it by, "dir/name" and, if dir ends with a slash, "dir" "name".
+ */
+static void CacheDirEntryStat(AgentConnection *conn, const char *dirname,
+                              const char *name, const Stat *entry)
+{
+    char path[CF_BUFSIZE];
+    size_t dirlen = strlen(dirname);
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (i == 1 && (dirlen == 0 || dirname[dirlen - 1] != '/'))
+        {
+            break;
+        }
+
+        int len = snprintf(path, sizeof(path), i == 0 ? "%s/%s" : "%s%s", dirname, name);
+        if (len < 0 || len >= (int) sizeof(path))
+        {
+            continue;
+        }
+
+        Stat cfst = *entry;
+        cfst.cf_filename = xstrdup(path);
+        cfst.cf_server = xstrdup(conn->this_server);
+        cfst.cf_readlink = (entry->cf_readlink != NULL) ? xstrdup(entry->cf_readlink) : NULL;
+        cfst.cf_failed = false;
+        NewClientCache(&cfst, conn);
+    }
+}
+
+/**
+ * List dirname with OPENDIRSTAT, which also returns the attributes of each
+ * entry, so that the cf_remote_stat() of every file copied from the directory
+ * is answered from the connection cache instead of costing a round trip.
+ *
+ * The reply consists of "name\0OK: ...\0OK:link\0" triples in the format of
+ * the SYNCH STAT reply, ended by CFD_TERMINATOR. Entries the server did not
+ * stat have a BAD: attribute line and are stat'ed one by one as before.
+ *
+ * @return false if the server refused to stat the directory (clock drift),
+ *         the caller should list it with OPENDIR instead. Otherwise true,
+ *         with the listing, NULL on error, in *list.
+ */
+static bool RemoteDirListStat(const char *dirname, AgentConnection *conn, Item **list)
+{
+    char sendbuffer[CF_BUFSIZE];
+    char recvbuffer[CF_BUFSIZE];
+    Item *files = NULL;
+    Item *ret = NULL;
+    int n;
+
+    *list = NULL;
+
+    snprintf(sendbuffer, CF_BUFSIZE, "OPENDIRSTAT %jd %s", (intmax_t) time(NULL), dirname);
+
+    if (SendTransaction(&conn->conn_info, sendbuffer, strlen(sendbuffer), CF_DONE) == -1)
+    {
+        return true;
+    }
+
+    while (true)
+    {
+        if ((n = ReceiveTransaction(&conn->conn_info, recvbuffer, NULL)) == -1)
+        {
+            DeleteItemList(ret);
+            return true;
+        }
+
+        if (n == 0)
+        {
+            break;
+        }
+
+        recvbuffer[MIN(n, CF_BUFSIZE - 1)] = '\0';
+        char *end = recvbuffer + MIN(n, CF_BUFSIZE - 1);
+
+        if (FailedProtoReply(recvbuffer))
+        {
+            Log(LOG_LEVEL_INFO, "Network access to '%s:%s' denied", conn->this_server, dirname);
+            DeleteItemList(ret);
+            return true;
+        }
+
+        if (BadProtoReply(recvbuffer))
+        {
+            DeleteItemList(ret);
+
+            if (strstr(recvbuffer, "unsynchronized"))
+            {
+                Log(LOG_LEVEL_VERBOSE, "Server refused to stat the entries of '%s', '%s'",
+                    dirname, recvbuffer + 4);
+                return false;
+            }
+
+            Log(LOG_LEVEL_INFO, "%s", recvbuffer + 4);
+            return true;
+        }
+
+        char *sp = recvbuffer;
+        while (sp < end && *sp != '\0')
+        {
+            if (strncmp(sp, CFD_TERMINATOR, strlen(CFD_TERMINATOR)) == 0)       /* End transmission */
+            {
+                *list = ret;
+                return true;
+            }
+
+            char *name = sp;
+            char *attrs = name + strlen(name) + 1;
+            char *link = (attrs < end) ? attrs + strlen(attrs) + 1 : end;
+
+            if (link >= end)
+            {
+                Log(LOG_LEVEL_ERR, "Truncated listing of '%s' from '%s'", dirname, conn->remoteip);
+                DeleteItemList(ret);
+                return true;
+            }
+
+            sp = link + strlen(link) + 1;
+
+            Item *ip = xcalloc(1, sizeof(Item));
+            ip->name = (char *) AllocateDirentForFilename(name);
+
+            if (files == NULL)  /* First element */
+            {
+                ret = ip;
+                files = ip;
+            }
+            else
+            {
+                files->next = ip;
+                files = ip;
+            }
+
+            Stat cfst;
+            if (OKProtoReply(attrs) && ParseStatReply(attrs, &cfst, conn))
+            {
+                cfst.cf_readlink = (strlen(link) > 3) ? link + 3 : NULL;
+                CacheDirEntryStat(conn, dirname, name, &cfst);
+            }
+        }
+    }
+
+    *list = ret;
+    return true;
+}
+
 Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
 {
     char sendbuffer[CF_BUFSIZE];
@@ -668,6 +837,16 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
         return NULL;
     }
 
+    if (conn->conn_info.type == CF_PROTOCOL_TLS &&
+        (conn->conn_info.features & CFNET_FEATURE_OPENDIR_STAT))
+    {
+        Item *list;
+        if (RemoteDirListStat(dirname, conn, &list))
+        {
+            return list;
+        }
+    }
+
     /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
      * encrypted layer, so it does not support encrypted (S*) commands. */
     encrypt = encrypt && (conn->conn_info.type == CF_PROTOCOL_CLASSIC);
@@ -767,16 +946,28 @@ static void NewClientCache(Stat *data, AgentConnection *conn)
     Stat *sp = xmemdup(data, sizeof(Stat));
     sp->next = conn->cache;
     conn->cache = sp;
+
+    /* A directory listing may fill the cache with thousands of entries */
+    if (conn->cache_index == NULL)
+    {
+        conn->cache_index = MapNew((MapHashFn) &StringHash,
+                                   (MapKeyEqualFn) &StringSafeEqual,
+                                   NULL, NULL);
+    }
+    MapInsert(conn->cache_index, sp->cf_filename, sp);
 }
 
 const Stat *ClientCacheLookup(AgentConnection *conn, const char *server_name, const char *file_name)
 {
-    for (const Stat *sp = conn->cache; sp != NULL; sp = sp->next)
+    if (conn->cache_index == NULL)
     {
-        if (strcmp(server_name, sp->cf_server) == 0 && strcmp(file_name, sp->cf_filename) == 0)
-        {
-            return sp;
-        }
+        return NULL;
+    }
+
+    const Stat *sp = MapGet(conn->cache_index, file_name);
+    if (sp != NULL && strcmp(server_name, sp->cf_server) == 0)
+    {
+        return sp;
     }
 
     return NULL;
@@ -998,6 +1189,42 @@ int EncryptCopyRegularFileNet(const char *source, const char *dest, off_t size,
     return true;
 }
 
+/**
+ * Receive exactly toget bytes of a GET block. Blocks bigger than a TLS record
+ * arrive in several SSL_read() chunks.
+ * @return bytes received (less than toget only on EOF), -1 on error
+ */
+static int RecvFileBlock(ConnectionInfo *conn_info, char *buf, int toget)
+{
+    switch (conn_info->type)
+    {
+    case CF_PROTOCOL_CLASSIC:
+        return RecvSocketStream(conn_info->sd, buf, toget);
+    case CF_PROTOCOL_TLS:
+    {
+        int already = 0;
+        while (already < toget)
+        {
+            int got = TLSRecv(conn_info->ssl, buf + already, toget - already);
+            if (got == -1)
+            {
+                return -1;
+            }
+            if (got == 0)
+            {
+                break;
+            }
+            already += got;
+        }
+        return already;
+    }
+    default:
+        UnexpectedError("CopyRegularFileNet: ProtocolVersion %d!",
+                        conn_info->type);
+        return -1;
+    }
+}
+
 int CopyRegularFileNet(const char *source, const char *dest, off_t size, bool encrypt, AgentConnection *conn)
 {
     int dd, buf_size, n_read = 0, toget, towrite;
@@ -1037,7 +1264,16 @@ int CopyRegularFileNet(const char *source, const char *dest, off_t size, bool en
 
     workbuf[0] = '\0';
 
-    buf_size = 2048;
+    /* Servers advertising large_get accept big blocks over TLS */
+    if (conn->conn_info.type == CF_PROTOCOL_TLS &&
+        (conn->conn_info.features & CFNET_FEATURE_LARGE_GET))
+    {
+        buf_size = CFNET_GET_BLOCKSIZE_LARGE;
+    }
+    else
+    {
+        buf_size = CFNET_GET_BLOCKSIZE;
+    }
 
 /* Send proposition C0 */
 
@@ -1051,7 +1287,7 @@ int CopyRegularFileNet(const char *source, const char *dest, off_t size, bool en
         return false;
     }
 
-    buf = xmalloc(CF_BUFSIZE + sizeof(int));    /* Note CF_BUFSIZE not buf_size !! */
+    buf = xmalloc(MAX(CF_BUFSIZE, buf_size) + sizeof(int));
     n_read_total = 0;
 
     Log(LOG_LEVEL_VERBOSE, "Copying remote file '%s:%s', expecting %jd bytes",
@@ -1074,19 +1310,7 @@ int CopyRegularFileNet(const char *source, const char *dest, off_t size, bool en
         }
 
         /* Stage C1 - receive */
-        switch(conn->conn_info.type)
-        {
-        case CF_PROTOCOL_CLASSIC:
-            n_read = RecvSocketStream(conn->conn_info.sd, buf, toget);
-            break;
-        case CF_PROTOCOL_TLS:
-            n_read = TLSRecv(conn->conn_info.ssl, buf, toget);
-            break;
-        default:
-            UnexpectedError("CopyRegularFileNet: ProtocolVersion %d!",
-                            conn->conn_info.type);
-            n_read = -1;
-        }
+        n_read = RecvFileBlock(&conn->conn_info, buf, toget);
 
         if (n_read == -1)
         {
@@ -1524,42 +1748,39 @@ static void CacheServerConnection(AgentConnection *conn, const char *server)
 
 static int CacheStat(const char *file, struct stat *statbuf, const char *stattype, AgentConnection *conn)
 {
-    Stat *sp;
+    const Stat *sp = ClientCacheLookup(conn, conn->this_server, file);
 
-    for (sp = conn->cache; sp != NULL; sp = sp->next)
+    if (sp == NULL)
     {
-        if ((strcmp(conn->this_server, sp->cf_server) == 0) && (strcmp(file, sp->cf_filename) == 0))
-        {
-            if (sp->cf_failed)  /* cached failure from cfopendir */
-            {
-                errno = EPERM;
-                return -1;
-            }
-
-            if ((strcmp(stattype, "link") == 0) && (sp->cf_lmode != 0))
-            {
-                statbuf->st_mode = sp->cf_lmode;
-            }
-            else
-            {
-                statbuf->st_mode = sp->cf_mode;
-            }
+        return 1;
+    }
 
-            statbuf->st_uid = sp->cf_uid;
-            statbuf->st_gid = sp->cf_gid;
-            statbuf->st_size = sp->cf_size;
-            statbuf->st_atime = sp->cf_atime;
-            statbuf->st_mtime = sp->cf_mtime;
-            statbuf->st_ctime = sp->cf_ctime;
-            statbuf->st_ino = sp->cf_ino;
-            statbuf->st_dev = sp->cf_dev;
-            statbuf->st_nlink = sp->cf_nlink;
+    if (sp->cf_failed)  /* cached failure from cfopendir */
+    {
+        errno = EPERM;
+        return -1;
+    }
 
-            return 0;
-        }
+    if ((strcmp(stattype, "link") == 0) && (sp->cf_lmode != 0))
+    {
+        statbuf->st_mode = sp->cf_lmode;
+    }
+    else
+    {
+        statbuf->st_mode = sp->cf_mode;
     }
 
-    return 1;
+    statbuf->st_uid = sp->cf_uid;
+    statbuf->st_gid = sp->cf_gid;
+    statbuf->st_size = sp->cf_size;
+    statbuf->st_atime = sp->cf_atime;
+    statbuf->st_mtime = sp->cf_mtime;
+    statbuf->st_ctime = sp->cf_ctime;
+    statbuf->st_ino = sp->cf_ino;
+    statbuf->st_dev = sp->cf_dev;
+    statbuf->st_nlink = sp->cf_nlink;
+
+    return 0;
 }
 
 /*********************************************************************/
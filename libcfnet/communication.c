@@ -57,6 +57,11 @@ void DeleteAgentConn(AgentConnection *conn)
         free(sps);
     }
 
+    if (conn->cache_index != NULL)
+    {
+        MapDestroy(conn->cache_index);
+    }
+
     if (conn->conn_info.remote_key != NULL)
     {
         RSA_free(conn->conn_info.remote_key);
@@ -27,6 +27,8 @@
 
 #include <logging.h>
 #include <misc_lib.h>
+#include <map.h>
+#include <string_lib.h>                            /* StringHash */
 
 #include <tls_client.h>
 #include <tls_generic.h>
@@ -42,6 +44,11 @@ extern char CFWORKDIR[];
 static SSL_CTX *SSLCLIENTCONTEXT = NULL;
 static X509 *SSLCLIENTCERT = NULL;
 
+/* Last good TLS session per server address, offered again on the next
+ * connection so that the server can skip the full handshake. */
+static Map *SSLCLIENTSESSIONS = NULL;
+static pthread_mutex_t SSLCLIENTSESSIONS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
 
 /**
  * @warning Make sure you've called CryptoInitialize() first!
@@ -184,6 +191,104 @@ void TLSDeInitialize()
         SSL_CTX_free(SSLCLIENTCONTEXT);
         SSLCLIENTCONTEXT = NULL;
     }
+
+    pthread_mutex_lock(&SSLCLIENTSESSIONS_LOCK);
+    MapDestroy(SSLCLIENTSESSIONS);
+    SSLCLIENTSESSIONS = NULL;
+    pthread_mutex_unlock(&SSLCLIENTSESSIONS_LOCK);
+}
+
+/**
+ * Offer the session last saved for #ipaddr, if any, for resumption on #ssl.
+ */
+static void TLSClientSessionOffer(SSL *ssl, const char *ipaddr)
+{
+    pthread_mutex_lock(&SSLCLIENTSESSIONS_LOCK);
+    if (SSLCLIENTSESSIONS != NULL)
+    {
+        SSL_SESSION *session = MapGet(SSLCLIENTSESSIONS, ipaddr);
+        if (session != NULL)
+        {
+            /* SSL_set_session() takes its own reference. */
+            SSL_set_session(ssl, session);
+        }
+    }
+    pthread_mutex_unlock(&SSLCLIENTSESSIONS_LOCK);
+}
+
+/**
+ * Remember the session of an authenticated connection to #ipaddr, to be
+ * resumed by the next TLSTry() to the same server.
+ */
+void TLSClientSessionSave(const ConnectionInfo *conn_info, const char *ipaddr)
+{
+    SSL_SESSION *session = SSL_get1_session(conn_info->ssl);
+    if (session == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&SSLCLIENTSESSIONS_LOCK);
+    if (SSLCLIENTSESSIONS == NULL)
+    {
+        SSLCLIENTSESSIONS = MapNew((MapHashFn) &StringHash,
+                                   (MapKeyEqualFn) &StringSafeEqual,
+                                   free,
+                                   (MapDestroyDataFn) &SSL_SESSION_free);
+    }
+    MapInsert(SSLCLIENTSESSIONS, xstrdup(ipaddr), session);
+    pthread_mutex_unlock(&SSLCLIENTSESSIONS_LOCK);
+}
+
+/**
+ * Forget the session saved for #ipaddr, e.g. because the server could not
+ * be trusted on it.
+ */
+void TLSClientSessionForget(const char *ipaddr)
+{
+    pthread_mutex_lock(&SSLCLIENTSESSIONS_LOCK);
+    if (SSLCLIENTSESSIONS != NULL)
+    {
+        MapRemove(SSLCLIENTSESSIONS, ipaddr);
+    }
+    pthread_mutex_unlock(&SSLCLIENTSESSIONS_LOCK);
+}
+
+/**
+ * Parse the optional feature list at the end of the server greeting,
+ * "CFE_v%d cf-serverd VERSION [FEATURE...]".
+ * @return bitmask of CFNET_FEATURE_* flags
+ */
+static int TLSClientParseFeatures(const char *greeting)
+{
+    int features = 0;
+    int skip = 0;
+
+    if (sscanf(greeting, "%*s %*s %*s%n", &skip) < 0 || skip == 0)
+    {
+        return 0;
+    }
+
+    const char *p = greeting + skip;
+    while (*p != '\0')
+    {
+        p += strspn(p, " \t");
+        size_t len = strcspn(p, " \t");
+
+        if (len == strlen(CFNET_FEATURE_LARGE_GET_STR) &&
+            strncmp(p, CFNET_FEATURE_LARGE_GET_STR, len) == 0)
+        {
+            features |= CFNET_FEATURE_LARGE_GET;
+        }
+        else if (len == strlen(CFNET_FEATURE_OPENDIR_STAT_STR) &&
+                 strncmp(p, CFNET_FEATURE_OPENDIR_STAT_STR, len) == 0)
+        {
+            features |= CFNET_FEATURE_OPENDIR_STAT;
+        }
+        p += len;
+    }
+
+    return features;
 }
 
 /**
@@ -191,13 +296,14 @@ void TLSDeInitialize()
  *          0: no agreement on version was reached
  *         -1: error
  */
-int TLSClientNegotiateProtocol(const ConnectionInfo *conn_info)
+int TLSClientNegotiateProtocol(ConnectionInfo *conn_info)
 {
     int ret;
     char input[CF_SMALLBUF] = "";
 
     /* Receive CFE_v%d ... */
     ret = TLSRecvLine(conn_info->ssl, input, sizeof(input));
+    conn_info->features = (ret > 0) ? TLSClientParseFeatures(input) : 0;
 
     /* Send "CFE_v%d cf-agent version". */
     char version_string[128];
@@ -253,11 +359,13 @@ int TLSClientSendIdentity(const ConnectionInfo *conn_info, const char *username)
 /**
  * We directly initiate a TLS handshake with the server. If the server is old
  * version (does not speak TLS) the connection will be denied.
+ * @param ipaddr if not NULL, offer the session saved for this server with
+ *        TLSClientSessionSave() for resumption
  * @note the socket file descriptor in #conn_info must be connected and *not*
  *       non-blocking
  * @return -1 in case of error
  */
-int TLSTry(ConnectionInfo *conn_info)
+int TLSTry(ConnectionInfo *conn_info, const char *ipaddr)
 {
     /* SSL Context might not be initialised up to now due to lack of keys, as
      * they might be generated as part of the policy (e.g. failsafe.cf). */
@@ -286,6 +394,11 @@ int TLSTry(ConnectionInfo *conn_info)
     /* Initiate the TLS handshake over the already open TCP socket. */
     SSL_set_fd(conn_info->ssl, conn_info->sd);
 
+    if (ipaddr != NULL)
+    {
+        TLSClientSessionOffer(conn_info->ssl, ipaddr);
+    }
+
     int ret = SSL_connect(conn_info->ssl);
     if (ret <= 0)
     {
@@ -298,7 +411,8 @@ int TLSTry(ConnectionInfo *conn_info)
         Log(LOG_LEVEL_VERBOSE, "TLS cipher negotiated: %s, %s",
             SSL_get_cipher_name(conn_info->ssl),
             SSL_get_cipher_version(conn_info->ssl));
-        Log(LOG_LEVEL_VERBOSE, "TLS session established, checking trust...");
+        Log(LOG_LEVEL_VERBOSE, "TLS session %s, checking trust...",
+            SSL_session_reused(conn_info->ssl) ? "resumed" : "established");
     }
 
     return 0;
@@ -404,6 +404,7 @@ Recursion GetRecursionConstraints(const EvalContext *ctx, const Promise *pp)
     r.include_dirs = PromiseGetConstraintAsList(ctx, "include_dirs", pp);
     r.exclude_dirs = PromiseGetConstraintAsList(ctx, "exclude_dirs", pp);
     r.include_basedir = PromiseGetConstraintAsBoolean(ctx, "include_basedir", pp);
+    r.parallel = PromiseGetConstraintAsBoolean(ctx, "parallel", pp);
     return r;
 }
 
@@ -558,6 +558,7 @@ typedef enum
     EXEC_CONTROL_EXECUTORFACILITY,
     EXEC_CONTROL_EXECCOMMAND,
     EXEC_CONTROL_AGENT_EXPIREAFTER,
+    EXEC_CONTROL_WARM_AGENT,
     EXEC_CONTROL_NONE
 } ExecControl;
 
@@ -1010,6 +1011,7 @@ typedef struct
     int depth;
     int xdev;
     int include_basedir;
+    int parallel;
     Rlist *include_dirs;
     Rlist *exclude_dirs;
 } Recursion;
@@ -1,13 +1,20 @@
 #include <class.h>
 
 #include <rb-tree.h>
+#include <map.h>
 #include <alloc.h>
 #include <string_lib.h>
 #include <files_names.h>
 
+/*
+ * Classes are keyed by their canonical expression, "name" in the default
+ * namespace and "ns:name" otherwise. The map owns keys and classes; the tree
+ * shares them to iterate in order, and to only visit the keys sharing a prefix.
+ */
 struct ClassTable_
 {
-    RBTree *classes;
+    Map *classes;
+    RBTree *ordered;
 };
 
 struct ClassTableIterator_
@@ -16,27 +23,53 @@ struct ClassTableIterator_
     char *ns;
     bool is_hard;
     bool is_soft;
+
+    /* Only keys starting with prefix, and matching regex if set */
+    char *prefix;
+    size_t prefix_len;
+    char *regex;
 };
 
-static size_t ClassRefHash(const char *ns, const char *name)
+/* Fits all keys made from CF_MAXVARSIZE buffers */
+#define CLASS_KEY_BUFSIZE (2 * CF_MAXVARSIZE)
+
+/*
+ * Writes the key of the class into buf, or into a new string if it does not
+ * fit, which the caller must free.
+ */
+static char *ClassKey(char *buf, size_t size, const char *ns, const char *name)
 {
-    unsigned h = 0;
+    if (ns && strcmp("default", ns) == 0)
+    {
+        ns = NULL;
+    }
 
-    h = StringHash(ns ? ns : "default", h, INT_MAX);
+    size_t ns_len = ns ? strlen(ns) + 1 : 0;
+    size_t len = ns_len + strlen(name) + 1;
+    char *key = (len <= size) ? buf : xmalloc(len);
 
-    size_t len = strlen(name);
-    for (size_t i = 0; i < len; i++)
+    if (ns)
     {
-        h += (!isalnum(name[i]) || (name[i] == '.')) ? '_' : name[i];
-        h += (h << 10);
-        h ^= (h >> 6);
+        memcpy(key, ns, ns_len - 1);
+        key[ns_len - 1] = ':';
     }
+    strcpy(key + ns_len, name);
+    CanonifyNameInPlace(key + ns_len);
+
+    return key;
+}
 
-    h += (h << 3);
-    h ^= (h >> 11);
-    h += (h << 15);
+static void ClassKeyFree(char *key, char *buf)
+{
+    if (key != buf)
+    {
+        free(key);
+    }
+}
 
-    return (h & (INT_MAX - 1));
+static int ClassKeyCompare(const void *a, const void *b)
+{
+    return strcmp(a, b);
 }
 
 void ClassInit(Class *cls, const char *ns, const char *name, bool is_soft, ContextScope scope)
@@ -56,8 +89,6 @@ void ClassInit(Class *cls, const char *ns, const char *name, bool is_soft, Conte
     cls->is_soft = is_soft;
     cls->scope = scope;
     cls->tags = NULL;
-
-    cls->hash = ClassRefHash(cls->ns, cls->name);
 }
 
 void ClassDestroy(Class *cls)
@@ -70,11 +101,18 @@ void ClassDestroy(Class *cls)
     }
 }
 
+static void ClassFree(void *cls)
+{
+    ClassDestroy(cls);
+    free(cls);
+}
+
 ClassTable *ClassTableNew(void)
 {
     ClassTable *table = xmalloc(sizeof(ClassTable));
 
-    table->classes = RBTreeNew(NULL, NULL, NULL, NULL, NULL, (RBTreeValueDestroyFn *)ClassDestroy);
+    table->classes = MapNew((MapHashFn)&StringHash, (MapKeyEqualFn)&StringSafeEqual, &free, &ClassFree);
+    table->ordered = RBTreeNew(NULL, &ClassKeyCompare, NULL, NULL, NULL, NULL);
 
     return table;
 }
@@ -83,7 +121,9 @@ void ClassTableDestroy(ClassTable *table)
 {
     if (table)
     {
-        RBTreeDestroy(table->classes);
+        RBTreeDestroy(table->ordered);
+        MapDestroy(table->classes);
+        free(table);
     }
 }
 
@@ -109,48 +149,139 @@ bool ClassTablePut(ClassTable *table, const char *ns, const char *name, bool is_
     {
         cls = xmalloc(sizeof(Class));
         ClassInit(cls, ns, name, is_soft, scope);
-        return RBTreePut(table->classes, (void *)cls->hash, cls);
+
+        char buf[CLASS_KEY_BUFSIZE];
+        char *key = ClassKey(buf, sizeof(buf), ns, name);
+        if (key == buf)
+        {
+            key = xstrdup(buf);
+        }
+
+        MapInsert(table->classes, key, cls);
+        RBTreePut(table->ordered, key, cls);
+        return false;
     }
 }
 
 Class *ClassTableGet(const ClassTable *table, const char *ns, const char *name)
 {
-    size_t hash = ClassRefHash(ns, name);
-    return RBTreeGet(table->classes, (void *)hash);
+    char buf[CLASS_KEY_BUFSIZE];
+    char *key = ClassKey(buf, sizeof(buf), ns, name);
+
+    Class *cls = MapGet(table->classes, key);
+
+    ClassKeyFree(key, buf);
+    return cls;
 }
 
 bool ClassTableRemove(ClassTable *table, const char *ns, const char *name)
 {
-    size_t hash = ClassRefHash(ns, name);
-    return RBTreeRemove(table->classes, (void *)hash);
+    char buf[CLASS_KEY_BUFSIZE];
+    char *key = ClassKey(buf, sizeof(buf), ns, name);
+
+    /* The tree compares the key owned by the map, so it goes first */
+    bool removed = RBTreeRemove(table->ordered, key);
+    if (removed)
+    {
+        MapRemove(table->classes, key);
+    }
+
+    ClassKeyFree(key, buf);
+    return removed;
 }
 
 bool ClassTableClear(ClassTable *table)
 {
-    bool has_classes = RBTreeSize(table->classes) > 0;
-    RBTreeClear(table->classes);
+    bool has_classes = MapSize(table->classes) > 0;
+    RBTreeClear(table->ordered);
+    MapClear(table->classes);
     return has_classes;
 }
 
+size_t ClassTableSize(const ClassTable *table)
+{
+    return MapSize(table->classes);
+}
+
+/*
+ * Returns the literal text every string fully matching regex starts with,
+ * or "" if it cannot tell. Only needs to be conservative: shorter is fine.
+ */
+static char *RegexLiteralPrefix(const char *regex)
+{
+    /* An alternative could start with anything */
+    if (strchr(regex, '|'))
+    {
+        return xstrdup("");
+    }
+
+    if (*regex == '^')
+    {
+        regex++;
+    }
+
+    size_t len = strcspn(regex, ".[]()*+?{}^$\\");
+
+    /* A quantifier makes the last literal optional */
+    if (len > 0 && regex[len] && strchr("*?{", regex[len]))
+    {
+        len--;
+    }
+
+    return xstrndup(regex, len);
+}
+
 ClassTableIterator *ClassTableIteratorNew(const ClassTable *table, const char *ns, bool is_hard, bool is_soft)
+{
+    return ClassTableIteratorNewMatching(table, ns, NULL, is_hard, is_soft);
+}
+
+ClassTableIterator *ClassTableIteratorNewMatching(const ClassTable *table, const char *ns, const char *regex,
+                                                  bool is_hard, bool is_soft)
 {
     ClassTableIterator *iter = xmalloc(sizeof(ClassTableIterator));
 
     iter->ns = ns ? xstrdup(ns) : NULL;
-    iter->iter = RBTreeIteratorNew(table->classes);
     iter->is_soft = is_soft;
     iter->is_hard = is_hard;
+    iter->regex = regex ? xstrdup(regex) : NULL;
+
+    /* Keys of a namespace other than default share the "ns:" prefix */
+    char *ns_prefix = (ns && strcmp("default", ns) != 0) ? StringConcatenate(2, ns, ":") : xstrdup("");
+    char *regex_prefix = regex ? RegexLiteralPrefix(regex) : xstrdup("");
+
+    /* If neither is a prefix of the other, the regex just matches nothing
+     * in the namespace. */
+    if (StringStartsWith(regex_prefix, ns_prefix))
+    {
+        iter->prefix = regex_prefix;
+        free(ns_prefix);
+    }
+    else
+    {
+        iter->prefix = ns_prefix;
+        free(regex_prefix);
+    }
+    iter->prefix_len = strlen(iter->prefix);
+
+    iter->iter = RBTreeIteratorNewFrom(table->ordered, iter->prefix);
 
     return iter;
 }
 
 Class *ClassTableIteratorNext(ClassTableIterator *iter)
 {
-    void *key_ref = NULL;
+    void *key = NULL;
     Class *cls = NULL;
 
-    while (RBTreeIteratorNext(iter->iter, &key_ref, (void **)&cls))
+    while (RBTreeIteratorNext(iter->iter, &key, (void **)&cls))
     {
+        if (strncmp(key, iter->prefix, iter->prefix_len) != 0)
+        {
+            /* Past the keys with the prefix */
+            return NULL;
+        }
+
         const char *key_ns = cls->ns ? cls->ns : "default";
 
         if (iter->ns && strcmp(key_ns, iter->ns) != 0)
@@ -158,11 +289,16 @@ Class *ClassTableIteratorNext(ClassTableIterator *iter)
             continue;
         }
 
-        if (iter->is_soft && !iter->is_soft)
+        if (!iter->is_soft && cls->is_soft)
         {
             continue;
         }
-        if (iter->is_hard && !iter->is_hard)
+        if (!iter->is_hard && !cls->is_soft)
+        {
+            continue;
+        }
+
+        if (iter->regex && !StringMatchFull(iter->regex, key))
         {
             continue;
         }
@@ -178,6 +314,8 @@ void ClassTableIteratorDestroy(ClassTableIterator *iter)
     if (iter)
     {
         free(iter->ns);
+        free(iter->prefix);
+        free(iter->regex);
         RBTreeIteratorDestroy(iter->iter);
         free(iter);
     }
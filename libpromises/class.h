@@ -8,7 +8,6 @@ typedef struct
 {
     char *ns;
     char *name;
-    size_t hash;
 
     ContextScope scope;
     bool is_soft;
@@ -26,8 +25,16 @@ Class *ClassTableGet(const ClassTable *table, const char *ns, const char *name);
 bool ClassTableRemove(ClassTable *table, const char *ns, const char *name);
 
 bool ClassTableClear(ClassTable *table);
+size_t ClassTableSize(const ClassTable *table);
 
 ClassTableIterator *ClassTableIteratorNew(const ClassTable *table, const char *ns, bool is_hard, bool is_soft);
+/**
+ * @brief Iterate the classes whose expression ("name", or "ns:name" outside
+ *        the default namespace) fully matches regex. Only the classes
+ *        starting with the literal beginning of the regex are visited.
+ */
+ClassTableIterator *ClassTableIteratorNewMatching(const ClassTable *table, const char *ns, const char *regex,
+                                                  bool is_hard, bool is_soft);
 Class *ClassTableIteratorNext(ClassTableIterator *iter);
 void ClassTableIteratorDestroy(ClassTableIterator *iter);
 
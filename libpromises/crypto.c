@@ -35,6 +35,8 @@
 #include <sysinfo.h>
 #include <bootstrap.h>
 #include <misc_lib.h>                   /* UnexpectedError,ProgrammingError */
+#include <map.h>
+#include <string_lib.h>                 /* StringHash,StringSafeEqual */
 
 #ifdef DARWIN
 // On Mac OSX 10.7 and later, majority of functions in /usr/include/openssl/crypto.h
@@ -85,6 +87,7 @@ void CryptoDeInitialize()
 {
     if (crypto_initialized)
     {
+        PublicKeyCacheFlush();
         EVP_cleanup();
         CleanupOpenSSLThreadLocks();
         crypto_initialized = false;
@@ -242,6 +245,136 @@ RSA *HavePublicKeyByIP(const char *username, const char *ipaddress)
 
 /*********************************************************************/
 
+/*
+ * Trusted public keys are read from ppkeys/ on every connection. Keep the
+ * parsed keys around, keyed by file path (which embeds the key digest), and
+ * only reuse an entry while the file on disk is the one it was parsed from.
+ */
+
+typedef struct
+{
+    RSA *key;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+} PublicKeyCacheEntry;
+
+static Map *PUBKEY_CACHE = NULL;
+static unsigned long long PUBKEY_CACHE_HITS = 0;
+static unsigned long long PUBKEY_CACHE_MISSES = 0;
+static pthread_mutex_t PUBKEY_CACHE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+static void PublicKeyCacheEntryDestroy(PublicKeyCacheEntry *entry)
+{
+    RSA_free(entry->key);
+    free(entry);
+}
+
+static bool PublicKeyCacheEntryIsCurrent(const PublicKeyCacheEntry *entry,
+                                         const struct stat *sb)
+{
+    return entry->dev == sb->st_dev && entry->ino == sb->st_ino &&
+        entry->size == sb->st_size && entry->mtime == sb->st_mtime &&
+        entry->ctime == sb->st_ctime;
+}
+
+/**
+ * @return a new reference to the cached key, or NULL if #filename is not
+ *         cached or has changed since it was parsed
+ */
+static RSA *PublicKeyCacheGet(const char *filename, const struct stat *sb)
+{
+    RSA *key = NULL;
+
+    pthread_mutex_lock(&PUBKEY_CACHE_LOCK);
+
+    if (PUBKEY_CACHE != NULL)
+    {
+        PublicKeyCacheEntry *entry = MapGet(PUBKEY_CACHE, filename);
+        if (entry != NULL)
+        {
+            if (PublicKeyCacheEntryIsCurrent(entry, sb))
+            {
+                RSA_up_ref(entry->key);
+                key = entry->key;
+            }
+            else
+            {
+                MapRemove(PUBKEY_CACHE, filename);
+            }
+        }
+    }
+
+    if (key != NULL)
+    {
+        PUBKEY_CACHE_HITS++;
+    }
+    else
+    {
+        PUBKEY_CACHE_MISSES++;
+    }
+
+    pthread_mutex_unlock(&PUBKEY_CACHE_LOCK);
+
+    return key;
+}
+
+static void PublicKeyCachePut(const char *filename, const struct stat *sb, RSA *key)
+{
+    PublicKeyCacheEntry *entry = xmalloc(sizeof(PublicKeyCacheEntry));
+    RSA_up_ref(key);
+    *entry = (PublicKeyCacheEntry) {
+        .key = key,
+        .dev = sb->st_dev,
+        .ino = sb->st_ino,
+        .size = sb->st_size,
+        .mtime = sb->st_mtime,
+        .ctime = sb->st_ctime
+    };
+
+    pthread_mutex_lock(&PUBKEY_CACHE_LOCK);
+
+    if (PUBKEY_CACHE == NULL)
+    {
+        PUBKEY_CACHE = MapNew((MapHashFn) &StringHash,
+                              (MapKeyEqualFn) &StringSafeEqual,
+                              free,
+                              (MapDestroyDataFn) &PublicKeyCacheEntryDestroy);
+    }
+    MapInsert(PUBKEY_CACHE, xstrdup(filename), entry);
+
+    pthread_mutex_unlock(&PUBKEY_CACHE_LOCK);
+}
+
+void PublicKeyCacheFlush(void)
+{
+    pthread_mutex_lock(&PUBKEY_CACHE_LOCK);
+
+    if (PUBKEY_CACHE != NULL)
+    {
+        MapClear(PUBKEY_CACHE);
+    }
+
+    pthread_mutex_unlock(&PUBKEY_CACHE_LOCK);
+}
+
+void PublicKeyCacheGetStats(PublicKeyCacheStats *stats)
+{
+    pthread_mutex_lock(&PUBKEY_CACHE_LOCK);
+
+    *stats = (PublicKeyCacheStats) {
+        .entries = (PUBKEY_CACHE != NULL) ? MapSize(PUBKEY_CACHE) : 0,
+        .hits = PUBKEY_CACHE_HITS,
+        .misses = PUBKEY_CACHE_MISSES
+    };
+
+    pthread_mutex_unlock(&PUBKEY_CACHE_LOCK);
+}
+
+/*********************************************************************/
+
 /**
  * @brief Search for a key:
  *        1. username-hash.pub
@@ -297,6 +430,11 @@ RSA *HavePublicKey(const char *username, const char *ipaddress, const char *dige
         }
     }
 
+    if ((newkey = PublicKeyCacheGet(newname, &statbuf)) != NULL)
+    {
+        return newkey;
+    }
+
     if ((fp = fopen(newname, "r")) == NULL)
     {
         Log(LOG_LEVEL_ERR, "Couldn't find a public key '%s'. (fopen: %s)", newname, GetErrorStr());
@@ -320,6 +458,8 @@ RSA *HavePublicKey(const char *username, const char *ipaddress, const char *dige
         return NULL;
     }
 
+    PublicKeyCachePut(newname, &statbuf, newkey);
+
     return newkey;
 }
 
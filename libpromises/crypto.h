@@ -38,6 +38,21 @@ RSA *HavePublicKey(const char *username, const char *ipaddress, const char *dige
 RSA *HavePublicKeyByIP(const char *username, const char *ipaddress);
 void SavePublicKey(const char *username, const char *digest, const RSA *key);
 
+typedef struct
+{
+    size_t entries;
+    unsigned long long hits;
+    unsigned long long misses;
+} PublicKeyCacheStats;
+
+/**
+ * @brief Drop all parsed public keys kept by HavePublicKey(). Entries are
+ *        revalidated against the key file on every lookup, this is only
+ *        needed when key files are deliberately removed.
+ */
+void PublicKeyCacheFlush(void);
+void PublicKeyCacheGetStats(PublicKeyCacheStats *stats);
+
 const char *PublicKeyFile(const char *workdir);
 const char *PrivateKeyFile(const char *workdir);
 
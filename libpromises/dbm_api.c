@@ -30,11 +30,40 @@
 #include <atexit.h>
 #include <logging.h>
 #include <misc_lib.h>
+#include <map.h>
 
 
 static int DBPathLock(const char *filename);
 static void DBPathUnLock(int fd);
 static void DBPathMoveBroken(const char *filename);
+static void CloseHandle(DBHandle *handle);
+static bool DBBatchEnd(DBHandle *handle);
+
+typedef struct
+{
+    int size;
+    char data[];
+} DBBatchKey;
+
+typedef struct
+{
+    bool deleted;
+    int size;
+    char data[];
+} DBBatchValue;
+
+typedef struct
+{
+    Map *pending;                                 /* DBBatchKey -> DBBatchValue */
+    size_t max_pending;
+    time_t max_delay;
+    time_t oldest;                          /* time of oldest pending change */
+    int depth;                              /* nested DBBeginBatch() calls */
+    pid_t owner;                          /* process the changes belong to */
+
+    unsigned long changes;
+    unsigned long transactions;
+} DBBatch;
 
 struct DBHandle_
 {
@@ -46,13 +75,19 @@ struct DBHandle_
 
     int refcount;
 
-    /* This lock protects initialization of .priv element, and .refcount manipulation */
+    /* Pending writes, or NULL when not batching */
+    DBBatch *batch;
+    int open_cursors;
+
+    /* This lock protects initialization of .priv element, .refcount, .batch
+     * and .open_cursors manipulation */
     pthread_mutex_t lock;
 };
 
 struct DBCursor_
 {
     DBCursorPriv *cursor;
+    DBHandle *handle;
 };
 
 /******************************************************************************/
@@ -149,6 +184,12 @@ void CloseAllDBExit()
             /* Wait until all DB users are served, or a threshold is reached */
             int count = 0;
             pthread_mutex_lock(&db_handles[i].lock);
+
+            /* Pending batches are not users; write them out first. */
+            if (db_handles[i].batch != NULL)
+            {
+                DBBatchEnd(&db_handles[i]);
+            }
             while (db_handles[i].refcount > 0 && count < 1000)
             {
                 pthread_mutex_unlock(&db_handles[i].lock);
@@ -248,68 +289,465 @@ void CloseDB(DBHandle *handle)
     {
         Log(LOG_LEVEL_ERR, "Trying to close database %s which is not open", handle->filename);
     }
-    else if (--handle->refcount == 0)
+    else
+    {
+        CloseHandle(handle);
+    }
+
+    pthread_mutex_unlock(&handle->lock);
+}
+
+/*****************************************************************************/
+
+/*
+ * Write batching. All DBBatch* functions must be called with handle->lock
+ * held.
+ */
+
+static unsigned int DBBatchKeyHash(const void *key, unsigned int seed, unsigned int max)
+{
+    const DBBatchKey *k = key;
+    unsigned int h = seed;
+
+    for (int i = 0; i < k->size; i++)
+    {
+        h += (unsigned char) k->data[i];
+        h += (h << 10);
+        h ^= (h >> 6);
+    }
+
+    h += (h << 3);
+    h ^= (h >> 11);
+    h += (h << 15);
+
+    return (h & (max - 1));
+}
+
+static bool DBBatchKeyEqual(const void *a, const void *b)
+{
+    const DBBatchKey *ka = a;
+    const DBBatchKey *kb = b;
+
+    return ka->size == kb->size && memcmp(ka->data, kb->data, ka->size) == 0;
+}
+
+static DBBatchKey *DBBatchKeyNew(const void *key, int key_size)
+{
+    DBBatchKey *k = xmalloc(sizeof(DBBatchKey) + key_size);
+    k->size = key_size;
+    memcpy(k->data, key, key_size);
+    return k;
+}
+
+/* value == NULL records a deletion */
+static DBBatchValue *DBBatchValueNew(const void *value, int value_size)
+{
+    if (value == NULL)
+    {
+        value_size = 0;
+    }
+
+    DBBatchValue *v = xmalloc(sizeof(DBBatchValue) + value_size);
+    v->deleted = (value == NULL);
+    v->size = value_size;
+    if (value_size > 0)
+    {
+        memcpy(v->data, value, value_size);
+    }
+    return v;
+}
+
+/*
+ * A child inherits the parent's pending changes through fork(). Those are
+ * the parent's to write, so the child drops them and continues with a batch
+ * of its own.
+ */
+static void DBBatchAdopt(DBBatch *batch)
+{
+    if (batch->owner != getpid())
+    {
+        MapClear(batch->pending);
+        batch->oldest = 0;
+        batch->owner = getpid();
+        batch->changes = 0;
+        batch->transactions = 0;
+    }
+}
+
+static const DBBatchValue *DBBatchLookup(DBHandle *handle, const void *key, int key_size)
+{
+    if (handle->batch == NULL)
+    {
+        return NULL;
+    }
+
+    DBBatchAdopt(handle->batch);
+
+    DBBatchKey *k = DBBatchKeyNew(key, key_size);
+    const DBBatchValue *v = MapGet(handle->batch->pending, k);
+    free(k);
+    return v;
+}
+
+static bool DBBatchFlush(DBHandle *handle)
+{
+    DBBatch *batch = handle->batch;
+
+    DBBatchAdopt(batch);
+
+    if (MapSize(batch->pending) == 0)
+    {
+        return true;
+    }
+
+    /* A failed transaction writes nothing, and the backend may have made
+     * room for it (LMDB grows its map), so it is tried once more. */
+    bool ok = false;
+    for (int attempt = 0; attempt < 2 && !ok; attempt++)
+    {
+        /* If no transaction can be started, write one by one rather than
+         * lose the changes. */
+        bool in_txn = DBPrivBeginWriteBatch(handle->priv);
+        ok = true;
+
+        MapIterator it = MapIteratorInit(batch->pending);
+        MapKeyValue *item;
+        while ((item = MapIteratorNext(&it)))
+        {
+            const DBBatchKey *k = item->key;
+            const DBBatchValue *v = item->value;
+
+            if (v->deleted)
+            {
+                /* Deleting an absent key is not an error here. */
+                DBPrivDelete(handle->priv, k->data, k->size);
+            }
+            else if (!DBPrivWrite(handle->priv, k->data, k->size, v->data, v->size))
+            {
+                ok = false;
+                if (in_txn)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (!in_txn)
+        {
+            break;
+        }
+        ok = DBPrivCommitWriteBatch(handle->priv) && ok;
+    }
+
+    if (!ok)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to write %zu batched changes to database '%s'",
+            MapSize(batch->pending), handle->filename);
+    }
+
+    batch->changes += MapSize(batch->pending);
+    batch->transactions++;
+
+    MapClear(batch->pending);
+    batch->oldest = 0;
+    return ok;
+}
+
+static bool DBBatchPut(DBHandle *handle, const void *key, int key_size,
+                       const void *value, int value_size)
+{
+    DBBatch *batch = handle->batch;
+    time_t now = time(NULL);
+
+    DBBatchAdopt(batch);
+
+    MapInsert(batch->pending, DBBatchKeyNew(key, key_size),
+              DBBatchValueNew(value, value_size));
+
+    if (batch->oldest == 0)
+    {
+        batch->oldest = now;
+    }
+
+    /* Flushing would deadlock against the write txn of an open cursor. */
+    if (handle->open_cursors == 0 &&
+        (MapSize(batch->pending) >= batch->max_pending ||
+         now - batch->oldest >= batch->max_delay))
+    {
+        return DBBatchFlush(handle);
+    }
+
+    return true;
+}
+
+static void CloseHandle(DBHandle *handle)
+{
+    if (--handle->refcount == 0)
     {
         DBPrivCloseDB(handle->priv);
     }
+}
+
+static bool DBBatchEnd(DBHandle *handle)
+{
+    bool ok = DBBatchFlush(handle);
+
+    Log(LOG_LEVEL_VERBOSE, "Wrote %lu batched changes to database '%s' in %lu transactions",
+        handle->batch->changes, handle->filename, handle->batch->transactions);
+
+    MapDestroy(handle->batch->pending);
+    free(handle->batch);
+    handle->batch = NULL;
+
+    /* Drop the reference taken by DBBeginBatch() */
+    CloseHandle(handle);
+    return ok;
+}
+
+bool DBBeginBatch(DBHandle *handle, size_t max_pending, time_t max_delay)
+{
+    pthread_mutex_lock(&handle->lock);
+
+    if (handle->refcount < 1)
+    {
+        Log(LOG_LEVEL_ERR, "Trying to batch writes to database %s which is not open", handle->filename);
+        pthread_mutex_unlock(&handle->lock);
+        return false;
+    }
+
+    if (handle->batch != NULL)
+    {
+        handle->batch->depth++;
+        pthread_mutex_unlock(&handle->lock);
+        return true;
+    }
+
+    DBBatch *batch = xcalloc(1, sizeof(DBBatch));
+    batch->pending = MapNew(DBBatchKeyHash, DBBatchKeyEqual, free, free);
+    batch->max_pending = max_pending ? max_pending : DB_BATCH_DEFAULT_MAX_PENDING;
+    batch->max_delay = max_delay ? max_delay : DB_BATCH_DEFAULT_MAX_DELAY;
+    batch->depth = 1;
+    batch->owner = getpid();
+
+    handle->batch = batch;
+    handle->refcount++;
+
+    pthread_mutex_unlock(&handle->lock);
+    return true;
+}
+
+bool DBFlushBatch(DBHandle *handle)
+{
+    pthread_mutex_lock(&handle->lock);
+    bool ok = (handle->batch == NULL) || DBBatchFlush(handle);
+    pthread_mutex_unlock(&handle->lock);
+    return ok;
+}
+
+bool DBCommitBatch(DBHandle *handle)
+{
+    bool ok = true;
+
+    pthread_mutex_lock(&handle->lock);
+
+    if (handle->batch == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Trying to commit a batch to database %s without DBBeginBatch()", handle->filename);
+        ok = false;
+    }
+    else if (--handle->batch->depth == 0)
+    {
+        ok = DBBatchEnd(handle);
+    }
+
+    pthread_mutex_unlock(&handle->lock);
+    return ok;
+}
+
+/*****************************************************************************/
+
+bool CompactDB(dbid id)
+{
+    DBHandle *handle;
+    if (!OpenDB(&handle, id))
+    {
+        return false;
+    }
+
+    bool ret = false;
+
+    pthread_mutex_lock(&handle->lock);
+
+    /* Pending changes belong in the compacted file. */
+    if (handle->batch != NULL)
+    {
+        DBBatchFlush(handle);
+    }
+
+    if (handle->open_cursors > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Not compacting database '%s' while it is being iterated",
+            handle->filename);
+    }
+    else
+    {
+        /* Keeps other processes from opening the file while it is replaced. */
+        int lock_fd = DBPathLock(handle->filename);
+        if (lock_fd != -1)
+        {
+            ret = DBPrivCompact(handle->priv);
+            DBPathUnLock(lock_fd);
+        }
+    }
 
     pthread_mutex_unlock(&handle->lock);
+
+    CloseDB(handle);
+    return ret;
 }
 
 /*****************************************************************************/
 
+static bool DBWrite(DBHandle *handle, const void *key, int key_size,
+                    const void *value, int value_size)
+{
+    pthread_mutex_lock(&handle->lock);
+    if (handle->batch != NULL)
+    {
+        bool ret = DBBatchPut(handle, key, key_size, value, value_size);
+        pthread_mutex_unlock(&handle->lock);
+        return ret;
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return DBPrivWrite(handle->priv, key, key_size, value, value_size);
+}
+
+static bool DBDelete(DBHandle *handle, const void *key, int key_size)
+{
+    pthread_mutex_lock(&handle->lock);
+    if (handle->batch != NULL)
+    {
+        bool ret = DBBatchPut(handle, key, key_size, NULL, 0);
+        pthread_mutex_unlock(&handle->lock);
+        return ret;
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return DBPrivDelete(handle->priv, key, key_size);
+}
+
+/*
+ * Looks up the key among pending changes. Returns false if the database
+ * itself has to be asked, otherwise sets *found and copies the value.
+ */
+static bool DBReadPending(DBHandle *handle, const void *key, int key_size,
+                          void *dest, int dest_size, bool *found, int *value_size)
+{
+    pthread_mutex_lock(&handle->lock);
+
+    const DBBatchValue *v = DBBatchLookup(handle, key, key_size);
+    if (v == NULL)
+    {
+        pthread_mutex_unlock(&handle->lock);
+        return false;
+    }
+
+    *found = !v->deleted;
+    *value_size = v->size;
+    if (dest != NULL && *found)
+    {
+        memcpy(dest, v->data, MIN(dest_size, v->size));
+    }
+
+    pthread_mutex_unlock(&handle->lock);
+    return true;
+}
+
 bool ReadComplexKeyDB(DBHandle *handle, const char *key, int key_size,
                       void *dest, int dest_size)
 {
+    bool found;
+    int value_size;
+    if (DBReadPending(handle, key, key_size, dest, dest_size, &found, &value_size))
+    {
+        return found;
+    }
     return DBPrivRead(handle->priv, key, key_size, dest, dest_size);
 }
 
 bool WriteComplexKeyDB(DBHandle *handle, const char *key, int key_size,
                        const void *value, int value_size)
 {
-    return DBPrivWrite(handle->priv, key, key_size, value, value_size);
+    return DBWrite(handle, key, key_size, value, value_size);
 }
 
 bool DeleteComplexKeyDB(DBHandle *handle, const char *key, int key_size)
 {
-    return DBPrivDelete(handle->priv, key, key_size);
+    return DBDelete(handle, key, key_size);
 }
 
 bool ReadDB(DBHandle *handle, const char *key, void *dest, int destSz)
 {
-    return DBPrivRead(handle->priv, key, strlen(key) + 1, dest, destSz);
+    return ReadComplexKeyDB(handle, key, strlen(key) + 1, dest, destSz);
 }
 
 bool WriteDB(DBHandle *handle, const char *key, const void *src, int srcSz)
 {
-    return DBPrivWrite(handle->priv, key, strlen(key) + 1, src, srcSz);
+    return DBWrite(handle, key, strlen(key) + 1, src, srcSz);
 }
 
 bool HasKeyDB(DBHandle *handle, const char *key, int key_size)
 {
+    bool found;
+    int value_size;
+    if (DBReadPending(handle, key, key_size, NULL, 0, &found, &value_size))
+    {
+        return found;
+    }
     return DBPrivHasKey(handle->priv, key, key_size);
 }
 
 int ValueSizeDB(DBHandle *handle, const char *key, int key_size)
 {
+    bool found;
+    int value_size;
+    if (DBReadPending(handle, key, key_size, NULL, 0, &found, &value_size))
+    {
+        return found ? value_size : 0;
+    }
     return DBPrivGetValueSize(handle->priv, key, key_size);
 }
 
 bool DeleteDB(DBHandle *handle, const char *key)
 {
-    return DBPrivDelete(handle->priv, key, strlen(key) + 1);
+    return DBDelete(handle, key, strlen(key) + 1);
 }
 
 bool NewDBCursor(DBHandle *handle, DBCursor **cursor)
 {
+    /* Cursors only see the database, so write out what is pending. */
+    pthread_mutex_lock(&handle->lock);
+    if (handle->batch != NULL)
+    {
+        DBBatchFlush(handle);
+    }
+    /* Counted before it exists, so CompactDB() never waits for it. */
+    handle->open_cursors++;
+    pthread_mutex_unlock(&handle->lock);
+
     DBCursorPriv *priv = DBPrivOpenCursor(handle->priv);
     if (!priv)
     {
+        pthread_mutex_lock(&handle->lock);
+        handle->open_cursors--;
+        pthread_mutex_unlock(&handle->lock);
         return false;
     }
 
     *cursor = xcalloc(1, sizeof(DBCursor));
     (*cursor)->cursor = priv;
+    (*cursor)->handle = handle;
     return true;
 }
 
@@ -332,6 +770,11 @@ bool DBCursorWriteEntry(DBCursor *cursor, const void *value, int value_size)
 bool DeleteDBCursor(DBCursor *cursor)
 {
     DBPrivCloseCursor(cursor->cursor);
+
+    pthread_mutex_lock(&cursor->handle->lock);
+    cursor->handle->open_cursors--;
+    pthread_mutex_unlock(&cursor->handle->lock);
+
     free(cursor);
     return true;
 }
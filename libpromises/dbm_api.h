@@ -84,6 +84,38 @@ bool DBCursorDeleteEntry(CF_DBC *cursor);
 bool DBCursorWriteEntry(CF_DBC *cursor, const void *value, int value_size);
 bool DeleteDBCursor(CF_DBC *dbcp);
 
+/*
+ * Write batching. Between DBBeginBatch() and DBCommitBatch(), writes and
+ * deletes through any handle of this database are kept in memory and applied
+ * in a single transaction when the batch is flushed. Reads see the pending
+ * changes. A flush happens when max_pending changes are queued, when the
+ * oldest queued change is max_delay seconds old (checked on each write),
+ * when a cursor is created, or on DBFlushBatch(). A crash loses at most the
+ * changes of the current batch; the database itself stays consistent.
+ *
+ * DBBeginBatch() keeps the database open until the matching DBCommitBatch(),
+ * so the caller may CloseDB() its own handle in between. Batches nest; only
+ * the outermost DBCommitBatch() flushes.
+ *
+ * Other processes only see batched changes once they are flushed. A child
+ * created by fork() does not inherit the parent's pending changes but keeps
+ * batching its own, and must flush them before _exit().
+ */
+#define DB_BATCH_DEFAULT_MAX_PENDING 1000
+#define DB_BATCH_DEFAULT_MAX_DELAY   5                              /* seconds */
+
+bool DBBeginBatch(CF_DB *dbp, size_t max_pending, time_t max_delay);
+bool DBFlushBatch(CF_DB *dbp);
+bool DBCommitBatch(CF_DB *dbp);
+
+/*
+ * Rewrite the database file without the space left behind by deleted
+ * records. The LMDB backend refuses to compact a database another process
+ * has open. It also compacts on open, when no other process has the
+ * database open and enough of the file is free.
+ */
+bool CompactDB(dbid id);
+
 char *DBIdToPath(const char *workdir, dbid id);
 
 #endif  /* NOT CFENGINE_DBM_API_H */
@@ -40,6 +40,20 @@ struct DBPriv_
     MDB_env *env;
     MDB_dbi dbi;
     MDB_cursor *mc;
+    MDB_txn *batch_txn;
+    pthread_t batch_owner;
+
+    /* A write to the cursor or batch txn ran out of map space */
+    bool map_full;
+
+    /*
+     * LMDB only allows resizing the map or closing the environment while no
+     * transaction of this process is active. Every transaction holds this
+     * lock for reading, resizing and reopening take it for writing.
+     */
+    pthread_rwlock_t env_lock;
+
+    char *path;
 };
 
 struct DBCursorPriv_
@@ -58,45 +72,58 @@ const char *DBPrivGetFileExtension(void)
     return "lmdb";
 }
 
+/* Initial map size. The map grows in steps of doubling when it is full. */
 #ifndef LMDB_MAXSIZE
 #define LMDB_MAXSIZE    104857600
 #endif
 
-DBPriv *DBPrivOpenDB(const char *dbpath)
+#ifndef LMDB_MAX_MAPSIZE
+#define LMDB_MAX_MAPSIZE (SIZE_MAX / 4 < 17179869184ULL ? SIZE_MAX / 4 : 17179869184ULL)
+#endif
+
+/* Files smaller than this are never compacted on open */
+#ifndef LMDB_COMPACT_MIN_SIZE
+#define LMDB_COMPACT_MIN_SIZE (LMDB_MAXSIZE / 10)
+#endif
+
+#define LMDB_COMPACT_DEFAULT_FREE_PERCENT 50
+
+static int OpenEnv(const char *dbpath, MDB_env **env, MDB_dbi *dbi)
 {
-    DBPriv *db = xcalloc(1, sizeof(DBPriv));
     MDB_txn *txn = NULL;
     int rc;
 
-    rc = mdb_env_create(&db->env);
+    rc = mdb_env_create(env);
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not create handle for database %s: %s",
               dbpath, mdb_strerror(rc));
-        goto err;
+        *env = NULL;
+        return rc;
     }
-    rc = mdb_env_set_mapsize(db->env, LMDB_MAXSIZE);
+    /* If the file was grown beyond that, LMDB will use its size */
+    rc = mdb_env_set_mapsize(*env, LMDB_MAXSIZE);
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not set mapsize for database %s: %s",
               dbpath, mdb_strerror(rc));
         goto err;
     }
-    rc = mdb_env_open(db->env, dbpath, MDB_NOSUBDIR, 0644);
+    rc = mdb_env_open(*env, dbpath, MDB_NOSUBDIR, 0644);
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not open database %s: %s",
               dbpath, mdb_strerror(rc));
         goto err;
     }
-    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    rc = mdb_txn_begin(*env, NULL, MDB_RDONLY, &txn);
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not open database txn %s: %s",
               dbpath, mdb_strerror(rc));
         goto err;
     }
-    rc = mdb_open(txn, NULL, 0, &db->dbi);
+    rc = mdb_open(txn, NULL, 0, dbi);
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not open database dbi %s: %s",
@@ -104,23 +131,303 @@ DBPriv *DBPrivOpenDB(const char *dbpath)
         goto err;
     }
     rc = mdb_txn_commit(txn);
+    txn = NULL;
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not commit database dbi %s: %s",
               dbpath, mdb_strerror(rc));
         goto err;
     }
-    txn = NULL;
 
-    return db;
+    return MDB_SUCCESS;
 
 err:
-    if (db->env)
+    if (txn)
     {
-        mdb_env_close(db->env);
+        mdb_txn_abort(txn);
     }
-    free(db);
-    return NULL;
+    mdb_env_close(*env);
+    *env = NULL;
+    return rc;
+}
+
+static size_t GetMapSize(DBPriv *db)
+{
+    MDB_envinfo info;
+    mdb_env_info(db->env, &info);
+    return info.me_mapsize;
+}
+
+/*
+ * Double the map, unless another thread already grew it beyond full_size.
+ * Returns false if the map cannot grow any further.
+ */
+static bool GrowMap(DBPriv *db, size_t full_size)
+{
+    bool ret = true;
+
+    pthread_rwlock_wrlock(&db->env_lock);
+
+    size_t mapsize = GetMapSize(db);
+    if (mapsize <= full_size)
+    {
+        if (mapsize >= LMDB_MAX_MAPSIZE)
+        {
+            Log(LOG_LEVEL_ERR, "Database %s reached the maximum size of %zu bytes",
+                db->path, mapsize);
+            ret = false;
+        }
+        else
+        {
+            size_t new_size = MIN(mapsize * 2, LMDB_MAX_MAPSIZE);
+            int rc = mdb_env_set_mapsize(db->env, new_size);
+            if (rc)
+            {
+                Log(LOG_LEVEL_ERR, "Could not grow database %s to %zu bytes: %s",
+                    db->path, new_size, mdb_strerror(rc));
+                ret = false;
+            }
+            else
+            {
+                Log(LOG_LEVEL_VERBOSE, "Grew map of database %s to %zu bytes",
+                    db->path, new_size);
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&db->env_lock);
+    return ret;
+}
+
+/*
+ * All transactions are started and finished through these, see env_lock.
+ * On failure TxnBegin() returns with the lock released.
+ */
+static int TxnBegin(DBPriv *db, unsigned int flags, MDB_txn **txn)
+{
+    pthread_rwlock_rdlock(&db->env_lock);
+    if (db->env == NULL)
+    {
+        /* Lost when the compacted file could not be opened */
+        pthread_rwlock_unlock(&db->env_lock);
+        return EINVAL;
+    }
+
+    int rc = mdb_txn_begin(db->env, NULL, flags, txn);
+
+    if (rc == MDB_MAP_RESIZED)
+    {
+        /* Another process grew the map, adopt its size */
+        pthread_rwlock_unlock(&db->env_lock);
+        pthread_rwlock_wrlock(&db->env_lock);
+        rc = mdb_env_set_mapsize(db->env, 0);
+        pthread_rwlock_unlock(&db->env_lock);
+
+        pthread_rwlock_rdlock(&db->env_lock);
+        if (rc == MDB_SUCCESS)
+        {
+            rc = mdb_txn_begin(db->env, NULL, flags, txn);
+        }
+    }
+
+    if (rc != MDB_SUCCESS)
+    {
+        pthread_rwlock_unlock(&db->env_lock);
+    }
+    return rc;
+}
+
+static int TxnCommit(DBPriv *db, MDB_txn *txn)
+{
+    int rc = mdb_txn_commit(txn);
+    pthread_rwlock_unlock(&db->env_lock);
+    return rc;
+}
+
+static void TxnAbort(DBPriv *db, MDB_txn *txn)
+{
+    mdb_txn_abort(txn);
+    pthread_rwlock_unlock(&db->env_lock);
+}
+
+static int CompactFreePercent(void)
+{
+    static int threshold = -1;
+
+    if (threshold == -1)
+    {
+        /* 0 disables compaction on open */
+        threshold = LMDB_COMPACT_DEFAULT_FREE_PERCENT;
+
+        const char *perc = getenv("LMDB_COMPACT_FREE_PERCENT");
+        if (perc != NULL)
+        {
+            char *end;
+            long result = strtol(perc, &end, 10);
+            if (!*end && result >= 0 && result <= 100)
+            {
+                threshold = (int)result;
+            }
+        }
+    }
+
+    return threshold;
+}
+
+/* Free pages are reused, but never given back to the file system */
+static bool NeedsCompaction(DBPriv *db)
+{
+    int threshold = CompactFreePercent();
+    if (threshold == 0)
+    {
+        return false;
+    }
+
+    MDB_envinfo info;
+    MDB_stat st;
+    if (mdb_env_info(db->env, &info) != MDB_SUCCESS ||
+        mdb_env_stat(db->env, &st) != MDB_SUCCESS)
+    {
+        return false;
+    }
+
+    size_t pages = info.me_last_pgno + 1;
+    if (pages * st.ms_psize < LMDB_COMPACT_MIN_SIZE)
+    {
+        return false;
+    }
+
+    /* Two meta pages plus the main tree */
+    size_t used = 2 + st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages;
+    return used < pages && (pages - used) * 100 / pages >= (size_t)threshold;
+}
+
+/*
+ * Every process that has the environment open holds a shared lock on the
+ * first byte of the lock file (see mdb_env_excl_lock() in LMDB). F_GETLK
+ * ignores our own locks, so it finds exactly the other processes.
+ */
+static bool EnvInUseElsewhere(DBPriv *db)
+{
+#ifdef __MINGW32__
+    /* No way to tell, so never replace the file under somebody */
+    return true;
+#else
+    char *lock_path = StringFormat("%s-lock", db->path);
+    bool in_use = false;
+
+    int fd = open(lock_path, O_RDWR);
+    if (fd != -1)
+    {
+        struct flock lock = {
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+            .l_start = 0,
+            .l_len = 1,
+        };
+        in_use = fcntl(fd, F_GETLK, &lock) == -1 || lock.l_type != F_UNLCK;
+        close(fd);
+    }
+
+    free(lock_path);
+    return in_use;
+#endif
+}
+
+/*
+ * Copy the live data to a new file and move it over the old one. Changes
+ * committed by another process during the copy would be lost, so this is an
+ * offline operation: it refuses to run while another process has the
+ * database open, and must be called with env_lock held for writing and with
+ * the database path lock, so that nobody opens the file meanwhile.
+ */
+static bool CompactEnv(DBPriv *db)
+{
+#ifdef __MINGW32__
+    Log(LOG_LEVEL_VERBOSE, "Compacting LMDB databases is not supported on this platform");
+    return false;
+#else
+    if (EnvInUseElsewhere(db))
+    {
+        Log(LOG_LEVEL_ERR, "Not compacting database %s, it is in use by another process",
+            db->path);
+        return false;
+    }
+
+    char *tmp_path = StringFormat("%s.compact", db->path);
+    bool ret = false;
+
+    unlink(tmp_path);
+
+# ifdef MDB_CP_COMPACT
+    int rc = mdb_env_copy2(db->env, tmp_path, MDB_CP_COMPACT);
+# else
+    int rc = mdb_env_copy(db->env, tmp_path);
+# endif
+    if (rc)
+    {
+        Log(LOG_LEVEL_ERR, "Could not copy database %s for compaction: %s",
+            db->path, mdb_strerror(rc));
+        unlink(tmp_path);
+        goto out;
+    }
+
+    if (rename(tmp_path, db->path) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not replace database %s with its compacted copy. (rename: %s)",
+            db->path, GetErrorStr());
+        unlink(tmp_path);
+        goto out;
+    }
+
+    /*
+     * The lock file stays. Closing the old environment releases our lock on
+     * it, so the new one opens it exclusively and resets it for the new
+     * file. Both may not be open at once: fcntl() locks are per process.
+     */
+    mdb_env_close(db->env);
+    db->env = NULL;
+
+    if (OpenEnv(db->path, &db->env, &db->dbi) != MDB_SUCCESS)
+    {
+        goto out;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Compacted database %s", db->path);
+    ret = true;
+
+out:
+    free(tmp_path);
+    return ret;
+#endif
+}
+
+DBPriv *DBPrivOpenDB(const char *dbpath)
+{
+    DBPriv *db = xcalloc(1, sizeof(DBPriv));
+
+    if (OpenEnv(dbpath, &db->env, &db->dbi) != MDB_SUCCESS)
+    {
+        free(db);
+        return NULL;
+    }
+
+    pthread_rwlock_init(&db->env_lock, NULL);
+    db->path = xstrdup(dbpath);
+
+    /*
+     * Opening takes the database path lock, so nobody else can open the
+     * file meanwhile. If no other process has it open either, this is the
+     * moment to give the free space back. Otherwise the next open will.
+     */
+    if (NeedsCompaction(db) && !EnvInUseElsewhere(db))
+    {
+        pthread_rwlock_wrlock(&db->env_lock);
+        CompactEnv(db);
+        pthread_rwlock_unlock(&db->env_lock);
+    }
+
+    return db;
 }
 
 void DBPrivCloseDB(DBPriv *db)
@@ -129,9 +436,19 @@ void DBPrivCloseDB(DBPriv *db)
     {
         mdb_env_close(db->env);
     }
+    pthread_rwlock_destroy(&db->env_lock);
+    free(db->path);
     free(db);
 }
 
+bool DBPrivCompact(DBPriv *db)
+{
+    pthread_rwlock_wrlock(&db->env_lock);
+    bool ret = CompactEnv(db);
+    pthread_rwlock_unlock(&db->env_lock);
+    return ret;
+}
+
 bool DBPrivHasKey(DBPriv *db, const void *key, int key_size)
 {
     MDB_val mkey, data;
@@ -139,7 +456,7 @@ bool DBPrivHasKey(DBPriv *db, const void *key, int key_size)
     int rc;
     // FIXME: distinguish between "entry not found" and "error occured"
 
-    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    rc = TxnBegin(db, MDB_RDONLY, &txn);
     if (rc == MDB_SUCCESS)
     {
         mkey.mv_data = (void *)key;
@@ -149,7 +466,7 @@ bool DBPrivHasKey(DBPriv *db, const void *key, int key_size)
         {
             Log(LOG_LEVEL_ERR, "Could not read: %s", mdb_strerror(rc));
         }
-        mdb_txn_abort(txn);
+        TxnAbort(db, txn);
     }
     else
     {
@@ -167,7 +484,7 @@ int DBPrivGetValueSize(DBPriv *db, const void *key, int key_size)
 
     data.mv_size = 0;
 
-    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    rc = TxnBegin(db, MDB_RDONLY, &txn);
     if (rc == MDB_SUCCESS)
     {
         mkey.mv_data = (void *)key;
@@ -177,7 +494,7 @@ int DBPrivGetValueSize(DBPriv *db, const void *key, int key_size)
         {
             Log(LOG_LEVEL_ERR, "Could not read: %s", mdb_strerror(rc));
         }
-        mdb_txn_abort(txn);
+        TxnAbort(db, txn);
     }
     else
     {
@@ -194,7 +511,7 @@ bool DBPrivRead(DBPriv *db, const void *key, int key_size, void *dest, int dest_
     int rc;
     bool ret = false;
 
-    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    rc = TxnBegin(db, MDB_RDONLY, &txn);
     if (rc == MDB_SUCCESS)
     {
         mkey.mv_data = (void *)key;
@@ -213,7 +530,7 @@ bool DBPrivRead(DBPriv *db, const void *key, int key_size, void *dest, int dest_
         {
             Log(LOG_LEVEL_ERR, "Could not read: %s", mdb_strerror(rc));
         }
-        mdb_txn_abort(txn);
+        TxnAbort(db, txn);
     }
     else
     {
@@ -222,95 +539,149 @@ bool DBPrivRead(DBPriv *db, const void *key, int key_size, void *dest, int dest_
     return ret;
 }
 
-bool DBPrivWrite(DBPriv *db, const void *key, int key_size, const void *value, int value_size)
+/* If there's an open cursor or a batch of this thread, use its txn */
+static MDB_txn *GetSharedWriteTxn(DBPriv *db)
 {
-    MDB_val mkey, data;
-    MDB_txn *txn;
-    int rc;
-
-    /* If there's an open cursor, use its txn */
     if (db->mc)
     {
-        txn = mdb_cursor_txn(db->mc);
-        rc = MDB_SUCCESS;
+        return mdb_cursor_txn(db->mc);
     }
-    else
+    if (db->batch_txn && pthread_equal(db->batch_owner, pthread_self()))
     {
-        rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+        return db->batch_txn;
     }
-    if (rc == MDB_SUCCESS)
+    return NULL;
+}
+
+/* Stores data under mkey, or deletes mkey if data is NULL */
+static int Change(DBPriv *db, MDB_txn *txn, MDB_val *mkey, MDB_val *data)
+{
+    int rc;
+    if (data)
     {
-        mkey.mv_data = (void *)key;
-        mkey.mv_size = key_size;
-        data.mv_data = (void *)value;
-        data.mv_size = value_size;
-        rc = mdb_put(txn, db->dbi, &mkey, &data, 0);
-        /* don't commit here if there's a cursor */
-        if (!db->mc)
-        {
-            if (rc == MDB_SUCCESS)
-            {
-                rc = mdb_txn_commit(txn);
-                if (rc)
-                {
-                    Log(LOG_LEVEL_ERR, "Could not commit: %s", mdb_strerror(rc));
-                }
-            }
-            else
-            {
-                Log(LOG_LEVEL_ERR, "Could not write: %s", mdb_strerror(rc));
-                mdb_txn_abort(txn);
-            }
-        }
+        rc = mdb_put(txn, db->dbi, mkey, data, 0);
     }
     else
     {
-        Log(LOG_LEVEL_ERR, "Could not create write txn: %s", mdb_strerror(rc));
+        rc = mdb_del(txn, db->dbi, mkey, NULL);
     }
-    return rc == MDB_SUCCESS;
+
+    if (rc)
+    {
+        Log(rc == MDB_MAP_FULL ? LOG_LEVEL_VERBOSE : LOG_LEVEL_ERR,
+            "Could not %s: %s", data ? "write" : "delete", mdb_strerror(rc));
+    }
+    return rc;
 }
 
-bool DBPrivDelete(DBPriv *db, const void *key, int key_size)
+static int ChangeInTxn(DBPriv *db, MDB_val *mkey, MDB_val *data)
 {
-    MDB_val mkey;
-    MDB_txn *txn;
+    MDB_txn *txn = GetSharedWriteTxn(db);
     int rc;
 
-    /* If there's an open cursor, use its txn */
-    if (db->mc)
-    {
-        txn = mdb_cursor_txn(db->mc);
-        rc = MDB_SUCCESS;
-    } else
+    /* don't commit here if the txn is shared, the map grows when it ends */
+    if (txn)
     {
-        rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+        rc = Change(db, txn, mkey, data);
+        if (rc == MDB_MAP_FULL)
+        {
+            db->map_full = true;
+        }
+        return rc;
     }
-    if (rc == MDB_SUCCESS)
+
+    for (;;)
     {
-        mkey.mv_data = (void *)key;
-        mkey.mv_size = key_size;
-        rc = mdb_del(txn, db->dbi, &mkey, NULL);
-        /* don't commit here if there's a cursor */
-        if (!db->mc)
+        rc = TxnBegin(db, 0, &txn);
+        if (rc)
         {
-            if (rc == MDB_SUCCESS)
-            {
-                rc = mdb_txn_commit(txn);
-                if (rc)
-                {
-                    Log(LOG_LEVEL_ERR, "Could not commit: %s", mdb_strerror(rc));
-                }
-            }
-            else
+            Log(LOG_LEVEL_ERR, "Could not create write txn: %s", mdb_strerror(rc));
+            return rc;
+        }
+
+        size_t mapsize = GetMapSize(db);
+        rc = Change(db, txn, mkey, data);
+        if (rc == MDB_SUCCESS)
+        {
+            rc = TxnCommit(db, txn);
+            if (rc)
             {
-                Log(LOG_LEVEL_ERR, "Could not delete: %s", mdb_strerror(rc));
-                mdb_txn_abort(txn);
+                Log(LOG_LEVEL_ERR, "Could not commit: %s", mdb_strerror(rc));
             }
+            return rc;
+        }
+
+        TxnAbort(db, txn);
+        if (rc != MDB_MAP_FULL || !GrowMap(db, mapsize))
+        {
+            return rc;
         }
     }
-    else
+}
+
+bool DBPrivWrite(DBPriv *db, const void *key, int key_size, const void *value, int value_size)
+{
+    MDB_val mkey, data;
+
+    mkey.mv_data = (void *)key;
+    mkey.mv_size = key_size;
+    data.mv_data = (void *)value;
+    data.mv_size = value_size;
+
+    return ChangeInTxn(db, &mkey, &data) == MDB_SUCCESS;
+}
+
+bool DBPrivDelete(DBPriv *db, const void *key, int key_size)
+{
+    MDB_val mkey;
+
+    mkey.mv_data = (void *)key;
+    mkey.mv_size = key_size;
+
+    return ChangeInTxn(db, &mkey, NULL) == MDB_SUCCESS;
+}
+
+bool DBPrivBeginWriteBatch(DBPriv *db)
+{
+    assert(db->batch_txn == NULL);
+
+    int rc = TxnBegin(db, 0, &db->batch_txn);
+    if (rc)
     {
-        Log(LOG_LEVEL_ERR, "Could not create write txn: %s", mdb_strerror(rc));
+        Log(LOG_LEVEL_ERR, "Could not create batch write txn: %s", mdb_strerror(rc));
+        db->batch_txn = NULL;
+        return false;
+    }
+
+    db->batch_owner = pthread_self();
+    db->map_full = false;
+    return true;
+}
+
+bool DBPrivCommitWriteBatch(DBPriv *db)
+{
+    MDB_txn *txn = db->batch_txn;
+    db->batch_txn = NULL;
+
+    if (txn == NULL)
+    {
+        return true;
+    }
+
+    size_t mapsize = GetMapSize(db);
+
+    /* Also aborts the txn if any write in it failed. */
+    int rc = TxnCommit(db, txn);
+    if (db->map_full)
+    {
+        /* Nothing was written, grow so the caller can retry */
+        db->map_full = false;
+        GrowMap(db, mapsize);
+        return false;
+    }
+    if (rc)
+    {
+        Log(LOG_LEVEL_ERR, "Could not commit batch: %s", mdb_strerror(rc));
     }
     return rc == MDB_SUCCESS;
 }
@@ -321,7 +692,7 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
     MDB_txn *txn;
     int rc;
 
-    rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+    rc = TxnBegin(db, 0, &txn);
     if (rc == MDB_SUCCESS)
     {
         rc = mdb_cursor_open(txn, db->dbi, &db->mc);
@@ -334,7 +705,7 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
         else
         {
             Log(LOG_LEVEL_ERR, "Could not open cursor: %s", mdb_strerror(rc));
-            mdb_txn_abort(txn);
+            TxnAbort(db, txn);
         }
         /* txn remains with cursor */
     }
@@ -415,6 +786,10 @@ bool DBPrivWriteCursorEntry(DBCursorPriv *cursor, const void *value, int value_s
     if ((rc = mdb_cursor_put(cursor->mc, NULL, &data, MDB_CURRENT)) != MDB_SUCCESS)
     {
         Log(LOG_LEVEL_ERR, "Could not write cursor entry: %s", mdb_strerror(rc));
+        if (rc == MDB_MAP_FULL)
+        {
+            cursor->db->map_full = true;
+        }
     }
     return rc == MDB_SUCCESS;
 }
@@ -434,14 +809,23 @@ void DBPrivCloseCursor(DBCursorPriv *cursor)
         mdb_cursor_del(cursor->mc, 0);
     }
 
-    cursor->db->mc = NULL;
+    DBPriv *db = cursor->db;
+    size_t mapsize = GetMapSize(db);
+
+    db->mc = NULL;
     txn = mdb_cursor_txn(cursor->mc);
     mdb_cursor_close(cursor->mc);
-    rc = mdb_txn_commit(txn);
+    rc = TxnCommit(db, txn);
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not commit cursor txn: %s", mdb_strerror(rc));
     }
+    if (db->map_full)
+    {
+        /* The changes are lost, but the next pass will fit */
+        db->map_full = false;
+        GrowMap(db, mapsize);
+    }
     free(cursor);
 }
 
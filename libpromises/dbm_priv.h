@@ -60,6 +60,20 @@ bool DBPrivWrite(DBPriv *db, const void *key, int key_size,
 
 bool DBPrivDelete(DBPriv *db, const void *key, int key_size);
 
+/*
+ * Make the following DBPrivWrite/DBPrivDelete calls from this thread part of
+ * one transaction, until DBPrivCommitWriteBatch(). Implementations without
+ * transactions may apply the writes immediately.
+ */
+bool DBPrivBeginWriteBatch(DBPriv *db);
+bool DBPrivCommitWriteBatch(DBPriv *db);
+
+/*
+ * Give the space of deleted records back to the file system. Called with the
+ * per-database lock held. Returns false if the database was left as it is.
+ */
+bool DBPrivCompact(DBPriv *db);
+
 
 DBCursorPriv *DBPrivOpenCursor(DBPriv *db);
 bool DBPrivAdvanceCursor(DBCursorPriv *cursor, void **key, int *key_size,
@@ -261,6 +261,42 @@ bool DBPrivDelete(DBPriv *db, const void *key, int key_size)
     return true;
 }
 
+/* QDBM has no transactions, writes of a batch are applied one by one. */
+
+bool DBPrivBeginWriteBatch(ARG_UNUSED DBPriv *db)
+{
+    return true;
+}
+
+bool DBPrivCommitWriteBatch(ARG_UNUSED DBPriv *db)
+{
+    return true;
+}
+
+bool DBPrivCompact(DBPriv *db)
+{
+    if (!LockCursor(db))
+    {
+        return false;
+    }
+
+    if (!Lock(db))
+    {
+        UnlockCursor(db);
+        return false;
+    }
+
+    bool ret = dpoptimize(db->depot, -1);
+    if (!ret)
+    {
+        Log(LOG_LEVEL_ERR, "Could not compact QDBM database. (dpoptimize: %s)", dperrmsg(dpecode));
+    }
+
+    Unlock(db);
+    UnlockCursor(db);
+    return ret;
+}
+
 DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
 {
     if (!LockCursor(db))
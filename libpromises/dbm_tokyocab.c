@@ -292,6 +292,47 @@ bool DBPrivDelete(DBPriv *db, const void *key, int key_size)
     return ret;
 }
 
+bool DBPrivBeginWriteBatch(DBPriv *db)
+{
+    if (!tchdbtranbegin(db->hdb))
+    {
+        Log(LOG_LEVEL_ERR, "Could not start batch transaction in Tokyo path '%s'. (tchdbtranbegin: %s)",
+            tchdbpath(db->hdb), ErrorMessage(db->hdb));
+        return false;
+    }
+    return true;
+}
+
+bool DBPrivCommitWriteBatch(DBPriv *db)
+{
+    if (!tchdbtrancommit(db->hdb))
+    {
+        Log(LOG_LEVEL_ERR, "Could not commit batch transaction in Tokyo path '%s'. (tchdbtrancommit: %s)",
+            tchdbpath(db->hdb), ErrorMessage(db->hdb));
+        tchdbtranabort(db->hdb);
+        return false;
+    }
+    return true;
+}
+
+bool DBPrivCompact(DBPriv *db)
+{
+    if (!LockCursor(db))
+    {
+        return false;
+    }
+
+    bool ret = tchdboptimize(db->hdb, -1, -1, -1, false);
+    if (!ret)
+    {
+        Log(LOG_LEVEL_ERR, "Could not compact Tokyo path '%s'. (tchdboptimize: %s)",
+            tchdbpath(db->hdb), ErrorMessage(db->hdb));
+    }
+
+    UnlockCursor(db);
+    return ret;
+}
+
 DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
 {
     if (!LockCursor(db))
@@ -47,6 +47,7 @@ static bool ABORTBUNDLE = false;
 static bool EvalContextStackFrameContainsSoft(const EvalContext *ctx, const char *context);
 static bool EvalContextHeapContainsSoft(const EvalContext *ctx, const char *ns, const char *name);
 static bool EvalContextHeapContainsHard(const EvalContext *ctx, const char *name);
+static void EvalContextClassesChanged(EvalContext *ctx);
 
 
 static StackFrame *LastStackFrame(const EvalContext *ctx, size_t offset)
@@ -127,6 +128,7 @@ void EvalContextHeapAddSoft(EvalContext *ctx, const char *context, const char *n
     }
 
     ClassTablePut(ctx->global_classes, ns, canonified_context, true, CONTEXT_SCOPE_NAMESPACE);
+    EvalContextClassesChanged(ctx);
 
     if (!ABORTBUNDLE)
     {
@@ -206,6 +208,7 @@ static void EvalContextStackFrameAddSoft(EvalContext *ctx, const char *context)
     }
 
     ClassTablePut(frame.classes, frame.owner->ns, context, true, CONTEXT_SCOPE_BUNDLE);
+    EvalContextClassesChanged(ctx);
 
     if (!ABORTBUNDLE)
     {
@@ -270,38 +273,118 @@ static char *EvalVarRef(ARG_UNUSED const char *varname, ARG_UNUSED VarRefType ty
 
 /**********************************************************************/
 
-bool IsDefinedClass(const EvalContext *ctx, const char *context, const char *ns)
+/*
+ * Class expressions are parsed once per EvalContext. Their results are kept
+ * as long as ctx->class_generation does not change.
+ */
+
+#define CLASS_EXPRESSIONS_MAX 10000
+
+typedef struct
+{
+    char *ns;
+    char *expr;
+} ClassExpressionKey;
+
+typedef struct
 {
-    ParseResult res;
+    Expression *expr;                         /* NULL if it failed to parse */
+    bool evaluated;
+    unsigned long generation;                 /* of the result */
+    ExpressionValue result;
+} ClassExpression;
+
+static unsigned int ClassExpressionKeyHash(const void *key, unsigned int seed, unsigned int max)
+{
+    const ClassExpressionKey *k = key;
+    unsigned int ns_hash = StringHash(k->ns ? k->ns : "", seed, 0);
+    return StringHash(k->expr, ns_hash, max);
+}
+
+static bool ClassExpressionKeyEqual(const void *a, const void *b)
+{
+    const ClassExpressionKey *ka = a;
+    const ClassExpressionKey *kb = b;
+    return StringSafeEqual(ka->ns, kb->ns) && strcmp(ka->expr, kb->expr) == 0;
+}
+
+static void ClassExpressionKeyDestroy(void *key)
+{
+    ClassExpressionKey *k = key;
+    free(k->ns);
+    free(k->expr);
+    free(k);
+}
+
+static void ClassExpressionDestroy(void *value)
+{
+    ClassExpression *ce = value;
+    FreeExpression(ce->expr);
+    free(ce);
+}
+
+static ClassExpression *ClassExpressionGet(const EvalContext *ctx, const char *context, const char *ns)
+{
+    ClassExpressionKey lookup = { (char *)ns, (char *)context };
+    ClassExpression *ce = MapGet(ctx->class_expressions, &lookup);
+    if (ce)
+    {
+        return ce;
+    }
+
+    /* Expressions with expanded variables may all differ */
+    if (MapSize(ctx->class_expressions) >= CLASS_EXPRESSIONS_MAX)
+    {
+        MapClear(ctx->class_expressions);
+    }
+
+    ce = xcalloc(1, sizeof(ClassExpression));
+    ce->expr = ParseExpression(context, 0, strlen(context)).result;
+
+    ClassExpressionKey *key = xmalloc(sizeof(ClassExpressionKey));
+    key->ns = ns ? xstrdup(ns) : NULL;
+    key->expr = xstrdup(context);
+    MapInsert(ctx->class_expressions, key, ce);
+
+    return ce;
+}
+
+static void EvalContextClassesChanged(EvalContext *ctx)
+{
+    ctx->class_generation++;
+}
 
+bool IsDefinedClass(const EvalContext *ctx, const char *context, const char *ns)
+{
     if (!context)
     {
         return true;
     }
 
-    res = ParseExpression(context, 0, strlen(context));
+    ClassExpression *ce = ClassExpressionGet(ctx, context, ns);
 
-    if (!res.result)
+    if (!ce->expr)
     {
         Log(LOG_LEVEL_ERR, "Unable to parse class expression '%s'", context);
         return false;
     }
-    else
+
+    if (!ce->evaluated || ce->generation != ctx->class_generation)
     {
         EvalTokenAsClassContext etacc = {
             .ctx = ctx,
             .ns = ns
         };
 
-        ExpressionValue r = EvalExpression(res.result,
-                                           &EvalTokenAsClass, &EvalVarRef,
-                                           &etacc);
-
-        FreeExpression(res.result);
-
-        /* r is EvalResult which could be ERROR */
-        return r == true;
+        ce->result = EvalExpression(ce->expr,
+                                    &EvalTokenAsClass, &EvalVarRef,
+                                    &etacc);
+        ce->generation = ctx->class_generation;
+        ce->evaluated = true;
     }
+
+    /* result is EvalResult which could be ERROR */
+    return ce->result == true;
 }
 
 /**********************************************************************/
@@ -685,6 +768,10 @@ EvalContext *EvalContextNew(void)
 
     ctx->promises_done = PromiseSetNew();
 
+    ctx->class_expressions = MapNew(ClassExpressionKeyHash, ClassExpressionKeyEqual,
+                                    ClassExpressionKeyDestroy, ClassExpressionDestroy);
+    ctx->class_generation = 0;
+
     PromiseLoggingInit(ctx);
 
     return ctx;
@@ -709,6 +796,8 @@ void EvalContextDestroy(EvalContext *ctx)
 
         PromiseSetDestroy(ctx->promises_done);
 
+        MapDestroy(ctx->class_expressions);
+
         free(ctx);
     }
 }
@@ -755,17 +844,20 @@ static bool EvalContextStackFrameContainsSoft(const EvalContext *ctx, const char
 
 bool EvalContextHeapRemoveSoft(EvalContext *ctx, const char *ns, const char *name)
 {
+    EvalContextClassesChanged(ctx);
     return ClassTableRemove(ctx->global_classes, ns, name);
 }
 
 bool EvalContextHeapRemoveHard(EvalContext *ctx, const char *name)
 {
+    EvalContextClassesChanged(ctx);
     return ClassTableRemove(ctx->global_classes, NULL, name);
 }
 
 void EvalContextClear(EvalContext *ctx)
 {
     ClassTableClear(ctx->global_classes);
+    EvalContextClassesChanged(ctx);
 
     VariableTableClear(ctx->global_variables, NULL, NULL, NULL);
     VariableTableClear(ctx->match_variables, NULL, NULL, NULL);
@@ -848,11 +940,18 @@ void EvalContextStackFrameRemoveSoft(EvalContext *ctx, const char *context)
     assert(frame);
 
     ClassTableRemove(frame->data.bundle.classes, frame->data.bundle.owner->ns, context);
+    EvalContextClassesChanged(ctx);
 }
 
 static void EvalContextStackPushFrame(EvalContext *ctx, StackFrame *frame)
 {
     SeqAppend(ctx->stack, frame);
+
+    /* Promise frames don't hide or add classes */
+    if (frame->type == STACK_FRAME_TYPE_BUNDLE || frame->type == STACK_FRAME_TYPE_BODY)
+    {
+        EvalContextClassesChanged(ctx);
+    }
 }
 
 void EvalContextStackPushBundleFrame(EvalContext *ctx, const Bundle *owner, const Rlist *args, bool inherits_previous)
@@ -1012,6 +1111,11 @@ void EvalContextStackPopFrame(EvalContext *ctx)
 
     SeqRemove(ctx->stack, SeqLength(ctx->stack) - 1);
 
+    if (last_frame_type == STACK_FRAME_TYPE_BUNDLE || last_frame_type == STACK_FRAME_TYPE_BODY)
+    {
+        EvalContextClassesChanged(ctx);
+    }
+
     if (GetAgentAbortingContext(ctx))
     {
         FatalError(ctx, "cf-agent aborted on context '%s'", GetAgentAbortingContext(ctx));
@@ -1025,6 +1129,8 @@ void EvalContextStackPopFrame(EvalContext *ctx)
 
 bool EvalContextClassRemove(EvalContext *ctx, const char *ns, const char *name)
 {
+    EvalContextClassesChanged(ctx);
+
     for (size_t i = 0; i < SeqLength(ctx->stack); i++)
     {
         StackFrame *frame = SeqAt(ctx->stack, i);
@@ -1119,6 +1225,7 @@ bool EvalContextClassPut(EvalContext *ctx, const char *ns, const char *name, boo
     case CONTEXT_SCOPE_NONE:
         ProgrammingError("Attempted to add a class without a set scope");
     }
+    EvalContextClassesChanged(ctx);
 
     if (!ABORTBUNDLE)
     {
@@ -1154,6 +1261,23 @@ ClassTableIterator *EvalContextClassTableIteratorNewLocal(const EvalContext *ctx
     return ClassTableIteratorNew(frame->data.bundle.classes, frame->data.bundle.owner->ns, false, true);
 }
 
+ClassTableIterator *EvalContextClassTableIteratorNewGlobalMatching(const EvalContext *ctx, const char *ns, const char *regex,
+                                                                   bool is_hard, bool is_soft)
+{
+    return ClassTableIteratorNewMatching(ctx->global_classes, ns, regex, is_hard, is_soft);
+}
+
+ClassTableIterator *EvalContextClassTableIteratorNewLocalMatching(const EvalContext *ctx, const char *regex)
+{
+    StackFrame *frame = LastStackFrameByType(ctx, STACK_FRAME_TYPE_BUNDLE);
+    if (!frame)
+    {
+        return NULL;
+    }
+
+    return ClassTableIteratorNewMatching(frame->data.bundle.classes, frame->data.bundle.owner->ns, regex, false, true);
+}
+
 const Promise *EvalContextStackCurrentPromise(const EvalContext *ctx)
 {
     StackFrame *frame = LastStackFrameByType(ctx, STACK_FRAME_TYPE_PROMISE_ITERATION);
@@ -1778,9 +1902,9 @@ static void SummarizeTransaction(EvalContext *ctx, TransactionContext tc, const
 {
     if (logname && (tc.log_string))
     {
-        char buffer[CF_EXPANDSIZE];
-
-        ExpandScalar(ctx, NULL, NULL, tc.log_string, buffer);
+        Buffer *expanded = BufferNew();
+        ExpandScalar(ctx, NULL, NULL, tc.log_string, expanded);
+        const char *buffer = BufferData(expanded);
 
         if (strcmp(logname, "udp_syslog") == 0)
         {
@@ -1811,6 +1935,7 @@ static void SummarizeTransaction(EvalContext *ctx, TransactionContext tc, const
             if (fout == NULL)
             {
                 Log(LOG_LEVEL_ERR, "Unable to open private log '%s'", logname);
+                BufferDestroy(&expanded);
                 return;
             }
 
@@ -1820,6 +1945,7 @@ static void SummarizeTransaction(EvalContext *ctx, TransactionContext tc, const
             fclose(fout);
         }
 
+        BufferDestroy(&expanded);
         tc.log_string = NULL;     /* To avoid repetition */
     }
 }
@@ -30,6 +30,7 @@
 #include <writer.h>
 #include <set.h>
 #include <sequence.h>
+#include <map.h>
 #include <var_expressions.h>
 #include <scope.h>
 #include <variable.h>
@@ -104,6 +105,11 @@ struct EvalContext_
     StringSet *dependency_handles;
 
     PromiseSet *promises_done;
+
+    /* Parsed class expressions and their last results, see IsDefinedClass() */
+    Map *class_expressions;
+    /* Changes whenever the set of visible classes may have changed */
+    unsigned long class_generation;
 };
 
 EvalContext *EvalContextNew(void);
@@ -124,6 +130,9 @@ StringSet *EvalContextClassTags(const EvalContext *ctx, const char *ns, const ch
 
 ClassTableIterator *EvalContextClassTableIteratorNewGlobal(const EvalContext *ctx, const char *ns, bool is_hard, bool is_soft);
 ClassTableIterator *EvalContextClassTableIteratorNewLocal(const EvalContext *ctx);
+ClassTableIterator *EvalContextClassTableIteratorNewGlobalMatching(const EvalContext *ctx, const char *ns, const char *regex,
+                                                                   bool is_hard, bool is_soft);
+ClassTableIterator *EvalContextClassTableIteratorNewLocalMatching(const EvalContext *ctx, const char *regex);
 
 void EvalContextClear(EvalContext *ctx);
 
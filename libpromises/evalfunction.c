@@ -672,43 +672,21 @@ static FnCallResult FnCallConcat(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 static FnCallResult FnCallClassMatch(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 {
     const char *regex = RlistScalarValue(finalargs);
+    bool found = false;
     {
-        ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, true);
-        Class *cls = NULL;
-        while ((cls = ClassTableIteratorNext(iter)))
-        {
-            char *expr = ClassRefToString(cls->ns, cls->name);
-
-            if (StringMatchFull(regex, expr))
-            {
-                free(expr);
-                return (FnCallResult) { FNCALL_SUCCESS, { xstrdup("any"), RVAL_TYPE_SCALAR } };
-            }
-
-            free(expr);
-        }
+        ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobalMatching(ctx, NULL, regex, true, true);
+        found = ClassTableIteratorNext(iter) != NULL;
         ClassTableIteratorDestroy(iter);
     }
 
+    if (!found)
     {
-        ClassTableIterator *iter = EvalContextClassTableIteratorNewLocal(ctx);
-        Class *cls = NULL;
-        while ((cls = ClassTableIteratorNext(iter)))
-        {
-            char *expr = ClassRefToString(cls->ns, cls->name);
-
-            if (StringMatchFull(regex, expr))
-            {
-                free(expr);
-                return (FnCallResult) { FNCALL_SUCCESS, { xstrdup("any"), RVAL_TYPE_SCALAR } };
-            }
-
-            free(expr);
-        }
+        ClassTableIterator *iter = EvalContextClassTableIteratorNewLocalMatching(ctx, regex);
+        found = ClassTableIteratorNext(iter) != NULL;
         ClassTableIteratorDestroy(iter);
     }
 
-    return (FnCallResult) { FNCALL_SUCCESS, { xstrdup("!any"), RVAL_TYPE_SCALAR } };
+    return (FnCallResult) { FNCALL_SUCCESS, { xstrdup(found ? "any" : "!any"), RVAL_TYPE_SCALAR } };
 }
 
 /*********************************************************************/
@@ -763,35 +741,19 @@ static FnCallResult FnCallCountClassesMatching(EvalContext *ctx, FnCall *fp, Rli
     unsigned count = 0;
     const char *regex = RlistScalarValue(finalargs);
     {
-        ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, true);
-        Class *cls = NULL;
-        while ((cls = ClassTableIteratorNext(iter)))
+        ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobalMatching(ctx, NULL, regex, true, true);
+        while (ClassTableIteratorNext(iter))
         {
-            char *expr = ClassRefToString(cls->ns, cls->name);
-
-            if (StringMatchFull(regex, expr))
-            {
-                count++;
-            }
-
-            free(expr);
+            count++;
         }
         ClassTableIteratorDestroy(iter);
     }
 
     {
-        ClassTableIterator *iter = EvalContextClassTableIteratorNewLocal(ctx);
-        Class *cls = NULL;
-        while ((cls = ClassTableIteratorNext(iter)))
+        ClassTableIterator *iter = EvalContextClassTableIteratorNewLocalMatching(ctx, regex);
+        while (ClassTableIteratorNext(iter))
         {
-            char *expr = ClassRefToString(cls->ns, cls->name);
-
-            if (StringMatchFull(regex, expr))
-            {
-                count++;
-            }
-
-            free(expr);
+            count++;
         }
         ClassTableIteratorDestroy(iter);
     }
@@ -805,34 +767,31 @@ static StringSet *ClassesMatching(const EvalContext *ctx, ClassTableIterator *it
 {
     StringSet *matching = StringSetNew();
 
-    const char *regex = RlistScalarValue(args);
+    /* The iterator only returns classes matching the regex in args */
     Class *cls = NULL;
     while ((cls = ClassTableIteratorNext(iter)))
     {
         char *expr = ClassRefToString(cls->ns, cls->name);
 
-        if (StringMatchFull(regex, expr))
+        bool pass = true;
+        StringSet *tagset = EvalContextClassTags(ctx, cls->ns, cls->name);
+        for (const Rlist *arg = args->next; (pass && arg); arg = arg->next)
         {
-            bool pass = true;
-            StringSet *tagset = EvalContextClassTags(ctx, cls->ns, cls->name);
-            for (const Rlist *arg = args->next; (pass && arg); arg = arg->next)
+            const char *tag_regex = RlistScalarValue(arg);
+            const char *element = NULL;
+            StringSetIterator it = StringSetIteratorInit(tagset);
+            while ((element = StringSetIteratorNext(&it)))
             {
-                const char *tag_regex = RlistScalarValue(arg);
-                const char *element = NULL;
-                StringSetIterator it = StringSetIteratorInit(tagset);
-                while ((element = StringSetIteratorNext(&it)))
+                if (!StringMatchFull(tag_regex, element))
                 {
-                    if (!StringMatchFull(tag_regex, element))
-                    {
-                        pass = false;
-                    }
+                    pass = false;
                 }
             }
+        }
 
-            if (pass)
-            {
-                StringSetAdd(matching, expr);
-            }
+        if (pass)
+        {
+            StringSetAdd(matching, expr);
         }
         else
         {
@@ -862,7 +821,8 @@ static FnCallResult FnCallClassesMatching(EvalContext *ctx, FnCall *fp, Rlist *f
     Rlist *matches = NULL;
 
     {
-        ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, PromiseGetNamespace(fp->caller), true, true);
+        ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobalMatching(ctx, PromiseGetNamespace(fp->caller),
+                                                                                  RlistScalarValue(finalargs), true, true);
         StringSet *global_matches = ClassesMatching(ctx, iter, finalargs);
 
         StringSetIterator it = StringSetIteratorInit(global_matches);
@@ -877,7 +837,7 @@ static FnCallResult FnCallClassesMatching(EvalContext *ctx, FnCall *fp, Rlist *f
     }
 
     {
-        ClassTableIterator *iter = EvalContextClassTableIteratorNewLocal(ctx);
+        ClassTableIterator *iter = EvalContextClassTableIteratorNewLocalMatching(ctx, RlistScalarValue(finalargs));
         StringSet *local_matches = ClassesMatching(ctx, iter, finalargs);
 
         StringSetIterator it = StringSetIteratorInit(local_matches);
@@ -2037,7 +1997,7 @@ static FnCallResult FnCallLsDir(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 
 static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 {
-    char expbuf[CF_EXPANDSIZE];
+    Buffer *expbuf = BufferNew();
     Rlist *returnlist = NULL;
 
     char *map = RlistScalarValue(finalargs);
@@ -2060,18 +2020,20 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
         {
         case RVAL_TYPE_SCALAR:
             EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "v", var->rval.item, DATA_TYPE_STRING);
+            BufferZero(expbuf);
             ExpandScalar(ctx, PromiseGetBundle(fp->caller)->ns, PromiseGetBundle(fp->caller)->name, map, expbuf);
 
-            if (strstr(expbuf, "$(this.k)") || strstr(expbuf, "${this.k}") ||
-                strstr(expbuf, "$(this.v)") || strstr(expbuf, "${this.v}"))
+            if (strstr(BufferData(expbuf), "$(this.k)") || strstr(BufferData(expbuf), "${this.k}") ||
+                strstr(BufferData(expbuf), "$(this.v)") || strstr(BufferData(expbuf), "${this.v}"))
             {
                 RlistDestroy(returnlist);
                 EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "k");
                 EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
+                BufferDestroy(&expbuf);
                 return (FnCallResult) { FNCALL_FAILURE };
             }
 
-            RlistAppendScalar(&returnlist, expbuf);
+            RlistAppendScalar(&returnlist, BufferData(expbuf));
             EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
             break;
 
@@ -2079,18 +2041,20 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
             for (const Rlist *rp = var->rval.item; rp != NULL; rp = rp->next)
             {
                 EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "v", RlistScalarValue(rp), DATA_TYPE_STRING);
+                BufferZero(expbuf);
                 ExpandScalar(ctx, PromiseGetBundle(fp->caller)->ns, PromiseGetBundle(fp->caller)->name, map, expbuf);
 
-                if (strstr(expbuf, "$(this.k)") || strstr(expbuf, "${this.k}") ||
-                    strstr(expbuf, "$(this.v)") || strstr(expbuf, "${this.v}"))
+                if (strstr(BufferData(expbuf), "$(this.k)") || strstr(BufferData(expbuf), "${this.k}") ||
+                    strstr(BufferData(expbuf), "$(this.v)") || strstr(BufferData(expbuf), "${this.v}"))
                 {
                     RlistDestroy(returnlist);
                     EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "k");
                     EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
+                    BufferDestroy(&expbuf);
                     return (FnCallResult) { FNCALL_FAILURE };
                 }
 
-                RlistAppendScalarIdemp(&returnlist, expbuf);
+                RlistAppendScalarIdemp(&returnlist, BufferData(expbuf));
                 EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
             }
             break;
@@ -2103,6 +2067,7 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
 
     VariableTableIteratorDestroy(iter);
     VarRefDestroy(ref);
+    BufferDestroy(&expbuf);
 
     if (returnlist == NULL)
     {
@@ -2114,7 +2079,6 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
 
 static FnCallResult FnCallMapList(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 {
-    char expbuf[CF_EXPANDSIZE];
     Rlist *newlist = NULL;
     Rval rval;
     DataType retype;
@@ -2148,22 +2112,26 @@ static FnCallResult FnCallMapList(EvalContext *ctx, FnCall *fp, Rlist *finalargs
         return (FnCallResult) { FNCALL_FAILURE };
     }
 
+    Buffer *expbuf = BufferNew();
     for (const Rlist *rp = RvalRlistValue(rval); rp != NULL; rp = rp->next)
     {
         EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "this", RlistScalarValue(rp), DATA_TYPE_STRING);
 
+        BufferZero(expbuf);
         ExpandScalar(ctx, NULL, "this", map, expbuf);
 
-        if (strstr(expbuf, "$(this)") || strstr(expbuf, "${this}"))
+        if (strstr(BufferData(expbuf), "$(this)") || strstr(BufferData(expbuf), "${this}"))
         {
             RlistDestroy(newlist);
             EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "this");
+            BufferDestroy(&expbuf);
             return (FnCallResult) { FNCALL_FAILURE };
         }
 
-        RlistAppendScalar(&newlist, expbuf);
+        RlistAppendScalar(&newlist, BufferData(expbuf));
         EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "this");
     }
+    BufferDestroy(&expbuf);
 
     return (FnCallResult) { FNCALL_SUCCESS, { newlist, RVAL_TYPE_LIST } };
 }
@@ -4691,23 +4659,19 @@ static FnCallResult FnCallReadJson(EvalContext *ctx, FnCall *fp, Rlist *args)
     const char *input_path = RlistScalarValue(args);
     size_t size_max = IntFromString(RlistScalarValue(args->next));
 
-    char *contents = NULL;
-    if (FileReadMax(&contents, input_path, size_max) == -1)
+    JsonElement *json = NULL;
+    JsonParseError err = JsonParseFile(input_path, size_max, &json);
+    if (err == JSON_PARSE_ERROR_READ)
     {
         Log(LOG_LEVEL_ERR, "Error reading JSON input file '%s'", input_path);
         return (FnCallResult) { FNCALL_FAILURE, };
     }
-    JsonElement *json = NULL;
-    const char *data = contents;
-    if (JsonParse(&data, &json) != JSON_PARSE_OK)
+    else if (err != JSON_PARSE_OK)
     {
-        Log(LOG_LEVEL_ERR, "Error parsing JSON file '%s'", input_path);
-        free(contents);
+        Log(LOG_LEVEL_ERR, "Error parsing JSON file '%s': %s", input_path, JsonParseErrorToString(err));
         return (FnCallResult) { FNCALL_FAILURE };
     }
 
-    free(contents);
-
     return (FnCallResult) { FNCALL_SUCCESS, (Rval) { json, RVAL_TYPE_CONTAINER } };
 }
 
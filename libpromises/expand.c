@@ -43,6 +43,7 @@
 #include <string_lib.h>
 #include <conversion.h>
 #include <verify_classes.h>
+#include <map.h>
 
 
 static void ExpandPromiseAndDo(EvalContext *ctx, const Promise *pp, Rlist *lists, Rlist *containers,
@@ -160,12 +161,15 @@ static void ExpandPromiseAndDo(EvalContext *ctx, const Promise *pp, Rlist *lists
     {
         if (handle)
         {
-            char tmp[CF_EXPANDSIZE];
+            Buffer *expanded = BufferNew();
             // This ordering is necessary to get automated canonification
-            ExpandScalar(ctx, NULL, "this", handle, tmp);
+            ExpandScalar(ctx, NULL, "this", handle, expanded);
+            char *tmp = xstrdup(BufferData(expanded));
             CanonifyNameInPlace(tmp);
             Log(LOG_LEVEL_DEBUG, "Expanded handle to '%s'", tmp);
             EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "handle", tmp, DATA_TYPE_STRING);
+            free(tmp);
+            BufferDestroy(&expanded);
         }
         else
         {
@@ -523,7 +527,6 @@ Rlist *ExpandList(EvalContext *ctx, const char *ns, const char *scope, const Rli
 
 Rval ExpandPrivateRval(EvalContext *ctx, const char *ns, const char *scope, Rval rval)
 {
-    char buffer[CF_EXPANDSIZE];
     FnCall *fp, *fpe;
     Rval returnval;
 
@@ -534,10 +537,13 @@ Rval ExpandPrivateRval(EvalContext *ctx, const char *ns, const char *scope, Rval
     switch (rval.type)
     {
     case RVAL_TYPE_SCALAR:
-
-        ExpandScalar(ctx, ns, scope, (char *) rval.item, buffer);
-        returnval.item = xstrdup(buffer);
-        returnval.type = RVAL_TYPE_SCALAR;
+        {
+            Buffer *buffer = BufferNew();
+            ExpandScalar(ctx, ns, scope, (char *) rval.item, buffer);
+            returnval.item = xstrdup(BufferData(buffer));
+            returnval.type = RVAL_TYPE_SCALAR;
+            BufferDestroy(&buffer);
+        }
         break;
 
     case RVAL_TYPE_LIST:
@@ -575,9 +581,11 @@ Rval ExpandBundleReference(EvalContext *ctx, const char *ns, const char *scope,
     {
     case RVAL_TYPE_SCALAR:
         {
-            char buffer[CF_EXPANDSIZE];
+            Buffer *buffer = BufferNew();
             ExpandScalar(ctx, ns, scope, (char *) rval.item, buffer);
-            return RvalNew(buffer, RVAL_TYPE_SCALAR);
+            Rval expanded = RvalNew(BufferData(buffer), RVAL_TYPE_SCALAR);
+            BufferDestroy(&buffer);
+            return expanded;
         }
 
     case RVAL_TYPE_FNCALL:
@@ -595,122 +603,154 @@ Rval ExpandBundleReference(EvalContext *ctx, const char *ns, const char *scope,
 
 /*********************************************************************/
 
-static bool ExpandOverflow(const char *str1, const char *str2)
+/*
+ * A scalar is parsed once into a sequence of literal text and variable
+ * references, so that expanding it again (e.g. on every iteration of a
+ * promise) does not rescan it for "$(" and "${".
+ */
+
+typedef enum
 {
-    int len = strlen(str2);
+    EXPAND_SEGMENT_LITERAL,
+    EXPAND_SEGMENT_VARIABLE
+} ExpandSegmentType;
 
-    if ((strlen(str1) + len) > (CF_EXPANDSIZE - CF_BUFFERMARGIN))
+typedef struct
+{
+    ExpandSegmentType type;
+    size_t offset;          /* Literal: position in the scalar */
+    size_t length;          /* Literal: length */
+    char *name;             /* Variable: text between the brackets */
+    bool nested;            /* Variable: name contains references itself */
+    char close;             /* Variable: ')' or '}' */
+} ExpandSegment;
+
+/* Parsed scalars are kept across expansions, up to this many */
+#define EXPAND_CACHE_MAX 10000
+/* Longer scalars are parsed on each expansion rather than kept */
+#define EXPAND_CACHE_MAX_LENGTH CF_EXPANDSIZE
+
+static Map *EXPAND_CACHE = NULL;
+
+static void ExpandSegmentDestroy(ExpandSegment *segment)
+{
+    if (segment)
     {
-        Log(LOG_LEVEL_ERR,
-            "Expansion overflow constructing string. Increase CF_EXPANDSIZE macro. Tried to add '%s' to '%s'", str2,
-              str1);
-        return true;
+        free(segment->name);
+        free(segment);
     }
-
-    return false;
 }
 
-/*********************************************************************/
-
-bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, char buffer[CF_EXPANDSIZE])
+static void AppendLiteralSegment(Seq *segments, size_t offset, size_t length)
 {
-    Rval rval;
-    int varstring = false;
-    char currentitem[CF_EXPANDSIZE], temp[CF_BUFSIZE], name[CF_MAXVARSIZE];
-    int increment, returnval = true;
-
-    buffer[0] = '\0';
-
-    if (string == 0 || strlen(string) == 0)
+    if (length == 0)
     {
-        return false;
+        return;
     }
 
-    for (const char *sp = string; /* No exit */ ; sp++)     /* check for varitems */
+    /* Merge with the preceding literal, e.g. a stray '$' */
+    ExpandSegment *last = SeqLength(segments) > 0 ? SeqAt(segments, SeqLength(segments) - 1) : NULL;
+    if (last && last->type == EXPAND_SEGMENT_LITERAL && last->offset + last->length == offset)
     {
-        char var[CF_BUFSIZE];
+        last->length += length;
+        return;
+    }
 
-        var[0] = '\0';
+    ExpandSegment *segment = xcalloc(1, sizeof(ExpandSegment));
+    segment->type = EXPAND_SEGMENT_LITERAL;
+    segment->offset = offset;
+    segment->length = length;
+    SeqAppend(segments, segment);
+}
+
+static Seq *ParseScalar(const char *string)
+{
+    Seq *segments = SeqNew(10, ExpandSegmentDestroy);
+    char var[CF_BUFSIZE], name[CF_BUFSIZE];
 
-        increment = 0;
+    const char *sp = string;
+    while (*sp != '\0')
+    {
+        size_t literal = strcspn(sp, "$");
+        AppendLiteralSegment(segments, sp - string, literal);
+        sp += literal;
 
         if (*sp == '\0')
         {
             break;
         }
 
-        currentitem[0] = '\0';
-        StringNotMatchingSetCapped(sp,CF_EXPANDSIZE,"$",currentitem);
-
-        if (ExpandOverflow(buffer, currentitem))
+        if (sp[1] != '(' && sp[1] != '{')
         {
-            FatalError(ctx, "Can't expand varstring");
+            AppendLiteralSegment(segments, sp - string, 1);
+            sp++;
+            continue;
         }
 
-        strlcat(buffer, currentitem, CF_EXPANDSIZE);
-        sp += strlen(currentitem);
-
-        Log(LOG_LEVEL_DEBUG, "  Aggregate result '%s', scanning at '%s' (current delta '%s')", buffer, sp, currentitem);
-
-        if (*sp == '\0')
+        var[0] = '\0';
+        ExtractOuterCf3VarString(sp, var);
+        if (var[0] == '\0')
         {
-            break;
+            AppendLiteralSegment(segments, sp - string, 1);
+            sp++;
+            continue;
         }
 
-        if (*sp == '$')
-        {
-            switch (*(sp + 1))
-            {
-            case '(':
-                ExtractOuterCf3VarString(sp, var);
-                varstring = ')';
-                if (strlen(var) == 0)
-                {
-                    strlcat(buffer, "$", CF_EXPANDSIZE);
-                    continue;
-                }
-                break;
+        name[0] = '\0';
+        ExtractInnerCf3VarString(sp, name);
 
-            case '{':
-                ExtractOuterCf3VarString(sp, var);
-                varstring = '}';
-                if (strlen(var) == 0)
-                {
-                    strlcat(buffer, "$", CF_EXPANDSIZE);
-                    continue;
-                }
-                break;
+        ExpandSegment *segment = xcalloc(1, sizeof(ExpandSegment));
+        segment->type = EXPAND_SEGMENT_VARIABLE;
+        segment->name = xstrdup(name);
+        segment->nested = IsCf3VarString(name);
+        segment->close = (sp[1] == '(') ? ')' : '}';
+        SeqAppend(segments, segment);
 
-            default:
-                strlcat(buffer, "$", CF_EXPANDSIZE);
-                continue;
-            }
-        }
+        sp += strlen(var);
+    }
+
+    return segments;
+}
 
-        currentitem[0] = '\0';
+static void AppendVariableReference(Buffer *out, const char *name, char close)
+{
+    BufferAppend(out, close == '}' ? "${" : "$(", 2);
+    BufferAppend(out, name, strlen(name));
+    BufferAppend(out, &close, 1);
+}
 
-        temp[0] = '\0';
-        ExtractInnerCf3VarString(sp, temp);
+static bool ExpandSegments(const EvalContext *ctx, const char *ns, const char *scope, const char *string,
+                           const Seq *segments, Buffer *out)
+{
+    bool returnval = true;
 
-        if (IsCf3VarString(temp))
+    for (size_t i = 0; i < SeqLength(segments); i++)
+    {
+        const ExpandSegment *segment = SeqAt(segments, i);
+
+        if (segment->type == EXPAND_SEGMENT_LITERAL)
         {
-            Log(LOG_LEVEL_DEBUG, "Nested variables '%s'", temp);
-            ExpandScalar(ctx, ns, scope, temp, currentitem);
+            BufferAppend(out, string + segment->offset, segment->length);
+            continue;
         }
-        else
+
+        const char *name = segment->name;
+        Buffer *nested = NULL;
+        if (segment->nested)
         {
-            Log(LOG_LEVEL_DEBUG, "Delta '%s'", temp);
-            strncpy(currentitem, temp, CF_BUFSIZE - 1);
+            Log(LOG_LEVEL_DEBUG, "Nested variables '%s'", name);
+            nested = BufferNew();
+            ExpandScalar(ctx, ns, scope, name, nested);
+            name = BufferData(nested);
         }
 
-        increment = strlen(var) - 1;
-
-        if (!IsExpandable(currentitem))
+        if (!IsExpandable(name))
         {
+            Rval rval;
             DataType type = DATA_TYPE_NONE;
             bool variable_found = false;
             {
-                VarRef *ref = VarRefParseFromNamespaceAndScope(currentitem, ns, scope, CF_NS, '.');
+                VarRef *ref = VarRefParseFromNamespaceAndScope(name, ns, scope, CF_NS, '.');
                 variable_found = EvalContextVariableGet(ctx, ref, &rval, &type);
                 VarRefDestroy(ref);
             }
@@ -722,13 +762,7 @@ bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, con
                 case DATA_TYPE_STRING:
                 case DATA_TYPE_INT:
                 case DATA_TYPE_REAL:
-
-                    if (ExpandOverflow(buffer, (char *) rval.item))
-                    {
-                        FatalError(ctx, "Can't expand varstring");
-                    }
-
-                    strlcat(buffer, (char *) rval.item, CF_EXPANDSIZE);
+                    BufferAppend(out, rval.item, strlen(rval.item));
                     break;
 
                 case DATA_TYPE_STRING_LIST:
@@ -738,65 +772,85 @@ bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, con
                     if (type == DATA_TYPE_NONE)
                     {
                         Log(LOG_LEVEL_DEBUG,
-                            "Can't expand inexistent variable '%s'", currentitem);
+                            "Can't expand inexistent variable '%s'", name);
                     }
                     else
                     {
                         Log(LOG_LEVEL_DEBUG,
                             "Expecting scalar, can't expand list variable '%s'",
-                            currentitem);
-                    }
-
-                    if (varstring == '}')
-                    {
-                        snprintf(name, CF_MAXVARSIZE, "${%s}", currentitem);
-                    }
-                    else
-                    {
-                        snprintf(name, CF_MAXVARSIZE, "$(%s)", currentitem);
+                            name);
                     }
 
-                    strlcat(buffer, name, CF_EXPANDSIZE);
+                    AppendVariableReference(out, name, segment->close);
                     returnval = false;
                     break;
 
                 default:
-                    Log(LOG_LEVEL_DEBUG, "Returning Unknown Scalar ('%s' => '%s')", string, buffer);
+                    Log(LOG_LEVEL_DEBUG, "Returning Unknown Scalar ('%s' => '%s')", string, BufferData(out));
+                    BufferDestroy(&nested);
                     return false;
-
                 }
             }
             else
             {
-                Log(LOG_LEVEL_DEBUG, "Currently non existent or list variable '%s'", currentitem);
-
-                if (varstring == '}')
-                {
-                    snprintf(name, CF_MAXVARSIZE, "${%s}", currentitem);
-                }
-                else
-                {
-                    snprintf(name, CF_MAXVARSIZE, "$(%s)", currentitem);
-                }
-
-                strlcat(buffer, name, CF_EXPANDSIZE);
+                Log(LOG_LEVEL_DEBUG, "Currently non existent or list variable '%s'", name);
+                AppendVariableReference(out, name, segment->close);
                 returnval = false;
             }
         }
 
-        sp += increment;
-        currentitem[0] = '\0';
+        BufferDestroy(&nested);
     }
 
-    if (returnval)
+    return returnval;
+}
+
+bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, Buffer *out)
+{
+    assert(out);
+
+    /* Expansions are only limited by memory */
+    BufferSetMemoryCap(out, UINT_MAX);
+
+    if (string == NULL || string[0] == '\0')
+    {
+        return false;
+    }
+
+    if (!EXPAND_CACHE)
+    {
+        EXPAND_CACHE = MapNew((MapHashFn)&StringHash, (MapKeyEqualFn)&StringSafeEqual, &free, (MapDestroyDataFn)&SeqDestroy);
+    }
+
+    bool cached = true;
+    Seq *segments = MapGet(EXPAND_CACHE, string);
+    if (!segments)
+    {
+        segments = ParseScalar(string);
+
+        /* Entries are never evicted, since a nested expansion may be using
+         * one, so stop adding once the cache is full. */
+        cached = strlen(string) <= EXPAND_CACHE_MAX_LENGTH && MapSize(EXPAND_CACHE) < EXPAND_CACHE_MAX;
+        if (cached)
+        {
+            MapInsert(EXPAND_CACHE, xstrdup(string), segments);
+        }
+    }
+
+    bool returnval = ExpandSegments(ctx, ns, scope, string, segments, out);
+
+    if (!cached)
     {
-        Log(LOG_LEVEL_DEBUG, "Returning complete scalar expansion ('%s' => '%s')", string, buffer);
+        SeqDestroy(segments);
+    }
 
-        /* Can we be sure this is complete? What about recursion */
+    if (returnval)
+    {
+        Log(LOG_LEVEL_DEBUG, "Returning complete scalar expansion ('%s' => '%s')", string, BufferData(out));
     }
     else
     {
-        Log(LOG_LEVEL_DEBUG, "Returning partial / best effort scalar expansion ('%s' => '%s')", string, buffer);
+        Log(LOG_LEVEL_DEBUG, "Returning partial / best effort scalar expansion ('%s' => '%s')", string, BufferData(out));
     }
 
     return returnval;
@@ -28,6 +28,7 @@
 #include <cf3.defs.h>
 #include <generic_agent.h>
 #include <actuator.h>
+#include <buffer.h>
 
 PromiseResult CommonEvalPromise(EvalContext *ctx, Promise *pp, void *param);
 
@@ -38,7 +39,14 @@ void MapIteratorsFromRval(EvalContext *ctx, const char *scope, Rval rval, Rlist
 
 bool IsExpandable(const char *str);
 
-bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, char buffer[CF_EXPANDSIZE]);
+/**
+ * @brief Appends the expansion of the scalar string to out.
+ *
+ * Variables that cannot be resolved are left as references. The expansion
+ * has no size limit, so the memory cap of out is lifted.
+ * @return True if every variable in string could be expanded
+ */
+bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, Buffer *out);
 Rval ExpandBundleReference(EvalContext *ctx, const char *ns, const char *scope, Rval rval);
 Rval ExpandPrivateRval(EvalContext *ctx, const char *ns, const char *scope, Rval rval);
 Rlist *ExpandList(EvalContext *ctx, const char *ns, const char *scope, const Rlist *list, int expandnaked);
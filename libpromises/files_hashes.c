@@ -30,6 +30,8 @@
 #include <files_lib.h>
 #include <rlist.h>
 #include <policy.h>
+#include <map.h>
+#include <string_lib.h>
 
 static const char *CF_DIGEST_TYPES[10][2] =
 {
@@ -59,33 +61,57 @@ static const int CF_DIGEST_SIZES[10] =
     0
 };
 
+#define HASH_FILE_BUFFER_SIZE (128 * 1024)
+
 void HashFile(const char *filename, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type)
 {
-    FILE *file;
+    int fd;
     EVP_MD_CTX context;
-    int len, md_len;
-    unsigned char buffer[1024];
+    ssize_t len;
+    int md_len;
     const EVP_MD *md = NULL;
 
-    if ((file = fopen(filename, "rb")) == NULL)
+    if ((fd = open(filename, O_RDONLY | O_BINARY)) == -1)
     {
-        Log(LOG_LEVEL_INFO, "Cannot open file for hashing '%s'. (fopen: %s)", filename, GetErrorStr());
+        Log(LOG_LEVEL_INFO, "Cannot open file for hashing '%s'. (open: %s)", filename, GetErrorStr());
     }
     else
     {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        /* Large reads keep the number of system calls per file low */
+        unsigned char *buffer = xmalloc(HASH_FILE_BUFFER_SIZE);
+
         md = EVP_get_digestbyname(FileHashName(type));
 
         EVP_DigestInit(&context, md);
 
-        while ((len = fread(buffer, 1, 1024, file)))
+        for (;;)
+        {
+            len = read(fd, buffer, HASH_FILE_BUFFER_SIZE);
+
+            if (len > 0)
+            {
+                EVP_DigestUpdate(&context, buffer, len);
+            }
+            else if ((len == 0) || (errno != EINTR))
+            {
+                break;
+            }
+        }
+
+        if (len < 0)
         {
-            EVP_DigestUpdate(&context, buffer, len);
+            Log(LOG_LEVEL_INFO, "Error while reading file for hashing '%s'. (read: %s)", filename, GetErrorStr());
         }
 
         EVP_DigestFinal(&context, digest, &md_len);
 
         /* Digest length stored in md_len */
-        fclose(file);
+        free(buffer);
+        close(fd);
     }
 }
 
@@ -258,3 +284,431 @@ HashMethod HashMethodFromString(char *typestr)
 
     return HASH_METHOD_NONE;
 }
+
+/*******************************************************************/
+/* File hash pool                                                  */
+/*******************************************************************/
+
+#define FILE_HASH_POOL_MAX_THREADS 8
+#define FILE_HASH_POOL_MAX_JOBS 4096
+
+typedef enum
+{
+    FILE_HASH_JOB_PENDING,
+    FILE_HASH_JOB_RUNNING,
+    FILE_HASH_JOB_DONE
+} FileHashJobState;
+
+typedef struct FileHashJob_ FileHashJob;
+
+struct FileHashJob_
+{
+    char *key;
+    char *path;
+    HashMethod type;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    FileHashJobState state;
+    bool discarded;             /* Removed by its worker once done */
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    FileHashJob *next;          /* Queue of pending jobs */
+};
+
+struct FileHashPool_
+{
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t done;
+    pthread_t *threads;
+    size_t thread_count;
+    bool shutdown;
+
+    Map *jobs;                  /* key -> FileHashJob */
+    FileHashJob *head;
+    FileHashJob *tail;
+
+    double started;
+    size_t files;
+    size_t skipped;
+    unsigned long long bytes;
+};
+
+static double FileHashPoolNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *FileHashJobKey(const char *path, HashMethod type)
+{
+    char *key;
+    xasprintf(&key, "%s:%s", FileHashName(type), path);
+    return key;
+}
+
+static bool FileHashJobMatches(const FileHashJob *job, const struct stat *sb)
+{
+    return (job->dev == sb->st_dev) && (job->ino == sb->st_ino) && (job->size == sb->st_size) &&
+        (job->mtime == sb->st_mtime) && (job->ctime == sb->st_ctime);
+}
+
+static void FileHashJobDestroy(FileHashJob *job)
+{
+    if (job)
+    {
+        free(job->key);
+        free(job->path);
+        free(job);
+    }
+}
+
+/* Called with the pool lock held */
+static FileHashJob *FileHashPoolDequeue(FileHashPool *pool)
+{
+    FileHashJob *job = pool->head;
+
+    if (job)
+    {
+        pool->head = job->next;
+        if (pool->head == NULL)
+        {
+            pool->tail = NULL;
+        }
+        job->next = NULL;
+    }
+
+    return job;
+}
+
+/* Called with the pool lock held */
+static void FileHashPoolUnqueue(FileHashPool *pool, FileHashJob *job)
+{
+    FileHashJob *prev = NULL;
+
+    for (FileHashJob *ip = pool->head; ip != NULL; prev = ip, ip = ip->next)
+    {
+        if (ip == job)
+        {
+            if (prev)
+            {
+                prev->next = ip->next;
+            }
+            else
+            {
+                pool->head = ip->next;
+            }
+
+            if (pool->tail == ip)
+            {
+                pool->tail = prev;
+            }
+
+            ip->next = NULL;
+            return;
+        }
+    }
+}
+
+static void *FileHashPoolWorker(void *arg)
+{
+    FileHashPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;)
+    {
+        while (!pool->shutdown && (pool->head == NULL))
+        {
+            pthread_cond_wait(&pool->queued, &pool->lock);
+        }
+
+        if (pool->shutdown)
+        {
+            break;
+        }
+
+        FileHashJob *job = FileHashPoolDequeue(pool);
+        job->state = FILE_HASH_JOB_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+
+        HashFile(job->path, job->digest, job->type);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = FILE_HASH_JOB_DONE;
+        pool->files++;
+        pool->bytes += job->size;
+        if (job->discarded)
+        {
+            MapRemove(pool->jobs, job->key);
+        }
+        pthread_cond_broadcast(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+FileHashPool *FileHashPoolNew(size_t threads)
+{
+    if (threads == 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (size_t) cpus : 1;
+#else
+        threads = 1;
+#endif
+    }
+
+    threads = MIN(threads, FILE_HASH_POOL_MAX_THREADS);
+
+    FileHashPool *pool = xcalloc(1, sizeof(FileHashPool));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->jobs = MapNew((MapHashFn) &StringHash, (MapKeyEqualFn) &StringSafeEqual,
+                        NULL, (MapDestroyDataFn) &FileHashJobDestroy);
+    pool->threads = xcalloc(threads, sizeof(pthread_t));
+    pool->started = FileHashPoolNow();
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        int ret = pthread_create(&pool->threads[pool->thread_count], NULL, &FileHashPoolWorker, pool);
+
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Unable to start file hashing thread. (pthread_create: %s)", GetErrorStrFromCode(ret));
+            break;
+        }
+
+        pool->thread_count++;
+    }
+
+    return pool;
+}
+
+bool FileHashPoolSubmit(FileHashPool *pool, const char *path, const struct stat *sb, HashMethod type)
+{
+    if ((pool == NULL) || (pool->thread_count == 0))
+    {
+        return false;
+    }
+
+    char *key = FileHashJobKey(path, type);
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (MapHasKey(pool->jobs, key) || (MapSize(pool->jobs) >= FILE_HASH_POOL_MAX_JOBS))
+    {
+        pthread_mutex_unlock(&pool->lock);
+        free(key);
+        return false;
+    }
+
+    FileHashJob *job = xcalloc(1, sizeof(FileHashJob));
+    job->key = key;
+    job->path = xstrdup(path);
+    job->type = type;
+    job->dev = sb->st_dev;
+    job->ino = sb->st_ino;
+    job->size = sb->st_size;
+    job->mtime = sb->st_mtime;
+    job->ctime = sb->st_ctime;
+    job->state = FILE_HASH_JOB_PENDING;
+
+    MapInsert(pool->jobs, job->key, job);
+
+    if (pool->tail)
+    {
+        pool->tail->next = job;
+    }
+    else
+    {
+        pool->head = job;
+    }
+    pool->tail = job;
+
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+bool FileHashPoolGet(FileHashPool *pool, const char *path, const struct stat *sb, HashMethod type,
+                     unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    if (pool == NULL)
+    {
+        return false;
+    }
+
+    char *key = FileHashJobKey(path, type);
+    bool found = false;
+
+    pthread_mutex_lock(&pool->lock);
+
+    FileHashJob *job = MapGet(pool->jobs, key);
+
+    if (job && job->discarded)
+    {
+        /* Its worker frees it */
+        job = NULL;
+    }
+
+    if (job && (job->state == FILE_HASH_JOB_PENDING))
+    {
+        /* No worker has picked it up yet, hash it right here */
+        FileHashPoolUnqueue(pool, job);
+        job->state = FILE_HASH_JOB_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+
+        HashFile(job->path, job->digest, job->type);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = FILE_HASH_JOB_DONE;
+        pool->files++;
+        pool->bytes += job->size;
+    }
+
+    if (job)
+    {
+        while (job->state != FILE_HASH_JOB_DONE)
+        {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+
+        /* The file may have changed since it was submitted */
+        if (FileHashJobMatches(job, sb))
+        {
+            memcpy(digest, job->digest, EVP_MAX_MD_SIZE + 1);
+            found = true;
+        }
+
+        MapRemove(pool->jobs, key);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    free(key);
+
+    return found;
+}
+
+static bool FileHashJobInDir(const FileHashJob *job, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    if (strncmp(job->path, dir, len) != 0)
+    {
+        return false;
+    }
+
+    const char *leaf = job->path + len;
+    if ((len > 0) && (dir[len - 1] != '/'))
+    {
+        if (*leaf != '/')
+        {
+            return false;
+        }
+        leaf++;
+    }
+
+    return strchr(leaf, '/') == NULL;
+}
+
+void FileHashPoolDiscard(FileHashPool *pool, const char *dir)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    /* Not removed while iterating the map */
+    FileHashJob **stale = xcalloc(MapSize(pool->jobs) + 1, sizeof(FileHashJob *));
+    size_t count = 0;
+
+    MapIterator it = MapIteratorInit(pool->jobs);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&it)))
+    {
+        FileHashJob *job = item->value;
+        if (!job->discarded && FileHashJobInDir(job, dir))
+        {
+            stale[count++] = job;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        FileHashJob *job = stale[i];
+
+        if (job->state == FILE_HASH_JOB_RUNNING)
+        {
+            job->discarded = true;
+            continue;
+        }
+
+        if (job->state == FILE_HASH_JOB_PENDING)
+        {
+            FileHashPoolUnqueue(pool, job);
+        }
+        MapRemove(pool->jobs, job->key);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    free(stale);
+}
+
+void FileHashPoolSkipped(FileHashPool *pool)
+{
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->skipped++;
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void FileHashPoolDestroy(FileHashPool *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->thread_count; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    double elapsed = FileHashPoolNow() - pool->started;
+    double megabytes = pool->bytes / (1024.0 * 1024.0);
+
+    if (pool->files > 0 || pool->skipped > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Hashed %zu files (%.1f MB) with %zu threads in %.3f seconds, %.1f MB/s, %.1f files/s, "
+            "%zu files unchanged since last hashed",
+            pool->files, megabytes, pool->thread_count, elapsed,
+            elapsed > 0 ? megabytes / elapsed : 0.0, elapsed > 0 ? pool->files / elapsed : 0.0,
+            pool->skipped);
+    }
+
+    MapDestroy(pool->jobs);
+    free(pool->threads);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
@@ -38,4 +38,42 @@ const char *FileHashName(HashMethod id);
 void HashPubKey(RSA *key, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type);
 HashMethod HashMethodFromString(char *typestr);
 
+typedef struct FileHashPool_ FileHashPool;
+
+/**
+ * @brief Bounded pool of threads hashing files ahead of their use, e.g.
+ *        while a recursive files promise walks a tree.
+ * @param threads Number of threads, 0 for one per CPU (at most 8).
+ */
+FileHashPool *FileHashPoolNew(size_t threads);
+
+/**
+ * @brief Queue a file for hashing.
+ * @return false if the pool is full or the file is already queued.
+ */
+bool FileHashPoolSubmit(FileHashPool *pool, const char *path, const struct stat *sb, HashMethod type);
+
+/**
+ * @brief Collect the digest of a submitted file, waiting for it if needed.
+ * @return false if the file was not submitted or its stat has changed since.
+ */
+bool FileHashPoolGet(FileHashPool *pool, const char *path, const struct stat *sb, HashMethod type,
+                     unsigned char digest[EVP_MAX_MD_SIZE + 1]);
+
+/**
+ * @brief Drop the jobs for files directly in #dir that were not collected,
+ *        so they do not take up the room of later ones.
+ */
+void FileHashPoolDiscard(FileHashPool *pool, const char *dir);
+
+/**
+ * @brief Account for a file that needed no hashing since it is unchanged.
+ */
+void FileHashPoolSkipped(FileHashPool *pool);
+
+/**
+ * @brief Stop the threads and log the throughput of the pool.
+ */
+void FileHashPoolDestroy(FileHashPool *pool);
+
 #endif
@@ -356,12 +356,139 @@ bool MakeParentDirectory(const char *parentandchild, bool force)
     return true;
 }
 
-int LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits)
+/* Called with each line, without its newline. Returns false to stop reading. */
+typedef bool (*FileLineFn)(const char *line, size_t length, void *data);
+
+typedef struct
+{
+    FileLineFn line_fn;
+    void *data;
+    bool joinlines;
+    char *joined;
+    size_t joined_length;
+    size_t joined_capacity;
+} FileLineSplitter;
+
+static void JoinedAppend(FileLineSplitter *splitter, const char *line, size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    if (splitter->joined_length + length > splitter->joined_capacity)
+    {
+        splitter->joined_capacity = MAX(splitter->joined_capacity * 2, splitter->joined_length + length);
+        splitter->joined = xrealloc(splitter->joined, splitter->joined_capacity);
+    }
+    memcpy(splitter->joined + splitter->joined_length, line, length);
+    splitter->joined_length += length;
+}
+
+static bool SplitterLine(FileLineSplitter *splitter, const char *line, size_t length)
+{
+    /* Like fgets() and strlen(), a line ends at a NUL byte */
+    length = strnlen(line, length);
+
+    if (splitter->joinlines && length > 0 && line[length - 1] == '\\')
+    {
+        JoinedAppend(splitter, line, length - 1);
+        return true;
+    }
+
+    if (splitter->joined_length > 0)
+    {
+        JoinedAppend(splitter, line, length);
+        size_t joined_length = splitter->joined_length;
+        splitter->joined_length = 0;
+        return splitter->line_fn(splitter->joined, joined_length, splitter->data);
+    }
+
+    return splitter->line_fn(line, length, splitter->data);
+}
+
+/**
+ * Splits contents into lines and hands them to the splitter. A last line
+ * without a newline is a line unless empty. Returns false if stopped early.
+ */
+static bool SplitterFeed(FileLineSplitter *splitter, const char *contents, size_t size)
+{
+    const char *end = contents + size;
+    const char *line = contents;
+
+    while (line < end)
+    {
+        const char *nl = memchr(line, '\n', end - line);
+        const char *line_end = nl ? nl : end;
+
+        if (!SplitterLine(splitter, line, line_end - line))
+        {
+            return false;
+        }
+
+        line = line_end + 1;
+    }
+
+    /* A continuation on the last line joins with nothing */
+    if (splitter->joined_length > 0)
+    {
+        return SplitterLine(splitter, "", 0);
+    }
+
+    return true;
+}
+
+static bool ReadFileSplit(int fd, const char *file, size_t size_hint, FileLineSplitter *splitter)
+{
+    /* The file may grow while we read it, so read until end of file */
+    size_t capacity = size_hint + 1;
+    size_t size = 0;
+    char *contents = xmalloc(capacity);
+
+    for (;;)
+    {
+        if (size == capacity)
+        {
+            capacity *= 2;
+            contents = xrealloc(contents, capacity);
+        }
+
+        ssize_t res = read(fd, contents + size, capacity - size);
+        if (res == 0)
+        {
+            break;
+        }
+
+        if (res == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            Log(LOG_LEVEL_ERR, "Unable to read contents of '%s'. (read: %s)", file, GetErrorStr());
+            free(contents);
+            return false;
+        }
+
+        size += res;
+    }
+
+    SplitterFeed(splitter, contents, size);
+    free(contents);
+    return true;
+}
+
+/**
+ * Reads file and calls line_fn with each line, or with each run of lines
+ * ending in a backslash joined together if edits.joinlines. Unlike reading
+ * with CfReadLine(), lines are not limited in length.
+ *
+ * @return False if the file could not be read or is not to be edited.
+ */
+static bool ForEachFileLine(const char *file, EditDefaults edits, FileLineFn line_fn, void *data)
 {
-    FILE *fp;
     struct stat statbuf;
-    char line[CF_BUFSIZE], concat[CF_BUFSIZE];
-    int join = false;
 
     if (stat(file, &statbuf) == -1)
     {
@@ -382,73 +509,99 @@ int LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits)
         return false;
     }
 
-    if ((fp = fopen(file, "r")) == NULL)
+    int fd = open(file, O_RDONLY);
+    if (fd == -1)
     {
-        Log(LOG_LEVEL_INFO, "Couldn't read file '%s' for editing. (fopen: %s)", file, GetErrorStr());
+        Log(LOG_LEVEL_INFO, "Couldn't read file '%s' for editing. (open: %s)", file, GetErrorStr());
         return false;
     }
 
-    memset(line, 0, CF_BUFSIZE);
-    memset(concat, 0, CF_BUFSIZE);
+    FileLineSplitter splitter = { .line_fn = line_fn, .data = data, .joinlines = edits.joinlines };
 
-    for (;;)
+    if (fstat(fd, &statbuf) == -1)
     {
-        ssize_t res = CfReadLine(line, CF_BUFSIZE, fp);
-        if (res == 0)
-        {
-            break;
-        }
+        statbuf.st_size = 0;
+    }
 
-        if (res == -1)
-        {
-            Log(LOG_LEVEL_ERR, "Unable to read contents of '%s'. (fread: %s)", file, GetErrorStr());
-            fclose(fp);
-            return false;
-        }
+    /* Not mapped: the file may be truncated under us, and a mapping would then fault */
+    bool ok = ReadFileSplit(fd, file, statbuf.st_size, &splitter);
 
-        if (edits.joinlines && *(line + strlen(line) - 1) == '\\')
-        {
-            join = true;
-        }
-        else
-        {
-            join = false;
-        }
+    free(splitter.joined);
+    close(fd);
+    return ok;
+}
 
-        if (join)
-        {
-            *(line + strlen(line) - 1) = '\0';
+typedef struct
+{
+    Item **liststart;
+    Item *tail;
+} ItemListAppender;
 
-            if (strlcat(concat, line, CF_BUFSIZE) >= CF_BUFSIZE)
-            {
-                Log(LOG_LEVEL_ERR, "Internal limit 3: Buffer ran out of space constructing string. Tried to add '%s' to '%s'",
-                    concat, line);
-            }
-        }
-        else
-        {
-            if (strlcat(concat, line, CF_BUFSIZE) >= CF_BUFSIZE)
-            {
-                Log(LOG_LEVEL_ERR, "Internal limit 3: Buffer ran out of space constructing string. Tried to add '%s' to '%s'",
-                    concat, line);
-            }
+static bool AppendLine(const char *line, size_t length, void *data)
+{
+    ItemListAppender *appender = data;
 
-            if (!feof(fp) || (strlen(concat) != 0))
-            {
-                AppendItem(liststart, concat, NULL);
-            }
+    Item *ip = xcalloc(1, sizeof(Item));
+    ip->name = xstrndup(line, length);
 
-            concat[0] = '\0';
-            join = false;
-        }
+    if (appender->tail == NULL)
+    {
+        *appender->liststart = ip;
+    }
+    else
+    {
+        appender->tail->next = ip;
+    }
+    appender->tail = ip;
+
+    return true;
+}
+
+int LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits)
+{
+    ItemListAppender appender = { .liststart = liststart, .tail = NULL };
 
-        line[0] = '\0';
+    if (*liststart != NULL)
+    {
+        appender.tail = EndOfList(*liststart);
     }
 
-    fclose(fp);
+    return ForEachFileLine(file, edits, &AppendLine, &appender);
+}
+
+typedef struct
+{
+    const Item *next;
+    bool equal;
+} ItemListComparer;
+
+static bool CompareLine(const char *line, size_t length, void *data)
+{
+    ItemListComparer *comparer = data;
+
+    if (comparer->next == NULL ||
+        strncmp(comparer->next->name, line, length) != 0 || comparer->next->name[length] != '\0')
+    {
+        comparer->equal = false;
+        return false;
+    }
+
+    comparer->next = comparer->next->next;
     return true;
 }
 
+bool FileEqualsItemList(const char *file, const Item *list, EditDefaults edits)
+{
+    ItemListComparer comparer = { .next = list, .equal = true };
+
+    if (!ForEachFileLine(file, edits, &CompareLine, &comparer))
+    {
+        return false;
+    }
+
+    return comparer.equal && comparer.next == NULL;
+}
+
 static bool DeleteDirectoryTreeInternal(const char *basepath, const char *path)
 {
     Dir *dirh = DirOpen(path);
@@ -32,6 +32,13 @@ bool FileWriteOver(char *filename, char *contents);
 
 int LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits);
 
+/**
+ * @brief Compares the lines of a file, read as by LoadFileAsItemList(), to a
+ *        list without loading the file, stopping at the first difference.
+ * @return False if they differ or the file could not be read.
+ */
+bool FileEqualsItemList(const char *file, const Item *list, EditDefaults edits);
+
 bool MakeParentDirectory(const char *parentandchild, bool force);
 int MakeParentDirectory2(char *parentandchild, int force, bool enforce_promise);
 
@@ -32,6 +32,7 @@
 #include <evalfunction.h>
 #include <policy.h>
 #include <string_lib.h>
+#include <profiler.h>
 
 
 /*******************************************************************/
@@ -175,7 +176,9 @@ FnCallResult FnCallEvaluate(EvalContext *ctx, FnCall *fp, const Promise *caller)
 
     fp->caller = caller;
 
+    ProfilerEnter(PROFILE_FRAME_FUNCTION, NULL, fp->name);
     FnCallResult result = CallFunction(ctx, fp_type, fp, expargs);
+    ProfilerLeave();
 
     if (result.status == FNCALL_FAILURE)
     {
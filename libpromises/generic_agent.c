@@ -28,6 +28,7 @@
 #include <sysinfo.h>
 #include <env_context.h>
 #include <policy.h>
+#include <policy_cache.h>
 #include <promises.h>
 #include <files_lib.h>
 #include <files_names.h>
@@ -620,6 +621,12 @@ Policy *GenericAgentLoadPolicy(EvalContext *ctx, GenericAgentConfig *config)
         SeqDestroy(errors);
     }
 
+    /* Only a policy that passed validation is precompiled for the agents */
+    if (config->agent_type == AGENT_TYPE_COMMON)
+    {
+        PolicyCacheCommit();
+    }
+
     if (LogGetGlobalLevel() >= LOG_LEVEL_VERBOSE)
     {
         ShowContext(ctx);
@@ -941,35 +948,43 @@ static Policy *Cf3ParseFile(const GenericAgentConfig *config, const char *input_
     Policy *policy = NULL;
     if (StringEndsWith(input_path, ".json"))
     {
-        char *contents = NULL;
-        if (FileReadMax(&contents, input_path, SIZE_MAX) == -1)
+        JsonElement *json_policy = NULL;
+        JsonParseError err = JsonParseFile(input_path, SIZE_MAX, &json_policy);
+        if (err == JSON_PARSE_ERROR_READ)
         {
             Log(LOG_LEVEL_ERR, "Error reading JSON input file '%s'", input_path);
             return NULL;
         }
-        JsonElement *json_policy = NULL;
-        const char *data = contents; // TODO: need to fix JSON parser signature, just silly
-        if (JsonParse(&data, &json_policy) != JSON_PARSE_OK)
+        else if (err != JSON_PARSE_OK)
         {
-            Log(LOG_LEVEL_ERR, "Error parsing JSON input file '%s'", input_path);
-            free(contents);
+            Log(LOG_LEVEL_ERR, "Error parsing JSON input file '%s': %s", input_path, JsonParseErrorToString(err));
             return NULL;
         }
 
         policy = PolicyFromJson(json_policy);
 
         JsonDestroy(json_policy);
-        free(contents);
     }
     else
     {
         if (config->agent_type == AGENT_TYPE_COMMON)
         {
-            policy = ParserParseFile(input_path, config->agent_specific.common.parser_warnings, config->agent_specific.common.parser_warnings_error);
+            unsigned char digest[EVP_MAX_MD_SIZE + 1];
+
+            policy = ParserParseFileDigest(input_path, config->agent_specific.common.parser_warnings,
+                                           config->agent_specific.common.parser_warnings_error, digest);
+            if (policy)
+            {
+                PolicyCacheStage(input_path, digest, policy);
+            }
         }
         else
         {
-            policy = ParserParseFile(input_path, 0, 0);
+            policy = PolicyCacheLoad(input_path);
+            if (!policy)
+            {
+                policy = ParserParseFile(input_path, 0, 0);
+            }
         }
     }
 
@@ -26,6 +26,7 @@
 
 #include <keyring.h>
 #include <dir.h>
+#include <crypto.h>
 
 /***************************************************************/
 
@@ -109,6 +110,12 @@ int RemovePublicKey(const char *id)
     }
 
     DirClose(dirh);
+
+    if (removed > 0)
+    {
+        PublicKeyCacheFlush();
+    }
+
     return removed;
 }
 /***************************************************************/
@@ -292,7 +292,7 @@ static void RemoveDates(char *s)
     }
 }
 
-static int RemoveLock(char *name)
+static int RemoveLock(char *name, bool flush)
 {
     CF_DB *dbp;
 
@@ -303,6 +303,10 @@ static int RemoveLock(char *name)
 
     ThreadLock(cft_lock);
     DeleteDB(dbp, name);
+    if (flush)
+    {
+        DBFlushBatch(dbp);
+    }
     ThreadUnlock(cft_lock);
 
     CloseLock(dbp);
@@ -324,12 +328,30 @@ static void WaitForCriticalSection()
         then = FindLockTime("CF_CRITICAL_SECTION");
     }
 
-    WriteLock("CF_CRITICAL_SECTION");
+    /* Other agents poll for the marker, so when the locks database is
+     * written in batches it has to be flushed before the section is
+     * entered. */
+    CF_DB *dbp;
+
+    ThreadLock(cft_lock);
+    if ((dbp = OpenLock()) == NULL)
+    {
+        ThreadUnlock(cft_lock);
+        return;
+    }
+
+    WriteLockDataCurrent(dbp, "CF_CRITICAL_SECTION");
+    DBFlushBatch(dbp);
+
+    CloseLock(dbp);
+    ThreadUnlock(cft_lock);
 }
 
+/* Flushed like the marker itself, which also publishes any lock taken
+ * under the critical section. */
 static void ReleaseCriticalSection()
 {
-    RemoveLock("CF_CRITICAL_SECTION");
+    RemoveLock("CF_CRITICAL_SECTION", true);
 }
 
 static time_t FindLock(char *last)
@@ -848,7 +870,7 @@ void YieldCurrentLock(CfLock lock)
 
     Log(LOG_LEVEL_DEBUG, "Yielding lock '%s'", lock.lock);
 
-    if (RemoveLock(lock.lock) == -1)
+    if (RemoveLock(lock.lock, false) == -1)
     {
         Log(LOG_LEVEL_VERBOSE, "Unable to remove lock %s", lock.lock);
         free(lock.last);
@@ -33,15 +33,16 @@
 #include <misc_lib.h>
 #include <rlist.h>
 #include <string_lib.h>
+#include <regex_cache.h>
 
-/* Pure */
-static pcre *CompileRegExp(const char *regexp)
+/* Pure, result must be returned with RegexCacheRelease() */
+static const CompiledRegex *CompileRegExp(const char *regexp)
 {
-    pcre *rx;
+    const CompiledRegex *rx;
     const char *errorstr;
     int erroffset;
 
-    rx = pcre_compile(regexp, PCRE_MULTILINE | PCRE_DOTALL, &errorstr, &erroffset, NULL);
+    rx = RegexCacheAcquire(regexp, PCRE_MULTILINE | PCRE_DOTALL, &errorstr, &erroffset);
 
     if (rx == NULL)
     {
@@ -53,12 +54,12 @@ static pcre *CompileRegExp(const char *regexp)
 }
 
 /* Sets variables */
-static int RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststring, int *start, int *end)
+static int RegExMatchSubString(EvalContext *ctx, const CompiledRegex *rx, const char *teststring, int *start, int *end)
 {
     int ovector[OVECCOUNT];
     int rc = 0;
 
-    if ((rc = pcre_exec(rx, NULL, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
+    if ((rc = pcre_exec(rx->rx, rx->extra, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
     {
         *start = ovector[0];
         *end = ovector[1];
@@ -90,12 +91,12 @@ static int RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststrin
         *end = 0;
     }
 
-    free(rx);
+    RegexCacheRelease(rx);
     return rc >= 0;
 }
 
 /* Sets variables */
-static int RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststring)
+static int RegExMatchFullString(EvalContext *ctx, const CompiledRegex *rx, const char *teststring)
 {
     int match_start;
     int match_len;
@@ -111,7 +112,7 @@ static int RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststri
 }
 
 /* Pure, non-thread-safe */
-static char *FirstBackReference(pcre *rx, const char *teststring)
+static char *FirstBackReference(const CompiledRegex *rx, const char *teststring)
 {
     static char backreference[CF_BUFSIZE];
 
@@ -119,7 +120,7 @@ static char *FirstBackReference(pcre *rx, const char *teststring)
 
     memset(backreference, 0, CF_BUFSIZE);
 
-    if ((rc = pcre_exec(rx, NULL, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
+    if ((rc = pcre_exec(rx->rx, rx->extra, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
     {
         for (i = 1; i < rc; i++)        /* make backref vars $(1),$(2) etc */
         {
@@ -135,23 +136,23 @@ static char *FirstBackReference(pcre *rx, const char *teststring)
         }
     }
 
-    free(rx);
+    RegexCacheRelease(rx);
 
     return backreference;
 }
 
 bool ValidateRegEx(const char *regex)
 {
-    pcre *rx = CompileRegExp(regex);
+    const CompiledRegex *rx = CompileRegExp(regex);
     bool regex_valid = rx != NULL;
 
-    free(rx);
+    RegexCacheRelease(rx);
     return regex_valid;
 }
 
 int FullTextMatch(EvalContext *ctx, const char *regexp, const char *teststring)
 {
-    pcre *rx;
+    const CompiledRegex *rx;
 
     if (strcmp(regexp, teststring) == 0)
     {
@@ -180,7 +181,7 @@ char *ExtractFirstReference(const char *regexp, const char *teststring)
     static char *nothing = "";
     char *backreference;
 
-    pcre *rx;
+    const CompiledRegex *rx;
 
     if ((regexp == NULL) || (teststring == NULL))
     {
@@ -206,7 +207,7 @@ char *ExtractFirstReference(const char *regexp, const char *teststring)
 
 int BlockTextMatch(EvalContext *ctx, const char *regexp, const char *teststring, int *start, int *end)
 {
-    pcre *rx = CompileRegExp(regexp);
+    const CompiledRegex *rx = CompileRegExp(regexp);
 
     if (rx == NULL)
     {
@@ -323,6 +323,7 @@ const ConstraintSyntax CFS_CONTROLBODY[] =
     ConstraintSyntaxNewStringList("trustkeysfrom", "", "List of IPs from whom we accept public keys on trust", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("listen", "true/false enable server daemon to listen on defined port. Default value: true", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("allowciphers", "", "List of ciphers the server accepts. For Syntax help see man page for \"openssl ciphers\". Default is \"AES256-GCM-SHA384:AES256-SHA\"", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("workerthreads", CF_VALRANGE, "Number of worker threads serving all connections from an event loop (Linux only). Default value: 0, one thread per connection", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
@@ -333,6 +334,8 @@ const ConstraintSyntax CFM_CONTROLBODY[] =
     ConstraintSyntaxNewBool("histograms", "Ignored, kept for backward compatibility. Default value: true", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("tcpdump", "true/false use tcpdump if found. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("tcpdumpcommand", CF_ABSPATHRANGE, "Path to the tcpdump command on this system", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("packet_sampling", "true/false classify packets from a packet socket in process instead of running tcpdump (Linux only). Default value: false", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("packet_sample_rate", "1,99999999", "Classify one in every N packets when packet_sampling is used. Default value: 1", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
@@ -363,6 +366,7 @@ const ConstraintSyntax CFEX_CONTROLBODY[] = /* enum cfexcontrol */
     ConstraintSyntaxNewOption("executorfacility", CF_FACILITY, "Menu option for syslog facility level. Default value: LOG_USER", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewString("exec_command", CF_ABSPATHRANGE,"The full path and command to the executable run by default (overriding builtin)", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewInt("agent_expireafter", "0,10080", "Maximum agent runtime (in minutes). Default value: 10080", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewBool("warm_agent", "true/false keep a cf-agent with the policy loaded and fork each run from it after the failsafe.cf update step. Not used if exec_command updates the policy. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
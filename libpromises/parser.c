@@ -26,6 +26,8 @@
 #include <parser_state.h>
 
 #include <misc_lib.h>
+#include <file_lib.h>
+#include <files_hashes.h>
 
 #include <errno.h>
 
@@ -78,7 +80,7 @@ static void ParserStateReset(ParserState *p)
     p->rval = RvalNew(NULL, RVAL_TYPE_NOPROMISEE);
 }
 
-Policy *ParserParseFile(const char *path, unsigned int warnings, unsigned int warnings_error)
+static Policy *ParserParseStream(FILE *in, const char *path, unsigned int warnings, unsigned int warnings_error)
 {
     ParserStateReset(&P);
     P.policy = PolicyNew();
@@ -90,12 +92,7 @@ Policy *ParserParseFile(const char *path, unsigned int warnings, unsigned int wa
     // no include is active by default
     P.include_filename[0] = '\0';
 
-    yyin = fopen(path, "r");
-    if (yyin == NULL)
-    {
-        Log(LOG_LEVEL_ERR, "While opening file '%s' for parsing. (fopen: %s)", path, GetErrorStr());
-        exit(1);
-    }
+    yyin = in;
 
     while (!feof(yyin))
     {
@@ -122,6 +119,68 @@ Policy *ParserParseFile(const char *path, unsigned int warnings, unsigned int wa
     return policy;
 }
 
+Policy *ParserParseFile(const char *path, unsigned int warnings, unsigned int warnings_error)
+{
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "While opening file '%s' for parsing. (fopen: %s)", path, GetErrorStr());
+        exit(1);
+    }
+
+    return ParserParseStream(in, path, warnings, warnings_error);
+}
+
+/* A stream over the contents, which the parser then reads like a file */
+static FILE *OpenContents(const char *contents, size_t size)
+{
+    FILE *in = NULL;
+
+#ifndef __MINGW32__
+    if (size > 0)
+    {
+        in = fmemopen((void *) contents, size, "r");
+    }
+#endif
+
+    if (in == NULL)
+    {
+        in = tmpfile();
+        if (in != NULL && ((fwrite(contents, 1, size, in) != size) || (fseek(in, 0, SEEK_SET) != 0)))
+        {
+            fclose(in);
+            in = NULL;
+        }
+    }
+
+    return in;
+}
+
+Policy *ParserParseFileDigest(const char *path, unsigned int warnings, unsigned int warnings_error,
+                              unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    char *contents = NULL;
+    ssize_t size = FileReadMax(&contents, path, SIZE_MAX);
+    if (size < 0)
+    {
+        Log(LOG_LEVEL_ERR, "While opening file '%s' for parsing. (read: %s)", path, GetErrorStr());
+        exit(1);
+    }
+
+    HashString(contents, size, digest, HASH_METHOD_SHA256);
+
+    FILE *in = OpenContents(contents, size);
+    if (in == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "While preparing file '%s' for parsing. (tmpfile: %s)", path, GetErrorStr());
+        exit(1);
+    }
+
+    Policy *policy = ParserParseStream(in, path, warnings, warnings_error);
+    free(contents);
+    return policy;
+}
+
 int ParserWarningFromString(const char *warning_str)
 {
     if (strcmp("deprecated", warning_str) == 0)
@@ -47,4 +47,11 @@ const char *ParserWarningToString(unsigned int warning);
  */
 Policy *ParserParseFile(const char *path, unsigned int warnings, unsigned int warnings_error);
 
+/**
+ * @brief As ParserParseFile(), reading the file only once
+ * @param digest Receives the SHA-256 of exactly the contents that were parsed
+ */
+Policy *ParserParseFileDigest(const char *path, unsigned int warnings, unsigned int warnings_error,
+                              unsigned char digest[EVP_MAX_MD_SIZE + 1]);
+
 #endif
@@ -42,6 +42,7 @@
 #include <audit.h>
 #include <logging.h>
 #include <expand.h>
+#include <map.h>
 
 
 static const char *POLICY_ERROR_POLICY_NOT_RUNNABLE = "Policy is not runnable (does not contain a body common control)";
@@ -64,6 +65,7 @@ static const char *POLICY_ERROR_EMPTY_VARREF = "Empty variable reference";
 //************************************************************************
 
 static void BundleDestroy(Bundle *bundle);
+static void ConstraintIndexDestroy(ConstraintIndex *index);
 static void BodyDestroy(Body *body);
 static SyntaxTypeMatch ConstraintCheckType(const Constraint *cp);
 static bool PromiseCheck(const Promise *pp, Seq *errors);
@@ -1295,6 +1297,7 @@ void PromiseDestroy(Promise *pp)
         free(pp->classes);
         free(pp->comment);
 
+        ConstraintIndexDestroy(pp->conindex);
         SeqDestroy(pp->conlist);
 
         free(pp);
@@ -1325,6 +1328,9 @@ Constraint *PromiseAppendConstraint(Promise *promise, const char *lval, Rval rva
 
     SeqAppend(promise->conlist, cp);
 
+    ConstraintIndexDestroy(promise->conindex);
+    promise->conindex = NULL;
+
     return cp;
 }
 
@@ -2161,47 +2167,175 @@ void ConstraintDestroy(Constraint *cp)
 
 /*****************************************************************************/
 
+/*
+ * Attribute extraction asks a promise for hundreds of lvals, so instead of
+ * scanning conlist for each of them the positions of the constraints are
+ * grouped by lval on first lookup. The results of the constraints' class
+ * guards are kept for as long as the class generation of the EvalContext
+ * stays the same, see IsDefinedClass().
+ */
+
+typedef struct
+{
+    size_t start;                     /* in ConstraintIndex.positions */
+    size_t count;
+} ConstraintIndexEntry;
+
+struct ConstraintIndex_
+{
+    Map *lvals;                       /* lval -> ConstraintIndexEntry */
+    ConstraintIndexEntry *entries;
+    size_t *positions;                /* conlist positions, grouped by lval */
+    signed char *guards;              /* per conlist position, -1 if unknown */
+
+    const EvalContext *ctx;           /* guards were evaluated in */
+    unsigned long class_generation;
+};
+
+static ConstraintIndex *ConstraintIndexNew(const Seq *conlist)
+{
+    size_t length = SeqLength(conlist);
+
+    ConstraintIndex *index = xcalloc(1, sizeof(ConstraintIndex));
+    index->lvals = MapNew((MapHashFn) &StringHash,
+                          (MapKeyEqualFn) &StringSafeEqual, NULL, NULL);
+    index->entries = xcalloc(length + 1, sizeof(ConstraintIndexEntry));
+    index->positions = xcalloc(length + 1, sizeof(size_t));
+    index->guards = xmalloc(length + 1);
+    memset(index->guards, -1, length + 1);
+
+    size_t distinct = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        const Constraint *cp = SeqAt(conlist, i);
+        ConstraintIndexEntry *entry = MapGet(index->lvals, cp->lval);
+        if (entry == NULL)
+        {
+            entry = &index->entries[distinct++];
+            MapInsert(index->lvals, cp->lval, entry);
+        }
+        entry->count++;
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i < distinct; i++)
+    {
+        index->entries[i].start = start;
+        start += index->entries[i].count;
+        index->entries[i].count = 0;
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        const Constraint *cp = SeqAt(conlist, i);
+        ConstraintIndexEntry *entry = MapGet(index->lvals, cp->lval);
+        index->positions[entry->start + entry->count++] = i;
+    }
+
+    return index;
+}
+
+static void ConstraintIndexDestroy(ConstraintIndex *index)
+{
+    if (index)
+    {
+        MapDestroy(index->lvals);
+        free(index->entries);
+        free(index->positions);
+        free(index->guards);
+        free(index);
+    }
+}
+
+static ConstraintIndex *PromiseGetConstraintIndex(const Promise *pp)
+{
+    if (pp->conindex == NULL)
+    {
+        /* The index is a cache, building it does not change the promise. */
+        ((Promise *) pp)->conindex = ConstraintIndexNew(pp->conlist);
+    }
+
+    return pp->conindex;
+}
+
+/**
+ * @brief Iterate over the constraints named #lval whose class guard is
+ *        defined, in conlist order.
+ * @param i iterator state, must be 0 on the first call
+ * @return the next matching constraint, or NULL when there are no more
+ */
+static Constraint *PromiseNextDefinedConstraint(const EvalContext *ctx, const Promise *pp,
+                                                const char *lval, size_t *i)
+{
+    ConstraintIndex *index = PromiseGetConstraintIndex(pp);
+
+    const ConstraintIndexEntry *entry = MapGet(index->lvals, lval);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    unsigned long generation = ctx ? ctx->class_generation : 0;
+    if (index->ctx != ctx || index->class_generation != generation)
+    {
+        memset(index->guards, -1, SeqLength(pp->conlist) + 1);
+        index->ctx = ctx;
+        index->class_generation = generation;
+    }
+
+    while (*i < entry->count)
+    {
+        size_t position = index->positions[entry->start + (*i)++];
+        Constraint *cp = SeqAt(pp->conlist, position);
+
+        if (index->guards[position] == -1)
+        {
+            index->guards[position] =
+                IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp));
+        }
+
+        if (index->guards[position])
+        {
+            return cp;
+        }
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************/
+
 int PromiseGetConstraintAsBoolean(const EvalContext *ctx, const char *lval, const Promise *pp)
 {
     int retval = CF_UNDEFINED;
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (retval != CF_UNDEFINED)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != CF_UNDEFINED)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s' (boolean) constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-            }
-            else
-            {
-                continue;
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s' (boolean) constraints break this promise", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+        }
 
-            if (cp->rval.type != RVAL_TYPE_SCALAR)
-            {
-                Log(LOG_LEVEL_ERR, "Type mismatch on rhs - expected type %c for boolean constraint '%s'",
-                      cp->rval.type, lval);
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Aborted");
-            }
+        if (cp->rval.type != RVAL_TYPE_SCALAR)
+        {
+            Log(LOG_LEVEL_ERR, "Type mismatch on rhs - expected type %c for boolean constraint '%s'",
+                  cp->rval.type, lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Aborted");
+        }
 
-            if (strcmp(cp->rval.item, "true") == 0 || strcmp(cp->rval.item, "yes") == 0)
-            {
-                retval = true;
-                continue;
-            }
+        if (strcmp(cp->rval.item, "true") == 0 || strcmp(cp->rval.item, "yes") == 0)
+        {
+            retval = true;
+            continue;
+        }
 
-            if (strcmp(cp->rval.item, "false") == 0 || strcmp(cp->rval.item, "no") == 0)
-            {
-                retval = false;
-            }
+        if (strcmp(cp->rval.item, "false") == 0 || strcmp(cp->rval.item, "no") == 0)
+        {
+            retval = false;
         }
     }
 
@@ -2271,36 +2405,26 @@ bool PromiseBundleConstraintExists(const EvalContext *ctx, const char *lval, con
 {
     int retval = CF_UNDEFINED;
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    const Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        const Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (retval != CF_UNDEFINED)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != CF_UNDEFINED)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s' constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-            }
-            else
-            {
-                continue;
-            }
-
-            if (!(cp->rval.type == RVAL_TYPE_FNCALL || cp->rval.type == RVAL_TYPE_SCALAR))
-            {
-                Log(LOG_LEVEL_ERR,
-                    "Anomalous type mismatch - type %c for bundle constraint '%s' did not match internals",
-                      cp->rval.type, lval);
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Aborted");
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s' constraints break this promise", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+        }
 
-            return true;
+        if (!(cp->rval.type == RVAL_TYPE_FNCALL || cp->rval.type == RVAL_TYPE_SCALAR))
+        {
+            Log(LOG_LEVEL_ERR,
+                "Anomalous type mismatch - type %c for bundle constraint '%s' did not match internals",
+                  cp->rval.type, lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Aborted");
         }
+
+        return true;
     }
 
     return false;
@@ -2359,35 +2483,25 @@ int PromiseGetConstraintAsInt(const EvalContext *ctx, const char *lval, const Pr
 {
     int retval = CF_NOINT;
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (retval != CF_NOINT)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != CF_NOINT)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s' (int) constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-            }
-            else
-            {
-                continue;
-            }
-
-            if (cp->rval.type != RVAL_TYPE_SCALAR)
-            {
-                Log(LOG_LEVEL_ERR,
-                      "Anomalous type mismatch - expected type for int constraint %s did not match internals", lval);
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Aborted");
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s' (int) constraints break this promise", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+        }
 
-            retval = (int) IntFromString((char *) cp->rval.item);
+        if (cp->rval.type != RVAL_TYPE_SCALAR)
+        {
+            Log(LOG_LEVEL_ERR,
+                  "Anomalous type mismatch - expected type for int constraint %s did not match internals", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Aborted");
         }
+
+        retval = (int) IntFromString((char *) cp->rval.item);
     }
 
     return retval;
@@ -2399,34 +2513,24 @@ bool PromiseGetConstraintAsReal(const EvalContext *ctx, const char *lval, const
 {
     bool found_constraint = false;
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (found_constraint)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (found_constraint)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s' (real) constraints break this promise", lval);
-                }
-            }
-            else
-            {
-                continue;
-            }
-
-            if (cp->rval.type != RVAL_TYPE_SCALAR)
-            {
-                Log(LOG_LEVEL_ERR,
-                    "Anomalous type mismatch - expected type for int constraint '%s' did not match internals", lval);
-                FatalError(ctx, "Aborted");
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s' (real) constraints break this promise", lval);
+        }
 
-            *value_out = DoubleFromString((char *) cp->rval.item, value_out);
-            found_constraint = true;
+        if (cp->rval.type != RVAL_TYPE_SCALAR)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Anomalous type mismatch - expected type for int constraint '%s' did not match internals", lval);
+            FatalError(ctx, "Aborted");
         }
+
+        *value_out = DoubleFromString((char *) cp->rval.item, value_out);
+        found_constraint = true;
     }
 
     return found_constraint;
@@ -2464,38 +2568,28 @@ mode_t PromiseGetConstraintAsOctal(const EvalContext *ctx, const char *lval, con
 
 // We could handle units here, like kb,b,mb
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (retval != 077)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != 077)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s' (int,octal) constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-            }
-            else
-            {
-                continue;
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s' (int,octal) constraints break this promise", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+        }
 
-            if (cp->rval.type != RVAL_TYPE_SCALAR)
-            {
-                Log(LOG_LEVEL_ERR,
-                      "Anomalous type mismatch - expected type for int constraint %s did not match internals", lval);
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Aborted");
-            }
+        if (cp->rval.type != RVAL_TYPE_SCALAR)
+        {
+            Log(LOG_LEVEL_ERR,
+                  "Anomalous type mismatch - expected type for int constraint %s did not match internals", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Aborted");
+        }
 
-            if (!Str2Mode(cp->rval.item, &retval))
-            {
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Error reading assumed octal value '%s'", (const char *)cp->rval.item);
-            }
+        if (!Str2Mode(cp->rval.item, &retval))
+        {
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Error reading assumed octal value '%s'", (const char *)cp->rval.item);
         }
     }
 
@@ -2518,36 +2612,26 @@ uid_t PromiseGetConstraintAsUid(const EvalContext *ctx, const char *lval, const
     int retval = CF_SAME_OWNER;
     char buffer[CF_MAXVARSIZE];
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (retval != CF_UNDEFINED)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != CF_UNDEFINED)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s' (owner/uid) constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-            }
-            else
-            {
-                continue;
-            }
-
-            if (cp->rval.type != RVAL_TYPE_SCALAR)
-            {
-                Log(LOG_LEVEL_ERR,
-                      "Anomalous type mismatch - expected type for owner constraint %s did not match internals",
-                      lval);
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Aborted");
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s' (owner/uid) constraints break this promise", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+        }
 
-            retval = Str2Uid((char *) cp->rval.item, buffer, pp);
+        if (cp->rval.type != RVAL_TYPE_SCALAR)
+        {
+            Log(LOG_LEVEL_ERR,
+                  "Anomalous type mismatch - expected type for owner constraint %s did not match internals",
+                  lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Aborted");
         }
+
+        retval = Str2Uid((char *) cp->rval.item, buffer, pp);
     }
 
     return retval;
@@ -2571,36 +2655,26 @@ gid_t PromiseGetConstraintAsGid(const EvalContext *ctx, char *lval, const Promis
     int retval = CF_SAME_GROUP;
     char buffer[CF_MAXVARSIZE];
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (retval != CF_UNDEFINED)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != CF_UNDEFINED)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s'  (group/gid) constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-            }
-            else
-            {
-                continue;
-            }
-
-            if (cp->rval.type != RVAL_TYPE_SCALAR)
-            {
-                Log(LOG_LEVEL_ERR,
-                    "Anomalous type mismatch - expected type for group constraint '%s' did not match internals",
-                     lval);
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Aborted");
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s'  (group/gid) constraints break this promise", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+        }
 
-            retval = Str2Gid((char *) cp->rval.item, buffer, pp);
+        if (cp->rval.type != RVAL_TYPE_SCALAR)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Anomalous type mismatch - expected type for group constraint '%s' did not match internals",
+                 lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Aborted");
         }
+
+        retval = Str2Gid((char *) cp->rval.item, buffer, pp);
     }
 
     return retval;
@@ -2614,35 +2688,25 @@ Rlist *PromiseGetConstraintAsList(const EvalContext *ctx, const char *lval, cons
 {
     Rlist *retval = NULL;
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
+    size_t i = 0;
+    Constraint *cp;
+    while ((cp = PromiseNextDefinedConstraint(ctx, pp, lval, &i)))
     {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
+        if (retval != NULL)
         {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != NULL)
-                {
-                    Log(LOG_LEVEL_ERR, "Multiple '%s' int constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-            }
-            else
-            {
-                continue;
-            }
-
-            if (cp->rval.type != RVAL_TYPE_LIST)
-            {
-                Log(LOG_LEVEL_ERR, "Type mismatch on rhs - expected type for list constraint '%s'", lval);
-                PromiseRef(LOG_LEVEL_ERR, pp);
-                FatalError(ctx, "Aborted");
-            }
+            Log(LOG_LEVEL_ERR, "Multiple '%s' int constraints break this promise", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+        }
 
-            retval = (Rlist *) cp->rval.item;
-            break;
+        if (cp->rval.type != RVAL_TYPE_LIST)
+        {
+            Log(LOG_LEVEL_ERR, "Type mismatch on rhs - expected type for list constraint '%s'", lval);
+            PromiseRef(LOG_LEVEL_ERR, pp);
+            FatalError(ctx, "Aborted");
         }
+
+        retval = (Rlist *) cp->rval.item;
+        break;
     }
 
     return retval;
@@ -2650,34 +2714,13 @@ Rlist *PromiseGetConstraintAsList(const EvalContext *ctx, const char *lval, cons
 
 Constraint *PromiseGetConstraint(const EvalContext *ctx, const Promise *pp, const char *lval)
 {
-    Constraint *retval = NULL;
-
     if (pp == NULL)
     {
         return NULL;
     }
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); i++)
-    {
-        Constraint *cp = SeqAt(pp->conlist, i);
-
-        if (strcmp(cp->lval, lval) == 0)
-        {
-            if (IsDefinedClass(ctx, cp->classes, PromiseGetNamespace(pp)))
-            {
-                if (retval != NULL)
-                {
-                    Log(LOG_LEVEL_ERR, "Inconsistent '%s' constraints break this promise", lval);
-                    PromiseRef(LOG_LEVEL_ERR, pp);
-                }
-
-                retval = cp;
-                break;
-            }
-        }
-    }
-
-    return retval;
+    size_t i = 0;
+    return PromiseNextDefinedConstraint(ctx, pp, lval, &i);
 }
 
 Constraint *PromiseGetImmediateConstraint(const Promise *pp, const char *lval)
@@ -2687,22 +2730,20 @@ Constraint *PromiseGetImmediateConstraint(const Promise *pp, const char *lval)
         return NULL;
     }
 
-    for (size_t i = 0; i < SeqLength(pp->conlist); ++i)
-    {
-        Constraint *cp = SeqAt(pp->conlist, i);
+    const ConstraintIndex *index = PromiseGetConstraintIndex(pp);
+    const ConstraintIndexEntry *entry = MapGet(index->lvals, lval);
 
-        if (strcmp(cp->lval, lval) == 0)
-        {
-            /* It would be nice to check whether the constraint we have asked
-               for is defined in promise (not in referenced body), but there
-               seem to be no way to do it easily.
+    if (entry != NULL)
+    {
+        /* It would be nice to check whether the constraint we have asked
+           for is defined in promise (not in referenced body), but there
+           seem to be no way to do it easily.
 
-               Checking for absence of classes does not work, as constrains
-               obtain classes defined on promise itself.
-            */
+           Checking for absence of classes does not work, as constrains
+           obtain classes defined on promise itself.
+        */
 
-            return cp;
-        }
+        return SeqAt(pp->conlist, index->positions[entry->start]);
     }
 
     return NULL;
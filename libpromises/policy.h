@@ -103,6 +103,8 @@ struct PromiseType_
     SourceOffset offset;
 };
 
+typedef struct ConstraintIndex_ ConstraintIndex;
+
 struct Promise_
 {
     PromiseType *parent_promise_type;
@@ -113,6 +115,7 @@ struct Promise_
     Rval promisee;
     Seq *conlist;
     bool has_subbundles;
+    ConstraintIndex *conindex;        /* conlist by lval, see PromiseGetConstraint() */
 
     const Promise *org_pp;            /* A ptr to the unexpanded raw promise */
 
@@ -0,0 +1,1022 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <policy_cache.h>
+
+#include <policy.h>
+#include <rlist.h>
+#include <fncall.h>
+#include <files_hashes.h>
+#include <files_names.h>
+#include <file_lib.h>
+#include <string_lib.h>
+#include <sequence.h>
+#include <map.h>
+#include <dir.h>
+
+#ifndef __MINGW32__
+# include <sys/mman.h>
+#endif
+
+/*
+ * File layout, in the byte order of the host:
+ *
+ *   PolicyCacheHeader
+ *   uint32_t offsets[string_count]     start of each string in the data
+ *   uint32_t code[code_size]           the policy, see PolicyCacheEmit*()
+ *   char strings[strings_size]         NUL terminated strings
+ *
+ * Strings are referred to by their index in offsets, or POLICY_CACHE_NONE.
+ */
+
+#define POLICY_CACHE_MAGIC "CFPOLICY"
+#define POLICY_CACHE_FORMAT 1
+#define POLICY_CACHE_BYTE_ORDER 0x01020304
+#define POLICY_CACHE_NONE 0xFFFFFFFF
+#define POLICY_CACHE_MAX_NESTING 64
+
+typedef struct
+{
+    char magic[8];
+    uint32_t format;
+    uint32_t byte_order;
+    char version[32];                   /* VERSION of the writing binary */
+    unsigned char digest[CF_SHA256_LEN]; /* Of the input file */
+    uint32_t path;                      /* Input file name, a string */
+    uint32_t string_count;
+    uint32_t code_size;                 /* In words */
+    uint32_t strings_size;              /* In bytes */
+} PolicyCacheHeader;
+
+typedef struct
+{
+    Map *ids;                   /* String -> index + 1 */
+
+    uint32_t *offsets;
+    size_t string_count;
+    size_t offsets_capacity;
+
+    char *strings;
+    size_t strings_size;
+    size_t strings_capacity;
+
+    uint32_t *code;
+    size_t code_size;
+    size_t code_capacity;
+
+    bool failed;
+} PolicyCacheWriter;
+
+typedef struct
+{
+    const uint32_t *offsets;
+    size_t string_count;
+
+    const uint32_t *code;
+    size_t code_size;
+    size_t pos;
+
+    const char *strings;
+    size_t strings_size;
+
+    bool failed;
+} PolicyCacheReader;
+
+typedef struct
+{
+    char *cache_file;
+    char *image;
+    size_t size;
+} PolicyCacheStaged;
+
+static Seq *STAGED = NULL;
+
+/*********************************************************************/
+
+static bool PolicyCacheDigest(const char *input_path, unsigned char digest[CF_SHA256_LEN])
+{
+    char *contents = NULL;
+    ssize_t size = FileReadMax(&contents, input_path, SIZE_MAX);
+
+    if (size < 0)
+    {
+        return false;
+    }
+
+    unsigned char full[EVP_MAX_MD_SIZE + 1];
+    HashString(contents, size, full, HASH_METHOD_SHA256);
+    memcpy(digest, full, CF_SHA256_LEN);
+
+    free(contents);
+    return true;
+}
+
+static char *PolicyCacheFileName(const char *input_path)
+{
+    char filename[CF_BUFSIZE];
+
+    snprintf(filename, sizeof(filename), "%s%cstate%cpolicy_cache%c%s", CFWORKDIR,
+             FILE_SEPARATOR, FILE_SEPARATOR, FILE_SEPARATOR, CanonifyName(input_path));
+    MapName(filename);
+
+    return xstrdup(filename);
+}
+
+static void PolicyCacheStagedDestroy(PolicyCacheStaged *staged)
+{
+    if (staged)
+    {
+        free(staged->cache_file);
+        free(staged->image);
+        free(staged);
+    }
+}
+
+/*********************************************************************/
+/* Writing                                                           */
+/*********************************************************************/
+
+static void PolicyCacheEmitWord(PolicyCacheWriter *w, uint32_t word)
+{
+    if (w->code_size == w->code_capacity)
+    {
+        w->code_capacity = (w->code_capacity == 0) ? 1024 : w->code_capacity * 2;
+        w->code = xrealloc(w->code, w->code_capacity * sizeof(uint32_t));
+    }
+
+    w->code[w->code_size++] = word;
+}
+
+static uint32_t PolicyCacheIntern(PolicyCacheWriter *w, const char *str)
+{
+    uintptr_t id = (uintptr_t) MapGet(w->ids, str);
+
+    if (id == 0)
+    {
+        size_t len = strlen(str) + 1;
+
+        if (w->strings_size + len > UINT32_MAX)
+        {
+            w->failed = true;
+            return POLICY_CACHE_NONE;
+        }
+
+        if (w->string_count == w->offsets_capacity)
+        {
+            w->offsets_capacity = (w->offsets_capacity == 0) ? 256 : w->offsets_capacity * 2;
+            w->offsets = xrealloc(w->offsets, w->offsets_capacity * sizeof(uint32_t));
+        }
+
+        while (w->strings_size + len > w->strings_capacity)
+        {
+            w->strings_capacity = (w->strings_capacity == 0) ? 4096 : w->strings_capacity * 2;
+            w->strings = xrealloc(w->strings, w->strings_capacity);
+        }
+
+        memcpy(w->strings + w->strings_size, str, len);
+        w->offsets[w->string_count] = w->strings_size;
+        w->strings_size += len;
+
+        id = ++w->string_count;
+        MapInsert(w->ids, xstrdup(str), (void *) id);
+    }
+
+    return id - 1;
+}
+
+static void PolicyCacheEmitString(PolicyCacheWriter *w, const char *str)
+{
+    PolicyCacheEmitWord(w, (str != NULL) ? PolicyCacheIntern(w, str) : POLICY_CACHE_NONE);
+}
+
+static void PolicyCacheEmitSize(PolicyCacheWriter *w, size_t value)
+{
+    uint64_t wide = value;
+
+    PolicyCacheEmitWord(w, (uint32_t) (wide & 0xFFFFFFFF));
+    PolicyCacheEmitWord(w, (uint32_t) (wide >> 32));
+}
+
+static void PolicyCacheEmitOffset(PolicyCacheWriter *w, const SourceOffset *offset)
+{
+    PolicyCacheEmitSize(w, offset->start);
+    PolicyCacheEmitSize(w, offset->end);
+    PolicyCacheEmitSize(w, offset->line);
+    PolicyCacheEmitSize(w, offset->context);
+}
+
+static void PolicyCacheEmitRval(PolicyCacheWriter *w, Rval rval);
+
+static void PolicyCacheEmitRlist(PolicyCacheWriter *w, const Rlist *list)
+{
+    PolicyCacheEmitWord(w, RlistLen(list));
+
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        PolicyCacheEmitRval(w, rp->val);
+    }
+}
+
+static void PolicyCacheEmitRval(PolicyCacheWriter *w, Rval rval)
+{
+    PolicyCacheEmitWord(w, rval.type);
+
+    switch (rval.type)
+    {
+    case RVAL_TYPE_SCALAR:
+        PolicyCacheEmitString(w, RvalScalarValue(rval));
+        break;
+
+    case RVAL_TYPE_LIST:
+        PolicyCacheEmitRlist(w, RvalRlistValue(rval));
+        break;
+
+    case RVAL_TYPE_FNCALL:
+        PolicyCacheEmitString(w, RvalFnCallValue(rval)->name);
+        PolicyCacheEmitRlist(w, RvalFnCallValue(rval)->args);
+        break;
+
+    case RVAL_TYPE_NOPROMISEE:
+        break;
+
+    default:
+        /* Containers are not produced by the parser */
+        w->failed = true;
+        break;
+    }
+}
+
+static void PolicyCacheEmitConstraints(PolicyCacheWriter *w, const Seq *conlist)
+{
+    PolicyCacheEmitWord(w, SeqLength(conlist));
+
+    for (size_t i = 0; i < SeqLength(conlist); i++)
+    {
+        const Constraint *cp = SeqAt(conlist, i);
+
+        PolicyCacheEmitString(w, cp->lval);
+        PolicyCacheEmitString(w, cp->classes);
+        PolicyCacheEmitWord(w, cp->references_body);
+        PolicyCacheEmitRval(w, cp->rval);
+        PolicyCacheEmitOffset(w, &cp->offset);
+    }
+}
+
+static void PolicyCacheEmitPolicy(PolicyCacheWriter *w, const Policy *policy)
+{
+    PolicyCacheEmitWord(w, SeqLength(policy->bundles));
+
+    for (size_t i = 0; i < SeqLength(policy->bundles); i++)
+    {
+        const Bundle *bundle = SeqAt(policy->bundles, i);
+
+        PolicyCacheEmitString(w, bundle->ns);
+        PolicyCacheEmitString(w, bundle->name);
+        PolicyCacheEmitString(w, bundle->type);
+        PolicyCacheEmitString(w, bundle->source_path);
+        PolicyCacheEmitRlist(w, bundle->args);
+        PolicyCacheEmitOffset(w, &bundle->offset);
+
+        PolicyCacheEmitWord(w, SeqLength(bundle->promise_types));
+
+        for (size_t j = 0; j < SeqLength(bundle->promise_types); j++)
+        {
+            const PromiseType *type = SeqAt(bundle->promise_types, j);
+
+            PolicyCacheEmitString(w, type->name);
+            PolicyCacheEmitOffset(w, &type->offset);
+
+            PolicyCacheEmitWord(w, SeqLength(type->promises));
+
+            for (size_t k = 0; k < SeqLength(type->promises); k++)
+            {
+                const Promise *pp = SeqAt(type->promises, k);
+
+                PolicyCacheEmitString(w, pp->promiser);
+                PolicyCacheEmitString(w, pp->classes);
+                PolicyCacheEmitString(w, pp->comment);
+                PolicyCacheEmitRval(w, pp->promisee);
+                PolicyCacheEmitWord(w, pp->has_subbundles);
+                PolicyCacheEmitOffset(w, &pp->offset);
+                PolicyCacheEmitConstraints(w, pp->conlist);
+            }
+        }
+    }
+
+    PolicyCacheEmitWord(w, SeqLength(policy->bodies));
+
+    for (size_t i = 0; i < SeqLength(policy->bodies); i++)
+    {
+        const Body *body = SeqAt(policy->bodies, i);
+
+        PolicyCacheEmitString(w, body->ns);
+        PolicyCacheEmitString(w, body->name);
+        PolicyCacheEmitString(w, body->type);
+        PolicyCacheEmitString(w, body->source_path);
+        PolicyCacheEmitRlist(w, body->args);
+        PolicyCacheEmitOffset(w, &body->offset);
+        PolicyCacheEmitConstraints(w, body->conlist);
+    }
+}
+
+/**
+ * @brief Build the contents of the precompiled copy of a policy.
+ * @return The image, to be freed by the caller, or NULL on failure.
+ */
+static char *PolicyCacheImage(const char *input_path, const unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                              const Policy *policy, size_t *size)
+{
+    PolicyCacheHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POLICY_CACHE_MAGIC, sizeof(header.magic));
+    header.format = POLICY_CACHE_FORMAT;
+    header.byte_order = POLICY_CACHE_BYTE_ORDER;
+    strlcpy(header.version, VERSION, sizeof(header.version));
+    memcpy(header.digest, digest, CF_SHA256_LEN);
+
+    PolicyCacheWriter w;
+
+    memset(&w, 0, sizeof(w));
+    w.ids = MapNew((MapHashFn) &StringHash, (MapKeyEqualFn) &StringSafeEqual, free, NULL);
+
+    header.path = PolicyCacheIntern(&w, input_path);
+
+    PolicyCacheEmitPolicy(&w, policy);
+
+    char *image = NULL;
+
+    if (!w.failed && (w.code_size <= UINT32_MAX))
+    {
+        header.string_count = w.string_count;
+        header.code_size = w.code_size;
+        header.strings_size = w.strings_size;
+
+        *size = sizeof(header) + w.string_count * sizeof(uint32_t) + w.code_size * sizeof(uint32_t) + w.strings_size;
+        image = xmalloc(*size);
+
+        char *p = image;
+        memcpy(p, &header, sizeof(header));
+        p += sizeof(header);
+        memcpy(p, w.offsets, w.string_count * sizeof(uint32_t));
+        p += w.string_count * sizeof(uint32_t);
+        memcpy(p, w.code, w.code_size * sizeof(uint32_t));
+        p += w.code_size * sizeof(uint32_t);
+        memcpy(p, w.strings, w.strings_size);
+    }
+
+    MapDestroy(w.ids);
+    free(w.offsets);
+    free(w.strings);
+    free(w.code);
+
+    return image;
+}
+
+static bool PolicyCacheWriteImage(const char *cache_file, const char *image, size_t size)
+{
+    char tmp_file[CF_BUFSIZE];
+
+    if (snprintf(tmp_file, sizeof(tmp_file), "%s.%jd", cache_file, (intmax_t) getpid()) >= sizeof(tmp_file))
+    {
+        return false;
+    }
+
+    int fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create precompiled policy file '%s'. (open: %s)", tmp_file, GetErrorStr());
+        return false;
+    }
+
+    if (FullWrite(fd, image, size) < 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not write precompiled policy file '%s'. (write: %s)", tmp_file, GetErrorStr());
+        close(fd);
+        unlink(tmp_file);
+        return false;
+    }
+
+    close(fd);
+
+    /* Agents may be reading the old copy, replace it as a whole */
+    if (rename(tmp_file, cache_file) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not replace precompiled policy file '%s'. (rename: %s)", cache_file, GetErrorStr());
+        unlink(tmp_file);
+        return false;
+    }
+
+    return true;
+}
+
+bool PolicyCacheWriteFile(const char *cache_file, const char *input_path,
+                          const unsigned char digest[EVP_MAX_MD_SIZE + 1], const Policy *policy)
+{
+    size_t size;
+    char *image = PolicyCacheImage(input_path, digest, policy, &size);
+
+    if (image == NULL)
+    {
+        return false;
+    }
+
+    bool ret = PolicyCacheWriteImage(cache_file, image, size);
+    free(image);
+
+    return ret;
+}
+
+void PolicyCacheStage(const char *input_path, const unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                      const Policy *policy)
+{
+    size_t size;
+    char *image = PolicyCacheImage(input_path, digest, policy, &size);
+
+    if (image == NULL)
+    {
+        return;
+    }
+
+    if (STAGED == NULL)
+    {
+        STAGED = SeqNew(100, PolicyCacheStagedDestroy);
+    }
+
+    PolicyCacheStaged *staged = xmalloc(sizeof(PolicyCacheStaged));
+    staged->cache_file = PolicyCacheFileName(input_path);
+    staged->image = image;
+    staged->size = size;
+
+    SeqAppend(STAGED, staged);
+}
+
+static const char *PolicyCacheOpenImage(const char *image, size_t size, PolicyCacheHeader *header,
+                                        PolicyCacheReader *r);
+
+static bool PolicyCacheIsStaged(const char *cache_file)
+{
+    for (size_t i = 0; i < SeqLength(STAGED); i++)
+    {
+        const PolicyCacheStaged *staged = SeqAt(STAGED, i);
+        if (strcmp(staged->cache_file, cache_file) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief A copy is stale if it was written by another version, or its input
+ *        file has changed or is gone.
+ */
+static bool PolicyCacheIsStale(const char *cache_file)
+{
+    char *image = NULL;
+    ssize_t size = FileReadMax(&image, cache_file, SIZE_MAX);
+
+    if (size < 0)
+    {
+        return false;
+    }
+
+    PolicyCacheHeader header;
+    PolicyCacheReader r;
+    bool stale = true;
+
+    const char *input_path = PolicyCacheOpenImage(image, size, &header, &r);
+    if (input_path != NULL)
+    {
+        unsigned char digest[CF_SHA256_LEN];
+        char *expected = PolicyCacheFileName(input_path);
+
+        stale = (strcmp(expected, cache_file) != 0) || !PolicyCacheDigest(input_path, digest) ||
+            (memcmp(header.digest, digest, CF_SHA256_LEN) != 0);
+
+        free(expected);
+    }
+
+    free(image);
+    return stale;
+}
+
+static void PolicyCachePrune(const char *dirname)
+{
+    Dir *dirh = DirOpen(dirname);
+    if (dirh == NULL)
+    {
+        return;
+    }
+
+    size_t removed = 0;
+    const struct dirent *dirp;
+
+    while ((dirp = DirRead(dirh)) != NULL)
+    {
+        /* Canonified names have no dots, skips . and .. and files still being written */
+        if (strchr(dirp->d_name, '.') != NULL)
+        {
+            continue;
+        }
+
+        char cache_file[CF_BUFSIZE];
+        if (snprintf(cache_file, sizeof(cache_file), "%s%c%s", dirname, FILE_SEPARATOR, dirp->d_name) >= sizeof(cache_file))
+        {
+            continue;
+        }
+
+        if (PolicyCacheIsStaged(cache_file) || !PolicyCacheIsStale(cache_file))
+        {
+            continue;
+        }
+
+        if (unlink(cache_file) == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Could not remove stale precompiled policy file '%s'. (unlink: %s)", cache_file, GetErrorStr());
+        }
+        else
+        {
+            removed++;
+        }
+    }
+
+    DirClose(dirh);
+
+    if (removed > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Removed %zu stale precompiled policy files from '%s'", removed, dirname);
+    }
+}
+
+void PolicyCacheCommit(void)
+{
+    if (STAGED == NULL)
+    {
+        return;
+    }
+
+    char dirname[CF_BUFSIZE];
+
+    snprintf(dirname, sizeof(dirname), "%s%cstate%cpolicy_cache", CFWORKDIR, FILE_SEPARATOR, FILE_SEPARATOR);
+    MapName(dirname);
+
+    struct stat sb;
+    if ((stat(dirname, &sb) == -1) && (mkdir(dirname, 0700) == -1))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create precompiled policy directory '%s'. (mkdir: %s)", dirname, GetErrorStr());
+    }
+    else
+    {
+        for (size_t i = 0; i < SeqLength(STAGED); i++)
+        {
+            const PolicyCacheStaged *staged = SeqAt(STAGED, i);
+            PolicyCacheWriteImage(staged->cache_file, staged->image, staged->size);
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "Wrote %zu precompiled policy files to '%s'", SeqLength(STAGED), dirname);
+
+        PolicyCachePrune(dirname);
+    }
+
+    SeqDestroy(STAGED);
+    STAGED = NULL;
+}
+
+/*********************************************************************/
+/* Reading                                                           */
+/*********************************************************************/
+
+static uint32_t PolicyCacheReadWord(PolicyCacheReader *r)
+{
+    if (r->pos >= r->code_size)
+    {
+        r->failed = true;
+        return 0;
+    }
+
+    return r->code[r->pos++];
+}
+
+/* Counts precede that many items of at least one word each */
+static size_t PolicyCacheReadCount(PolicyCacheReader *r)
+{
+    uint32_t count = PolicyCacheReadWord(r);
+
+    if (count > r->code_size - r->pos)
+    {
+        r->failed = true;
+        return 0;
+    }
+
+    return count;
+}
+
+static const char *PolicyCacheReadString(PolicyCacheReader *r)
+{
+    uint32_t id = PolicyCacheReadWord(r);
+
+    if (id == POLICY_CACHE_NONE)
+    {
+        return NULL;
+    }
+
+    if (id >= r->string_count)
+    {
+        r->failed = true;
+        return NULL;
+    }
+
+    return r->strings + r->offsets[id];
+}
+
+static size_t PolicyCacheReadSize(PolicyCacheReader *r)
+{
+    uint64_t low = PolicyCacheReadWord(r);
+    uint64_t high = PolicyCacheReadWord(r);
+
+    return (size_t) (low | (high << 32));
+}
+
+static void PolicyCacheReadOffset(PolicyCacheReader *r, SourceOffset *offset)
+{
+    offset->start = PolicyCacheReadSize(r);
+    offset->end = PolicyCacheReadSize(r);
+    offset->line = PolicyCacheReadSize(r);
+    offset->context = PolicyCacheReadSize(r);
+}
+
+static Rval PolicyCacheReadRval(PolicyCacheReader *r, int nesting);
+
+static Rlist *PolicyCacheReadRlist(PolicyCacheReader *r, int nesting)
+{
+    Rlist *list = NULL;
+    Rlist **tail = &list;
+    size_t count = PolicyCacheReadCount(r);
+
+    for (size_t i = 0; (i < count) && !r->failed; i++)
+    {
+        Rlist *rp = xmalloc(sizeof(Rlist));
+        rp->val = PolicyCacheReadRval(r, nesting);
+        rp->next = NULL;
+
+        *tail = rp;
+        tail = &rp->next;
+    }
+
+    return list;
+}
+
+static Rval PolicyCacheReadRval(PolicyCacheReader *r, int nesting)
+{
+    if (nesting > POLICY_CACHE_MAX_NESTING)
+    {
+        r->failed = true;
+        return RvalNew(NULL, RVAL_TYPE_NOPROMISEE);
+    }
+
+    uint32_t type = PolicyCacheReadWord(r);
+
+    switch (type)
+    {
+    case RVAL_TYPE_SCALAR:
+        {
+            const char *scalar = PolicyCacheReadString(r);
+            if (scalar != NULL)
+            {
+                return RvalNew(scalar, RVAL_TYPE_SCALAR);
+            }
+        }
+        break;
+
+    case RVAL_TYPE_LIST:
+        return (Rval) { PolicyCacheReadRlist(r, nesting + 1), RVAL_TYPE_LIST };
+
+    case RVAL_TYPE_FNCALL:
+        {
+            const char *name = PolicyCacheReadString(r);
+            Rlist *args = PolicyCacheReadRlist(r, nesting + 1);
+            if (name != NULL)
+            {
+                return (Rval) { FnCallNew(name, args), RVAL_TYPE_FNCALL };
+            }
+            RlistDestroy(args);
+        }
+        break;
+
+    case RVAL_TYPE_NOPROMISEE:
+        return RvalNew(NULL, RVAL_TYPE_NOPROMISEE);
+
+    default:
+        break;
+    }
+
+    r->failed = true;
+    return RvalNew(NULL, RVAL_TYPE_NOPROMISEE);
+}
+
+static void PolicyCacheReadConstraints(PolicyCacheReader *r, Promise *pp, Body *body)
+{
+    size_t count = PolicyCacheReadCount(r);
+
+    for (size_t i = 0; (i < count) && !r->failed; i++)
+    {
+        const char *lval = PolicyCacheReadString(r);
+        const char *classes = PolicyCacheReadString(r);
+        bool references_body = PolicyCacheReadWord(r);
+        Rval rval = PolicyCacheReadRval(r, 0);
+
+        if (r->failed || (lval == NULL))
+        {
+            RvalDestroy(rval);
+            r->failed = true;
+            return;
+        }
+
+        Constraint *cp = (pp != NULL) ? PromiseAppendConstraint(pp, lval, rval, classes, references_body)
+                                      : BodyAppendConstraint(body, lval, rval, classes, references_body);
+        PolicyCacheReadOffset(r, &cp->offset);
+    }
+}
+
+static void PolicyCacheReadPromises(PolicyCacheReader *r, PromiseType *type)
+{
+    size_t count = PolicyCacheReadCount(r);
+
+    for (size_t i = 0; (i < count) && !r->failed; i++)
+    {
+        const char *promiser = PolicyCacheReadString(r);
+        const char *classes = PolicyCacheReadString(r);
+        const char *comment = PolicyCacheReadString(r);
+        Rval promisee = PolicyCacheReadRval(r, 0);
+
+        if (r->failed || (promiser == NULL))
+        {
+            RvalDestroy(promisee);
+            r->failed = true;
+            return;
+        }
+
+        Promise *pp = PromiseTypeAppendPromise(type, promiser, promisee, classes);
+        pp->comment = SafeStringDuplicate(comment);
+        pp->has_subbundles = PolicyCacheReadWord(r);
+        PolicyCacheReadOffset(r, &pp->offset);
+
+        PolicyCacheReadConstraints(r, pp, NULL);
+    }
+}
+
+static Policy *PolicyCacheReadPolicy(PolicyCacheReader *r)
+{
+    Policy *policy = PolicyNew();
+
+    size_t count = PolicyCacheReadCount(r);
+
+    for (size_t i = 0; (i < count) && !r->failed; i++)
+    {
+        const char *ns = PolicyCacheReadString(r);
+        const char *name = PolicyCacheReadString(r);
+        const char *type = PolicyCacheReadString(r);
+        const char *source_path = PolicyCacheReadString(r);
+        Rlist *args = PolicyCacheReadRlist(r, 0);
+
+        if (r->failed || (ns == NULL) || (name == NULL) || (type == NULL))
+        {
+            RlistDestroy(args);
+            r->failed = true;
+            break;
+        }
+
+        Bundle *bundle = PolicyAppendBundle(policy, ns, name, type, args, source_path);
+        RlistDestroy(args);
+        PolicyCacheReadOffset(r, &bundle->offset);
+
+        size_t type_count = PolicyCacheReadCount(r);
+
+        for (size_t j = 0; (j < type_count) && !r->failed; j++)
+        {
+            const char *type_name = PolicyCacheReadString(r);
+
+            if (type_name == NULL)
+            {
+                r->failed = true;
+                break;
+            }
+
+            PromiseType *promise_type = BundleAppendPromiseType(bundle, type_name);
+            PolicyCacheReadOffset(r, &promise_type->offset);
+
+            PolicyCacheReadPromises(r, promise_type);
+        }
+    }
+
+    count = PolicyCacheReadCount(r);
+
+    for (size_t i = 0; (i < count) && !r->failed; i++)
+    {
+        const char *ns = PolicyCacheReadString(r);
+        const char *name = PolicyCacheReadString(r);
+        const char *type = PolicyCacheReadString(r);
+        const char *source_path = PolicyCacheReadString(r);
+        Rlist *args = PolicyCacheReadRlist(r, 0);
+
+        if (r->failed || (ns == NULL) || (name == NULL) || (type == NULL))
+        {
+            RlistDestroy(args);
+            r->failed = true;
+            break;
+        }
+
+        Body *body = PolicyAppendBody(policy, ns, name, type, args, source_path);
+        RlistDestroy(args);
+        PolicyCacheReadOffset(r, &body->offset);
+
+        PolicyCacheReadConstraints(r, NULL, body);
+    }
+
+    if (r->failed || (r->pos != r->code_size))
+    {
+        PolicyDestroy(policy);
+        return NULL;
+    }
+
+    return policy;
+}
+
+/**
+ * @brief Check the header and bounds of a precompiled copy written by this
+ *        version and set up a reader for it.
+ * @return The input file name recorded in the copy, or NULL if it is not valid.
+ */
+static const char *PolicyCacheOpenImage(const char *image, size_t size, PolicyCacheHeader *header,
+                                        PolicyCacheReader *r)
+{
+    if (size < sizeof(*header))
+    {
+        return NULL;
+    }
+
+    memcpy(header, image, sizeof(*header));
+
+    if ((memcmp(header->magic, POLICY_CACHE_MAGIC, sizeof(header->magic)) != 0) ||
+        (header->format != POLICY_CACHE_FORMAT) ||
+        (header->byte_order != POLICY_CACHE_BYTE_ORDER) ||
+        (strncmp(header->version, VERSION, sizeof(header->version)) != 0))
+    {
+        return NULL;
+    }
+
+    uint64_t expected = (uint64_t) sizeof(*header) + (uint64_t) header->string_count * sizeof(uint32_t) +
+        (uint64_t) header->code_size * sizeof(uint32_t) + header->strings_size;
+
+    if ((expected != size) || (header->strings_size == 0) || (image[size - 1] != '\0'))
+    {
+        return NULL;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->offsets = (const uint32_t *) (image + sizeof(*header));
+    r->string_count = header->string_count;
+    r->code = r->offsets + header->string_count;
+    r->code_size = header->code_size;
+    r->strings = (const char *) (r->code + header->code_size);
+    r->strings_size = header->strings_size;
+
+    for (size_t i = 0; i < r->string_count; i++)
+    {
+        if (r->offsets[i] >= r->strings_size)
+        {
+            return NULL;
+        }
+    }
+
+    if (header->path >= r->string_count)
+    {
+        return NULL;
+    }
+
+    return r->strings + r->offsets[header->path];
+}
+
+/**
+ * @brief Check a precompiled copy against the input file and decode it.
+ */
+static Policy *PolicyCacheDecode(const char *image, size_t size, const char *input_path,
+                                 const unsigned char digest[CF_SHA256_LEN])
+{
+    PolicyCacheHeader header;
+    PolicyCacheReader r;
+
+    const char *path = PolicyCacheOpenImage(image, size, &header, &r);
+
+    /* A copy of another file that canonifies to the same name */
+    if ((path == NULL) || (strcmp(path, input_path) != 0))
+    {
+        return NULL;
+    }
+
+    if (memcmp(header.digest, digest, CF_SHA256_LEN) != 0)
+    {
+        return NULL;
+    }
+
+    return PolicyCacheReadPolicy(&r);
+}
+
+Policy *PolicyCacheReadFile(const char *cache_file, const char *input_path)
+{
+    unsigned char digest[CF_SHA256_LEN];
+
+    int fd = open(cache_file, O_RDONLY | O_BINARY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+#ifndef __MINGW32__
+    /* Loading a copy is as good as loading the policy itself */
+    if ((sb.st_uid != getuid()) || (sb.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Ignoring precompiled policy file '%s' not owned by us or writable by others", cache_file);
+        close(fd);
+        return NULL;
+    }
+#endif
+
+    if ((sb.st_size < sizeof(PolicyCacheHeader)) || !PolicyCacheDigest(input_path, digest))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = sb.st_size;
+    Policy *policy = NULL;
+
+#ifndef __MINGW32__
+    void *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (image == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    policy = PolicyCacheDecode(image, size, input_path, digest);
+    munmap(image, size);
+#else
+    char *image = xmalloc(size);
+    ssize_t bytes = read(fd, image, size);
+    close(fd);
+
+    if (bytes == size)
+    {
+        policy = PolicyCacheDecode(image, size, input_path, digest);
+    }
+    free(image);
+#endif
+
+    return policy;
+}
+
+Policy *PolicyCacheLoad(const char *input_path)
+{
+    char *cache_file = PolicyCacheFileName(input_path);
+    Policy *policy = PolicyCacheReadFile(cache_file, input_path);
+
+    if (policy != NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Loaded precompiled policy of '%s' from '%s'", input_path, cache_file);
+    }
+
+    free(cache_file);
+    return policy;
+}
@@ -0,0 +1,79 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_POLICY_CACHE_H
+#define CFENGINE_POLICY_CACHE_H
+
+#include <cf3.defs.h>
+
+/*
+ * Precompiled copies of parsed policy files, kept in WORKDIR/state/policy_cache.
+ *
+ * A copy holds the policy DOM parsed from one input file as a table of
+ * interned strings followed by a flat stream of words, and is only used if
+ * the SHA-256 of the input file and the version of the binary that wrote it
+ * still match. cf-promises stages a copy of each file it parses and writes
+ * them out once the whole policy has been validated, the other agents load
+ * them instead of parsing.
+ */
+
+/**
+ * @brief Load the policy of an input file from its precompiled copy.
+ * @return The policy, or NULL if there is no up to date copy.
+ */
+Policy *PolicyCacheLoad(const char *input_path);
+
+/**
+ * @brief Precompile the policy just parsed from an input file. The copy is
+ *        kept in memory until PolicyCacheCommit().
+ * @param digest SHA-256 of the contents the policy was parsed from, see
+ *               ParserParseFileDigest()
+ */
+void PolicyCacheStage(const char *input_path, const unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                      const Policy *policy);
+
+/**
+ * @brief Write the copies staged so far, once the policy has been validated,
+ *        and remove copies that have gone out of date.
+ */
+void PolicyCacheCommit(void);
+
+/**
+ * @brief Write the precompiled copy of the policy of an input file.
+ * @param cache_file File to write the copy to
+ * @param input_path Input file the policy was parsed from
+ * @param digest SHA-256 of the contents the policy was parsed from
+ * @return True if the copy was written.
+ */
+bool PolicyCacheWriteFile(const char *cache_file, const char *input_path,
+                          const unsigned char digest[EVP_MAX_MD_SIZE + 1], const Policy *policy);
+
+/**
+ * @brief Read the precompiled copy of the policy of an input file.
+ * @return The policy, or NULL if the copy is missing, damaged or out of
+ *         date with respect to the input file.
+ */
+Policy *PolicyCacheReadFile(const char *cache_file, const char *input_path);
+
+#endif
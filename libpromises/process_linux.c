@@ -155,3 +155,313 @@ ProcessState GetProcessState(pid_t pid)
         return PROCESS_STATE_DOES_NOT_EXIST;
     }
 }
+
+/*
+ * Native process table
+ */
+
+typedef struct
+{
+    time_t boot_time;
+    double uptime;
+    long mem_total;             /* KiB */
+    long clock_ticks;
+    long page_size;
+} SystemInfo;
+
+typedef struct
+{
+    uid_t *uids;
+    char **names;
+    size_t size;
+} UserNameCache;
+
+static bool GetSystemInfo(SystemInfo *info)
+{
+    char line[CF_BUFSIZE];
+    FILE *fp;
+
+    info->boot_time = 0;
+    info->uptime = 0;
+    info->mem_total = 0;
+    info->clock_ticks = sysconf(_SC_CLK_TCK);
+    info->page_size = sysconf(_SC_PAGESIZE);
+
+    if ((fp = fopen("/proc/stat", "r")) == NULL)
+    {
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        long btime;
+        if (sscanf(line, "btime %ld", &btime) == 1)
+        {
+            info->boot_time = (time_t)btime;
+            break;
+        }
+    }
+    fclose(fp);
+
+    if ((fp = fopen("/proc/uptime", "r")) != NULL)
+    {
+        if (fscanf(fp, "%lf", &info->uptime) != 1)
+        {
+            info->uptime = 0;
+        }
+        fclose(fp);
+    }
+
+    if ((fp = fopen("/proc/meminfo", "r")) != NULL)
+    {
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (sscanf(line, "MemTotal: %ld kB", &info->mem_total) == 1)
+            {
+                break;
+            }
+        }
+        fclose(fp);
+    }
+
+    return info->boot_time != 0 && info->clock_ticks > 0;
+}
+
+static const char *UserNameCacheGet(UserNameCache *cache, uid_t uid)
+{
+    for (size_t i = 0; i < cache->size; i++)
+    {
+        if (cache->uids[i] == uid)
+        {
+            return cache->names[i];
+        }
+    }
+
+    char *name;
+    struct passwd *pw = getpwuid(uid);
+    if (pw)
+    {
+        name = xstrdup(pw->pw_name);
+    }
+    else
+    {
+        xasprintf(&name, "%ju", (uintmax_t)uid);
+    }
+
+    cache->uids = xrealloc(cache->uids, (cache->size + 1) * sizeof(uid_t));
+    cache->names = xrealloc(cache->names, (cache->size + 1) * sizeof(char *));
+    cache->uids[cache->size] = uid;
+    cache->names[cache->size] = name;
+    cache->size++;
+
+    return name;
+}
+
+static void UserNameCacheClear(UserNameCache *cache)
+{
+    for (size_t i = 0; i < cache->size; i++)
+    {
+        free(cache->names[i]);
+    }
+    free(cache->uids);
+    free(cache->names);
+}
+
+static int ReadProcFile(int dir, const char *name, char *buf, size_t size)
+{
+    int fd = openat(dir, name, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    int res = FullRead(fd, buf, size - 1);
+    close(fd);
+
+    if (res < 0)
+    {
+        return -1;
+    }
+
+    buf[res] = '\0';
+    return res;
+}
+
+static bool ReadProcessTableRow(int dir, const SystemInfo *info, UserNameCache *users, ProcessTableRow *row)
+{
+    char buf[CF_BUFSIZE];
+
+    if (ReadProcFile(dir, "stat", buf, sizeof(buf)) <= 0)
+    {
+        return false;
+    }
+
+    /* As in GetProcessStat, the task name may contain anything, so look for
+       the last closing parenthesis */
+
+    char *name_start = strchr(buf, '(');
+    char *name_end = strrchr(buf, ')');
+    if (name_start == NULL || name_end == NULL || name_end < name_start)
+    {
+        return false;
+    }
+
+    char comm[CF_SMALLBUF];
+    snprintf(comm, sizeof(comm), "%.*s", (int)(name_end - name_start - 1), name_start + 1);
+
+    int pid, ppid, pgid;
+    char state;
+    unsigned long long utime, stime, starttime, vsize;
+    long nice, threads, rss;
+
+    if (sscanf(buf, "%d", &pid) != 1 ||
+        sscanf(name_end + 1,
+               " %c"    /* state */
+               " %d"    /* ppid */
+               " %d"    /* pgrp */
+               " %*s"   /* session */
+               " %*s"   /* tty_nr */
+               " %*s"   /* tpgid */
+               " %*s"   /* flags */
+               " %*s"   /* minflt */
+               " %*s"   /* cminflt */
+               " %*s"   /* majflt */
+               " %*s"   /* cmajflt */
+               " %llu"  /* utime */
+               " %llu"  /* stime */
+               " %*s"   /* cutime */
+               " %*s"   /* cstime */
+               " %*s"   /* priority */
+               " %ld"   /* nice */
+               " %ld"   /* num_threads */
+               " %*s"   /* itrealvalue */
+               " %llu"  /* starttime */
+               " %llu"  /* vsize */
+               " %ld",  /* rss */
+               &state, &ppid, &pgid, &utime, &stime, &nice, &threads,
+               &starttime, &vsize, &rss) != 10)
+    {
+        return false;
+    }
+
+    if (ReadProcFile(dir, "status", buf, sizeof(buf)) <= 0)
+    {
+        return false;
+    }
+
+    /* ps reports the effective uid, the second field of the Uid: line */
+    char *uid_line = strstr(buf, "\nUid:");
+    unsigned int uid;
+    if (uid_line == NULL || sscanf(uid_line, "\nUid: %*u %u", &uid) != 1)
+    {
+        return false;
+    }
+
+    int len = ReadProcFile(dir, "cmdline", buf, sizeof(buf));
+    if (len < 0)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        /* Like ps, keep each process on a single printable line */
+        if (buf[i] == '\0' || isspace((unsigned char)buf[i]))
+        {
+            buf[i] = ' ';
+        }
+        else if (iscntrl((unsigned char)buf[i]))
+        {
+            buf[i] = '?';
+        }
+    }
+
+    while (len > 0 && buf[len - 1] == ' ')
+    {
+        buf[--len] = '\0';
+    }
+
+    double ticks = (double)info->clock_ticks;
+    double elapsed = info->uptime - starttime / ticks;
+
+    row->pid = (pid_t)pid;
+    row->ppid = (pid_t)ppid;
+    row->pgid = (pid_t)pgid;
+    row->uid = (uid_t)uid;
+    row->user = xstrdup(UserNameCacheGet(users, row->uid));
+    row->state = state;
+    row->priority = nice;
+    row->threads = threads;
+    row->vsize = (long)(vsize / 1024);
+    row->rsize = rss * (info->page_size / 1024);
+    row->start_time = info->boot_time + (time_t)(starttime / info->clock_ticks);
+    row->cpu_time = (time_t)((utime + stime) / info->clock_ticks);
+    row->pcpu = elapsed > 0 ? (utime + stime) / ticks * 100.0 / elapsed : 0.0;
+    row->pmem = info->mem_total > 0 ? row->rsize * 100.0 / info->mem_total : 0.0;
+
+    /* Kernel threads have no command line, ps shows their name instead */
+    if (len == 0)
+    {
+        xasprintf(&row->command, "[%s]", comm);
+    }
+    else
+    {
+        row->command = xstrdup(buf);
+    }
+
+    return true;
+}
+
+ProcessTable *ReadProcessTable(void)
+{
+    SystemInfo info;
+    if (!GetSystemInfo(&info))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to read system information from /proc");
+        return NULL;
+    }
+
+    DIR *proc = opendir("/proc");
+    if (proc == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to open /proc. (opendir: %s)", GetErrorStr());
+        return NULL;
+    }
+
+    ProcessTable *table = xcalloc(1, sizeof(ProcessTable));
+    UserNameCache users = { 0 };
+
+    const struct dirent *entry;
+    while ((entry = readdir(proc)) != NULL)
+    {
+        if (!isdigit((unsigned char)entry->d_name[0]))
+        {
+            continue;
+        }
+
+        int dir = openat(dirfd(proc), entry->d_name, O_RDONLY | O_DIRECTORY);
+        if (dir == -1)
+        {
+            /* Process has exited meanwhile */
+            continue;
+        }
+
+        if (table->size == table->capacity)
+        {
+            table->capacity = table->capacity ? table->capacity * 2 : 512;
+            table->rows = xrealloc(table->rows, table->capacity * sizeof(ProcessTableRow));
+        }
+
+        if (ReadProcessTableRow(dir, &info, &users, &table->rows[table->size]))
+        {
+            table->size++;
+        }
+
+        close(dir);
+    }
+
+    closedir(proc);
+    UserNameCacheClear(&users);
+
+    return table;
+}
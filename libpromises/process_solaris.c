@@ -101,3 +101,8 @@ ProcessState GetProcessState(pid_t pid)
         return PROCESS_STATE_DOES_NOT_EXIST;
     }
 }
+
+ProcessTable *ReadProcessTable(void)
+{
+    return NULL;
+}
@@ -241,3 +241,18 @@ int GracefulTerminate(pid_t pid, time_t process_start_time)
 
     return true;
 }
+
+void ProcessTableDestroy(ProcessTable *table)
+{
+    if (table)
+    {
+        for (size_t i = 0; i < table->size; i++)
+        {
+            free(table->rows[i].user);
+            free(table->rows[i].command);
+        }
+
+        free(table->rows);
+        free(table);
+    }
+}
@@ -49,4 +49,44 @@ typedef enum
  */
 ProcessState GetProcessState(pid_t pid);
 
+/*
+ * One process as observed in the native process table. The fields mirror the
+ * columns of the ps(1) listing the table stands in for.
+ */
+typedef struct
+{
+    pid_t pid;
+    pid_t ppid;
+    pid_t pgid;
+    uid_t uid;
+    char *user;
+    char state;
+    long priority;
+    long threads;
+    long vsize;                 /* KiB */
+    long rsize;                 /* KiB */
+    time_t start_time;          /* Unix timestamp */
+    time_t cpu_time;            /* seconds */
+    double pcpu;
+    double pmem;
+    char *command;
+} ProcessTableRow;
+
+typedef struct
+{
+    ProcessTableRow *rows;
+    size_t size;
+    size_t capacity;
+} ProcessTable;
+
+/*
+ * Read the process table natively, without forking ps(1).
+ *
+ * @return the process table, to be freed with ProcessTableDestroy()
+ * @return NULL if the platform has no native reader or it failed
+ */
+ProcessTable *ReadProcessTable(void);
+
+void ProcessTableDestroy(ProcessTable *table);
+
 #endif
@@ -43,3 +43,8 @@ ProcessState GetProcessState(ARG_UNUSED pid_t pid)
 
     return PROCESS_STATE_RUNNING;
 }
+
+ProcessTable *ReadProcessTable(void)
+{
+    return NULL;
+}
@@ -35,6 +35,11 @@
 #include <rlist.h>
 #include <policy.h>
 #include <zones.h>
+#include <atexit.h>
+
+#ifndef __MINGW32__
+# include <process_unix_priv.h>
+#endif
 
 static int SelectProcRangeMatch(char *name1, char *name2, int min, int max, char **names, char **line);
 static int SelectProcRegexMatch(EvalContext *ctx, char *name1, char *name2, char *regex, char **colNames, char **line);
@@ -44,6 +49,17 @@ static int SelectProcTimeAbsRangeMatch(char *name1, char *name2, time_t min, tim
 static int GetProcColumnIndex(char *name1, char *name2, char **names);
 static void GetProcessColumnNames(char *proc, char **names, int *start, int *end);
 static int ExtractPid(char *psentry, char **names, int *end);
+static int EvalProcessSelection(StringSet *process_select_attributes, ProcessSelect a);
+
+#ifndef __MINGW32__
+/* The most recent process table read from /proc, with the Item of each row
+ * in the process list handed out by LoadProcessTable(). */
+static ProcessTable *NATIVE_TABLE = NULL;
+static const Item **NATIVE_TABLE_ITEMS = NULL;
+
+static const ProcessTableRow *GetNativeProcessRow(const Item *ip);
+static int SelectNativeProcess(EvalContext *ctx, const ProcessTableRow *row, ProcessSelect a);
+#endif
 
 /***************************************************************************/
 
@@ -135,6 +151,22 @@ static int SelectProcess(EvalContext *ctx, char *procentry, char **names, int *s
         StringSetAdd(process_select_attributes, xstrdup("tty"));
     }
 
+    result = EvalProcessSelection(process_select_attributes, a);
+
+    StringSetDestroy(process_select_attributes);
+
+    for (i = 0; column[i] != NULL; i++)
+    {
+        free(column[i]);
+    }
+
+    return result;
+}
+
+static int EvalProcessSelection(StringSet *process_select_attributes, ProcessSelect a)
+{
+    int result;
+
     if (!a.process_result)
     {
         if (StringSetSize(process_select_attributes) == 0)
@@ -163,13 +195,6 @@ static int SelectProcess(EvalContext *ctx, char *procentry, char **names, int *s
         result = EvalProcessResult(a.process_result, process_select_attributes);
     }
 
-    StringSetDestroy(process_select_attributes);
-
-    for (i = 0; column[i] != NULL; i++)
-    {
-        free(column[i]);
-    }
-
     return result;
 }
 
@@ -199,6 +224,22 @@ Item *SelectProcesses(EvalContext *ctx, const Item *processes, const char *proce
                 continue;
             }
 
+#ifndef __MINGW32__
+            const ProcessTableRow *row = GetNativeProcessRow(ip);
+
+            if (row)
+            {
+                if (attrselect && !SelectNativeProcess(ctx, row, a))
+                {
+                    continue;
+                }
+
+                PrependItem(&result, ip->name, "");
+                result->counter = (int)row->pid;
+                continue;
+            }
+#endif
+
             if (attrselect && !SelectProcess(ctx, ip->name, names, start, end, a))
             {
                 continue;
@@ -559,6 +600,20 @@ bool IsProcessNameRunning(EvalContext *ctx, char *procNameRegex)
             continue;
         }
 
+#ifndef __MINGW32__
+        const ProcessTableRow *row = GetNativeProcessRow(ip);
+
+        if (row)
+        {
+            if (FullTextMatch(ctx, procNameRegex, row->command))
+            {
+                matched = true;
+                break;
+            }
+            continue;
+        }
+#endif
+
         if (!SplitProcLine(ip->name, colHeaders, start, end, lineSplit))
         {
             Log(LOG_LEVEL_ERR, "IsProcessNameRunning: Could not split process line '%s'", ip->name);
@@ -708,6 +763,321 @@ static int ExtractPid(char *psentry, char **names, int *end)
     return pid;
 }
 
+#ifndef __MINGW32__
+
+/*
+ * Native process table (Linux). Rows are read from /proc with typed fields,
+ * and the process list is rendered in the format of
+ *
+ *   ps -eo user,pid,ppid,pgid,pcpu,pmem,vsz,ni,rss,nlwp,stime,time,args
+ *
+ * so that promisers keep matching the lines they matched before. Process
+ * selection works on the typed fields and never splits these lines.
+ */
+
+#define NATIVE_TABLE_FORMAT "%-8s %5s %5s %5s %4s %4s %6s %3s %5s %4s %5s %8s %s"
+
+static bool UseNativeProcessTable(void)
+{
+    if (VSYSTEMHARDCLASS != PLATFORM_CONTEXT_LINUX)
+    {
+        return false;
+    }
+
+    // No threads on 2.4 kernels, see GetProcessOptions()
+    return strncmp(VSYSNAME.release, "2.4", 3) != 0;
+}
+
+static const ProcessTableRow *GetNativeProcessRow(const Item *ip)
+{
+    if ((NATIVE_TABLE != NULL) && (ip->counter >= 0) &&
+        ((size_t) ip->counter < NATIVE_TABLE->size) &&
+        (NATIVE_TABLE_ITEMS[ip->counter] == ip))
+    {
+        return &NATIVE_TABLE->rows[ip->counter];
+    }
+
+    return NULL;
+}
+
+static void FormatProcessStartTime(time_t start_time, time_t now, char *buf, size_t size)
+{
+    struct tm tm;
+    const char *format = "%H:%M";
+
+    if (now - start_time > 24 * 3600)
+    {
+        format = "%b%d";
+    }
+
+    if (now - start_time > 365 * 24 * 3600)
+    {
+        format = "%Y";
+    }
+
+    if ((localtime_r(&start_time, &tm) == NULL) || (strftime(buf, size, format, &tm) == 0))
+    {
+        strlcpy(buf, "?", size);
+    }
+}
+
+static void FormatProcessCpuTime(time_t cpu_time, char *buf, size_t size)
+{
+    long days = cpu_time / (24 * 3600);
+    long hours = (cpu_time / 3600) % 24;
+    long minutes = (cpu_time / 60) % 60;
+    long seconds = cpu_time % 60;
+
+    if (days > 0)
+    {
+        snprintf(buf, size, "%ld-%02ld:%02ld:%02ld", days, hours, minutes, seconds);
+    }
+    else
+    {
+        snprintf(buf, size, "%02ld:%02ld:%02ld", hours, minutes, seconds);
+    }
+}
+
+static char *NativeProcessLine(const ProcessTableRow *row, time_t now)
+{
+    char pid[32], ppid[32], pgid[32], pcpu[32], pmem[32], vsize[32];
+    char priority[32], rsize[32], threads[32], stime[32], ttime[32];
+    char *line;
+
+    snprintf(pid, sizeof(pid), "%d", (int) row->pid);
+    snprintf(ppid, sizeof(ppid), "%d", (int) row->ppid);
+    snprintf(pgid, sizeof(pgid), "%d", (int) row->pgid);
+    snprintf(pcpu, sizeof(pcpu), "%.1f", row->pcpu);
+    snprintf(pmem, sizeof(pmem), "%.1f", row->pmem);
+    snprintf(vsize, sizeof(vsize), "%ld", row->vsize);
+    snprintf(priority, sizeof(priority), "%ld", row->priority);
+    snprintf(rsize, sizeof(rsize), "%ld", row->rsize);
+    snprintf(threads, sizeof(threads), "%ld", row->threads);
+    FormatProcessStartTime(row->start_time, now, stime, sizeof(stime));
+    FormatProcessCpuTime(row->cpu_time, ttime, sizeof(ttime));
+
+    xasprintf(&line, NATIVE_TABLE_FORMAT, row->user, pid, ppid, pgid, pcpu, pmem,
+              vsize, priority, rsize, threads, stime, ttime, row->command);
+    return line;
+}
+
+static char *NativeProcessHeader(void)
+{
+    char *header;
+
+    xasprintf(&header, NATIVE_TABLE_FORMAT, "USER", "PID", "PPID", "PGID", "%CPU", "%MEM",
+              "VSZ", "NI", "RSS", "NLWP", "STIME", "TIME", "COMMAND");
+    return header;
+}
+
+static bool SelectNativeProcRangeMatch(long value, long min, long max)
+{
+    if ((min == CF_NOINT) || (max == CF_NOINT))
+    {
+        return false;
+    }
+
+    return (min <= value) && (value <= max);
+}
+
+static int SelectNativeProcess(EvalContext *ctx, const ProcessTableRow *row, ProcessSelect a)
+{
+    StringSet *process_select_attributes = StringSetNew();
+
+    if (a.owner != NULL)
+    {
+        char uid[32];
+        snprintf(uid, sizeof(uid), "%ju", (uintmax_t) row->uid);
+
+        for (const Rlist *rp = a.owner; rp != NULL; rp = rp->next)
+        {
+            if (FullTextMatch(ctx, RlistScalarValue(rp), row->user) ||
+                FullTextMatch(ctx, RlistScalarValue(rp), uid))
+            {
+                StringSetAdd(process_select_attributes, xstrdup("process_owner"));
+                break;
+            }
+        }
+    }
+
+    if (SelectNativeProcRangeMatch(row->pid, a.min_pid, a.max_pid))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("pid"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->ppid, a.min_ppid, a.max_ppid))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("ppid"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->pgid, a.min_pgid, a.max_pgid))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("pgid"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->vsize, a.min_vsize, a.max_vsize))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("vsize"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->rsize, a.min_rsize, a.max_rsize))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("rsize"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->cpu_time, a.min_ttime, a.max_ttime))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("ttime"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->start_time, a.min_stime, a.max_stime))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("stime"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->priority, a.min_pri, a.max_pri))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("priority"));
+    }
+
+    if (SelectNativeProcRangeMatch(row->threads, a.min_thread, a.max_thread))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("threads"));
+    }
+
+    if (a.status != NULL)
+    {
+        char state[2] = { row->state, '\0' };
+
+        if (FullTextMatch(ctx, a.status, state))
+        {
+            StringSetAdd(process_select_attributes, xstrdup("status"));
+        }
+    }
+
+    if ((a.command != NULL) && FullTextMatch(ctx, a.command, row->command))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("command"));
+    }
+
+    if (a.tty != NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, " INFO - process column TTY/TTY was not supported on this system");
+    }
+
+    int result = EvalProcessSelection(process_select_attributes, a);
+
+    StringSetDestroy(process_select_attributes);
+
+    return result;
+}
+
+/* The state dumps are only of interest once the agent is done, so they are
+ * written once at exit from the last table observed rather than on every
+ * reload. */
+static void SaveNativeProcessTableState(void)
+{
+    if (NATIVE_TABLE == NULL)
+    {
+        return;
+    }
+
+    char filename[CF_BUFSIZE];
+    time_t now = time(NULL);
+    Item *procs = NULL;
+    Item *rootprocs = NULL;
+    Item *otherprocs = NULL;
+
+    for (size_t i = NATIVE_TABLE->size; i > 0; i--)
+    {
+        char *line = NativeProcessLine(&NATIVE_TABLE->rows[i - 1], now);
+
+        PrependItem(&procs, line, NULL);
+        PrependItem(strstr(line, "root") ? &rootprocs : &otherprocs, line, NULL);
+        free(line);
+    }
+
+    char *header = NativeProcessHeader();
+    PrependItem(&procs, header, NULL);
+    PrependItem(&rootprocs, header, NULL);
+    PrependItem(&otherprocs, header, NULL);
+    free(header);
+
+    snprintf(filename, sizeof(filename), "%s/state/cf_procs", CFWORKDIR);
+    RawSaveItemList(procs, filename);
+    DeleteItemList(procs);
+
+    snprintf(filename, sizeof(filename), "%s/state/cf_rootprocs", CFWORKDIR);
+    RawSaveItemList(rootprocs, filename);
+    DeleteItemList(rootprocs);
+
+    snprintf(filename, sizeof(filename), "%s/state/cf_otherprocs", CFWORKDIR);
+    RawSaveItemList(otherprocs, filename);
+    DeleteItemList(otherprocs);
+}
+
+static void NativeProcessTableClear(void)
+{
+    ProcessTableDestroy(NATIVE_TABLE);
+    NATIVE_TABLE = NULL;
+    free(NATIVE_TABLE_ITEMS);
+    NATIVE_TABLE_ITEMS = NULL;
+}
+
+static bool LoadNativeProcessTable(Item **procdata)
+{
+    static bool registered = false;
+
+    ProcessTable *table = ReadProcessTable();
+
+    if (table == NULL)
+    {
+        return false;
+    }
+
+    NativeProcessTableClear();
+    NATIVE_TABLE = table;
+    NATIVE_TABLE_ITEMS = xcalloc(MAX(table->size, 1), sizeof(Item *));
+
+    /* Built back to front, appending would be quadratic in the table size */
+    time_t now = time(NULL);
+    Item *procs = NULL;
+
+    for (size_t i = table->size; i > 0; i--)
+    {
+        char *line = NativeProcessLine(&table->rows[i - 1], now);
+
+        PrependItem(&procs, line, "");
+        procs->counter = (int) (i - 1);
+        NATIVE_TABLE_ITEMS[i - 1] = procs;
+        free(line);
+    }
+
+    char *header = NativeProcessHeader();
+    PrependItem(&procs, header, "");
+    free(header);
+
+    if (*procdata)
+    {
+        ConcatLists(*procdata, procs);
+    }
+    else
+    {
+        *procdata = procs;
+    }
+
+    if (!registered)
+    {
+        RegisterAtExitFunction(&SaveNativeProcessTableState);
+        registered = true;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Observed process table natively, %zu processes", table->size);
+    return true;
+}
+
+#endif
+
 #ifndef __MINGW32__
 int LoadProcessTable(EvalContext *ctx, Item **procdata)
 {
@@ -722,6 +1092,13 @@ int LoadProcessTable(EvalContext *ctx, Item **procdata)
         return true;
     }
 
+    if (UseNativeProcessTable() && LoadNativeProcessTable(procdata))
+    {
+        return true;
+    }
+
+    NativeProcessTableClear();
+
     const char *psopts = GetProcessOptions();
 
     snprintf(pscomm, CF_MAXLINKSIZE, "%s %s", VPSCOMM[VSYSTEMHARDCLASS], psopts);
@@ -0,0 +1,423 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <profiler.h>
+
+#include <alloc.h>
+#include <misc_lib.h>
+#include <string_lib.h>
+
+/* Iterations entered once this many call paths are recorded are folded into "..." */
+#define PROFILE_MAX_NODES 100000
+#define PROFILE_NO_PARENT ((size_t) -1)
+#define PROFILE_OVERFLOW_NAME "..."
+
+typedef struct
+{
+    ProfileFrameType type;
+    char *scope;
+    char *name;
+    size_t parent;
+    unsigned int hash;
+
+    unsigned long calls;
+    /* Inclusive times, and the part of them spent in child frames */
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    uint64_t child_wall_ns;
+    uint64_t child_cpu_ns;
+} ProfileNode;
+
+typedef struct
+{
+    size_t node;
+    uint64_t wall_start;
+    uint64_t cpu_start;
+} ProfileFrame;
+
+static bool PROFILING = false;
+
+static ProfileNode *NODES = NULL;
+static size_t NODES_LEN = 0;
+static size_t NODES_CAPACITY = 0;
+
+/* Open addressing, holds node index + 1 so that 0 is an empty slot */
+static size_t *NODE_INDEX = NULL;
+static size_t NODE_INDEX_SIZE = 0;
+
+static ProfileFrame *STACK = NULL;
+static size_t STACK_LEN = 0;
+static size_t STACK_CAPACITY = 0;
+
+static const char *const FRAME_TYPE_NAMES[] =
+{
+    [PROFILE_FRAME_BUNDLE] = "bundle",
+    [PROFILE_FRAME_PROMISE] = "promise",
+    [PROFILE_FRAME_ITERATION] = "iteration",
+    [PROFILE_FRAME_FUNCTION] = "function",
+};
+
+static uint64_t ClockNs(clockid_t clock)
+{
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) == -1)
+    {
+        return 0;
+    }
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int NodeHash(ProfileFrameType type, const char *scope, const char *name, size_t parent)
+{
+    unsigned int seed = (unsigned int) parent * 31 + type;
+    if (scope)
+    {
+        seed = StringHash(scope, seed, 1U << 31);
+    }
+    return StringHash(name, seed, 1U << 31);
+}
+
+static bool SameFrame(const ProfileNode *node, ProfileFrameType type, const char *scope, const char *name)
+{
+    if (node->type != type || (node->scope == NULL) != (scope == NULL))
+    {
+        return false;
+    }
+
+    return (scope == NULL || strcmp(node->scope, scope) == 0) && strcmp(node->name, name) == 0;
+}
+
+static bool NodeMatches(const ProfileNode *node, ProfileFrameType type, const char *scope,
+                        const char *name, size_t parent, unsigned int hash)
+{
+    return node->hash == hash && node->parent == parent && SameFrame(node, type, scope, name);
+}
+
+static void NodeIndexInsert(size_t *index, size_t size, size_t node, unsigned int hash)
+{
+    size_t slot = hash & (size - 1);
+    while (index[slot] != 0)
+    {
+        slot = (slot + 1) & (size - 1);
+    }
+    index[slot] = node + 1;
+}
+
+static void NodeIndexGrow(void)
+{
+    size_t size = NODE_INDEX_SIZE ? NODE_INDEX_SIZE * 2 : 1024;
+    size_t *index = xcalloc(size, sizeof(size_t));
+
+    for (size_t i = 0; i < NODES_LEN; i++)
+    {
+        NodeIndexInsert(index, size, i, NODES[i].hash);
+    }
+
+    free(NODE_INDEX);
+    NODE_INDEX = index;
+    NODE_INDEX_SIZE = size;
+}
+
+static size_t NodeGet(ProfileFrameType type, const char *scope, const char *name, size_t parent)
+{
+    unsigned int hash = NodeHash(type, scope, name, parent);
+
+    if (NODE_INDEX_SIZE > 0)
+    {
+        size_t slot = hash & (NODE_INDEX_SIZE - 1);
+        while (NODE_INDEX[slot] != 0)
+        {
+            size_t node = NODE_INDEX[slot] - 1;
+            if (NodeMatches(&NODES[node], type, scope, name, parent, hash))
+            {
+                return node;
+            }
+            slot = (slot + 1) & (NODE_INDEX_SIZE - 1);
+        }
+    }
+
+    /* Only iterations are unbounded, everything else is bounded by the policy */
+    if (NODES_LEN >= PROFILE_MAX_NODES && type == PROFILE_FRAME_ITERATION &&
+        strcmp(name, PROFILE_OVERFLOW_NAME) != 0)
+    {
+        return NodeGet(type, NULL, PROFILE_OVERFLOW_NAME, parent);
+    }
+
+    if ((NODES_LEN + 1) * 2 > NODE_INDEX_SIZE)
+    {
+        NodeIndexGrow();
+    }
+
+    if (NODES_LEN == NODES_CAPACITY)
+    {
+        NODES_CAPACITY = NODES_CAPACITY ? NODES_CAPACITY * 2 : 256;
+        NODES = xrealloc(NODES, NODES_CAPACITY * sizeof(ProfileNode));
+    }
+
+    ProfileNode *node = &NODES[NODES_LEN];
+    memset(node, 0, sizeof(ProfileNode));
+    node->type = type;
+    node->scope = scope ? xstrdup(scope) : NULL;
+    node->name = xstrdup(name);
+    node->parent = parent;
+    node->hash = hash;
+
+    NodeIndexInsert(NODE_INDEX, NODE_INDEX_SIZE, NODES_LEN, hash);
+
+    return NODES_LEN++;
+}
+
+/*******************************************************************/
+
+void ProfilerStart(void)
+{
+    ProfilerStop();
+    PROFILING = true;
+}
+
+void ProfilerStop(void)
+{
+    for (size_t i = 0; i < NODES_LEN; i++)
+    {
+        free(NODES[i].scope);
+        free(NODES[i].name);
+    }
+    free(NODES);
+    free(NODE_INDEX);
+    free(STACK);
+
+    NODES = NULL;
+    NODES_LEN = NODES_CAPACITY = 0;
+    NODE_INDEX = NULL;
+    NODE_INDEX_SIZE = 0;
+    STACK = NULL;
+    STACK_LEN = STACK_CAPACITY = 0;
+
+    PROFILING = false;
+}
+
+bool ProfilerIsEnabled(void)
+{
+    return PROFILING;
+}
+
+void ProfilerEnter(ProfileFrameType type, const char *scope, const char *name)
+{
+    if (!PROFILING)
+    {
+        return;
+    }
+
+    size_t parent = STACK_LEN > 0 ? STACK[STACK_LEN - 1].node : PROFILE_NO_PARENT;
+
+    if (STACK_LEN == STACK_CAPACITY)
+    {
+        STACK_CAPACITY = STACK_CAPACITY ? STACK_CAPACITY * 2 : 64;
+        STACK = xrealloc(STACK, STACK_CAPACITY * sizeof(ProfileFrame));
+    }
+
+    ProfileFrame *frame = &STACK[STACK_LEN++];
+    frame->node = NodeGet(type, scope, name ? name : "", parent);
+    frame->wall_start = ClockNs(CLOCK_MONOTONIC);
+    frame->cpu_start = ClockNs(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void ProfilerLeave(void)
+{
+    if (!PROFILING)
+    {
+        return;
+    }
+
+    if (STACK_LEN == 0)
+    {
+        ProgrammingError("ProfilerLeave() called without matching ProfilerEnter()");
+    }
+
+    uint64_t cpu_stop = ClockNs(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t wall_stop = ClockNs(CLOCK_MONOTONIC);
+
+    ProfileFrame *frame = &STACK[--STACK_LEN];
+    ProfileNode *node = &NODES[frame->node];
+    uint64_t wall = wall_stop - frame->wall_start;
+    uint64_t cpu = cpu_stop - frame->cpu_start;
+
+    node->calls++;
+    node->wall_ns += wall;
+    node->cpu_ns += cpu;
+
+    if (node->parent != PROFILE_NO_PARENT)
+    {
+        NODES[node->parent].child_wall_ns += wall;
+        NODES[node->parent].child_cpu_ns += cpu;
+    }
+}
+
+/*******************************************************************/
+
+static uint64_t SelfTime(uint64_t total, uint64_t children)
+{
+    /* Clock granularity can make children add up to more than the parent */
+    return total > children ? total - children : 0;
+}
+
+static void WriteFrameName(Writer *w, const ProfileNode *node)
+{
+    if (node->type == PROFILE_FRAME_BUNDLE)
+    {
+        WriterWrite(w, "bundle ");
+    }
+
+    if (node->scope)
+    {
+        WriterWriteF(w, "%s:", node->scope);
+    }
+
+    /* ';' separates frames and a line is one path, so keep them out of names */
+    for (const char *c = node->name; *c != '\0'; c++)
+    {
+        WriterWriteChar(w, (*c == ';' || *c == '\n' || *c == '\r') ? '_' : *c);
+    }
+
+    if (node->type == PROFILE_FRAME_FUNCTION)
+    {
+        WriterWrite(w, "()");
+    }
+}
+
+static void WritePath(Writer *w, size_t node)
+{
+    if (NODES[node].parent != PROFILE_NO_PARENT)
+    {
+        WritePath(w, NODES[node].parent);
+        WriterWriteChar(w, ';');
+    }
+    WriteFrameName(w, &NODES[node]);
+}
+
+void ProfilerWriteFolded(Writer *w)
+{
+    for (size_t i = 0; i < NODES_LEN; i++)
+    {
+        uint64_t self_us = SelfTime(NODES[i].wall_ns, NODES[i].child_wall_ns) / 1000;
+        if (self_us > 0)
+        {
+            WritePath(w, i);
+            WriterWriteF(w, " %" PRIu64 "\n", self_us);
+        }
+    }
+}
+
+typedef struct
+{
+    size_t node;            /* First node of this frame, for its name */
+    unsigned long calls;
+    uint64_t self_wall_ns;
+    uint64_t self_cpu_ns;
+    uint64_t wall_ns;
+} ProfileSummaryRow;
+
+static bool HasAncestorLike(size_t node)
+{
+    const ProfileNode *n = &NODES[node];
+    for (size_t p = n->parent; p != PROFILE_NO_PARENT; p = NODES[p].parent)
+    {
+        if (SameFrame(&NODES[p], n->type, n->scope, n->name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int CompareSelfWall(const void *a, const void *b)
+{
+    const ProfileSummaryRow *ra = a;
+    const ProfileSummaryRow *rb = b;
+
+    if (ra->self_wall_ns != rb->self_wall_ns)
+    {
+        return ra->self_wall_ns < rb->self_wall_ns ? 1 : -1;
+    }
+    return ra->node < rb->node ? -1 : (ra->node > rb->node);
+}
+
+void ProfilerWriteSummary(Writer *w, size_t top)
+{
+    /* Sum the nodes of each frame over all the paths it was entered from */
+    ProfileSummaryRow *rows = xcalloc(NODES_LEN + 1, sizeof(ProfileSummaryRow));
+    size_t num_rows = 0;
+
+    size_t index_size = 1024;
+    while (index_size < NODES_LEN * 2)
+    {
+        index_size *= 2;
+    }
+    size_t *index = xcalloc(index_size, sizeof(size_t));
+
+    for (size_t i = 0; i < NODES_LEN; i++)
+    {
+        const ProfileNode *node = &NODES[i];
+        unsigned int hash = NodeHash(node->type, node->scope, node->name, PROFILE_NO_PARENT);
+
+        size_t slot = hash & (index_size - 1);
+        while (index[slot] != 0 && !SameFrame(&NODES[rows[index[slot] - 1].node], node->type, node->scope, node->name))
+        {
+            slot = (slot + 1) & (index_size - 1);
+        }
+        if (index[slot] == 0)
+        {
+            rows[num_rows].node = i;
+            index[slot] = ++num_rows;
+        }
+
+        ProfileSummaryRow *row = &rows[index[slot] - 1];
+        row->calls += node->calls;
+        row->self_wall_ns += SelfTime(node->wall_ns, node->child_wall_ns);
+        row->self_cpu_ns += SelfTime(node->cpu_ns, node->child_cpu_ns);
+
+        /* Time spent in recursive calls is already in the outermost one */
+        if (!HasAncestorLike(i))
+        {
+            row->wall_ns += node->wall_ns;
+        }
+    }
+
+    qsort(rows, num_rows, sizeof(ProfileSummaryRow), CompareSelfWall);
+
+    WriterWriteF(w, "%12s %12s %12s %10s  %-9s %s\n", "self ms", "total ms", "self cpu ms", "calls", "type", "frame");
+    for (size_t i = 0; i < num_rows && i < top; i++)
+    {
+        const ProfileNode *node = &NODES[rows[i].node];
+        WriterWriteF(w, "%12.3f %12.3f %12.3f %10lu  %-9s ",
+                     rows[i].self_wall_ns / 1e6, rows[i].wall_ns / 1e6, rows[i].self_cpu_ns / 1e6,
+                     rows[i].calls, FRAME_TYPE_NAMES[node->type]);
+        WriteFrameName(w, node);
+        WriterWriteChar(w, '\n');
+    }
+
+    free(index);
+    free(rows);
+}
@@ -0,0 +1,88 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_PROFILER_H
+#define CFENGINE_PROFILER_H
+
+#include <platform.h>
+#include <writer.h>
+
+/*
+ * In-process profiler for policy evaluation, enabled by cf-agent --profile.
+ *
+ * Bundles, promises, promise iterations and function calls enter and leave
+ * frames. Monotonic wall time and process CPU time are aggregated per call
+ * path in memory, so the cost of an enabled profiler is two clock reads and
+ * a hash lookup per frame and does not grow with the length of the run.
+ * While disabled, entering or leaving a frame only tests a flag.
+ */
+
+typedef enum
+{
+    PROFILE_FRAME_BUNDLE,
+    PROFILE_FRAME_PROMISE,
+    PROFILE_FRAME_ITERATION,
+    PROFILE_FRAME_FUNCTION
+} ProfileFrameType;
+
+/**
+ * @brief Start recording frames, discarding anything recorded before.
+ */
+void ProfilerStart(void);
+
+/**
+ * @brief Stop recording frames and free the recorded profile.
+ */
+void ProfilerStop(void);
+
+bool ProfilerIsEnabled(void);
+
+/**
+ * @brief Enter a frame below the current one.
+ * @param scope Qualifies the name in the output (namespace of a bundle,
+ *              promise type of a promise), may be NULL
+ * @param name Bundle name, promiser or function name
+ */
+void ProfilerEnter(ProfileFrameType type, const char *scope, const char *name);
+
+/**
+ * @brief Leave the frame entered last.
+ */
+void ProfilerLeave(void);
+
+/**
+ * @brief Write the profile in folded stack format, one line per call path
+ *        with its self wall time in microseconds, as read by flamegraph.pl.
+ */
+void ProfilerWriteFolded(Writer *w);
+
+/**
+ * @brief Write the frames with the most self wall time, summed over all
+ *        call paths.
+ * @param top Number of frames to write
+ */
+void ProfilerWriteSummary(Writer *w, size_t top);
+
+#endif
@@ -0,0 +1,51 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_WARM_AGENT_H
+#define CFENGINE_WARM_AGENT_H
+
+/*
+ * Protocol between cf-execd and a warm cf-agent (cf-agent --warm-worker).
+ *
+ * The warm agent discovers the host and loads the policy once, then listens
+ * on a UNIX socket in WORKDIR/state. cf-execd connects for each run and
+ * writes one request line. The warm agent forks a child for the run, whose
+ * stdout and stderr are the connection, so cf-execd reads its output as it
+ * would from a pipe to a freshly started cf-agent. Lines starting with
+ * WARM_AGENT_TAG are not output but notes for cf-execd:
+ *
+ *   cf-agent-warm: pid <pid>             first line, the process of the run
+ *   cf-agent-warm: first-promise <ms>    time from request to first promise
+ *   cf-agent-warm: reload                only line, the policy has changed
+ *                                        and the warm agent is exiting
+ */
+
+#define WARM_AGENT_SOCKET "cf-agent.warm"
+#define WARM_AGENT_TAG "cf-agent-warm:"
+
+#define WARM_AGENT_REQUEST_RUN "run"
+#define WARM_AGENT_REQUEST_SCHEDULED_RUN "run scheduled_run"
+
+#endif
@@ -26,9 +26,6 @@
 #include <array_map_priv.h>
 #include <alloc.h>
 
-/* FIXME: make configurable and move to map.c */
-#define TINY_LIMIT 14
-
 ArrayMap *ArrayMapNew(MapKeyEqualFn equal_fn,
                       MapDestroyDataFn destroy_key_fn,
                       MapDestroyDataFn destroy_value_fn)
@@ -27,6 +27,9 @@
 
 #include <map_common.h>
 
+/* Maximum number of elements an ArrayMap holds before Map converts it */
+#define TINY_LIMIT 14
+
 typedef struct
 {
     MapKeyEqualFn equal_fn;
@@ -501,28 +501,35 @@ int BufferAppend(Buffer *buffer, const char *bytes, unsigned int length)
         buffer->used = used;
     }
     /*
-     * Check if we have enough space, otherwise create a larger buffer
+     * Check if we have enough space, otherwise create a larger buffer.
+     * The capacity at least doubles, so that many small appends do not
+     * reallocate and copy the whole contents every DEFAULT_BUFFER_SIZE bytes.
      */
     if (buffer->used + length >= buffer->capacity)
     {
         unsigned int required_blocks = ((buffer->used + length)/ DEFAULT_BUFFER_SIZE) + 1;
-        buffer->buffer = (char *)xrealloc(buffer->buffer, required_blocks * DEFAULT_BUFFER_SIZE);
-        buffer->capacity = required_blocks * DEFAULT_BUFFER_SIZE;
+        unsigned int new_capacity = required_blocks * DEFAULT_BUFFER_SIZE;
+        if (new_capacity < 2 * buffer->capacity)
+        {
+            new_capacity = 2 * buffer->capacity;
+        }
+        buffer->buffer = (char *)xrealloc(buffer->buffer, new_capacity);
+        buffer->capacity = new_capacity;
     }
     /*
      * We have a buffer that is large enough, copy the data.
+     * A CString stops at the first '\0'.
      */
-    unsigned int c = 0;
-    unsigned int total = 0;
-    for (c = 0; c < length; ++c)
+    unsigned int total = length;
+    if (buffer->mode == BUFFER_BEHAVIOR_CSTRING)
     {
-        buffer->buffer[c + buffer->used] = bytes[c];
-        if ((bytes[c] == '\0') && (buffer->mode = BUFFER_BEHAVIOR_CSTRING))
+        const char *end = memchr(bytes, '\0', length);
+        if (end)
         {
-            break;
+            total = end - bytes;
         }
-        ++total;
     }
+    memcpy(buffer->buffer + buffer->used, bytes, total);
     buffer->used += total;
     if (buffer->mode == BUFFER_BEHAVIOR_CSTRING)
     {
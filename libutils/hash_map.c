@@ -26,117 +26,211 @@
 #include <hash_map_priv.h>
 #include <alloc.h>
 
-/* FIXME: make configurable and move to map.c */
-#define HASHMAP_BUCKETS 8192
+#define HASHMAP_MIN_CAPACITY 32
+
+/* Passed to hash_fn as "max", hash functions mask their result with max - 1 */
+#define HASHMAP_HASH_RANGE 0x80000000U
+
+/* Load factor bounds, in percent */
+#define HASHMAP_MAX_LOAD 75
+#define HASHMAP_MIN_LOAD 10
+
+/*
+ * Hash functions in use are of varying quality (e.g. pointer hashes have the
+ * low bits zeroed by alignment), so scramble the bits before masking, this is
+ * the MurmurHash3 finalizer.
+ */
+static unsigned int HashMapMixHash(unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static size_t HashMapCapacityFor(size_t elements)
+{
+    size_t capacity = HASHMAP_MIN_CAPACITY;
+    while (capacity * HASHMAP_MAX_LOAD / 100 < elements)
+    {
+        capacity <<= 1;
+    }
+    return capacity;
+}
 
 HashMap *HashMapNew(MapHashFn hash_fn, MapKeyEqualFn equal_fn,
                     MapDestroyDataFn destroy_key_fn,
-                    MapDestroyDataFn destroy_value_fn)
+                    MapDestroyDataFn destroy_value_fn,
+                    size_t init_capacity)
 {
     HashMap *map = xcalloc(1, sizeof(HashMap));
     map->hash_fn = hash_fn;
     map->equal_fn = equal_fn;
     map->destroy_key_fn = destroy_key_fn;
     map->destroy_value_fn = destroy_value_fn;
-    map->buckets = xcalloc(1, sizeof(BucketListItem *) * HASHMAP_BUCKETS);
+    map->init_capacity = HashMapCapacityFor(init_capacity);
+    map->capacity = map->init_capacity;
+    map->buckets = xcalloc(map->capacity, sizeof(HashMapBucket));
     return map;
 }
 
-static unsigned int HashMapGetBucket(const HashMap *map, const void *key)
+static unsigned int HashMapGetHash(const HashMap *map, const void *key)
 {
-    return map->hash_fn(key, 0, HASHMAP_BUCKETS);
+    return HashMapMixHash(map->hash_fn(key, 0, HASHMAP_HASH_RANGE));
 }
 
-bool HashMapInsert(HashMap *map, void *key, void *value)
+/*
+ * Returns the bucket holding key, or the empty bucket where key would be
+ * inserted. Terminates because the load factor is always below 100%.
+ */
+static size_t HashMapFindBucket(const HashMap *map, const void *key, unsigned int hash, bool *found)
 {
-    unsigned bucket = HashMapGetBucket(map, key);
+    size_t mask = map->capacity - 1;
 
-    for (BucketListItem *i = map->buckets[bucket]; i != NULL; i = i->next)
+    for (size_t i = hash & mask; ; i = (i + 1) & mask)
     {
-        if (map->equal_fn(i->value.key, key))
+        const HashMapBucket *b = &map->buckets[i];
+        if (!b->used)
+        {
+            *found = false;
+            return i;
+        }
+        if (b->hash == hash && map->equal_fn(b->value.key, key))
         {
-            map->destroy_key_fn(key);
-            map->destroy_value_fn(i->value.value);
-            i->value.value = value;
-            return true;
+            *found = true;
+            return i;
         }
     }
-
-    BucketListItem *i = xcalloc(1, sizeof(BucketListItem));
-    i->value.key = key;
-    i->value.value = value;
-    i->next = map->buckets[bucket];
-    map->buckets[bucket] = i;
-
-    return false;
 }
 
-bool HashMapRemove(HashMap *map, const void *key)
+static void HashMapResize(HashMap *map, size_t new_capacity)
 {
-    unsigned bucket = HashMapGetBucket(map, key);
+    HashMapBucket *old_buckets = map->buckets;
+    size_t old_capacity = map->capacity;
 
-    /*
-     * prev points to a previous "next" pointer to rewrite it in case value need
-     * to be deleted
-     */
+    map->buckets = xcalloc(new_capacity, sizeof(HashMapBucket));
+    map->capacity = new_capacity;
 
-    for (BucketListItem **prev = &map->buckets[bucket];
-         *prev != NULL;
-         prev = &((*prev)->next))
+    size_t mask = new_capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++)
     {
-        BucketListItem *cur = *prev;
-        if (map->equal_fn(cur->value.key, key))
+        if (old_buckets[i].used)
         {
-            map->destroy_key_fn(cur->value.key);
-            map->destroy_value_fn(cur->value.value);
-            *prev = cur->next;
-            free(cur);
-            return true;
+            size_t j = old_buckets[i].hash & mask;
+            while (map->buckets[j].used)
+            {
+                j = (j + 1) & mask;
+            }
+            map->buckets[j] = old_buckets[i];
         }
     }
 
+    free(old_buckets);
+}
+
+bool HashMapInsert(HashMap *map, void *key, void *value)
+{
+    unsigned int hash = HashMapGetHash(map, key);
+    bool found;
+    size_t i = HashMapFindBucket(map, key, hash, &found);
+
+    if (found)
+    {
+        map->destroy_key_fn(key);
+        map->destroy_value_fn(map->buckets[i].value.value);
+        map->buckets[i].value.value = value;
+        return true;
+    }
+
+    if ((map->size + 1) * 100 > map->capacity * HASHMAP_MAX_LOAD)
+    {
+        HashMapResize(map, map->capacity * 2);
+        i = HashMapFindBucket(map, key, hash, &found);
+    }
+
+    map->buckets[i] = (HashMapBucket) { { key, value }, hash, true };
+    map->size++;
+
     return false;
 }
 
-MapKeyValue *HashMapGet(const HashMap *map, const void *key)
+bool HashMapRemove(HashMap *map, const void *key)
 {
-    unsigned bucket = HashMapGetBucket(map, key);
+    bool found;
+    size_t i = HashMapFindBucket(map, key, HashMapGetHash(map, key), &found);
 
-    for (BucketListItem *cur = map->buckets[bucket];
-         cur != NULL;
-         cur = cur->next)
+    if (!found)
     {
-        if (map->equal_fn(cur->value.key, key))
+        return false;
+    }
+
+    map->destroy_key_fn(map->buckets[i].value.key);
+    map->destroy_value_fn(map->buckets[i].value.value);
+
+    /*
+     * Backward shift deletion: move following entries of the probe sequence
+     * into the hole unless their home bucket lies cyclically in (hole, j].
+     */
+    size_t mask = map->capacity - 1;
+    for (size_t j = (i + 1) & mask; map->buckets[j].used; j = (j + 1) & mask)
+    {
+        size_t home = map->buckets[j].hash & mask;
+        bool in_place = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!in_place)
         {
-            return &cur->value;
+            map->buckets[i] = map->buckets[j];
+            i = j;
         }
     }
+    map->buckets[i].used = false;
+    map->size--;
 
-    return NULL;
+    if (map->capacity > map->init_capacity &&
+        map->size * 100 < map->capacity * HASHMAP_MIN_LOAD)
+    {
+        HashMapResize(map, map->capacity / 2);
+    }
+
+    return true;
 }
 
-static void FreeBucketListItem(HashMap *map, BucketListItem *item)
+MapKeyValue *HashMapGet(const HashMap *map, const void *key)
 {
-    if (item->next)
-    {
-        FreeBucketListItem(map, item->next);
-    }
+    bool found;
+    size_t i = HashMapFindBucket(map, key, HashMapGetHash(map, key), &found);
 
-    map->destroy_key_fn(item->value.key);
-    map->destroy_value_fn(item->value.value);
-    free(item);
+    return found ? &map->buckets[i].value : NULL;
+}
+
+size_t HashMapSize(const HashMap *map)
+{
+    return map->size;
 }
 
 void HashMapClear(HashMap *map)
 {
-    for (int i = 0; i < HASHMAP_BUCKETS; ++i)
+    for (size_t i = 0; i < map->capacity; ++i)
     {
-        if (map->buckets[i])
+        if (map->buckets[i].used)
         {
-            FreeBucketListItem(map, map->buckets[i]);
+            map->destroy_key_fn(map->buckets[i].value.key);
+            map->destroy_value_fn(map->buckets[i].value.value);
         }
-        map->buckets[i] = NULL;
     }
+
+    if (map->capacity != map->init_capacity)
+    {
+        free(map->buckets);
+        map->capacity = map->init_capacity;
+        map->buckets = xcalloc(map->capacity, sizeof(HashMapBucket));
+    }
+    else
+    {
+        memset(map->buckets, 0, map->capacity * sizeof(HashMapBucket));
+    }
+    map->size = 0;
 }
 
 void HashMapDestroy(HashMap *map)
@@ -153,22 +247,19 @@ void HashMapDestroy(HashMap *map)
 
 HashMapIterator HashMapIteratorInit(HashMap *map)
 {
-    return (HashMapIterator) { map, map->buckets[0], 0 };
+    return (HashMapIterator) { map, 0 };
 }
 
 MapKeyValue *HashMapIteratorNext(HashMapIterator *i)
 {
-    while (i->cur == NULL)
+    while (i->bucket < i->map->capacity)
     {
-        if (++i->bucket >= HASHMAP_BUCKETS)
+        HashMapBucket *b = &i->map->buckets[i->bucket++];
+        if (b->used)
         {
-            return NULL;
+            return &b->value;
         }
-
-        i->cur = i->map->buckets[i->bucket];
     }
 
-    MapKeyValue *ret = &i->cur->value;
-    i->cur = i->cur->next;
-    return ret;
+    return NULL;
 }
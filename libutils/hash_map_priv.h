@@ -27,37 +27,52 @@
 
 #include <map_common.h>
 
-typedef struct BucketListItem_
+typedef struct
 {
     MapKeyValue value;
-    struct BucketListItem_ *next;
-} BucketListItem;
+    unsigned int hash;
+    bool used;
+} HashMapBucket;
 
 typedef unsigned int (*MapHashFn) (const void *p, unsigned int seed, unsigned int max);
 
+/*
+ * Open addressing with linear probing. The bucket array grows (and shrinks)
+ * by powers of two to keep the load factor between HASHMAP_MIN_LOAD and
+ * HASHMAP_MAX_LOAD; deletion shifts following entries back, so there are no
+ * tombstones. Pointers into the table are invalidated by insertion/removal.
+ */
 typedef struct
 {
     MapHashFn hash_fn;
     MapKeyEqualFn equal_fn;
     MapDestroyDataFn destroy_key_fn;
     MapDestroyDataFn destroy_value_fn;
-    BucketListItem **buckets;
+    HashMapBucket *buckets;
+    size_t size;
+    size_t capacity;
+    size_t init_capacity;
 } HashMap;
 
 typedef struct
 {
     HashMap *map;
-    BucketListItem *cur;
-    int bucket;
+    size_t bucket;
 } HashMapIterator;
 
+/**
+ * @param init_capacity Number of elements the map should hold without
+ *                      rehashing, 0 for the default.
+ */
 HashMap *HashMapNew(MapHashFn hash_fn, MapKeyEqualFn equal_fn,
                     MapDestroyDataFn destroy_key_fn,
-                    MapDestroyDataFn destroy_value_fn);
+                    MapDestroyDataFn destroy_value_fn,
+                    size_t init_capacity);
 
 bool HashMapInsert(HashMap *map, void *key, void *value);
 bool HashMapRemove(HashMap *map, const void *key);
 MapKeyValue *HashMapGet(const HashMap *map, const void *key);
+size_t HashMapSize(const HashMap *map);
 void HashMapClear(HashMap *map);
 void HashMapDestroy(HashMap *map);
 
@@ -25,6 +25,7 @@
 
 #include <alloc.h>
 #include <sequence.h>
+#include <map.h>
 #include <string_lib.h>
 
 #include <json.h>
@@ -32,6 +33,8 @@
 
 static const int SPACES_PER_INDENT = 2;
 static const int DEFAULT_CONTAINER_CAPACITY = 64;
+/* Objects with at least this many members get a key index on first lookup */
+static const size_t JSON_OBJECT_INDEX_THRESHOLD = 16;
 
 static const char *JSON_TRUE = "true";
 static const char *JSON_FALSE = "false";
@@ -47,6 +50,7 @@ struct JsonElement_
         {
             JsonContainerType type;
             Seq *children;
+            Map *index;         // objects only: propertyName -> child, NULL until built
         } container;
         struct JsonPrimitive
         {
@@ -314,6 +318,11 @@ void JsonDestroy(JsonElement *element)
         {
         case JSON_ELEMENT_TYPE_CONTAINER:
             assert(element->container.children);
+            if (element->container.index)
+            {
+                MapDestroy(element->container.index);
+                element->container.index = NULL;
+            }
             SeqDestroy(element->container.children);
             element->container.children = NULL;
             break;
@@ -339,6 +348,8 @@ void JsonDestroy(JsonElement *element)
     }
 }
 
+static JsonElement *JsonObjectLookup(JsonElement *object, const char *key);
+
 JsonElement *JsonMerge(const JsonElement *a, const JsonElement *b)
 {
     assert(JsonGetElementType(a) == JsonGetElementType(b));
@@ -365,16 +376,21 @@ JsonElement *JsonMerge(const JsonElement *a, const JsonElement *b)
         }
         break;
 
-    case JSON_ELEMENT_TYPE_CONTAINER:
+    case JSON_CONTAINER_TYPE_OBJECT:
         {
             JsonElement *obj = JsonObjectCreate(JsonLength(a) + JsonLength(b));
 
+            /* Keys of a that b overrides go last, as if appended again;
+             * leave them out here rather than removing them later. */
             JsonIterator iter = JsonIteratorInit(a);
             const JsonElement *child = NULL;
             while ((child = JsonIteratorNextValue(&iter)))
             {
                 const char *key = JsonIteratorCurrentKey(&iter);
-                JsonObjectAppendElement(obj, key, JsonCopy(child));
+                if (!JsonObjectLookup((JsonElement *)b, key))
+                {
+                    JsonObjectAppendElement(obj, key, JsonCopy(child));
+                }
             }
             iter = JsonIteratorInit(b);
             child = NULL;
@@ -681,58 +697,6 @@ static char *JsonEncodeString(const char *unescaped_string)
     return StringWriterClose(writer);
 }
 
-static char *JsonDecodeString(const char *encoded_string)
-{
-    assert(encoded_string);
-
-    Writer *w = StringWriter();
-
-    for (const char *c = encoded_string; *c != '\0'; c++)
-    {
-        switch (*c)
-        {
-        case '\\':
-            switch (c[1])
-            {
-            case '\"':
-            case '\\':
-                WriterWriteChar(w, c[1]);
-                c++;
-                break;
-            case 'b':
-                WriterWriteChar(w, '\b');
-                c++;
-                break;
-            case 'f':
-                WriterWriteChar(w, '\f');
-                c++;
-                break;
-            case 'n':
-                WriterWriteChar(w, '\n');
-                c++;
-                break;
-            case 'r':
-                WriterWriteChar(w, '\r');
-                c++;
-                break;
-            case 't':
-                WriterWriteChar(w, '\t');
-                c++;
-                break;
-            default:
-                WriterWriteChar(w, *c);
-                break;
-            }
-            break;
-        default:
-            WriterWriteChar(w, *c);
-            break;
-        }
-    }
-
-    return StringWriterClose(w);
-}
-
 void JsonObjectAppendString(JsonElement *object, const char *key, const char *value)
 {
     JsonElement *child = JsonStringCreate(value);
@@ -781,48 +745,101 @@ void JsonObjectAppendObject(JsonElement *object, const char *key, JsonElement *c
     JsonObjectAppendElement(object, key, childObject);
 }
 
-void JsonObjectAppendElement(JsonElement *object, const char *key, JsonElement *element)
+/*
+ * The members of an object stay in a Seq to keep insertion order. Past
+ * JSON_OBJECT_INDEX_THRESHOLD members a Map from key to member is built
+ * on the first lookup, and from then on kept up to date by every function
+ * adding or removing members. Its keys are the members' propertyName.
+ */
+
+static JsonElement *JsonObjectLookup(JsonElement *object, const char *key)
 {
     assert(object);
     assert(object->type == JSON_ELEMENT_TYPE_CONTAINER);
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
-    assert(element);
 
-    JsonObjectRemoveKey(object, key);
-
-    JsonElementSetPropertyName(element, key);
-    SeqAppend(object->container.children, element);
-}
+    Seq *children = object->container.children;
 
-static int JsonElementHasProperty(const void *propertyName, const void *jsonElement, ARG_UNUSED void *user_data)
-{
-    assert(propertyName);
+    if (!object->container.index)
+    {
+        if (SeqLength(children) < JSON_OBJECT_INDEX_THRESHOLD)
+        {
+            for (size_t i = 0; i < SeqLength(children); i++)
+            {
+                JsonElement *child = SeqAt(children, i);
+                if (strcmp(key, child->propertyName) == 0)
+                {
+                    return child;
+                }
+            }
+            return NULL;
+        }
 
-    const JsonElement *element = jsonElement;
+        object->container.index = MapNew((MapHashFn)&StringHash, (MapKeyEqualFn)&StringSafeEqual, NULL, NULL);
+        for (size_t i = 0; i < SeqLength(children); i++)
+        {
+            JsonElement *child = SeqAt(children, i);
+            MapInsert(object->container.index, child->propertyName, child);
+        }
+    }
 
-    assert(element->propertyName);
+    return MapGet(object->container.index, key);
+}
 
-    if (strcmp(propertyName, element->propertyName) == 0)
+static size_t JsonObjectMemberPosition(const JsonElement *object, const JsonElement *member)
+{
+    Seq *children = object->container.children;
+    for (size_t i = 0; i < SeqLength(children); i++)
     {
-        return 0;
+        if (SeqAt(children, i) == member)
+        {
+            return i;
+        }
     }
+
+    assert(false && "JSON object member not found among children");
     return -1;
 }
 
-static int CompareKeyToPropertyName(const void *a, const void *b, ARG_UNUSED void *user_data)
+/*
+ * Takes the member out of the object and the index, returning it, or NULL
+ * if there is no member with that key.
+ */
+static JsonElement *JsonObjectUnlinkKey(JsonElement *object, const char *key)
 {
-    return StringSafeCompare((char*)a, ((JsonElement*)b)->propertyName);
+    JsonElement *member = JsonObjectLookup(object, key);
+    if (!member)
+    {
+        return NULL;
+    }
+
+    if (object->container.index)
+    {
+        MapRemove(object->container.index, member->propertyName);
+    }
+
+    SeqSoftRemove(object->container.children, JsonObjectMemberPosition(object, member));
+    return member;
 }
 
-static size_t JsonElementIndexInParentObject(JsonElement *parent, const char* key)
+void JsonObjectAppendElement(JsonElement *object, const char *key, JsonElement *element)
 {
-    assert(parent);
-    assert(parent->type == JSON_ELEMENT_TYPE_CONTAINER);
-    assert(parent->container.type == JSON_CONTAINER_TYPE_OBJECT);
+    assert(object);
+    assert(object->type == JSON_ELEMENT_TYPE_CONTAINER);
+    assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
+    assert(element);
+
+    JsonObjectRemoveKey(object, key);
+
+    JsonElementSetPropertyName(element, key);
+    SeqAppend(object->container.children, element);
 
-    return SeqIndexOf(parent->container.children, key, CompareKeyToPropertyName);
+    if (object->container.index)
+    {
+        MapInsert(object->container.index, element->propertyName, element);
+    }
 }
 
 bool JsonObjectRemoveKey(JsonElement *object, const char *key)
@@ -832,10 +849,10 @@ bool JsonObjectRemoveKey(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    size_t index = JsonElementIndexInParentObject(object, key);
-    if (index != -1)
+    JsonElement *removed = JsonObjectUnlinkKey(object, key);
+    if (removed)
     {
-        SeqRemove(object->container.children, index);
+        JsonDestroy(removed);
         return true;
     }
     return false;
@@ -848,16 +865,7 @@ JsonElement *JsonObjectDetachKey(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    JsonElement *detached = NULL;
-
-    size_t index = JsonElementIndexInParentObject(object, key);
-    if (index != -1)
-    {
-        detached = SeqLookup(object->container.children, key, JsonElementHasProperty);
-        SeqSoftRemove(object->container.children, index);
-    }
-
-    return detached;
+    return JsonObjectUnlinkKey(object, key);
 }
 
 const char *JsonObjectGetAsString(JsonElement *object, const char *key)
@@ -867,7 +875,7 @@ const char *JsonObjectGetAsString(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    JsonElement *childPrimitive = SeqLookup(object->container.children, key, JsonElementHasProperty);
+    JsonElement *childPrimitive = JsonObjectLookup(object, key);
 
     if (childPrimitive)
     {
@@ -886,7 +894,7 @@ JsonElement *JsonObjectGetAsObject(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    JsonElement *childPrimitive = SeqLookup(object->container.children, key, JsonElementHasProperty);
+    JsonElement *childPrimitive = JsonObjectLookup(object, key);
 
     if (childPrimitive)
     {
@@ -905,7 +913,7 @@ JsonElement *JsonObjectGetAsArray(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    JsonElement *childPrimitive = SeqLookup(object->container.children, key, JsonElementHasProperty);
+    JsonElement *childPrimitive = JsonObjectLookup(object, key);
 
     if (childPrimitive)
     {
@@ -924,7 +932,7 @@ JsonElement *JsonObjectGet(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    return SeqLookup(object->container.children, key, JsonElementHasProperty);
+    return JsonObjectLookup(object, key);
 }
 
 // *******************************************************************************************
@@ -1272,42 +1280,307 @@ void JsonWrite(Writer *writer, JsonElement *element, size_t indent_level)
 // Parsing
 // *******************************************************************************************
 
-static JsonParseError JsonParseAsObject(const char **data, JsonElement **json_out);
+/*
+ * The parser reads through a JsonSource, a window over either the whole
+ * document in memory or a fixed size buffer refilled from a file
+ * descriptor. Strings and numbers are scanned as spans of the window and
+ * allocated once, a token running past the end of the buffer is collected
+ * in the scratch buffer of the source first. A NUL byte ends the input.
+ */
 
-static JsonElement *JsonParseAsBoolean(const char **data)
+#define JSON_PARSE_BUFFER_SIZE (64 * 1024)
+
+typedef struct
 {
-    if (StringMatch("^true", *data))
+    const char *cur;
+    const char *end;
+
+    int fd;                     /* -1 when parsing a string in memory */
+    char *buffer;
+    size_t remaining;           /* Bytes still to be read from fd at most */
+    bool read_error;
+
+    char *scratch;
+    size_t scratch_len;
+    size_t scratch_capacity;
+} JsonSource;
+
+static bool JsonSourceFill(JsonSource *src)
+{
+    if (src->fd == -1 || src->remaining == 0)
+    {
+        return false;
+    }
+
+    size_t keep = src->end - src->cur;
+    memmove(src->buffer, src->cur, keep);
+    src->cur = src->buffer;
+    src->end = src->buffer + keep;
+
+    size_t want = MIN(JSON_PARSE_BUFFER_SIZE - keep, src->remaining);
+    if (want == 0)
+    {
+        return false;
+    }
+
+    ssize_t got;
+    do
+    {
+        got = read(src->fd, src->buffer + keep, want);
+    } while (got == -1 && errno == EINTR);
+
+    if (got <= 0)
     {
-        char next = *(*data + 4);
-        if (IsSeparator(next) || next == '\0')
+        src->read_error = (got == -1);
+        src->remaining = 0;
+        return false;
+    }
+
+    src->end += got;
+    src->remaining -= got;
+    return true;
+}
+
+static char JsonSourcePeek(JsonSource *src, size_t offset)
+{
+    while ((size_t) (src->end - src->cur) <= offset)
+    {
+        if (!JsonSourceFill(src))
         {
-            *data += 3;
-            return JsonBoolCreate(true);
+            return '\0';
         }
     }
-    else if (StringMatch("^false", *data))
+
+    return src->cur[offset];
+}
+
+static void JsonSourceScratchAppend(JsonSource *src, const char *data, size_t len)
+{
+    if (src->scratch_len + len > src->scratch_capacity)
+    {
+        src->scratch_capacity = MAX(src->scratch_capacity * 2, src->scratch_len + len);
+        src->scratch = xrealloc(src->scratch, src->scratch_capacity);
+    }
+
+    memcpy(src->scratch + src->scratch_len, data, len);
+    src->scratch_len += len;
+}
+
+/* Consume word if it is followed by a separator or the end of the input */
+static bool JsonSourceMatchWord(JsonSource *src, const char *word)
+{
+    size_t len = strlen(word);
+
+    for (size_t i = 0; i < len; i++)
     {
-        char next = *(*data + 5);
-        if (IsSeparator(next) || next == '\0')
+        if (JsonSourcePeek(src, i) != word[i])
         {
-            *data += 4;
-            return JsonBoolCreate(false);
+            return false;
         }
     }
 
-    return NULL;
+    char next = JsonSourcePeek(src, len);
+    if (!IsSeparator(next) && next != '\0')
+    {
+        return false;
+    }
+
+    src->cur += len;
+    return true;
 }
 
-static JsonElement *JsonParseAsNull(const char **data)
+static bool JsonDecodeHex4(const char *p, const char *end, unsigned int *value)
 {
-    if (StringMatch("^null", *data))
+    if (end - p < 4)
     {
-        char next = *(*data + 4);
-        if (IsSeparator(next) || next == '\0')
+        return false;
+    }
+
+    *value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = p[i];
+        unsigned int digit;
+
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = c - 'A' + 10;
+        }
+        else
         {
-            *data += 3;
-            return JsonNullCreate();
+            return false;
         }
+
+        *value = (*value << 4) | digit;
+    }
+
+    return true;
+}
+
+static size_t JsonEncodeUtf8(unsigned int code_point, char *out)
+{
+    if (code_point < 0x80)
+    {
+        out[0] = code_point;
+        return 1;
+    }
+    else if (code_point < 0x800)
+    {
+        out[0] = 0xC0 | (code_point >> 6);
+        out[1] = 0x80 | (code_point & 0x3F);
+        return 2;
+    }
+    else if (code_point < 0x10000)
+    {
+        out[0] = 0xE0 | (code_point >> 12);
+        out[1] = 0x80 | ((code_point >> 6) & 0x3F);
+        out[2] = 0x80 | (code_point & 0x3F);
+        return 3;
+    }
+    else
+    {
+        out[0] = 0xF0 | (code_point >> 18);
+        out[1] = 0x80 | ((code_point >> 12) & 0x3F);
+        out[2] = 0x80 | ((code_point >> 6) & 0x3F);
+        out[3] = 0x80 | (code_point & 0x3F);
+        return 4;
+    }
+}
+
+/*
+ * Decode the escapes of a string span into a new string. Decoding never
+ * makes a string longer, so one allocation of the span length is enough.
+ * \u escapes become UTF-8, with surrogate pairs combined and lone
+ * surrogates replaced by U+FFFD. Unknown or malformed escapes, and \u0000,
+ * are kept as they are.
+ */
+static char *JsonDecodeSpan(const char *raw, size_t len)
+{
+    char *out = xmalloc(len + 1);
+    const char *escape = memchr(raw, '\\', len);
+
+    if (escape == NULL)
+    {
+        memcpy(out, raw, len);
+        out[len] = '\0';
+        return out;
+    }
+
+    memcpy(out, raw, escape - raw);
+    char *o = out + (escape - raw);
+
+    const char *end = raw + len;
+    const char *p = escape;
+
+    while (p < end)
+    {
+        if (*p != '\\' || p + 1 == end)
+        {
+            *o++ = *p++;
+            continue;
+        }
+
+        switch (p[1])
+        {
+        case '"':
+        case '\\':
+        case '/':
+            *o++ = p[1];
+            p += 2;
+            break;
+        case 'b':
+            *o++ = '\b';
+            p += 2;
+            break;
+        case 'f':
+            *o++ = '\f';
+            p += 2;
+            break;
+        case 'n':
+            *o++ = '\n';
+            p += 2;
+            break;
+        case 'r':
+            *o++ = '\r';
+            p += 2;
+            break;
+        case 't':
+            *o++ = '\t';
+            p += 2;
+            break;
+        case 'u':
+            {
+                unsigned int code_point;
+                if (!JsonDecodeHex4(p + 2, end, &code_point) || code_point == 0)
+                {
+                    *o++ = *p++;
+                    break;
+                }
+
+                size_t used = 6;
+                if (code_point >= 0xD800 && code_point <= 0xDBFF)
+                {
+                    unsigned int low;
+                    if (end - p >= 12 && p[6] == '\\' && p[7] == 'u' &&
+                        JsonDecodeHex4(p + 8, end, &low) && low >= 0xDC00 && low <= 0xDFFF)
+                    {
+                        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                        used = 12;
+                    }
+                    else
+                    {
+                        code_point = 0xFFFD;
+                    }
+                }
+                else if (code_point >= 0xDC00 && code_point <= 0xDFFF)
+                {
+                    code_point = 0xFFFD;
+                }
+
+                o += JsonEncodeUtf8(code_point, o);
+                p += used;
+            }
+            break;
+        default:
+            *o++ = *p++;
+            *o++ = *p++;
+            break;
+        }
+    }
+
+    *o = '\0';
+    return out;
+}
+
+static JsonParseError JsonParseAsObject(JsonSource *src, JsonElement **json_out);
+
+static JsonElement *JsonParseAsBoolean(JsonSource *src)
+{
+    if (JsonSourceMatchWord(src, "true"))
+    {
+        return JsonBoolCreate(true);
+    }
+    else if (JsonSourceMatchWord(src, "false"))
+    {
+        return JsonBoolCreate(false);
+    }
+
+    return NULL;
+}
+
+static JsonElement *JsonParseAsNull(JsonSource *src)
+{
+    if (JsonSourceMatchWord(src, "null"))
+    {
+        return JsonNullCreate();
     }
 
     return NULL;
@@ -1345,71 +1618,103 @@ const char* JsonParseErrorToString(JsonParseError error)
         [JSON_PARSE_ERROR_OBJECT_OPEN_LVAL] = "Unable to parse json data as object, tried to close object having opened an l-value",
 
         [JSON_PARSE_ERROR_INVALID_START] = "Unwilling to parse json data starting with invalid character",
-        [JSON_PARSE_ERROR_NO_DATA] = "No data"
+        [JSON_PARSE_ERROR_NO_DATA] = "No data",
+        [JSON_PARSE_ERROR_READ] = "Unable to read json data"
     };
 
     assert(error < JSON_PARSE_ERROR_MAX);
     return parse_errors[error];
 }
 
-static JsonParseError JsonParseAsString(const char **data, char **str_out)
+static JsonParseError JsonParseAsString(JsonSource *src, char **str_out)
 {
-    if (**data != '"')
+    if (JsonSourcePeek(src, 0) != '"')
     {
         *str_out = NULL;
         return JSON_PARSE_ERROR_STRING_NO_DOUBLEQUOTE_START;
     }
+    src->cur++;
 
-    Writer *writer = StringWriter();
+    bool escaped = false;
+    bool in_scratch = false;
+    src->scratch_len = 0;
 
-    for (*data = *data + 1; **data != '\0'; *data = *data + 1)
+    for (;;)
     {
-        if (**data == '"' && *(*data - 1) != '\\')
+        const char *start = src->cur;
+        const char *p = start;
+
+        for (; p < src->end; p++)
         {
-            *str_out = StringWriterClose(writer);
-            return JSON_PARSE_OK;
+            if (*p == '\0')
+            {
+                break;
+            }
+            else if (escaped)
+            {
+                escaped = false;
+            }
+            else if (*p == '\\')
+            {
+                escaped = true;
+            }
+            else if (*p == '"')
+            {
+                break;
+            }
         }
 
-        /* unescaping input strings */
-        if (**data == '\\' &&
-                (*(*data + 1) == '\"' ||
-                 *(*data + 1) == '\\' ||
-                 *(*data + 1) == '\b' ||
-                 *(*data + 1) == '\f' ||
-                 *(*data + 1) == '\n' ||
-                 *(*data + 1) == '\r' ||
-                 *(*data + 1) == '\t'))
+        if (p < src->end)
         {
-            continue;
+            if (*p == '\0')
+            {
+                break;
+            }
+
+            if (in_scratch)
+            {
+                JsonSourceScratchAppend(src, start, p - start);
+                *str_out = JsonDecodeSpan(src->scratch, src->scratch_len);
+            }
+            else
+            {
+                *str_out = JsonDecodeSpan(start, p - start);
+            }
+
+            src->cur = p + 1;
+            return JSON_PARSE_OK;
         }
 
-        WriterWriteChar(writer, **data);
+        /* The string goes on past the buffer */
+        JsonSourceScratchAppend(src, start, p - start);
+        in_scratch = true;
+        src->cur = src->end;
+
+        if (!JsonSourceFill(src))
+        {
+            break;
+        }
     }
 
-    WriterClose(writer);
     *str_out = NULL;
     return JSON_PARSE_ERROR_STRING_NO_DOUBLEQUOTE_END;
 }
 
-static JsonParseError JsonParseAsNumber(const char **data, JsonElement **json_out)
+static JsonParseError JsonCheckNumber(const char *span, size_t len, bool *seen_dot_out)
 {
-    Writer *writer = StringWriter();
-
     bool zero_started = false;
     bool seen_dot = false;
     bool seen_exponent = false;
 
     char prev_char = 0;
 
-    for (*data = *data; **data != '\0' && !IsSeparator(**data); prev_char = **data, *data = *data + 1)
+    for (size_t i = 0; i < len; prev_char = span[i], i++)
     {
-        switch (**data)
+        switch (span[i])
         {
         case '-':
             if (prev_char != 0 && prev_char != 'e' && prev_char != 'E')
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_EXPONENT_NEGATIVE;
             }
             break;
@@ -1417,8 +1722,6 @@ static JsonParseError JsonParseAsNumber(const char **data, JsonElement **json_ou
         case '+':
             if (prev_char != 'e' && prev_char != 'E')
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_EXPONENT_POSITIVE;
             }
             break;
@@ -1426,8 +1729,6 @@ static JsonParseError JsonParseAsNumber(const char **data, JsonElement **json_ou
         case '0':
             if (zero_started && !seen_dot && !seen_exponent)
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_DUPLICATE_ZERO;
             }
             if (prev_char == 0)
@@ -1439,8 +1740,6 @@ static JsonParseError JsonParseAsNumber(const char **data, JsonElement **json_ou
         case '.':
             if (prev_char != '0' && !IsDigit(prev_char))
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_NO_DIGIT;
             }
             seen_dot = true;
@@ -1450,14 +1749,10 @@ static JsonParseError JsonParseAsNumber(const char **data, JsonElement **json_ou
         case 'E':
             if (seen_exponent)
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_EXPONENT_DUPLICATE;
             }
             else if (!IsDigit(prev_char) && prev_char != '0')
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_EXPONENT_DIGIT;
             }
             seen_exponent = true;
@@ -1466,83 +1761,142 @@ static JsonParseError JsonParseAsNumber(const char **data, JsonElement **json_ou
         default:
             if (zero_started && !seen_dot && !seen_exponent)
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_EXPONENT_FOLLOW_LEADING_ZERO;
             }
 
-            if (!IsDigit(**data))
+            if (!IsDigit(span[i]))
             {
-                *json_out = NULL;
-                WriterClose(writer);
                 return JSON_PARSE_ERROR_NUMBER_BAD_SYMBOL;
             }
             break;
         }
-
-        WriterWriteChar(writer, **data);
     }
 
     if (prev_char != '0' && !IsDigit(prev_char))
     {
-        *json_out = NULL;
-        WriterClose(writer);
         return JSON_PARSE_ERROR_NUMBER_DIGIT_END;
     }
 
-    // rewind 1 char so caller will see separator next
-    *data = *data - 1;
+    *seen_dot_out = seen_dot;
+    return JSON_PARSE_OK;
+}
+
+static JsonParseError JsonParseAsNumber(JsonSource *src, JsonElement **json_out)
+{
+    bool in_scratch = false;
+    src->scratch_len = 0;
 
-    if (seen_dot)
+    const char *start;
+    const char *p;
+
+    for (;;)
     {
-        *json_out = JsonElementCreatePrimitive(JSON_PRIMITIVE_TYPE_REAL, StringWriterClose(writer));
-        return JSON_PARSE_OK;
+        start = src->cur;
+        p = start;
+
+        while (p < src->end && *p != '\0' && !IsSeparator(*p))
+        {
+            p++;
+        }
+
+        if (p < src->end)
+        {
+            break;
+        }
+
+        /* The number goes on past the buffer, or ends with the input */
+        JsonSourceScratchAppend(src, start, p - start);
+        in_scratch = true;
+        src->cur = src->end;
+
+        if (!JsonSourceFill(src))
+        {
+            start = p = src->cur;
+            break;
+        }
     }
-    else
+
+    const char *span = start;
+    size_t len = p - start;
+
+    if (in_scratch)
+    {
+        JsonSourceScratchAppend(src, start, len);
+        span = src->scratch;
+        len = src->scratch_len;
+    }
+
+    src->cur = p;
+
+    bool seen_dot = false;
+    JsonParseError err = JsonCheckNumber(span, len, &seen_dot);
+    if (err != JSON_PARSE_OK)
     {
-        *json_out = JsonElementCreatePrimitive(JSON_PRIMITIVE_TYPE_INTEGER, StringWriterClose(writer));
-        return JSON_PARSE_OK;
+        *json_out = NULL;
+        return err;
+    }
+
+    *json_out = JsonElementCreatePrimitive(seen_dot ? JSON_PRIMITIVE_TYPE_REAL : JSON_PRIMITIVE_TYPE_INTEGER,
+                                           xstrndup(span, len));
+    return JSON_PARSE_OK;
+}
+
+/* Append a member whose key was just parsed, taking over the key */
+static void JsonObjectAppendParsed(JsonElement *object, char *key, JsonElement *element)
+{
+    JsonObjectRemoveKey(object, key);
+
+    element->propertyName = key;
+    SeqAppend(object->container.children, element);
+
+    if (object->container.index)
+    {
+        MapInsert(object->container.index, element->propertyName, element);
     }
 }
 
-static JsonParseError JsonParseAsArray(const char **data, JsonElement **json_out)
+static JsonParseError JsonParseAsArray(JsonSource *src, JsonElement **json_out)
 {
-    if (**data != '[')
+    if (JsonSourcePeek(src, 0) != '[')
     {
         *json_out = NULL;
         return JSON_PARSE_ERROR_ARRAY_START;
     }
+    src->cur++;
 
     JsonElement *array = JsonArrayCreate(DEFAULT_CONTAINER_CAPACITY);
 
-    for (*data = *data + 1; **data != '\0'; *data = *data + 1)
+    for (char c = JsonSourcePeek(src, 0); c != '\0'; c = JsonSourcePeek(src, 0))
     {
-        if (IsWhitespace(**data))
+        if (IsWhitespace(c) || c == ',')
         {
+            src->cur++;
             continue;
         }
 
-        switch (**data)
+        switch (c)
         {
         case '"':
             {
                 char *value = NULL;
-                JsonParseError err = JsonParseAsString(data, &value);
+                JsonParseError err = JsonParseAsString(src, &value);
                 if (err != JSON_PARSE_OK)
                 {
+                    *json_out = NULL;
+                    JsonDestroy(array);
                     return err;
                 }
-                JsonArrayAppendElement(array, JsonElementCreatePrimitive(JSON_PRIMITIVE_TYPE_STRING, JsonDecodeString(value)));
-                free(value);
+                JsonArrayAppendElement(array, JsonElementCreatePrimitive(JSON_PRIMITIVE_TYPE_STRING, value));
             }
             break;
 
         case '[':
             {
                 JsonElement *child_array = NULL;
-                JsonParseError err = JsonParseAsArray(data, &child_array);
+                JsonParseError err = JsonParseAsArray(src, &child_array);
                 if (err != JSON_PARSE_OK)
                 {
+                    *json_out = NULL;
                     JsonDestroy(array);
                     return err;
                 }
@@ -1555,9 +1909,10 @@ static JsonParseError JsonParseAsArray(const char **data, JsonElement **json_out
         case '{':
             {
                 JsonElement *child_object = NULL;
-                JsonParseError err = JsonParseAsObject(data, &child_object);
+                JsonParseError err = JsonParseAsObject(src, &child_object);
                 if (err != JSON_PARSE_OK)
                 {
+                    *json_out = NULL;
                     JsonDestroy(array);
                     return err;
                 }
@@ -1567,20 +1922,19 @@ static JsonParseError JsonParseAsArray(const char **data, JsonElement **json_out
             }
             break;
 
-        case ',':
-            break;
-
         case ']':
+            src->cur++;
             *json_out = array;
             return JSON_PARSE_OK;
 
         default:
-            if (**data == '-' || **data == '0' || IsDigit(**data))
+            if (c == '-' || c == '0' || IsDigit(c))
             {
                 JsonElement *child = NULL;
-                JsonParseError err = JsonParseAsNumber(data, &child);
+                JsonParseError err = JsonParseAsNumber(src, &child);
                 if (err != JSON_PARSE_OK)
                 {
+                    *json_out = NULL;
                     JsonDestroy(array);
                     return err;
                 }
@@ -1590,14 +1944,14 @@ static JsonParseError JsonParseAsArray(const char **data, JsonElement **json_out
                 break;
             }
 
-            JsonElement *child_bool = JsonParseAsBoolean(data);
+            JsonElement *child_bool = JsonParseAsBoolean(src);
             if (child_bool)
             {
                 JsonArrayAppendElement(array, child_bool);
                 break;
             }
 
-            JsonElement *child_null = JsonParseAsNull(data);
+            JsonElement *child_null = JsonParseAsNull(src);
             if (child_null)
             {
                 JsonArrayAppendElement(array, child_null);
@@ -1615,52 +1969,50 @@ static JsonParseError JsonParseAsArray(const char **data, JsonElement **json_out
     return JSON_PARSE_ERROR_ARRAY_END;
 }
 
-static JsonParseError JsonParseAsObject(const char **data, JsonElement **json_out)
+static JsonParseError JsonParseAsObject(JsonSource *src, JsonElement **json_out)
 {
-    if (**data != '{')
+    if (JsonSourcePeek(src, 0) != '{')
     {
         *json_out = NULL;
         return JSON_PARSE_ERROR_ARRAY_START;
     }
+    src->cur++;
 
     JsonElement *object = JsonObjectCreate(DEFAULT_CONTAINER_CAPACITY);
     char *property_name = NULL;
+    JsonParseError err = JSON_PARSE_ERROR_OBJECT_END;
 
-    for (*data = *data + 1; **data != '\0'; *data = *data + 1)
+    for (char c = JsonSourcePeek(src, 0); c != '\0'; c = JsonSourcePeek(src, 0))
     {
-        if (IsWhitespace(**data))
+        if (IsWhitespace(c))
         {
+            src->cur++;
             continue;
         }
 
-        switch (**data)
+        JsonElement *child = NULL;
+
+        switch (c)
         {
         case '"':
             if (property_name != NULL)
             {
                 char *property_value = NULL;
-                JsonParseError err = JsonParseAsString(data, &property_value);
+                err = JsonParseAsString(src, &property_value);
                 if (err != JSON_PARSE_OK)
                 {
-                    free(property_name);
-                    JsonDestroy(object);
-                    return err;
+                    goto fail;
                 }
                 assert(property_value);
 
-                JsonObjectAppendElement(object, property_name, JsonElementCreatePrimitive(JSON_PRIMITIVE_TYPE_STRING, JsonDecodeString(property_value)));
-                free(property_value);
-                free(property_name);
-                property_name = NULL;
+                child = JsonElementCreatePrimitive(JSON_PRIMITIVE_TYPE_STRING, property_value);
             }
             else
             {
-                property_name = NULL;
-                JsonParseError err = JsonParseAsString(data, &property_name);
+                err = JsonParseAsString(src, &property_name);
                 if (err != JSON_PARSE_OK)
                 {
-                    JsonDestroy(object);
-                    return err;
+                    goto fail;
                 }
                 assert(property_name);
             }
@@ -1669,155 +2021,120 @@ static JsonParseError JsonParseAsObject(const char **data, JsonElement **json_ou
         case ':':
             if (property_name == NULL)
             {
-                json_out = NULL;
-                free(property_name);
-                JsonDestroy(object);
-                return JSON_PARSE_ERROR_OBJECT_COLON;
+                err = JSON_PARSE_ERROR_OBJECT_COLON;
+                goto fail;
             }
+            src->cur++;
             break;
 
         case ',':
             if (property_name != NULL)
             {
-                free(property_name);
-                JsonDestroy(object);
-                return JSON_PARSE_ERROR_OBJECT_COMMA;
+                err = JSON_PARSE_ERROR_OBJECT_COMMA;
+                goto fail;
             }
+            src->cur++;
             break;
 
         case '[':
-            if (property_name != NULL)
+            if (property_name == NULL)
             {
-                JsonElement *child_array = NULL;
-                JsonParseError err = JsonParseAsArray(data, &child_array);
-                if (err != JSON_PARSE_OK)
-                {
-                    free(property_name);
-                    JsonDestroy(object);
-                    return err;
-                }
-
-                JsonObjectAppendArray(object, property_name, child_array);
-                free(property_name);
-                property_name = NULL;
+                err = JSON_PARSE_ERROR_OBJECT_ARRAY_LVAL;
+                goto fail;
             }
-            else
+
+            err = JsonParseAsArray(src, &child);
+            if (err != JSON_PARSE_OK)
             {
-                free(property_name);
-                JsonDestroy(object);
-                return JSON_PARSE_ERROR_OBJECT_ARRAY_LVAL;
+                goto fail;
             }
             break;
 
         case '{':
-            if (property_name != NULL)
+            if (property_name == NULL)
             {
-                JsonElement *child_object = NULL;
-                JsonParseError err = JsonParseAsObject(data, &child_object);
-                if (err != JSON_PARSE_OK)
-                {
-                    free(property_name);
-                    JsonDestroy(object);
-                    return err;
-                }
-
-                JsonObjectAppendObject(object, property_name, child_object);
-                free(property_name);
-                property_name = NULL;
+                err = JSON_PARSE_ERROR_OBJECT_OBJECT_LVAL;
+                goto fail;
             }
-            else
+
+            err = JsonParseAsObject(src, &child);
+            if (err != JSON_PARSE_OK)
             {
-                *json_out = NULL;
-                free(property_name);
-                JsonDestroy(object);
-                return JSON_PARSE_ERROR_OBJECT_OBJECT_LVAL;
+                goto fail;
             }
             break;
 
         case '}':
             if (property_name != NULL)
             {
-                *json_out = NULL;
-                free(property_name);
-                JsonDestroy(object);
-                return JSON_PARSE_ERROR_OBJECT_OPEN_LVAL;
+                err = JSON_PARSE_ERROR_OBJECT_OPEN_LVAL;
+                goto fail;
             }
-            free(property_name);
+            src->cur++;
             *json_out = object;
             return JSON_PARSE_OK;
 
         default:
             if (property_name)
             {
-                if (**data == '-' || **data == '0' || IsDigit(**data))
+                if (c == '-' || c == '0' || IsDigit(c))
                 {
-                    JsonElement *child = NULL;
-                    JsonParseError err = JsonParseAsNumber(data, &child);
+                    err = JsonParseAsNumber(src, &child);
                     if (err != JSON_PARSE_OK)
                     {
-                        free(property_name);
-                        JsonDestroy(object);
-                        return err;
+                        goto fail;
                     }
-                    JsonObjectAppendElement(object, property_name, child);
-                    free(property_name);
-                    property_name = NULL;
                     break;
                 }
 
-                JsonElement *child_bool = JsonParseAsBoolean(data);
-                if (child_bool)
+                child = JsonParseAsBoolean(src);
+                if (child)
                 {
-                    JsonObjectAppendElement(object, property_name, child_bool);
-                    free(property_name);
-                    property_name = NULL;
                     break;
                 }
 
-                JsonElement *child_null = JsonParseAsNull(data);
-                if (child_null)
+                child = JsonParseAsNull(src);
+                if (child)
                 {
-                    JsonObjectAppendElement(object, property_name, child_null);
-                    free(property_name);
-                    property_name = NULL;
                     break;
                 }
             }
 
-            *json_out = NULL;
-            free(property_name);
-            JsonDestroy(object);
-            return JSON_PARSE_ERROR_OBJECT_BAD_SYMBOL;
+            err = JSON_PARSE_ERROR_OBJECT_BAD_SYMBOL;
+            goto fail;
+        }
+
+        if (child != NULL)
+        {
+            JsonObjectAppendParsed(object, property_name, child);
+            property_name = NULL;
         }
     }
 
+    err = JSON_PARSE_ERROR_OBJECT_END;
+
+fail:
     *json_out = NULL;
     free(property_name);
     JsonDestroy(object);
-    return JSON_PARSE_ERROR_OBJECT_END;
+    return err;
 }
 
-JsonParseError JsonParse(const char **data, JsonElement **json_out)
+static JsonParseError JsonParseSource(JsonSource *src, JsonElement **json_out)
 {
-    assert(data && *data);
-    if (data == NULL || *data == NULL)
+    for (char c = JsonSourcePeek(src, 0); c != '\0'; c = JsonSourcePeek(src, 0))
     {
-        return JSON_PARSE_ERROR_NO_DATA;
-    }
-
-    while (**data)
-    {
-        if (**data == '{')
+        if (c == '{')
         {
-            return JsonParseAsObject(data, json_out);
+            return JsonParseAsObject(src, json_out);
         }
-        else if (**data == '[')
+        else if (c == '[')
         {
-            return JsonParseAsArray(data, json_out);
+            return JsonParseAsArray(src, json_out);
         }
-        else if (IsWhitespace(**data))
+        else if (IsWhitespace(c))
         {
-            (*data)++;
+            src->cur++;
         }
         else
         {
@@ -1826,5 +2143,67 @@ JsonParseError JsonParse(const char **data, JsonElement **json_out)
         }
     }
 
-    return JSON_PARSE_ERROR_NO_DATA;
+    *json_out = NULL;
+    return src->read_error ? JSON_PARSE_ERROR_READ : JSON_PARSE_ERROR_NO_DATA;
+}
+
+JsonParseError JsonParse(const char **data, JsonElement **json_out)
+{
+    assert(data && *data);
+    if (data == NULL || *data == NULL)
+    {
+        return JSON_PARSE_ERROR_NO_DATA;
+    }
+
+    JsonSource src = {
+        .cur = *data,
+        .end = *data + strlen(*data),
+        .fd = -1,
+    };
+
+    JsonParseError err = JsonParseSource(&src, json_out);
+
+    free(src.scratch);
+    *data = src.cur;
+
+    return err;
+}
+
+JsonParseError JsonParseFd(int fd, size_t size_max, JsonElement **json_out)
+{
+    JsonSource src = {
+        .fd = fd,
+        .buffer = xmalloc(JSON_PARSE_BUFFER_SIZE),
+        .remaining = size_max,
+    };
+    src.cur = src.end = src.buffer;
+
+    JsonParseError err = JsonParseSource(&src, json_out);
+
+    if (err != JSON_PARSE_OK && src.read_error)
+    {
+        JsonDestroy(*json_out);
+        *json_out = NULL;
+        err = JSON_PARSE_ERROR_READ;
+    }
+
+    free(src.buffer);
+    free(src.scratch);
+
+    return err;
+}
+
+JsonParseError JsonParseFile(const char *path, size_t size_max, JsonElement **json_out)
+{
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd == -1)
+    {
+        *json_out = NULL;
+        return JSON_PARSE_ERROR_READ;
+    }
+
+    JsonParseError err = JsonParseFd(fd, size_max, json_out);
+    close(fd);
+
+    return err;
 }
@@ -93,6 +93,7 @@ typedef enum
 
     JSON_PARSE_ERROR_INVALID_START,
     JSON_PARSE_ERROR_NO_DATA,
+    JSON_PARSE_ERROR_READ,
 
     JSON_PARSE_ERROR_MAX
 } JsonParseError;
@@ -348,6 +349,22 @@ JsonElement *JsonArrayGet(JsonElement *array, size_t index);
   */
 JsonParseError JsonParse(const char **data, JsonElement **json_out);
 
+/**
+  @brief Parse JSON read from a file descriptor, holding only a fixed size
+         window of the input in memory besides the resulting JsonElement
+  @param fd [in] Descriptor to read from, left open
+  @param size_max [in] Maximum number of bytes to read
+  @param json_out Resulting JSON object
+  @returns See JsonParseError and JsonParseErrorToString
+  */
+JsonParseError JsonParseFd(int fd, size_t size_max, JsonElement **json_out);
+
+/**
+  @brief Parse a JSON file, see JsonParseFd()
+  @returns JSON_PARSE_ERROR_READ if the file cannot be opened or read
+  */
+JsonParseError JsonParseFile(const char *path, size_t size_max, JsonElement **json_out);
+
 const char* JsonParseErrorToString(JsonParseError error);
 
 /**
@@ -79,6 +79,15 @@ Map *MapNew(MapHashFn hash_fn,
             MapKeyEqualFn equal_fn,
             MapDestroyDataFn destroy_key_fn,
             MapDestroyDataFn destroy_value_fn)
+{
+    return MapNewWithCapacity(hash_fn, equal_fn, destroy_key_fn, destroy_value_fn, 0);
+}
+
+Map *MapNewWithCapacity(MapHashFn hash_fn,
+                        MapKeyEqualFn equal_fn,
+                        MapDestroyDataFn destroy_key_fn,
+                        MapDestroyDataFn destroy_value_fn,
+                        size_t initial_capacity)
 {
     if (hash_fn == NULL)
     {
@@ -101,8 +110,18 @@ Map *MapNew(MapHashFn hash_fn,
     }
 
     Map *map = xcalloc(1, sizeof(Map));
-    map->arraymap = ArrayMapNew(equal_fn, destroy_key_fn, destroy_value_fn);
-    map->hash_fn = hash_fn;
+    if (initial_capacity > TINY_LIMIT)
+    {
+        /* Known to be big, skip the ArrayMap stage */
+        map->hashmap = HashMapNew(hash_fn, equal_fn, destroy_key_fn, destroy_value_fn,
+                                  initial_capacity);
+        map->hash_fn = NULL;
+    }
+    else
+    {
+        map->arraymap = ArrayMapNew(equal_fn, destroy_key_fn, destroy_value_fn);
+        map->hash_fn = hash_fn;
+    }
     return map;
 }
 
@@ -114,15 +133,7 @@ size_t MapSize(const Map *map)
     }
     else
     {
-        MapIterator i = MapIteratorInit((Map*)map);
-        size_t size = 0;
-
-        while (MapIteratorNext(&i))
-        {
-            size++;
-        }
-
-        return size;
+        return HashMapSize(map->hashmap);
     }
 }
 
@@ -131,7 +142,8 @@ static void ConvertToHashMap(Map *map)
     HashMap *hashmap = HashMapNew(map->hash_fn,
                                   map->arraymap->equal_fn,
                                   map->arraymap->destroy_key_fn,
-                                  map->arraymap->destroy_value_fn);
+                                  map->arraymap->destroy_value_fn,
+                                  0);
 
     /* We have to use internals of ArrayMap here, as we don't want to
        destroy the values in ArrayMapDestroy */
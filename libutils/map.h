@@ -38,6 +38,16 @@ Map *MapNew(MapHashFn hash_fn,
             MapDestroyDataFn destroy_key_fn,
             MapDestroyDataFn destroy_value_fn);
 
+/*
+ * Same as MapNew, but preallocates room for initial_capacity elements so
+ * that a map known to become large does not rehash while it is filled.
+ */
+Map *MapNewWithCapacity(MapHashFn hash_fn,
+                        MapKeyEqualFn equal_fn,
+                        MapDestroyDataFn destroy_key_fn,
+                        MapDestroyDataFn destroy_value_fn,
+                        size_t initial_capacity);
+
 /*
  * Returns 'true' if the key was previously used in the map, otherwise 'false'.
  * If the key is in the map, value get replaced. Old value is destroyed.
@@ -642,6 +642,30 @@ RBTreeIterator *RBTreeIteratorNew(const RBTree *tree)
     return iter;
 }
 
+RBTreeIterator *RBTreeIteratorNewFrom(const RBTree *tree, const void *key)
+{
+    RBTreeIterator *iter = xmalloc(sizeof(RBTreeIterator));
+
+    iter->tree = tree;
+    iter->curr = tree->nil;
+
+    RBNode *curr = tree->root->left;
+    while (curr != tree->nil)
+    {
+        if (tree->KeyCompare(key, curr->key) <= 0)
+        {
+            iter->curr = curr;
+            curr = curr->left;
+        }
+        else
+        {
+            curr = curr->right;
+        }
+    }
+
+    return iter;
+}
+
 bool Peek_(RBTreeIterator *iter, void **key, void **value)
 {
     if (iter->tree->size == 0)
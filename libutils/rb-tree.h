@@ -34,6 +34,8 @@ void RBTreeClear(RBTree *tree);
 size_t RBTreeSize(const RBTree *tree);
 
 RBTreeIterator *RBTreeIteratorNew(const RBTree *tree);
+/* Starts at the first key not less than key */
+RBTreeIterator *RBTreeIteratorNewFrom(const RBTree *tree, const void *key);
 bool RBTreeIteratorNext(RBTreeIterator *iter, void **key, void **value);
 void RBTreeIteratorDestroy(void *_rb_iter);
 
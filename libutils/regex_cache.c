@@ -0,0 +1,260 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <regex_cache.h>
+
+#include <alloc.h>
+#include <string_lib.h>
+
+#define REGEX_CACHE_MAX_ENTRIES 256
+#define REGEX_CACHE_BUCKETS 512 /* must be a power of two */
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+# define REGEX_STUDY_OPTIONS PCRE_STUDY_JIT_COMPILE
+#else
+# define REGEX_STUDY_OPTIONS 0
+#endif
+
+typedef struct RegexCacheEntry_
+{
+    CompiledRegex regex;        /* must be first, handed out to callers */
+    char *pattern;
+    int options;
+    unsigned int bucket;
+    unsigned int refcount;
+    unsigned long last_used;
+    bool cached;
+    struct RegexCacheEntry_ *next;
+} RegexCacheEntry;
+
+static pthread_mutex_t regex_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static RegexCacheEntry *regex_cache[REGEX_CACHE_BUCKETS];
+static size_t regex_cache_size;
+static unsigned long regex_cache_tick;
+static RegexCacheStats regex_cache_stats;
+
+static void RegexCacheEntryDestroy(RegexCacheEntry *entry)
+{
+    if (entry)
+    {
+        if (entry->regex.extra)
+        {
+#ifdef PCRE_STUDY_JIT_COMPILE
+            pcre_free_study(entry->regex.extra);
+#else
+            pcre_free(entry->regex.extra);
+#endif
+        }
+        pcre_free(entry->regex.rx);
+        free(entry->pattern);
+        free(entry);
+    }
+}
+
+static RegexCacheEntry *RegexCacheEntryCompile(const char *pattern, int options,
+                                               const char **errorstr, int *erroffset)
+{
+    const char *err = NULL;
+    int offset = 0;
+
+    pcre *rx = pcre_compile(pattern, options, &err, &offset, NULL);
+    if (rx == NULL)
+    {
+        if (errorstr)
+        {
+            *errorstr = err;
+        }
+        if (erroffset)
+        {
+            *erroffset = offset;
+        }
+        return NULL;
+    }
+
+    RegexCacheEntry *entry = xcalloc(1, sizeof(RegexCacheEntry));
+    entry->regex.rx = rx;
+    /* Study failure is not fatal, pcre_exec() just runs without the extra data. */
+    entry->regex.extra = pcre_study(rx, REGEX_STUDY_OPTIONS, &err);
+    entry->pattern = xstrdup(pattern);
+    entry->options = options;
+    return entry;
+}
+
+static RegexCacheEntry *RegexCacheLookup(unsigned int bucket, const char *pattern, int options)
+{
+    for (RegexCacheEntry *entry = regex_cache[bucket]; entry; entry = entry->next)
+    {
+        if (entry->options == options && strcmp(entry->pattern, pattern) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void RegexCacheUnlink(RegexCacheEntry *entry)
+{
+    RegexCacheEntry **prev = &regex_cache[entry->bucket];
+    while (*prev != entry)
+    {
+        prev = &(*prev)->next;
+    }
+    *prev = entry->next;
+    regex_cache_size--;
+}
+
+/* Evict the least recently used entry nobody is holding. Called with the lock held. */
+static bool RegexCacheEvictOne(void)
+{
+    RegexCacheEntry *victim = NULL;
+
+    for (size_t i = 0; i < REGEX_CACHE_BUCKETS; i++)
+    {
+        for (RegexCacheEntry *entry = regex_cache[i]; entry; entry = entry->next)
+        {
+            if (entry->refcount == 0 && (!victim || entry->last_used < victim->last_used))
+            {
+                victim = entry;
+            }
+        }
+    }
+
+    if (victim)
+    {
+        RegexCacheUnlink(victim);
+        RegexCacheEntryDestroy(victim);
+        regex_cache_stats.evictions++;
+        return true;
+    }
+
+    return false;
+}
+
+const CompiledRegex *RegexCacheAcquire(const char *pattern, int options,
+                                       const char **errorstr, int *erroffset)
+{
+    assert(pattern);
+
+    unsigned int bucket = StringHash(pattern, (unsigned int) options, REGEX_CACHE_BUCKETS);
+
+    pthread_mutex_lock(&regex_cache_mutex);
+    RegexCacheEntry *entry = RegexCacheLookup(bucket, pattern, options);
+    if (entry)
+    {
+        entry->refcount++;
+        entry->last_used = ++regex_cache_tick;
+        regex_cache_stats.hits++;
+        pthread_mutex_unlock(&regex_cache_mutex);
+        return &entry->regex;
+    }
+    regex_cache_stats.misses++;
+    pthread_mutex_unlock(&regex_cache_mutex);
+
+    /* Compile outside the lock, other threads may keep matching meanwhile. */
+    RegexCacheEntry *fresh = RegexCacheEntryCompile(pattern, options, errorstr, erroffset);
+    if (fresh == NULL)
+    {
+        return NULL;
+    }
+    fresh->bucket = bucket;
+
+    pthread_mutex_lock(&regex_cache_mutex);
+    entry = RegexCacheLookup(bucket, pattern, options);
+    if (entry)
+    {
+        /* Lost the race against another thread compiling the same pattern. */
+        RegexCacheEntryDestroy(fresh);
+    }
+    else
+    {
+        entry = fresh;
+        if (regex_cache_size < REGEX_CACHE_MAX_ENTRIES || RegexCacheEvictOne())
+        {
+            entry->cached = true;
+            entry->next = regex_cache[bucket];
+            regex_cache[bucket] = entry;
+            regex_cache_size++;
+        }
+    }
+    entry->refcount++;
+    entry->last_used = ++regex_cache_tick;
+    pthread_mutex_unlock(&regex_cache_mutex);
+
+    return &entry->regex;
+}
+
+void RegexCacheRelease(const CompiledRegex *regex)
+{
+    if (regex == NULL)
+    {
+        return;
+    }
+
+    RegexCacheEntry *entry = (RegexCacheEntry *) regex;
+
+    pthread_mutex_lock(&regex_cache_mutex);
+    assert(entry->refcount > 0);
+    entry->refcount--;
+    bool destroy = !entry->cached && entry->refcount == 0;
+    pthread_mutex_unlock(&regex_cache_mutex);
+
+    if (destroy)
+    {
+        RegexCacheEntryDestroy(entry);
+    }
+}
+
+void RegexCacheGetStats(RegexCacheStats *stats_out)
+{
+    pthread_mutex_lock(&regex_cache_mutex);
+    *stats_out = regex_cache_stats;
+    stats_out->size = regex_cache_size;
+    pthread_mutex_unlock(&regex_cache_mutex);
+}
+
+void RegexCacheClear(void)
+{
+    pthread_mutex_lock(&regex_cache_mutex);
+    for (size_t i = 0; i < REGEX_CACHE_BUCKETS; i++)
+    {
+        RegexCacheEntry **prev = &regex_cache[i];
+        while (*prev)
+        {
+            RegexCacheEntry *entry = *prev;
+            if (entry->refcount == 0)
+            {
+                *prev = entry->next;
+                RegexCacheEntryDestroy(entry);
+                regex_cache_size--;
+            }
+            else
+            {
+                prev = &entry->next;
+            }
+        }
+    }
+    memset(&regex_cache_stats, 0, sizeof(regex_cache_stats));
+    pthread_mutex_unlock(&regex_cache_mutex);
+}
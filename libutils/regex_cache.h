@@ -0,0 +1,81 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_REGEX_CACHE_H
+#define CFENGINE_REGEX_CACHE_H
+
+#include <platform.h>
+
+/**
+  @brief Process-wide cache of compiled and studied regular expressions.
+
+  Policy evaluation matches the same handful of patterns against thousands of
+  strings, so compiled patterns are kept keyed by (pattern, options). The cache
+  is bounded and least recently used entries are evicted once it is full.
+  Entries are reference counted, so an entry in use by another thread is never
+  freed under its feet. The cache is safe to use from several threads.
+  */
+
+typedef struct
+{
+    pcre *rx;
+    pcre_extra *extra;
+} CompiledRegex;
+
+typedef struct
+{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t size;
+} RegexCacheStats;
+
+/**
+  @brief Get a compiled regex from the cache, compiling and studying it on a miss.
+  @param pattern [in] Regular expression
+  @param options [in] Options passed to pcre_compile()
+  @param errorstr [out] Compilation error message, may be NULL
+  @param erroffset [out] Offset of compilation error in pattern, may be NULL
+  @return Compiled regex to be returned with RegexCacheRelease(), or NULL if the pattern does not compile
+  */
+const CompiledRegex *RegexCacheAcquire(const char *pattern, int options,
+                                       const char **errorstr, int *erroffset);
+
+/**
+  @brief Return a regex obtained from RegexCacheAcquire(). NULL is ignored.
+  */
+void RegexCacheRelease(const CompiledRegex *regex);
+
+/**
+  @brief Copy the hit/miss counters of the process-wide cache.
+  */
+void RegexCacheGetStats(RegexCacheStats *stats_out);
+
+/**
+  @brief Drop all cached entries which are not in use and reset the counters.
+  */
+void RegexCacheClear(void);
+
+#endif
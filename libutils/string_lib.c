@@ -28,6 +28,7 @@
 #include <alloc.h>
 #include <writer.h>
 #include <misc_lib.h>
+#include <regex_cache.h>
 
 char *StringVFormat(const char *fmt, va_list ap)
 {
@@ -397,12 +398,7 @@ static bool StringMatchInternal(const char *regex, const char *str, int *start,
         return true;
     }
 
-    pcre *pattern = NULL;
-    {
-        const char *errorstr;
-        int erroffset;
-        pattern = pcre_compile(regex, PCRE_MULTILINE | PCRE_DOTALL, &errorstr, &erroffset, NULL);
-    }
+    const CompiledRegex *pattern = RegexCacheAcquire(regex, PCRE_MULTILINE | PCRE_DOTALL, NULL, NULL);
     assert(pattern);
 
     if (pattern == NULL)
@@ -411,7 +407,7 @@ static bool StringMatchInternal(const char *regex, const char *str, int *start,
     }
 
     int ovector[STRING_MATCH_OVECCOUNT] = { 0 };
-    int result = pcre_exec(pattern, NULL, str, strlen(str), 0, 0, ovector, STRING_MATCH_OVECCOUNT);
+    int result = pcre_exec(pattern->rx, pattern->extra, str, strlen(str), 0, 0, ovector, STRING_MATCH_OVECCOUNT);
 
     if (result)
     {
@@ -436,7 +432,7 @@ static bool StringMatchInternal(const char *regex, const char *str, int *start,
         }
     }
 
-    free(pattern);
+    RegexCacheRelease(pattern);
 
     return result >= 0;
 }
@@ -0,0 +1,104 @@
+#include <platform.h>
+#include <alloc.h>
+#include <policy.h>
+#include <attributes.h>
+#include <env_context.h>
+#include <load_common.h>
+
+/*
+ * Measures GetFilesAttributes() on a policy of many files promises, each
+ * carrying the constraints of typical copy_from, perms and depth_search
+ * bodies. Promises are evaluated once right after they are built, as an
+ * expanded promise is, and then again as further iterations would.
+ */
+
+#define ITERATIONS 10
+
+static const char *const CONSTRAINTS[][2] =
+{
+    { "copy_from", "true" },
+    { "source", "/var/cfengine/masterfiles/file" },
+    { "servers", "policy_server" },
+    { "compare", "digest" },
+    { "copy_backup", "false" },
+    { "encrypt", "true" },
+    { "verify", "false" },
+    { "purge", "true" },
+    { "type_check", "false" },
+    { "preserve", "true" },
+    { "trustkey", "false" },
+    { "perms", "true" },
+    { "mode", "0600" },
+    { "depth_search", "true" },
+    { "depth", "inf" },
+    { "exclude_dirs", ".svn" },
+    { "xdev", "true" },
+    { "rmdeadlinks", "true" },
+    { "ifelapsed", "1" },
+    { "action_policy", "fix" },
+    { "comment", "Mirror the policy" },
+    { "handle", "mirror_policy" },
+};
+
+static void Bench(size_t n)
+{
+    EvalContext *ctx = EvalContextNew();
+    EvalContextClassPutHard(ctx, "linux");
+
+    Policy *policy = PolicyNew();
+    Bundle *bundle = PolicyAppendBundle(policy, "default", "main", "agent", NULL, NULL);
+    PromiseType *files = BundleAppendPromiseType(bundle, "files");
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char promiser[64];
+        snprintf(promiser, sizeof(promiser), "/var/cfengine/inputs/file%zu", i);
+        Promise *pp = PromiseTypeAppendPromise(files, promiser, (Rval) { NULL, RVAL_TYPE_NOPROMISEE }, "any");
+
+        for (size_t j = 0; j < sizeof(CONSTRAINTS) / sizeof(CONSTRAINTS[0]); j++)
+        {
+            /* Some body constraints are guarded by a class context. */
+            const char *classes = (j % 4 == 0) ? "linux.!windows" : "any";
+            PromiseAppendConstraint(pp, CONSTRAINTS[j][0],
+                                    (Rval) { xstrdup(CONSTRAINTS[j][1]), RVAL_TYPE_SCALAR },
+                                    classes, false);
+        }
+    }
+
+    size_t checked = 0;
+
+    double start = Now();
+    for (size_t i = 0; i < n; i++)
+    {
+        Attributes attr = GetFilesAttributes(ctx, SeqAt(files->promises, i));
+        checked += attr.havecopy && attr.haveperms;
+    }
+    PrintTiming("first", n, "promises", Now() - start);
+
+    start = Now();
+    for (int k = 0; k < ITERATIONS; k++)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            Attributes attr = GetFilesAttributes(ctx, SeqAt(files->promises, i));
+            checked += attr.havecopy && attr.haveperms;
+        }
+    }
+    PrintTiming("repeat", n * ITERATIONS, "promises", Now() - start);
+
+    if (checked != n * (ITERATIONS + 1))
+    {
+        exit(1);
+    }
+
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+}
+
+int main()
+{
+    Bench(1000);
+    Bench(10000);
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <platform.h>
+#include <alloc.h>
+#include <class.h>
+#include <load_common.h>
+
+/*
+ * Measures ClassTable insert and lookup, and iterating over the classes
+ * matching a regex with a literal prefix against a full table walk.
+ */
+
+static size_t Iterate(ClassTable *table, const char *regex)
+{
+    size_t count = 0;
+    ClassTableIterator *iter = ClassTableIteratorNewMatching(table, NULL, regex, true, true);
+    while (ClassTableIteratorNext(iter))
+    {
+        count++;
+    }
+    ClassTableIteratorDestroy(iter);
+    return count;
+}
+
+static void Bench(size_t n)
+{
+    char **names = xcalloc(n, sizeof(char *));
+    for (size_t i = 0; i < n; i++)
+    {
+        xasprintf(&names[i], "%s_class_%zu", (i % 100 == 0) ? "ipv4" : "host", i);
+    }
+
+    ClassTable *table = ClassTableNew();
+
+    double start = Now();
+    for (size_t i = 0; i < n; i++)
+    {
+        ClassTablePut(table, NULL, names[i], false, CONTEXT_SCOPE_NAMESPACE);
+    }
+    PrintTiming("put", n, "classes", Now() - start);
+
+    start = Now();
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!ClassTableGet(table, NULL, names[i]))
+        {
+            exit(1);
+        }
+    }
+    PrintTiming("get", n, "classes", Now() - start);
+
+    start = Now();
+    size_t matched = Iterate(table, "ipv4_.*");
+    PrintTiming("prefix", n, "classes", Now() - start);
+
+    start = Now();
+    size_t walked = Iterate(table, ".*ipv4_.*");
+    PrintTiming("walk", n, "classes", Now() - start);
+
+    if (matched != walked || matched != (n + 99) / 100 || ClassTableSize(table) != n)
+    {
+        exit(1);
+    }
+
+    ClassTableDestroy(table);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+}
+
+int main()
+{
+    Bench(1000);
+    Bench(100000);
+
+    return 0;
+}
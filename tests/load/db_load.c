@@ -22,6 +22,11 @@
 #define VALUE_OFFSET1 10000
 #define VALUE_OFFSET2 100000
 
+/* Fill scenarios write past the initial 100MB map of the LMDB backend */
+#define FILL_VALUE_SIZE 4000
+#define FILL_UNBATCHED 1000   // written one by one, the rest in batches
+#define FILL_KEEP_EVERY 10    // records left over before compaction
+
 char CFWORKDIR[CF_BUFSIZE];
 
 static bool CoinFlip(void);
@@ -30,6 +35,7 @@ static bool ReadWriteDataIsValid(char *data);
 static void DBWriteTestData(CF_DB *db);
 static void TestReadWriteData(CF_DB *db);
 static void TestCursorIteration(CF_DB *db);
+static int Fill(int megabytes, bool compact, bool compact_on_open);
 
 void *contend(void *param)
 {
@@ -210,9 +216,10 @@ static void Cleanup(void)
 
 int main(int argc, char **argv)
 {
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
     {
-        fprintf(stderr, "Usage: db_load <num_threads>\n");
+        fprintf(stderr, "Usage: db_load <num_threads>\n"
+                "       db_load fill|compact|autocompact <megabytes>\n");
         exit(1);
     }
 
@@ -222,6 +229,29 @@ int main(int argc, char **argv)
     snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/db_load.XXXXXX");
     mkdtemp(CFWORKDIR);
 
+    if (argc == 3)
+    {
+        int megabytes = atoi(argv[2]);
+
+        if (strcmp(argv[1], "fill") == 0)
+        {
+            exit(Fill(megabytes, false, false));
+        }
+        else if (strcmp(argv[1], "compact") == 0)
+        {
+            /* Compaction on open would do the work of CompactDB() */
+            setenv("LMDB_COMPACT_FREE_PERCENT", "0", 1);
+            exit(Fill(megabytes, true, false));
+        }
+        else if (strcmp(argv[1], "autocompact") == 0)
+        {
+            exit(Fill(megabytes, true, true));
+        }
+
+        fprintf(stderr, "Unknown scenario '%s'\n", argv[1]);
+        exit(1);
+    }
+
     int numthreads = atoi(argv[1]);
 
     assert(numthreads < MAX_THREADS);
@@ -287,6 +317,155 @@ static void DBWriteTestData(CF_DB *db)
     WriteReadWriteData(db);
 }
 
+static void FillValue(char *value, int i)
+{
+    memset(value, 'A' + i % 26, FILL_VALUE_SIZE);
+    memcpy(value, &i, sizeof(i));
+}
+
+static off_t DBFileSize(void)
+{
+    char *path = DBIdToPath(CFWORKDIR, DB_ID);
+    struct stat sb;
+    off_t size = (stat(path, &sb) == 0) ? sb.st_size : -1;
+    free(path);
+    return size;
+}
+
+static bool CheckFilled(CF_DB *db, int records, int every)
+{
+    char expected[FILL_VALUE_SIZE];
+    char value[FILL_VALUE_SIZE];
+    bool ok = true;
+
+    for (int i = 0; i < records; i++)
+    {
+        bool present = ReadComplexKeyDB(db, (const char *)&i, sizeof(i), value, sizeof(value));
+
+        if (present != (i % every == 0))
+        {
+            printf("Error: record %d is %s\n", i, present ? "present" : "missing");
+            ok = false;
+            continue;
+        }
+
+        FillValue(expected, i);
+        if (present && memcmp(value, expected, sizeof(value)) != 0)
+        {
+            printf("Error: record %d is corrupt\n", i);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+/*
+ * Writes the given amount of data, reopens the database and reads it all
+ * back. With compaction, then deletes most of it and checks that the file
+ * shrinks and that the rest survives.
+ */
+static int Fill(int megabytes, bool compact, bool compact_on_open)
+{
+    CF_DB *db;
+    char value[FILL_VALUE_SIZE];
+    int records = (int)((long)megabytes * 1024 * 1024 / FILL_VALUE_SIZE);
+
+    if (!OpenDB(&db, DB_ID))
+    {
+        return STATUS_FAILED_OPEN;
+    }
+
+    DBBeginBatch(db, 0, 0);
+    for (int i = 0; i < records; i++)
+    {
+        if (i == records - FILL_UNBATCHED)
+        {
+            if (!DBCommitBatch(db))
+            {
+                printf("Error: batch commit failed\n");
+                CloseDB(db);
+                return STATUS_ERROR;
+            }
+        }
+
+        FillValue(value, i);
+        if (!WriteComplexKeyDB(db, (const char *)&i, sizeof(i), value, sizeof(value)))
+        {
+            printf("Error: write of record %d failed\n", i);
+            CloseDB(db);
+            return STATUS_ERROR;
+        }
+    }
+    CloseDB(db);
+
+    if (!OpenDB(&db, DB_ID))
+    {
+        return STATUS_FAILED_OPEN;
+    }
+
+    if (!CheckFilled(db, records, 1))
+    {
+        CloseDB(db);
+        return STATUS_ERROR;
+    }
+
+    if (!compact)
+    {
+        CloseDB(db);
+        return STATUS_SUCCESS;
+    }
+
+    DBBeginBatch(db, 0, 0);
+    for (int i = 0; i < records; i++)
+    {
+        if (i % FILL_KEEP_EVERY != 0)
+        {
+            DeleteComplexKeyDB(db, (const char *)&i, sizeof(i));
+        }
+    }
+    DBCommitBatch(db);
+    CloseDB(db);
+
+    off_t old_size = DBFileSize();
+
+    if (compact_on_open)
+    {
+        if (!OpenDB(&db, DB_ID))
+        {
+            return STATUS_FAILED_OPEN;
+        }
+        CloseDB(db);
+    }
+    else if (!CompactDB(DB_ID))
+    {
+        printf("Error: compaction failed\n");
+        return STATUS_ERROR;
+    }
+
+    off_t new_size = DBFileSize();
+    printf("Compacted from %jd to %jd bytes\n", (intmax_t)old_size, (intmax_t)new_size);
+
+#ifdef LMDB
+    /* Other backends decide themselves when to compact on open */
+    if (new_size > old_size / 2)
+    {
+        printf("Error: database did not shrink enough\n");
+        return STATUS_ERROR;
+    }
+#endif
+
+    if (!OpenDB(&db, DB_ID))
+    {
+        return STATUS_FAILED_OPEN;
+    }
+
+    bool ok = CheckFilled(db, records, FILL_KEEP_EVERY);
+    CloseDB(db);
+
+    return ok ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
 /* Stub out */
 
 void __ProgrammingError(const char *file, int lineno, const char *format, ...)
@@ -0,0 +1,203 @@
+#include <platform.h>
+#include <alloc.h>
+#include <dir_scan.h>
+#include <load_common.h>
+
+/*
+ * Measures walking a directory tree with lstat() on one thread, as a
+ * depth_search does, against consuming the same tree read ahead by a
+ * DirScan, as depth_search with parallel => "true" does.
+ */
+
+#define FANOUT 8
+#define FILES_PER_DIR 32
+
+static char DIRNAME[] = "/tmp/dir_scan_load.XXXXXX";
+
+static void MakeTree(const char *path, int levels)
+{
+    for (int i = 0; i < FILES_PER_DIR; i++)
+    {
+        char *file;
+        xasprintf(&file, "%s/file%d", path, i);
+        FILE *fp = fopen(file, "w");
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        free(file);
+    }
+
+    if (levels == 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < FANOUT; i++)
+    {
+        char *dir;
+        xasprintf(&dir, "%s/dir%d", path, i);
+        mkdir(dir, 0700);
+        MakeTree(dir, levels - 1);
+        free(dir);
+    }
+}
+
+static void RemoveTree(const char *path)
+{
+    DIR *dirh = opendir(path);
+    if (dirh == NULL)
+    {
+        return;
+    }
+
+    struct dirent *dirp;
+    while ((dirp = readdir(dirh)) != NULL)
+    {
+        if (strcmp(dirp->d_name, ".") == 0 || strcmp(dirp->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char *entry;
+        struct stat sb;
+        xasprintf(&entry, "%s/%s", path, dirp->d_name);
+        if (lstat(entry, &sb) == 0 && S_ISDIR(sb.st_mode))
+        {
+            RemoveTree(entry);
+        }
+        else
+        {
+            unlink(entry);
+        }
+        free(entry);
+    }
+    closedir(dirh);
+
+    rmdir(path);
+}
+
+static size_t WalkSerial(const char *path)
+{
+    size_t n = 0;
+    DIR *dirh = opendir(path);
+    if (dirh == NULL)
+    {
+        return 0;
+    }
+
+    struct dirent *dirp;
+    while ((dirp = readdir(dirh)) != NULL)
+    {
+        if (strcmp(dirp->d_name, ".") == 0 || strcmp(dirp->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char *entry;
+        struct stat sb;
+        xasprintf(&entry, "%s/%s", path, dirp->d_name);
+        if (lstat(entry, &sb) == 0)
+        {
+            n++;
+            if (S_ISDIR(sb.st_mode))
+            {
+                n += WalkSerial(entry);
+            }
+        }
+        free(entry);
+    }
+    closedir(dirh);
+
+    return n;
+}
+
+#ifdef HAVE_DIR_SCAN
+
+static size_t WalkScanned(DirScan *scan, DirScanNode *node, const char *path)
+{
+    const DirScanEntry *entries;
+    size_t count;
+    size_t n = 0;
+
+    if (!DirScanWait(scan, node, &entries, &count))
+    {
+        DirScanRelease(scan, node);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (entries[i].lstat_errno != 0)
+        {
+            continue;
+        }
+
+        n++;
+        if (S_ISDIR(entries[i].lsb.st_mode))
+        {
+            char *entry;
+            xasprintf(&entry, "%s/%s", path, entries[i].name);
+            DirScanNode *child = DirScanChild(scan, node, i, entry, &entries[i].lsb);
+            n += WalkScanned(scan, child, entry);
+            free(entry);
+        }
+    }
+
+    DirScanRelease(scan, node);
+    return n;
+}
+
+#endif
+
+static void Bench(int levels)
+{
+    char *root;
+    xasprintf(&root, "%s/tree%d", DIRNAME, levels);
+    mkdir(root, 0700);
+    MakeTree(root, levels);
+
+    double start = Now();
+    size_t serial = WalkSerial(root);
+    PrintTiming("serial", serial, "entries", Now() - start);
+
+#ifdef HAVE_DIR_SCAN
+    DirScanOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.depth = INT_MAX;
+    opts.rlevel_limit = INT_MAX;
+
+    struct stat sb;
+    stat(root, &sb);
+
+    start = Now();
+    DirScan *scan = DirScanNew(&opts, 0);
+    size_t scanned = WalkScanned(scan, DirScanSubmit(scan, root, &sb, 0), root);
+    DirScanDestroy(scan);
+    PrintTiming("scan", scanned, "entries", Now() - start);
+
+    if (scanned != serial)
+    {
+        exit(1);
+    }
+#endif
+
+    RemoveTree(root);
+    free(root);
+}
+
+int main()
+{
+    if (mkdtemp(DIRNAME) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    Bench(2);
+    Bench(4);
+
+    rmdir(DIRNAME);
+
+    return 0;
+}
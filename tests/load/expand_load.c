@@ -0,0 +1,95 @@
+#include <platform.h>
+#include <alloc.h>
+#include <buffer.h>
+#include <expand.h>
+#include <env_context.h>
+#include <load_common.h>
+
+/*
+ * Measures ExpandScalar on a few large strings and on many short ones,
+ * each expanded repeatedly as promise iteration would.
+ */
+
+#define LARGE_SIZE (1024 * 1024)
+#define SHORT_COUNT 100000
+#define ITERATIONS 10
+
+static void PutVariable(EvalContext *ctx, const char *name, const char *value)
+{
+    VarRef *ref = VarRefParseFromScope(name, "bundle");
+    EvalContextVariablePut(ctx, ref, value, DATA_TYPE_STRING);
+    VarRefDestroy(ref);
+}
+
+static void BenchLarge(EvalContext *ctx)
+{
+    /* Literal text with a variable reference every 64 bytes */
+    Buffer *template = BufferNew();
+    BufferSetMemoryCap(template, UINT_MAX);
+    while (BufferSize(template) < LARGE_SIZE)
+    {
+        BufferAppend(template, "0123456789012345678901234567890123456789012345678901 $(host) ", 62);
+    }
+
+    size_t bytes = 0;
+    double start = Now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        Buffer *out = BufferNew();
+        if (!ExpandScalar(ctx, NULL, "bundle", BufferData(template), out))
+        {
+            exit(1);
+        }
+        bytes += BufferSize(out);
+        BufferDestroy(&out);
+    }
+    PrintThroughput("1MB", ITERATIONS, "strings", bytes, Now() - start);
+
+    BufferDestroy(&template);
+}
+
+static void BenchShort(EvalContext *ctx)
+{
+    char **strings = xcalloc(SHORT_COUNT, sizeof(char *));
+    for (size_t i = 0; i < SHORT_COUNT; i++)
+    {
+        xasprintf(&strings[i], "/var/lib/$(host)/file_%zu.$(ext)", i % 1000);
+    }
+
+    size_t bytes = 0;
+    double start = Now();
+    Buffer *out = BufferNew();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        for (size_t j = 0; j < SHORT_COUNT; j++)
+        {
+            BufferZero(out);
+            if (!ExpandScalar(ctx, NULL, "bundle", strings[j], out))
+            {
+                exit(1);
+            }
+            bytes += BufferSize(out);
+        }
+    }
+    BufferDestroy(&out);
+    PrintThroughput("short", ITERATIONS * SHORT_COUNT, "strings", bytes, Now() - start);
+
+    for (size_t i = 0; i < SHORT_COUNT; i++)
+    {
+        free(strings[i]);
+    }
+    free(strings);
+}
+
+int main()
+{
+    EvalContext *ctx = EvalContextNew();
+    PutVariable(ctx, "host", "myhost.example.com");
+    PutVariable(ctx, "ext", "conf");
+
+    BenchLarge(ctx);
+    BenchShort(ctx);
+
+    EvalContextDestroy(ctx);
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <platform.h>
+#include <alloc.h>
+#include <files_hashes.h>
+#include <load_common.h>
+
+/*
+ * Measures hashing a tree of files one at a time with HashFile() against
+ * hashing them through a FileHashPool, as a recursive files promise with
+ * change detection does.
+ */
+
+#define FILE_SIZE (256 * 1024)
+
+static char DIRNAME[] = "/tmp/file_hash_load.XXXXXX";
+
+static char *FilePath(size_t i)
+{
+    char *path;
+    xasprintf(&path, "%s/file%zu", DIRNAME, i);
+    return path;
+}
+
+static void Bench(size_t n)
+{
+    unsigned char *data = xmalloc(FILE_SIZE);
+    for (size_t i = 0; i < FILE_SIZE; i++)
+    {
+        data[i] = (unsigned char) (i * 31);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char *path = FilePath(i);
+        FILE *fp = fopen(path, "w");
+        data[0] = (unsigned char) i;
+        fwrite(data, 1, FILE_SIZE, fp);
+        fclose(fp);
+        free(path);
+    }
+    free(data);
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+
+    double start = Now();
+    for (size_t i = 0; i < n; i++)
+    {
+        char *path = FilePath(i);
+        HashFile(path, digest, HASH_METHOD_SHA256);
+        free(path);
+    }
+    PrintThroughput("serial", n, "files", n * FILE_SIZE, Now() - start);
+
+    start = Now();
+    FileHashPool *pool = FileHashPoolNew(0);
+    for (size_t i = 0; i < n; i++)
+    {
+        char *path = FilePath(i);
+        struct stat sb;
+        stat(path, &sb);
+        FileHashPoolSubmit(pool, path, &sb, HASH_METHOD_SHA256);
+        free(path);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        char *path = FilePath(i);
+        struct stat sb;
+        stat(path, &sb);
+        if (!FileHashPoolGet(pool, path, &sb, HASH_METHOD_SHA256, digest))
+        {
+            HashFile(path, digest, HASH_METHOD_SHA256);
+        }
+        free(path);
+    }
+    FileHashPoolDestroy(pool);
+    PrintThroughput("pool", n, "files", n * FILE_SIZE, Now() - start);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        char *path = FilePath(i);
+        unlink(path);
+        free(path);
+    }
+}
+
+int main()
+{
+    if (mkdtemp(DIRNAME) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    OpenSSL_add_all_digests();
+
+    Bench(100);
+    Bench(1000);
+
+    rmdir(DIRNAME);
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <platform.h>
+#include <cf3.defs.h>
+#include <alloc.h>
+#include <server.h>
+#include <server_common.h>
+#include <client_code.h>
+#include <tls_generic.h>
+#include <net.h>
+#include <load_common.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+/*
+ * Loopback benchmark of the GET file transfer: CfGetFile() on one end of a
+ * socketpair, CopyRegularFileNet() on the other, over a throwaway TLS
+ * session. Runs once with classic 2KB blocks and once with large_get blocks.
+ *
+ * Usage: get_file_load [megabytes]
+ */
+
+typedef struct
+{
+    ServerConnectionState *conn;
+} ServerArgs;
+
+static void *ServerThread(void *arg)
+{
+    ServerArgs *sargs = arg;
+    char recvbuffer[CF_BUFSIZE + CF_BUFEXT] = "";
+    char sendbuffer[CF_BUFSIZE] = "";
+    char filename[CF_BUFSIZE] = "";
+    ServerFileGetState get_args = { 0 };
+
+    if (ReceiveTransaction(&sargs->conn->conn_info, recvbuffer, NULL) == -1)
+    {
+        return NULL;
+    }
+    sscanf(recvbuffer, "GET %d %[^\n]", &get_args.buf_size, filename);
+
+    get_args.connect = sargs->conn;
+    get_args.replybuff = sendbuffer;
+    get_args.replyfile = filename;
+    CfGetFile(&get_args);
+
+    return NULL;
+}
+
+static SSL_CTX *NewContext(bool server, EVP_PKEY *pkey, X509 *cert)
+{
+    SSL_CTX *ctx = SSL_CTX_new(server ? SSLv23_server_method() : SSLv23_client_method());
+    SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
+    if (server)
+    {
+        SSL_CTX_use_certificate(ctx, cert);
+        SSL_CTX_use_PrivateKey(ctx, pkey);
+    }
+    return ctx;
+}
+
+static void *AcceptThread(void *arg)
+{
+    SSL_accept(arg);
+    return NULL;
+}
+
+static void Bench(const char *source, off_t size, bool large_get, EVP_PKEY *pkey, X509 *cert)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+
+    SSL_CTX *server_ctx = NewContext(true, pkey, cert);
+    SSL_CTX *client_ctx = NewContext(false, pkey, cert);
+
+    ServerConnectionState *sconn = xcalloc(1, sizeof(ServerConnectionState));
+    sconn->conn_info.type = CF_PROTOCOL_TLS;
+    sconn->conn_info.sd = sv[0];
+    sconn->conn_info.ssl = SSL_new(server_ctx);
+    SSL_set_fd(sconn->conn_info.ssl, sv[0]);
+    sconn->uid = getuid();
+    sconn->maproot = true;
+
+    AgentConnection *aconn = xcalloc(1, sizeof(AgentConnection));
+    aconn->conn_info.type = CF_PROTOCOL_TLS;
+    aconn->conn_info.features = large_get ? CFNET_FEATURE_LARGE_GET : 0;
+    aconn->conn_info.sd = sv[1];
+    aconn->conn_info.ssl = SSL_new(client_ctx);
+    SSL_set_fd(aconn->conn_info.ssl, sv[1]);
+    aconn->this_server = "loopback";
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, AcceptThread, sconn->conn_info.ssl);
+    if (SSL_connect(aconn->conn_info.ssl) <= 0)
+    {
+        fprintf(stderr, "TLS handshake failed\n");
+        exit(1);
+    }
+    pthread_join(tid, NULL);
+
+    ServerArgs sargs = { sconn };
+    pthread_create(&tid, NULL, ServerThread, &sargs);
+
+    char dest[] = "/tmp/get_file_load.dest.XXXXXX";
+    int fd = mkstemp(dest);
+    close(fd);
+
+    double start = Now();
+    bool ok = CopyRegularFileNet(source, dest, size, false, aconn);
+    double elapsed = Now() - start;
+    pthread_join(tid, NULL);
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s transfer FAILED\n", large_get ? "large_get" : "classic");
+        exit(1);
+    }
+    PrintThroughput(large_get ? "large_get" : "classic", 1, "files", size, elapsed);
+
+    unlink(dest);
+    SSL_free(sconn->conn_info.ssl);
+    SSL_free(aconn->conn_info.ssl);
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    close(sv[0]);
+    close(sv[1]);
+    free(sconn);
+    free(aconn);
+}
+
+int main(int argc, char **argv)
+{
+    off_t megabytes = (argc > 1) ? atoi(argv[1]) : 256;
+
+    SSL_library_init();
+    SSL_load_error_strings();
+
+    EVP_PKEY *pkey = EVP_PKEY_new();
+    RSA *rsa = RSA_generate_key(2048, 65537, NULL, NULL);
+    EVP_PKEY_assign_RSA(pkey, rsa);
+
+    X509 *cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+    X509_set_pubkey(cert, pkey);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+                               (const unsigned char *) "localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    X509_sign(cert, pkey, EVP_sha256());
+
+    char source[] = "/tmp/get_file_load.src.XXXXXX";
+    int fd = mkstemp(source);
+    char block[65536];
+    memset(block, 'x', sizeof(block));
+    for (off_t i = 0; i < megabytes * 16; i++)
+    {
+        if (write(fd, block, sizeof(block)) != sizeof(block))
+        {
+            perror("write");
+            return 1;
+        }
+    }
+    close(fd);
+
+    Bench(source, megabytes * 1024 * 1024, false, pkey, cert);
+    Bench(source, megabytes * 1024 * 1024, true, pkey, cert);
+
+    unlink(source);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <platform.h>
+#include <alloc.h>
+#include <json.h>
+#include <writer.h>
+#include <load_common.h>
+
+/*
+ * Measures building, parsing, looking up keys in and merging JSON objects
+ * of the size readjson() and mergedata() containers reach.
+ */
+
+static void Bench(size_t n)
+{
+    char **keys = xcalloc(n, sizeof(char *));
+    for (size_t i = 0; i < n; i++)
+    {
+        xasprintf(&keys[i], "host_%zu.example.com", i);
+    }
+
+    double start = Now();
+    JsonElement *object = JsonObjectCreate(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        JsonObjectAppendString(object, keys[i], keys[i]);
+    }
+    PrintTiming("append", n, "keys", Now() - start);
+
+    start = Now();
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!JsonObjectGet(object, keys[i]))
+        {
+            exit(1);
+        }
+    }
+    PrintTiming("get", n, "keys", Now() - start);
+
+    start = Now();
+    for (size_t i = 0; i < n; i++)
+    {
+        char *indices[] = { keys[i] };
+        if (!JsonSelect(object, 1, indices))
+        {
+            exit(1);
+        }
+    }
+    PrintTiming("select", n, "keys", Now() - start);
+
+    start = Now();
+    JsonElement *merged = JsonMerge(object, object);
+    PrintTiming("merge", n, "keys", Now() - start);
+    if (JsonLength(merged) != n)
+    {
+        exit(1);
+    }
+    JsonDestroy(merged);
+
+    Writer *w = StringWriter();
+    JsonWrite(w, object, 0);
+    char *data = StringWriterClose(w);
+
+    start = Now();
+    const char *cursor = data;
+    JsonElement *parsed = NULL;
+    if (JsonParse(&cursor, &parsed) != JSON_PARSE_OK)
+    {
+        exit(1);
+    }
+    PrintTiming("parse", n, "keys", Now() - start);
+    JsonDestroy(parsed);
+    free(data);
+
+    JsonDestroy(object);
+    for (size_t i = 0; i < n; i++)
+    {
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+int main()
+{
+    Bench(1000);
+    Bench(50000);
+
+    return 0;
+}
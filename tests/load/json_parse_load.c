@@ -0,0 +1,128 @@
+#include <platform.h>
+#include <alloc.h>
+#include <json.h>
+#include <writer.h>
+#include <file_lib.h>
+#include <load_common.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * Measures parsing multi-megabyte JSON documents of the shape of inventory
+ * exports, as readjson() does: read whole into memory and parsed with
+ * JsonParse(), against parsed as read with JsonParseFile(). Each run is
+ * done in a child process so that its peak RSS can be reported.
+ */
+
+static char FILENAME[] = "/tmp/json_parse_load.XXXXXX";
+
+static size_t WriteDocument(size_t hosts)
+{
+    Writer *w = StringWriter();
+
+    WriterWrite(w, "{ \"hosts\": [\n");
+    for (size_t i = 0; i < hosts; i++)
+    {
+        WriterWriteF(w,
+                     "  { \"name\": \"host%zu.example.com\", \"ip\": \"10.%zu.%zu.%zu\", "
+                     "\"os\": \"Linux \\\"server\\\" edition\", \"owner\": \"J\\u00fcrgen\", "
+                     "\"cpus\": %zu, \"load\": %zu.25, \"tags\": [ \"web\", \"prod\", \"rack%zu\" ], "
+                     "\"monitored\": true, \"notes\": null }%s\n",
+                     i, (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF,
+                     1 + i % 64, i % 10, i % 40, (i + 1 < hosts) ? "," : "");
+    }
+    WriterWrite(w, "] }\n");
+
+    char *contents = StringWriterClose(w);
+    size_t size = strlen(contents);
+
+    FILE *fp = fopen(FILENAME, "w");
+    fwrite(contents, 1, size, fp);
+    fclose(fp);
+    free(contents);
+
+    return size;
+}
+
+static void ParseInChild(const char *op, size_t hosts, size_t size, bool streaming)
+{
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0)
+    {
+        JsonElement *json = NULL;
+        JsonParseError err;
+
+        double start = Now();
+        if (streaming)
+        {
+            err = JsonParseFile(FILENAME, SIZE_MAX, &json);
+        }
+        else
+        {
+            char *contents = NULL;
+            if (FileReadMax(&contents, FILENAME, SIZE_MAX) == -1)
+            {
+                exit(1);
+            }
+            const char *data = contents;
+            err = JsonParse(&data, &json);
+            free(contents);
+        }
+        double seconds = Now() - start;
+
+        if (err != JSON_PARSE_OK)
+        {
+            exit(1);
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        PrintThroughput(op, hosts, "hosts", size, seconds);
+        printf("%-8s peak RSS %8ld kB\n", op, usage.ru_maxrss);
+
+        JsonDestroy(json);
+        exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        exit(1);
+    }
+}
+
+static void Bench(size_t hosts)
+{
+    size_t size = WriteDocument(hosts);
+
+    ParseInChild("memory", hosts, size, false);
+    ParseInChild("file", hosts, size, true);
+
+    unlink(FILENAME);
+}
+
+int main()
+{
+    int fd = mkstemp(FILENAME);
+    if (fd == -1)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    Bench(10000);
+    Bench(200000);
+
+    return 0;
+}
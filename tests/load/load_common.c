@@ -0,0 +1,23 @@
+#include <platform.h>
+#include <load_common.h>
+
+double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void PrintTiming(const char *op, size_t n, const char *unit, double seconds)
+{
+    printf("%-8s %8zu %s: %8.3f ms, %10.0f ops/s, %8.2f us/op\n",
+           op, n, unit, seconds * 1000, seconds > 0 ? n / seconds : 0.0,
+           n > 0 ? seconds * 1e6 / n : 0.0);
+}
+
+void PrintThroughput(const char *op, size_t n, const char *unit, size_t bytes, double seconds)
+{
+    printf("%-8s %8zu %s: %8.3f ms, %10.0f ops/s, %8.1f MB/s\n",
+           op, n, unit, seconds * 1000, seconds > 0 ? n / seconds : 0.0,
+           seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0);
+}
@@ -0,0 +1,15 @@
+#ifndef CFENGINE_LOAD_COMMON_H
+#define CFENGINE_LOAD_COMMON_H
+
+#include <stddef.h>
+
+/* Monotonic wall clock in seconds, for timing a block of work. */
+double Now(void);
+
+/* Prints "op  n unit: ms, ops/s, us/op" for n operations taking seconds. */
+void PrintTiming(const char *op, size_t n, const char *unit, double seconds);
+
+/* As PrintTiming, with the MB/s rate for the given number of bytes. */
+void PrintThroughput(const char *op, size_t n, const char *unit, size_t bytes, double seconds);
+
+#endif
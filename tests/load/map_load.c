@@ -0,0 +1,189 @@
+#include <platform.h>
+#include <alloc.h>
+#include <map.h>
+#include <string_lib.h>
+#include <load_common.h>
+
+/*
+ * Compares Map (array map converting into the open addressing hash map)
+ * against the fixed 8192-bucket chained table it replaced, which is
+ * reproduced below.
+ */
+
+#define LEGACY_BUCKETS 8192
+
+typedef struct LegacyItem_
+{
+    MapKeyValue value;
+    struct LegacyItem_ *next;
+} LegacyItem;
+
+typedef struct
+{
+    LegacyItem **buckets;
+} LegacyMap;
+
+static LegacyMap *LegacyMapNew(void)
+{
+    LegacyMap *map = xcalloc(1, sizeof(LegacyMap));
+    map->buckets = xcalloc(LEGACY_BUCKETS, sizeof(LegacyItem *));
+    return map;
+}
+
+static void LegacyMapInsert(LegacyMap *map, void *key, void *value)
+{
+    unsigned bucket = StringHash(key, 0, LEGACY_BUCKETS);
+    for (LegacyItem *i = map->buckets[bucket]; i != NULL; i = i->next)
+    {
+        if (StringSafeEqual(i->value.key, key))
+        {
+            i->value.value = value;
+            return;
+        }
+    }
+
+    LegacyItem *i = xcalloc(1, sizeof(LegacyItem));
+    i->value.key = key;
+    i->value.value = value;
+    i->next = map->buckets[bucket];
+    map->buckets[bucket] = i;
+}
+
+static void *LegacyMapGet(LegacyMap *map, const void *key)
+{
+    unsigned bucket = StringHash(key, 0, LEGACY_BUCKETS);
+    for (LegacyItem *i = map->buckets[bucket]; i != NULL; i = i->next)
+    {
+        if (StringSafeEqual(i->value.key, key))
+        {
+            return i->value.value;
+        }
+    }
+    return NULL;
+}
+
+static size_t LegacyMapIterate(LegacyMap *map)
+{
+    size_t count = 0;
+    for (int b = 0; b < LEGACY_BUCKETS; b++)
+    {
+        for (LegacyItem *i = map->buckets[b]; i != NULL; i = i->next)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void LegacyMapDestroy(LegacyMap *map)
+{
+    for (int b = 0; b < LEGACY_BUCKETS; b++)
+    {
+        LegacyItem *i = map->buckets[b];
+        while (i)
+        {
+            LegacyItem *next = i->next;
+            free(i);
+            i = next;
+        }
+    }
+    free(map->buckets);
+    free(map);
+}
+
+static void Report(const char *impl, const char *op, size_t n, double seconds)
+{
+    printf("%-8s ", impl);
+    PrintTiming(op, n, "keys", seconds);
+}
+
+static void Bench(size_t n)
+{
+    char **keys = xcalloc(n, sizeof(char *));
+    for (size_t i = 0; i < n; i++)
+    {
+        xasprintf(&keys[i], "default:bundle.variable_%zu", i);
+    }
+
+    {
+        Map *map = MapNew((MapHashFn)StringHash, (MapKeyEqualFn)StringSafeEqual, NULL, NULL);
+
+        double start = Now();
+        for (size_t i = 0; i < n; i++)
+        {
+            MapInsert(map, keys[i], keys[i]);
+        }
+        Report("Map", "insert", n, Now() - start);
+
+        start = Now();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (MapGet(map, keys[i]) != keys[i])
+            {
+                exit(1);
+            }
+        }
+        Report("Map", "lookup", n, Now() - start);
+
+        start = Now();
+        size_t count = 0;
+        MapIterator it = MapIteratorInit(map);
+        while (MapIteratorNext(&it))
+        {
+            count++;
+        }
+        Report("Map", "iterate", n, Now() - start);
+        if (count != n || MapSize(map) != n)
+        {
+            exit(1);
+        }
+
+        MapDestroy(map);
+    }
+
+    {
+        LegacyMap *map = LegacyMapNew();
+
+        double start = Now();
+        for (size_t i = 0; i < n; i++)
+        {
+            LegacyMapInsert(map, keys[i], keys[i]);
+        }
+        Report("Legacy", "insert", n, Now() - start);
+
+        start = Now();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (LegacyMapGet(map, keys[i]) != keys[i])
+            {
+                exit(1);
+            }
+        }
+        Report("Legacy", "lookup", n, Now() - start);
+
+        start = Now();
+        size_t count = LegacyMapIterate(map);
+        Report("Legacy", "iterate", n, Now() - start);
+        if (count != n)
+        {
+            exit(1);
+        }
+
+        LegacyMapDestroy(map);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        free(keys[i]);
+    }
+    free(keys);
+}
+
+int main()
+{
+    Bench(1000);
+    Bench(100000);
+    Bench(1000000);
+
+    return 0;
+}
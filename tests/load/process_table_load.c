@@ -0,0 +1,38 @@
+#include <platform.h>
+#include <process_unix_priv.h>
+#include <load_common.h>
+
+/*
+ * Measures reading the native process table from /proc, as LoadProcessTable()
+ * does on Linux in place of running ps.
+ */
+
+#define ITERATIONS 20
+
+static void Bench(void)
+{
+    size_t processes = 0;
+
+    double start = Now();
+    for (int k = 0; k < ITERATIONS; k++)
+    {
+        ProcessTable *table = ReadProcessTable();
+
+        if (table == NULL)
+        {
+            printf("No native process table on this platform\n");
+            return;
+        }
+
+        processes += table->size;
+        ProcessTableDestroy(table);
+    }
+    PrintTiming("read", processes, "processes", Now() - start);
+}
+
+int main()
+{
+    Bench();
+
+    return 0;
+}
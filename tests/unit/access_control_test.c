@@ -0,0 +1,262 @@
+#include <test.h>
+
+#include <item_lib.h>
+#include <env_context.h>
+#include <server.h>
+#include <server_common.h>
+
+static char TEMPDIR[CF_BUFSIZE];
+
+/* Files below TEMPDIR */
+static char DIR_PATH[CF_BUFSIZE];                         /* TEMPDIR/dir */
+static char FILE_PATH[CF_BUFSIZE];                        /* TEMPDIR/dir/file */
+static char FILE2_PATH[CF_BUFSIZE];                       /* TEMPDIR/dir/file2 */
+static char SUB_FILE_PATH[CF_BUFSIZE];                    /* TEMPDIR/dir/sub/file */
+
+#define ALLOWED_IP "10.0.0.1"
+#define OTHER_IP   "10.0.0.2"
+
+static void CreateFile(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    assert_true(fp != NULL);
+    fclose(fp);
+}
+
+static void tests_setup(void)
+{
+    char tmp[] = "/tmp/access_control_test.XXXXXX";
+    assert_true(mkdtemp(tmp) != NULL);
+    /* Requests are resolved with realpath(), so rules have to be too */
+    assert_true(realpath(tmp, TEMPDIR) != NULL);
+
+    snprintf(DIR_PATH, sizeof(DIR_PATH), "%s/dir", TEMPDIR);
+    mkdir(DIR_PATH, 0700);
+
+    char sub[CF_BUFSIZE];
+    snprintf(sub, sizeof(sub), "%s/sub", DIR_PATH);
+    mkdir(sub, 0700);
+
+    snprintf(FILE_PATH, sizeof(FILE_PATH), "%s/file", DIR_PATH);
+    CreateFile(FILE_PATH);
+    snprintf(FILE2_PATH, sizeof(FILE2_PATH), "%s/file2", DIR_PATH);
+    CreateFile(FILE2_PATH);
+    snprintf(SUB_FILE_PATH, sizeof(SUB_FILE_PATH), "%s/file", sub);
+    CreateFile(SUB_FILE_PATH);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", TEMPDIR);
+    system(cmd);
+}
+
+/* Appends a rule admitting host to path, as the server control body would */
+static Auth *AddRule(Auth **list, const char *path, const char *host, bool encrypt)
+{
+    Auth *ap = xcalloc(1, sizeof(Auth));
+    ap->path = xstrdup(path);
+    ap->encrypt = encrypt;
+    AppendItem(&ap->accesslist, host, NULL);
+
+    Auth **tail = list;
+    while (*tail != NULL)
+    {
+        tail = &(*tail)->next;
+    }
+    *tail = ap;
+
+    return ap;
+}
+
+static void ClearRules(void)
+{
+    DeleteAuthList(SV.admit);
+    DeleteAuthList(SV.deny);
+    SV.admit = NULL;
+    SV.deny = NULL;
+    AdmitIndexBuild();
+}
+
+static ServerConnectionState *ConnNew(const char *ipaddr, const char *hostname)
+{
+    ServerConnectionState *conn = xcalloc(1, sizeof(ServerConnectionState));
+    strlcpy(conn->ipaddr, ipaddr, sizeof(conn->ipaddr));
+    strlcpy(conn->hostname, hostname, sizeof(conn->hostname));
+    return conn;
+}
+
+static void ConnDestroy(ServerConnectionState *conn)
+{
+    AccessCacheDestroy(conn->access_cache);
+    free(conn);
+}
+
+static void test_exact_and_prefix_match(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    ServerConnectionState *conn = ConnNew(ALLOWED_IP, "allowed.example.com");
+
+    /* A rule on a file admits that file only */
+    AddRule(&SV.admit, FILE_PATH, ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, FILE_PATH, conn, false));
+    assert_false(AccessControl(ctx, FILE2_PATH, conn, false));
+
+    /* A rule on a directory admits everything below it */
+    ClearRules();
+    AddRule(&SV.admit, DIR_PATH, ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, FILE_PATH, conn, false));
+    assert_true(AccessControl(ctx, SUB_FILE_PATH, conn, false));
+
+    /* ... but a rule path is not a prefix of a longer file name */
+    ClearRules();
+    char partial[CF_BUFSIZE];
+    snprintf(partial, sizeof(partial), "%s/fi", DIR_PATH);
+    CreateFile(partial);
+    AddRule(&SV.admit, partial, ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, partial, conn, false));
+    assert_false(AccessControl(ctx, FILE_PATH, conn, false));
+    unlink(partial);
+
+    /* Nor anything next to it */
+    ClearRules();
+    AddRule(&SV.admit, SUB_FILE_PATH, ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_false(AccessControl(ctx, FILE_PATH, conn, false));
+
+    ClearRules();
+    ConnDestroy(conn);
+    EvalContextDestroy(ctx);
+}
+
+static void test_root_rule(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    ServerConnectionState *conn = ConnNew(ALLOWED_IP, "allowed.example.com");
+
+    AddRule(&SV.admit, "/", ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, FILE_PATH, conn, false));
+    assert_true(AccessControl(ctx, SUB_FILE_PATH, conn, false));
+
+    /* The first rule in the admit list wins, not the most specific one */
+    ClearRules();
+    AddRule(&SV.admit, DIR_PATH, OTHER_IP, false);
+    AddRule(&SV.admit, "/", ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_false(AccessControl(ctx, FILE_PATH, conn, false));
+
+    ClearRules();
+    AddRule(&SV.admit, "/", ALLOWED_IP, false);
+    AddRule(&SV.admit, DIR_PATH, OTHER_IP, false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, FILE_PATH, conn, false));
+
+    ClearRules();
+    ConnDestroy(conn);
+    EvalContextDestroy(ctx);
+}
+
+static void test_deny_overrides_admit(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    ServerConnectionState *good = ConnNew(ALLOWED_IP, "good.example.com");
+    ServerConnectionState *bad = ConnNew(ALLOWED_IP, "bad.example.com");
+
+    AddRule(&SV.admit, DIR_PATH, ALLOWED_IP, false);
+    AddRule(&SV.deny, DIR_PATH, "bad.example.com", false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, FILE_PATH, good, false));
+    assert_false(AccessControl(ctx, FILE_PATH, bad, false));
+    /* Also when the decision comes from the cache */
+    assert_false(AccessControl(ctx, FILE_PATH, bad, false));
+
+    ClearRules();
+    ConnDestroy(bad);
+    ConnDestroy(good);
+    EvalContextDestroy(ctx);
+}
+
+static void test_encrypt_only_rule(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    ServerConnectionState *conn = ConnNew(ALLOWED_IP, "allowed.example.com");
+
+    AddRule(&SV.admit, DIR_PATH, ALLOWED_IP, true);
+    AdmitIndexBuild();
+
+    assert_false(AccessControl(ctx, FILE_PATH, conn, false));
+    assert_true(AccessControl(ctx, FILE_PATH, conn, true));
+    assert_false(AccessControl(ctx, FILE_PATH, conn, false));
+
+    ClearRules();
+    ConnDestroy(conn);
+    EvalContextDestroy(ctx);
+}
+
+static void test_cache_cleared_on_reload(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    ServerConnectionState *conn = ConnNew(ALLOWED_IP, "allowed.example.com");
+
+    AddRule(&SV.admit, DIR_PATH, ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, FILE_PATH, conn, false));
+
+    /* The reloaded policy no longer admits the host */
+    ClearRules();
+    AddRule(&SV.admit, DIR_PATH, OTHER_IP, false);
+    AdmitIndexBuild();
+
+    assert_false(AccessControl(ctx, FILE_PATH, conn, false));
+
+    /* It admits it again, but denies it by name */
+    ClearRules();
+    AddRule(&SV.admit, DIR_PATH, ALLOWED_IP, false);
+    AdmitIndexBuild();
+
+    assert_true(AccessControl(ctx, FILE_PATH, conn, false));
+
+    AddRule(&SV.deny, DIR_PATH, "allowed.example.com", false);
+    AdmitIndexBuild();
+
+    assert_false(AccessControl(ctx, FILE_PATH, conn, false));
+
+    ClearRules();
+    ConnDestroy(conn);
+    EvalContextDestroy(ctx);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_exact_and_prefix_match),
+        unit_test(test_root_rule),
+        unit_test(test_deny_overrides_admit),
+        unit_test(test_encrypt_only_rule),
+        unit_test(test_cache_cleared_on_reload),
+    };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+
+    return ret;
+}
@@ -74,6 +74,94 @@ static void test_default_ns(void)
     }
 }
 
+static void test_put_get_remove(void)
+{
+    ClassTable *t = ClassTableNew();
+    assert_false(ClassTablePut(t, NULL, "a", false, CONTEXT_SCOPE_NAMESPACE));
+    assert_false(ClassTablePut(t, "ns", "a", true, CONTEXT_SCOPE_BUNDLE));
+    assert_true(ClassTablePut(t, "default", "a", false, CONTEXT_SCOPE_NAMESPACE));
+    assert_int_equal(2, ClassTableSize(t));
+
+    Class *cls = ClassTableGet(t, NULL, "a");
+    assert_true(cls->ns == NULL);
+    cls = ClassTableGet(t, "ns", "a");
+    assert_string_equal("ns", cls->ns);
+
+    assert_true(ClassTableRemove(t, "ns", "a"));
+    assert_false(ClassTableRemove(t, "ns", "a"));
+    assert_true(ClassTableGet(t, "ns", "a") == NULL);
+    assert_true(ClassTableGet(t, NULL, "a") != NULL);
+    assert_int_equal(1, ClassTableSize(t));
+
+    assert_true(ClassTableClear(t));
+    assert_int_equal(0, ClassTableSize(t));
+    ClassTableDestroy(t);
+}
+
+static void test_many_classes(void)
+{
+    ClassTable *t = ClassTableNew();
+    char name[32];
+    for (int i = 0; i < 10000; i++)
+    {
+        snprintf(name, sizeof(name), "class_%d", i);
+        assert_false(ClassTablePut(t, NULL, name, false, CONTEXT_SCOPE_NAMESPACE));
+    }
+    assert_int_equal(10000, ClassTableSize(t));
+
+    for (int i = 0; i < 10000; i++)
+    {
+        snprintf(name, sizeof(name), "class_%d", i);
+        Class *cls = ClassTableGet(t, NULL, name);
+        assert_true(cls != NULL);
+        assert_string_equal(name, cls->name);
+    }
+
+    ClassTableDestroy(t);
+}
+
+static size_t CountMatching(ClassTable *t, const char *ns, const char *regex, bool is_hard, bool is_soft)
+{
+    size_t count = 0;
+    ClassTableIterator *iter = ClassTableIteratorNewMatching(t, ns, regex, is_hard, is_soft);
+    while (ClassTableIteratorNext(iter))
+    {
+        count++;
+    }
+    ClassTableIteratorDestroy(iter);
+    return count;
+}
+
+static void test_iterator_matching(void)
+{
+    ClassTable *t = ClassTableNew();
+    ClassTablePut(t, NULL, "linux", false, CONTEXT_SCOPE_NAMESPACE);
+    ClassTablePut(t, NULL, "linux_x86_64", false, CONTEXT_SCOPE_NAMESPACE);
+    ClassTablePut(t, NULL, "lin", true, CONTEXT_SCOPE_NAMESPACE);
+    ClassTablePut(t, NULL, "solaris", false, CONTEXT_SCOPE_NAMESPACE);
+    ClassTablePut(t, NULL, "my_linux", true, CONTEXT_SCOPE_NAMESPACE);
+    ClassTablePut(t, "ns", "linux_box", true, CONTEXT_SCOPE_NAMESPACE);
+
+    assert_int_equal(2, CountMatching(t, NULL, "linux.*", true, true));
+    assert_int_equal(2, CountMatching(t, NULL, "linux.*", true, false));
+    assert_int_equal(0, CountMatching(t, NULL, "linux.*", false, true));
+    assert_int_equal(1, CountMatching(t, NULL, "^linux$", true, true));
+    assert_int_equal(3, CountMatching(t, NULL, "lin.*", true, true));
+    assert_int_equal(1, CountMatching(t, NULL, "lin.*", false, true));
+    assert_int_equal(4, CountMatching(t, NULL, ".*linux.*", true, true));
+    assert_int_equal(2, CountMatching(t, NULL, "linux|solaris", true, true));
+    assert_int_equal(2, CountMatching(t, NULL, "linuxx?.*", true, true));
+    assert_int_equal(0, CountMatching(t, NULL, "zzz.*", true, true));
+    assert_int_equal(6, CountMatching(t, NULL, NULL, true, true));
+
+    assert_int_equal(1, CountMatching(t, "ns", "ns:linux.*", true, true));
+    assert_int_equal(1, CountMatching(t, "ns", ".*", true, true));
+    assert_int_equal(0, CountMatching(t, "ns", "linux.*", true, true));
+    assert_int_equal(5, CountMatching(t, "default", ".*", true, true));
+
+    ClassTableDestroy(t);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -82,6 +170,9 @@ int main()
         unit_test(test_default_ns),
         unit_test(test_ns),
         unit_test(test_class_ref),
+        unit_test(test_put_get_remove),
+        unit_test(test_many_classes),
+        unit_test(test_iterator_matching),
     };
 
     return run_tests(tests);
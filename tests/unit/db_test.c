@@ -109,6 +109,124 @@ void test_recreate(void)
     CloseDB(db);
 }
 
+void test_batch(void)
+{
+    CF_DB *db;
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+    assert_int_equal(WriteDB(db, "old", "abc", 4), true);
+
+    assert_int_equal(DBBeginBatch(db, 0, 0), true);
+
+    /* The batch keeps the database open */
+    CloseDB(db);
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+
+    char value[4];
+
+    /* Pending changes are visible through the API */
+    assert_int_equal(WriteDB(db, "new", "def", 4), true);
+    assert_int_equal(ReadDB(db, "new", value, sizeof(value)), true);
+    assert_string_equal(value, "def");
+    assert_int_equal(HasKeyDB(db, "new", strlen("new") + 1), true);
+    assert_int_equal(ValueSizeDB(db, "new", strlen("new") + 1), 4);
+
+    assert_int_equal(DeleteDB(db, "old"), true);
+    assert_int_equal(ReadDB(db, "old", value, sizeof(value)), false);
+    assert_int_equal(HasKeyDB(db, "old", strlen("old") + 1), false);
+
+    /* Later writes to the same key win */
+    assert_int_equal(WriteDB(db, "new", "ghi", 4), true);
+    assert_int_equal(ReadDB(db, "new", value, sizeof(value)), true);
+    assert_string_equal(value, "ghi");
+
+    /* Nested batches only flush on the outermost commit */
+    assert_int_equal(DBBeginBatch(db, 0, 0), true);
+    assert_int_equal(DBCommitBatch(db), true);
+
+    assert_int_equal(DBCommitBatch(db), true);
+    CloseDB(db);
+
+    /* Reopen from scratch, the changes must have reached the file */
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+    assert_int_equal(ReadDB(db, "new", value, sizeof(value)), true);
+    assert_string_equal(value, "ghi");
+    assert_int_equal(ReadDB(db, "old", value, sizeof(value)), false);
+
+    assert_int_equal(DBCommitBatch(db), false);
+    CloseDB(db);
+}
+
+void test_batch_flush_limit(void)
+{
+    CF_DB *db;
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+    assert_int_equal(DBBeginBatch(db, 10, 3600), true);
+
+    char key[16];
+    for (int i = 0; i < 100; i++)
+    {
+        snprintf(key, sizeof(key), "batch%d", i);
+        assert_int_equal(WriteDB(db, key, &i, sizeof(i)), true);
+    }
+
+    /* A cursor only sees the database, so creating one flushes */
+    CF_DBC *cursor;
+    assert_int_equal(NewDBCursor(db, &cursor), true);
+
+    char *k;
+    int ksize;
+    void *v;
+    int vsize;
+    int count = 0;
+    while (NextDB(cursor, &k, &ksize, &v, &vsize))
+    {
+        if (strncmp(k, "batch", 5) == 0)
+        {
+            count++;
+        }
+    }
+    assert_int_equal(count, 100);
+    assert_int_equal(DeleteDBCursor(cursor), true);
+
+    assert_int_equal(DBCommitBatch(db), true);
+    CloseDB(db);
+}
+
+void test_batch_fork(void)
+{
+    CF_DB *db;
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+    assert_int_equal(DBBeginBatch(db, 0, 0), true);
+    assert_int_equal(WriteDB(db, "parent", "abc", 4), true);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        /* The parent's pending change is not ours to write, ours are */
+        char value[4];
+        bool ok = !ReadDB(db, "parent", value, sizeof(value)) &&
+            WriteDB(db, "child", "def", 4) &&
+            DBFlushBatch(db);
+        _exit(ok ? 0 : 1);
+    }
+
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), 0);
+
+    assert_int_equal(DBCommitBatch(db), true);
+    CloseDB(db);
+
+    char value[4];
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+    assert_int_equal(ReadDB(db, "parent", value, sizeof(value)), true);
+    assert_string_equal(value, "abc");
+    assert_int_equal(ReadDB(db, "child", value, sizeof(value)), true);
+    assert_string_equal(value, "def");
+    CloseDB(db);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -119,6 +237,9 @@ int main()
             unit_test(test_iter_modify_entry),
             unit_test(test_iter_delete_entry),
             unit_test(test_recreate),
+            unit_test(test_batch),
+            unit_test(test_batch_flush_limit),
+            unit_test(test_batch_fork),
         };
 
     PRINT_TEST_BANNER();
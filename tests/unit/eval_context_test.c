@@ -0,0 +1,67 @@
+#include <test.h>
+#include <env_context.h>
+#include <policy.h>
+
+static void test_class_expressions(void)
+{
+    EvalContext *ctx = EvalContextNew();
+
+    assert_false(IsDefinedClass(ctx, "foo|bar", NULL));
+    assert_true(IsDefinedClass(ctx, "any", NULL));
+
+    EvalContextClassPut(ctx, NULL, "foo", true, CONTEXT_SCOPE_NAMESPACE);
+    assert_true(IsDefinedClass(ctx, "foo|bar", NULL));
+    assert_true(IsDefinedClass(ctx, "foo.!bar", NULL));
+    assert_false(IsDefinedClass(ctx, "foo.bar", NULL));
+
+    EvalContextClassPut(ctx, NULL, "bar", true, CONTEXT_SCOPE_NAMESPACE);
+    assert_false(IsDefinedClass(ctx, "foo.!bar", NULL));
+    assert_true(IsDefinedClass(ctx, "foo.bar", NULL));
+
+    EvalContextClassRemove(ctx, NULL, "foo");
+    assert_true(IsDefinedClass(ctx, "foo|bar", NULL));
+    assert_false(IsDefinedClass(ctx, "foo.bar", NULL));
+
+    EvalContextClear(ctx);
+    assert_false(IsDefinedClass(ctx, "foo|bar", NULL));
+
+    assert_false(IsDefinedClass(ctx, "foo.", NULL));
+    assert_false(IsDefinedClass(ctx, "foo.", NULL));
+
+    EvalContextDestroy(ctx);
+}
+
+static void test_class_expressions_bundle_frame(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Policy *policy = PolicyNew();
+    Bundle *bundle = PolicyAppendBundle(policy, "default", "main", "agent", NULL, NULL);
+
+    assert_false(IsDefinedClass(ctx, "local", "default"));
+
+    EvalContextStackPushBundleFrame(ctx, bundle, NULL, false);
+    EvalContextClassPut(ctx, "default", "local", true, CONTEXT_SCOPE_BUNDLE);
+    assert_true(IsDefinedClass(ctx, "local", "default"));
+
+    EvalContextStackPopFrame(ctx);
+    assert_false(IsDefinedClass(ctx, "local", "default"));
+
+    EvalContextStackPushBundleFrame(ctx, bundle, NULL, false);
+    assert_false(IsDefinedClass(ctx, "local", "default"));
+    EvalContextStackPopFrame(ctx);
+
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_class_expressions),
+        unit_test(test_class_expressions_bundle_frame),
+    };
+
+    return run_tests(tests);
+}
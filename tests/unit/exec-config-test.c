@@ -25,6 +25,7 @@ static void TestCheckConfigIsDefault(ExecConfig *c)
     assert_string_equal("",c->mail_to_address);
     assert_string_equal("",c->mail_subject);
     assert_int_equal(0, c->splay_time);
+    assert_false(c->warm_agent);
 
     assert_int_equal(12, StringSetSize(c->schedule));
 }
@@ -73,6 +74,7 @@ static void test_load(void)
         assert_string_equal("localhost", c->mail_server);
         assert_string_equal("cfengine_mail@example.org",c->mail_to_address);
         assert_string_equal("Test [localhost/127.0.0.1]",c->mail_subject);
+        assert_true(c->warm_agent);
 
         // splay time hard to test (pseudo random)
 
@@ -106,6 +108,7 @@ static void test_load(void)
             assert_string_equal("",c->mail_to_address);
             assert_string_equal("",c->mail_subject);
             assert_int_equal(0, c->splay_time);
+            assert_false(c->warm_agent);
 
             assert_int_equal(12, StringSetSize(c->schedule));
 
@@ -76,10 +76,11 @@ static void test_expand_scalar_two_scalars_concat(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a $(one) b $(two)c", res);
 
-    assert_string_equal("a first b secondc", res);
+    assert_string_equal("a first b secondc", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
@@ -98,10 +99,11 @@ static void test_expand_scalar_two_scalars_nested(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a $($(two))b", res);
 
-    assert_string_equal("a firstb", res);
+    assert_string_equal("a firstb", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
@@ -120,10 +122,11 @@ static void test_expand_scalar_array_concat(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a $(foo[one]) b $(foo[two])c", res);
 
-    assert_string_equal("a first b secondc", res);
+    assert_string_equal("a first b secondc", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
@@ -142,14 +145,74 @@ static void test_expand_scalar_array_with_scalar_arg(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a$(foo[$(bar)])b", res);
 
-    assert_string_equal("afirstb", res);
+    assert_string_equal("afirstb", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
 
+static void test_expand_scalar_undefined(void)
+{
+    EvalContext *ctx = EvalContextNew();
+
+    Buffer *res = BufferNew();
+    assert_false(ExpandScalar(ctx, "default", "bundle", "a $(nosuch) ${nosuch} $ $x b", res));
+    assert_string_equal("a $(nosuch) ${nosuch} $ $x b", BufferData(res));
+    BufferDestroy(&res);
+
+    EvalContextDestroy(ctx);
+}
+
+static void test_expand_scalar_repeated(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    VarRef *lval = VarRefParse("default:bundle.one");
+
+    for (int i = 0; i < 3; i++)
+    {
+        char value[16];
+        snprintf(value, sizeof(value), "v%d", i);
+        EvalContextVariablePut(ctx, lval, value, DATA_TYPE_STRING);
+
+        char expected[32];
+        snprintf(expected, sizeof(expected), "a v%d b", i);
+
+        Buffer *res = BufferNew();
+        assert_true(ExpandScalar(ctx, "default", "bundle", "a $(one) b", res));
+        assert_string_equal(expected, BufferData(res));
+        BufferDestroy(&res);
+    }
+
+    VarRefDestroy(lval);
+    EvalContextDestroy(ctx);
+}
+
+static void test_expand_scalar_large(void)
+{
+    EvalContext *ctx = EvalContextNew();
+
+    size_t value_len = 4 * CF_EXPANDSIZE;
+    char *value = xcalloc(value_len + 1, 1);
+    memset(value, 'x', value_len);
+    {
+        VarRef *lval = VarRefParse("default:bundle.big");
+        EvalContextVariablePut(ctx, lval, value, DATA_TYPE_STRING);
+        VarRefDestroy(lval);
+    }
+
+    Buffer *res = BufferNew();
+    assert_true(ExpandScalar(ctx, "default", "bundle", "$(big)-$(big)", res));
+    assert_int_equal(2 * value_len + 1, strlen(BufferData(res)));
+    assert_int_equal('-', BufferData(res)[value_len]);
+    BufferDestroy(&res);
+
+    free(value);
+    EvalContextDestroy(ctx);
+}
+
 static PromiseResult actuator_expand_promise_array_with_scalar_arg(EvalContext *ctx, Promise *pp, ARG_UNUSED void *param)
 {
     assert_string_equal("first", pp->promiser);
@@ -316,6 +379,9 @@ int main()
         unit_test(test_expand_scalar_two_scalars_nested),
         unit_test(test_expand_scalar_array_concat),
         unit_test(test_expand_scalar_array_with_scalar_arg),
+        unit_test(test_expand_scalar_undefined),
+        unit_test(test_expand_scalar_repeated),
+        unit_test(test_expand_scalar_large),
         unit_test(test_expand_promise_array_with_scalar_arg),
         unit_test(test_expand_promise_slist),
         unit_test(test_expand_promise_array_with_slist_arg)
@@ -2,6 +2,7 @@
 
 #include <cf3.defs.h>
 #include <files_lib.h>
+#include <item_lib.h>
 
 #define FILE_CONTENTS "8aysd9a8ydhsdkjnaldn12lk\njndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1lkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1lkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1lkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1lkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljew\nnbfdhwjebfkjhbnkjdn1lkdjn1lkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1l\rkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1\r\nlkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1lkjn38aysd9a8ydhsdkjnaldn12lkjndl1jndljewnbfdhwjebfkjhbnkjdn1lkdjn1lkjn3"
 #define FILE_SIZE (sizeof(FILE_CONTENTS) - 1)
@@ -10,6 +11,7 @@ char CFWORKDIR[CF_BUFSIZE];
 
 char FILE_NAME[CF_BUFSIZE];
 char FILE_NAME_EMPTY[CF_BUFSIZE];
+char FILE_NAME_LINES[CF_BUFSIZE];
 
 static void tests_setup(void)
 {
@@ -18,6 +20,7 @@ static void tests_setup(void)
 
     snprintf(FILE_NAME, CF_BUFSIZE, "%s/cfengine_file_test", CFWORKDIR);
     snprintf(FILE_NAME_EMPTY, CF_BUFSIZE, "%s/cfengine_file_test_empty", CFWORKDIR);
+    snprintf(FILE_NAME_LINES, CF_BUFSIZE, "%s/cfengine_file_test_lines", CFWORKDIR);
 }
 
 static void tests_teardown(void)
@@ -100,6 +103,104 @@ void test_file_read_invalid(void)
     assert_true(bytes_read == -1);
 }
 
+void test_load_item_list(void)
+{
+    /* Longer than a line could be when read with CfReadLine() */
+    char long_line[3 * CF_BUFSIZE + 1];
+    memset(long_line, 'x', sizeof(long_line) - 1);
+    long_line[sizeof(long_line) - 1] = '\0';
+
+    char *contents;
+    xasprintf(&contents, "first\n%s\n\nlast", long_line);
+    assert_true(FileWriteOver(FILE_NAME_LINES, contents));
+    free(contents);
+
+    EditDefaults edits = { 0 };
+    Item *list = NULL;
+    assert_true(LoadFileAsItemList(&list, FILE_NAME_LINES, edits));
+
+    assert_int_equal(4, ListLen(list));
+    assert_string_equal("first", list->name);
+    assert_string_equal(long_line, list->next->name);
+    assert_string_equal("", list->next->next->name);
+    assert_string_equal("last", list->next->next->next->name);
+
+    /* Appends to what is already in the list */
+    assert_true(LoadFileAsItemList(&list, FILE_NAME_LINES, edits));
+    assert_int_equal(8, ListLen(list));
+    assert_string_equal("first", list->next->next->next->next->name);
+
+    DeleteItemList(list);
+}
+
+void test_load_item_list_joinlines(void)
+{
+    assert_true(FileWriteOver(FILE_NAME_LINES, "a\\\nb\\\nc\nd\ne\\\n"));
+
+    EditDefaults edits = { 0 };
+    edits.joinlines = true;
+    Item *list = NULL;
+    assert_true(LoadFileAsItemList(&list, FILE_NAME_LINES, edits));
+
+    assert_int_equal(3, ListLen(list));
+    assert_string_equal("abc", list->name);
+    assert_string_equal("d", list->next->name);
+    assert_string_equal("e", list->next->next->name);
+
+    DeleteItemList(list);
+}
+
+void test_load_item_list_large(void)
+{
+    /* Big enough to be mapped rather than read */
+    FILE *fp = fopen(FILE_NAME_LINES, "w");
+    assert_true(fp != NULL);
+    for (int i = 0; i < 200000; i++)
+    {
+        fprintf(fp, "10.0.%d.%d host%d.example.com\n", i / 256 % 256, i % 256, i);
+    }
+    fclose(fp);
+
+    EditDefaults edits = { 0 };
+    Item *list = NULL;
+    assert_true(LoadFileAsItemList(&list, FILE_NAME_LINES, edits));
+
+    assert_int_equal(200000, ListLen(list));
+    assert_string_equal("10.0.0.0 host0.example.com", list->name);
+    assert_string_equal("10.0.13.63 host199999.example.com", EndOfList(list)->name);
+
+    assert_true(FileEqualsItemList(FILE_NAME_LINES, list, edits));
+
+    DeleteItemList(list);
+}
+
+void test_file_equals_item_list(void)
+{
+    assert_true(FileWriteOver(FILE_NAME_LINES, "one\ntwo\nthree\n"));
+
+    EditDefaults edits = { 0 };
+    Item *list = NULL;
+    AppendItem(&list, "one", NULL);
+    AppendItem(&list, "two", NULL);
+    assert_false(FileEqualsItemList(FILE_NAME_LINES, list, edits));
+
+    AppendItem(&list, "three", NULL);
+    assert_true(FileEqualsItemList(FILE_NAME_LINES, list, edits));
+
+    AppendItem(&list, "four", NULL);
+    assert_false(FileEqualsItemList(FILE_NAME_LINES, list, edits));
+    DeleteItemList(list);
+
+    list = NULL;
+    AppendItem(&list, "one", NULL);
+    AppendItem(&list, "tw", NULL);
+    AppendItem(&list, "three", NULL);
+    assert_false(FileEqualsItemList(FILE_NAME_LINES, list, edits));
+    DeleteItemList(list);
+
+    assert_false(FileEqualsItemList("nonexisting file", NULL, edits));
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -112,6 +213,10 @@ int main()
             unit_test(test_file_read_truncate),
             unit_test(test_file_read_empty),
             unit_test(test_file_read_invalid),
+            unit_test(test_load_item_list),
+            unit_test(test_load_item_list_joinlines),
+            unit_test(test_load_item_list_large),
+            unit_test(test_file_equals_item_list),
         };
 
     int ret = run_tests(tests);
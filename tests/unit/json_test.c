@@ -609,6 +609,78 @@ static void test_parse_object_escaped(void)
     JsonDestroy(obj);
 }
 
+static void test_parse_unicode_escapes(void)
+{
+    const char *data = "[ \"caf\\u00e9\", \"\\u20ac\", \"\\ud83d\\ude00\", \"\\ud83d\", \"\\/\\b\\f\\r\" ]";
+    JsonElement *arr = NULL;
+    assert_int_equal(JSON_PARSE_OK, JsonParse(&data, &arr));
+
+    assert_string_equal("caf\xc3\xa9", JsonArrayGetAsString(arr, 0));
+    assert_string_equal("\xe2\x82\xac", JsonArrayGetAsString(arr, 1));
+    assert_string_equal("\xf0\x9f\x98\x80", JsonArrayGetAsString(arr, 2));
+    assert_string_equal("\xef\xbf\xbd", JsonArrayGetAsString(arr, 3));
+    assert_string_equal("/\b\f\r", JsonArrayGetAsString(arr, 4));
+
+    JsonDestroy(arr);
+}
+
+static void test_parse_escaped_backslash(void)
+{
+    const char *data = "{ \"a\\\\\": \"b\\\\\", \"c\": \"\\\\n\" }";
+    JsonElement *obj = NULL;
+    assert_int_equal(JSON_PARSE_OK, JsonParse(&data, &obj));
+
+    assert_string_equal("b\\", JsonObjectGetAsString(obj, "a\\"));
+    assert_string_equal("\\n", JsonObjectGetAsString(obj, "c"));
+
+    JsonDestroy(obj);
+}
+
+static void test_parse_file(void)
+{
+    /* Large enough for tokens to cross the read buffer */
+    Writer *w = StringWriter();
+    WriterWrite(w, "[");
+    for (int i = 0; i < 20000; i++)
+    {
+        WriterWriteF(w, "{ \"key%d\": \"value \\\"%d\\\" \\u00e9\", \"n\": %d.5e1, \"t\": true }, ", i, i, i);
+    }
+    for (int i = 0; i < 100000; i++)
+    {
+        WriterWrite(w, i == 0 ? "\"" : "long\\n");
+    }
+    WriterWrite(w, "\", null ]");
+    char *contents = StringWriterClose(w);
+
+    char *path = tempnam(NULL, "cfengine_test");
+    FILE *fp = fopen(path, "w");
+    fputs(contents, fp);
+    fclose(fp);
+
+    JsonElement *from_file = NULL;
+    assert_int_equal(JSON_PARSE_OK, JsonParseFile(path, SIZE_MAX, &from_file));
+
+    JsonElement *from_string = NULL;
+    const char *data = contents;
+    assert_int_equal(JSON_PARSE_OK, JsonParse(&data, &from_string));
+
+    assert_int_equal(20002, JsonLength(from_file));
+    assert_int_equal(0, JsonCompare(from_file, from_string));
+
+    /* Reading stops at size_max */
+    JsonElement *truncated = NULL;
+    assert_int_not_equal(JSON_PARSE_OK, JsonParseFile(path, strlen(contents) - 1, &truncated));
+    assert_false(truncated);
+
+    assert_int_equal(JSON_PARSE_ERROR_READ, JsonParseFile("/nonexistent/file.json", SIZE_MAX, &truncated));
+
+    JsonDestroy(from_file);
+    JsonDestroy(from_string);
+    unlink(path);
+    free(path);
+    free(contents);
+}
+
 static void test_parse_tzz_evil_key(void)
 {
     const char *data = "{ \"third key! can? be$ anything&\": [ \"a\", \"b\", \"c\" ]}";
@@ -1097,6 +1169,91 @@ static void test_detach_key_from_object(void)
     JsonDestroy(detached);
 }
 
+static void test_large_object(void)
+{
+    JsonElement *object = JsonObjectCreate(10);
+    char key[32];
+
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        JsonObjectAppendInteger(object, key, i);
+    }
+    assert_int_equal(1000, JsonLength(object));
+
+    /* Overwriting moves the key last */
+    JsonObjectAppendString(object, "key10", "ten");
+    assert_int_equal(1000, JsonLength(object));
+    assert_string_equal("ten", JsonObjectGetAsString(object, "key10"));
+    assert_string_equal("key10", JsonGetPropertyAsString(JsonAt(object, 999)));
+
+    for (int i = 0; i < 1000; i += 2)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert_true(JsonObjectRemoveKey(object, key));
+        assert_false(JsonObjectRemoveKey(object, key));
+    }
+    assert_int_equal(500, JsonLength(object));
+
+    JsonElement *detached = JsonObjectDetachKey(object, "key11");
+    assert_true(detached != NULL);
+    assert_true(JsonObjectDetachKey(object, "key11") == NULL);
+    JsonDestroy(detached);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        JsonElement *child = JsonObjectGet(object, key);
+        if (i % 2 == 0 || i == 11)
+        {
+            assert_true(child == NULL);
+        }
+        else
+        {
+            assert_true(child != NULL);
+            assert_string_equal(key, JsonGetPropertyAsString(child));
+        }
+    }
+
+    /* Order is insertion order, regardless of the index */
+    assert_string_equal("key1", JsonGetPropertyAsString(JsonAt(object, 0)));
+    assert_string_equal("key13", JsonGetPropertyAsString(JsonAt(object, 5)));
+
+    {
+        char *indices[] = { "key999" };
+        assert_int_equal(999, JsonPrimitiveGetAsInteger(JsonSelect(object, 1, indices)));
+    }
+
+    JsonDestroy(object);
+}
+
+static void test_merge_large_object(void)
+{
+    JsonElement *a = JsonObjectCreate(10);
+    JsonElement *b = JsonObjectCreate(10);
+    char key[32];
+
+    for (int i = 0; i < 100; i++)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        JsonObjectAppendInteger(a, key, i);
+        snprintf(key, sizeof(key), "key%d", i + 50);
+        JsonObjectAppendInteger(b, key, 1000 + i);
+    }
+
+    JsonElement *c = JsonMerge(a, b);
+    assert_int_equal(150, JsonLength(c));
+    assert_int_equal(49, JsonPrimitiveGetAsInteger(JsonObjectGet(c, "key49")));
+    assert_int_equal(1000, JsonPrimitiveGetAsInteger(JsonObjectGet(c, "key50")));
+    assert_int_equal(1099, JsonPrimitiveGetAsInteger(JsonObjectGet(c, "key149")));
+    assert_string_equal("key49", JsonGetPropertyAsString(JsonAt(c, 49)));
+    assert_string_equal("key50", JsonGetPropertyAsString(JsonAt(c, 50)));
+
+    JsonDestroy(a);
+    JsonDestroy(b);
+    JsonDestroy(c);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -1146,10 +1303,15 @@ int main()
         unit_test(test_parse_array_garbage),
         unit_test(test_parse_array_nested_garbage),
         unit_test(test_parse_object_escaped),
+        unit_test(test_parse_unicode_escapes),
+        unit_test(test_parse_escaped_backslash),
+        unit_test(test_parse_file),
         unit_test(test_parse_tzz_evil_key),
         unit_test(test_array_remove_range),
         unit_test(test_remove_key_from_object),
         unit_test(test_detach_key_from_object),
+        unit_test(test_large_object),
+        unit_test(test_merge_large_object),
     };
 
     return run_tests(tests);
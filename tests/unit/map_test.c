@@ -75,7 +75,7 @@ static void test_insert_jumbo(void)
 
 static void test_remove(void)
 {
-    HashMap *hashmap = HashMapNew(ConstHash, (MapKeyEqualFn)StringSafeEqual, free, free);
+    HashMap *hashmap = HashMapNew(ConstHash, (MapKeyEqualFn)StringSafeEqual, free, free, 0);
 
     HashMapInsert(hashmap, xstrdup("a"), xstrdup("b"));
 
@@ -163,13 +163,13 @@ static void test_iterate(void)
 
 static void test_hashmap_new_destroy(void)
 {
-    HashMap *hashmap = HashMapNew(NULL, NULL, NULL, NULL);
+    HashMap *hashmap = HashMapNew(NULL, NULL, NULL, NULL, 0);
     HashMapDestroy(hashmap);
 }
 
 static void test_hashmap_degenerate_hash_fn(void)
 {
-    HashMap *hashmap = HashMapNew(ConstHash, (MapKeyEqualFn)StringSafeEqual, free, free);
+    HashMap *hashmap = HashMapNew(ConstHash, (MapKeyEqualFn)StringSafeEqual, free, free, 0);
 
     for (int i = 0; i < 100; i++)
     {
@@ -186,6 +186,76 @@ static void test_hashmap_degenerate_hash_fn(void)
     HashMapDestroy(hashmap);
 }
 
+static void test_hashmap_grow_shrink(void)
+{
+    HashMap *hashmap = HashMapNew((MapHashFn)StringHash, (MapKeyEqualFn)StringSafeEqual, free, free, 0);
+    size_t init_capacity = hashmap->capacity;
+
+    for (int i = 0; i < 10000; i++)
+    {
+        char *key;
+        xasprintf(&key, "%d", i);
+        assert_false(HashMapInsert(hashmap, key, xstrdup(key)));
+    }
+    assert_int_equal(HashMapSize(hashmap), 10000);
+    assert_true(hashmap->capacity > 10000);
+
+    for (int i = 0; i < 10000; i += 2)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%d", i);
+        assert_true(HashMapRemove(hashmap, key));
+    }
+    assert_int_equal(HashMapSize(hashmap), 5000);
+
+    for (int i = 0; i < 10000; i++)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%d", i);
+        MapKeyValue *item = HashMapGet(hashmap, key);
+        if (i % 2)
+        {
+            assert_true(item != NULL);
+            assert_string_equal(item->value, key);
+        }
+        else
+        {
+            assert_true(item == NULL);
+        }
+    }
+
+    for (int i = 1; i < 10000; i += 2)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%d", i);
+        assert_true(HashMapRemove(hashmap, key));
+    }
+    assert_int_equal(HashMapSize(hashmap), 0);
+    assert_int_equal(hashmap->capacity, init_capacity);
+
+    HashMapDestroy(hashmap);
+}
+
+static void test_new_with_capacity(void)
+{
+    Map *map = MapNewWithCapacity((MapHashFn)StringHash, (MapKeyEqualFn)StringSafeEqual, free, NULL, 1000);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        char *key;
+        xasprintf(&key, "%d", i);
+        MapInsert(map, key, NULL);
+    }
+    assert_int_equal(MapSize(map), 1000);
+    assert_true(MapHasKey(map, "999"));
+
+    MapClear(map);
+    assert_int_equal(MapSize(map), 0);
+    assert_false(MapHasKey(map, "999"));
+
+    MapDestroy(map);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -201,6 +271,8 @@ int main()
         unit_test(test_iterate),
         unit_test(test_hashmap_new_destroy),
         unit_test(test_hashmap_degenerate_hash_fn),
+        unit_test(test_hashmap_grow_shrink),
+        unit_test(test_new_with_capacity),
     };
 
     return run_tests(tests);
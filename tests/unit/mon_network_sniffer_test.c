@@ -0,0 +1,202 @@
+#include "test.h"
+
+#include "generic_agent.h"
+#include "item_lib.h"
+#include "file_lib.h"
+#include "mon.h"
+
+#define LOCAL_ADDRESS "192.0.2.1"
+#define REMOTE_ADDRESS "198.51.100.7"
+
+static char PCAP_FILE[CF_BUFSIZE];
+
+void tests_setup(void)
+{
+    snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/mon_network_sniffer_test.XXXXXX");
+    mkdtemp(CFWORKDIR);
+
+    char state[CF_BUFSIZE];
+    snprintf(state, CF_BUFSIZE, "%s/state", CFWORKDIR);
+    mkdir(state, 0700);
+
+    snprintf(PCAP_FILE, CF_BUFSIZE, "%s/test.pcap", CFWORKDIR);
+
+    AppendItem(&IPADDRESSES, LOCAL_ADDRESS, "");
+}
+
+void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static FILE *PcapCreate(void)
+{
+    FILE *fp = fopen(PCAP_FILE, "wb");
+    assert_true(fp != NULL);
+
+    /* magic, version 2.4, thiszone, sigfigs, snaplen, Ethernet */
+    uint32_t header[6] = { 0xA1B2C3D4, 2 | (4 << 16), 0, 0, 65535, 1 };
+    fwrite(header, sizeof(header), 1, fp);
+
+    return fp;
+}
+
+static void PcapWrite(FILE *fp, const unsigned char *frame, size_t len)
+{
+    uint32_t record[4] = { 0, 0, len, len };
+    fwrite(record, sizeof(record), 1, fp);
+    fwrite(frame, len, 1, fp);
+}
+
+/* An Ethernet frame holding an IPv4 packet with the given transport header */
+
+static void PcapWriteIPv4(FILE *fp, bool vlan, const char *src, const char *dest, int protocol,
+                          const unsigned char *transport, size_t transport_len)
+{
+    unsigned char frame[128] = { 0 };
+    size_t offset = 12;
+
+    if (vlan)
+    {
+        frame[offset++] = 0x81;
+        frame[offset++] = 0x00;
+        offset += 2;
+    }
+
+    frame[offset++] = 0x08;
+    frame[offset++] = 0x00;
+
+    unsigned char *ip = frame + offset;
+    ip[0] = 0x45;
+    ip[3] = 20 + transport_len;
+    ip[8] = 64;
+    ip[9] = protocol;
+    inet_pton(AF_INET, src, ip + 12);
+    inet_pton(AF_INET, dest, ip + 16);
+    memcpy(ip + 20, transport, transport_len);
+
+    PcapWrite(fp, frame, offset + 20 + transport_len);
+}
+
+static void PcapWriteTCP(FILE *fp, const char *src, const char *dest, unsigned char flags)
+{
+    unsigned char tcp[20] = { 0x9C, 0x40, 0x00, 0x16 };
+    tcp[12] = 5 << 4;
+    tcp[13] = flags;
+
+    PcapWriteIPv4(fp, false, src, dest, IPPROTO_TCP, tcp, sizeof(tcp));
+}
+
+static void PcapWriteUDP(FILE *fp, bool vlan, const char *src, const char *dest, int sport, int dport)
+{
+    unsigned char udp[8] = { sport >> 8, sport & 0xFF, dport >> 8, dport & 0xFF, 0, 8 };
+
+    PcapWriteIPv4(fp, vlan, src, dest, IPPROTO_UDP, udp, sizeof(udp));
+}
+
+void test_replay_classifies_packets(void)
+{
+    FILE *fp = PcapCreate();
+
+    PcapWriteTCP(fp, REMOTE_ADDRESS, LOCAL_ADDRESS, 0x02);       /* SYN */
+    PcapWriteTCP(fp, LOCAL_ADDRESS, REMOTE_ADDRESS, 0x12);       /* SYN ACK */
+    PcapWriteTCP(fp, REMOTE_ADDRESS, LOCAL_ADDRESS, 0x10);       /* ACK */
+    PcapWriteTCP(fp, REMOTE_ADDRESS, LOCAL_ADDRESS, 0x11);       /* FIN ACK */
+    PcapWriteUDP(fp, false, LOCAL_ADDRESS, "198.51.100.53", 40000, 53);
+    PcapWriteUDP(fp, false, REMOTE_ADDRESS, LOCAL_ADDRESS, 123, 123);
+    PcapWriteUDP(fp, true, REMOTE_ADDRESS, LOCAL_ADDRESS, 123, 123);
+
+    unsigned char icmp[8] = { 8 };
+    PcapWriteIPv4(fp, false, LOCAL_ADDRESS, REMOTE_ADDRESS, IPPROTO_ICMP, icmp, sizeof(icmp));
+
+    /* Not directed at us */
+    PcapWriteUDP(fp, false, REMOTE_ADDRESS, "198.51.100.8", 123, 123);
+
+    /* ARP */
+    unsigned char arp[42] = { 0 };
+    arp[12] = 0x08;
+    arp[13] = 0x06;
+    PcapWrite(fp, arp, sizeof(arp));
+
+    fclose(fp);
+
+    double cf_this[100] = { 0 };
+    assert_true(MonNetworkSnifferReplay(PCAP_FILE, 0, cf_this));
+
+    assert_int_equal(1, cf_this[ob_tcpsyn_in]);
+    assert_int_equal(1, cf_this[ob_tcpsyn_out]);
+    assert_int_equal(1, cf_this[ob_tcpack_in]);
+    assert_int_equal(1, cf_this[ob_tcpfin_in]);
+    assert_int_equal(1, cf_this[ob_dns_out]);
+    assert_int_equal(2, cf_this[ob_udp_in]);
+    assert_int_equal(0, cf_this[ob_udp_out]);
+    assert_int_equal(1, cf_this[ob_icmp_out]);
+    assert_int_equal(1, cf_this[ob_tcpmisc_in]);
+
+    MonNetworkSnifferGatherData();
+
+    char filename[CF_BUFSIZE];
+    char *contents = NULL;
+    snprintf(filename, CF_BUFSIZE, "%s/state/cf_incoming.udp", CFWORKDIR);
+    assert_true(FileReadMax(&contents, filename, CF_BUFSIZE) > 0);
+    assert_string_equal("2 " REMOTE_ADDRESS "\n", contents);
+    free(contents);
+
+    snprintf(filename, CF_BUFSIZE, "%s/state/cf_outgoing.dns", CFWORKDIR);
+    assert_true(FileReadMax(&contents, filename, CF_BUFSIZE) > 0);
+    assert_string_equal("1 198.51.100.53\n", contents);
+    free(contents);
+}
+
+void test_replay_sample_rate(void)
+{
+    /* Start counting packets afresh, whatever the tests before replayed */
+    MonNetworkSnifferGatherData();
+    MonNetworkSnifferSetSampleRate(2);
+
+    FILE *fp = PcapCreate();
+    for (int i = 0; i < 3; i++)
+    {
+        PcapWriteUDP(fp, false, REMOTE_ADDRESS, LOCAL_ADDRESS, 123, 123);
+    }
+    fclose(fp);
+
+    /* The second packet is sampled, and stands for the one skipped */
+    double cf_this[100] = { 0 };
+    assert_true(MonNetworkSnifferReplay(PCAP_FILE, 0, cf_this));
+    assert_int_equal(2, cf_this[ob_udp_in]);
+
+    MonNetworkSnifferSetSampleRate(1);
+    MonNetworkSnifferGatherData();
+}
+
+void test_replay_not_pcap(void)
+{
+    FILE *fp = fopen(PCAP_FILE, "w");
+    assert_true(fp != NULL);
+    fputs("IP (tos 0x0, ttl 64, id 0, offset 0, flags [DF], proto ICMP (1), length 84)\n", fp);
+    fclose(fp);
+
+    double cf_this[100] = { 0 };
+    assert_false(MonNetworkSnifferReplay(PCAP_FILE, 0, cf_this));
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_replay_classifies_packets),
+        unit_test(test_replay_sample_rate),
+        unit_test(test_replay_not_pcap),
+    };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
@@ -0,0 +1,100 @@
+#include "test.h"
+
+#include "generic_agent.h"
+#include "item_lib.h"
+#include "mon.h"
+
+extern Item *ALL_INCOMING;
+extern Item *MON_TCP4;
+
+void tests_setup(void)
+{
+    snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/mon_network_test.XXXXXX");
+    mkdtemp(CFWORKDIR);
+
+    char state[CF_BUFSIZE];
+    snprintf(state, CF_BUFSIZE, "%s/state", CFWORKDIR);
+    mkdir(state, 0700);
+}
+
+void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static int Listen(int *port)
+{
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(sd != -1);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert_int_equal(0, bind(sd, (struct sockaddr *) &addr, sizeof(addr)));
+    assert_int_equal(0, listen(sd, 1));
+
+    socklen_t len = sizeof(addr);
+    assert_int_equal(0, getsockname(sd, (struct sockaddr *) &addr, &len));
+    *port = ntohs(addr.sin_port);
+
+    return sd;
+}
+
+void test_listening_port(void)
+{
+    int port;
+    int sd = Listen(&port);
+
+    char portstr[16];
+    snprintf(portstr, sizeof(portstr), "%d", port);
+
+    double cf_this[100] = { 0 };
+    MonNetworkInit();
+    MonNetworkGatherData(cf_this);
+
+    assert_true(IsItemIn(ALL_INCOMING, portstr));
+
+    Item *ip = ReturnItemIn(MON_TCP4, portstr);
+    assert_true(ip != NULL);
+    assert_string_equal("127.0.0.1", ip->classes);
+
+    close(sd);
+}
+
+void test_closed_port(void)
+{
+    int port;
+    int sd = Listen(&port);
+    close(sd);
+
+    char portstr[16];
+    snprintf(portstr, sizeof(portstr), "%d", port);
+
+    double cf_this[100] = { 0 };
+    MonNetworkInit();
+    MonNetworkGatherData(cf_this);
+
+    assert_false(IsItemIn(ALL_INCOMING, portstr));
+    assert_false(IsItemIn(MON_TCP4, portstr));
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_listening_port),
+        unit_test(test_closed_port),
+    };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
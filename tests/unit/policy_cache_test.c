@@ -0,0 +1,190 @@
+#include <test.h>
+
+#include <policy.h>
+#include <policy_cache.h>
+#include <parser.h>
+#include <files_hashes.h>
+
+static char *INPUT_FILE = NULL;
+static char *CACHE_FILE = NULL;
+
+static void CopyTestData(const char *filename, const char *dest)
+{
+    char path[1024];
+    sprintf(path, "%s/%s", TESTDATADIR, filename);
+
+    FILE *in = fopen(path, "r");
+    FILE *out = fopen(dest, "w");
+    assert_true(in != NULL && out != NULL);
+
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        fwrite(buf, 1, n, out);
+    }
+
+    fclose(in);
+    fclose(out);
+}
+
+static char *PolicyJsonString(const Policy *policy)
+{
+    JsonElement *json = PolicyToJson(policy);
+    Writer *w = StringWriter();
+    JsonWrite(w, json, 0);
+    JsonDestroy(json);
+
+    return StringWriterClose(w);
+}
+
+static void setup(void)
+{
+    INPUT_FILE = tempnam(NULL, "cfengine_test");
+    CACHE_FILE = tempnam(NULL, "cfengine_test");
+
+    CopyTestData("benchmark.cf", INPUT_FILE);
+}
+
+static void teardown(void)
+{
+    unlink(INPUT_FILE);
+    unlink(CACHE_FILE);
+    free(INPUT_FILE);
+    free(CACHE_FILE);
+}
+
+static void test_round_trip(void)
+{
+    setup();
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    Policy *original = ParserParseFileDigest(INPUT_FILE, 0, 0, digest);
+    assert_true(original);
+    assert_true(PolicyCacheWriteFile(CACHE_FILE, INPUT_FILE, digest, original));
+
+    Policy *cached = PolicyCacheReadFile(CACHE_FILE, INPUT_FILE);
+    assert_true(cached);
+
+    /* The JSON form covers the whole DOM, including source offsets */
+    char *expected = PolicyJsonString(original);
+    char *actual = PolicyJsonString(cached);
+    assert_string_equal(expected, actual);
+
+    assert_int_equal(PolicyHash(original), PolicyHash(cached));
+
+    free(expected);
+    free(actual);
+    PolicyDestroy(original);
+    PolicyDestroy(cached);
+
+    teardown();
+}
+
+static void test_changed_input(void)
+{
+    setup();
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    Policy *original = ParserParseFileDigest(INPUT_FILE, 0, 0, digest);
+    assert_true(original);
+    assert_true(PolicyCacheWriteFile(CACHE_FILE, INPUT_FILE, digest, original));
+    PolicyDestroy(original);
+
+    FILE *fp = fopen(INPUT_FILE, "a");
+    fputs("\n# changed\n", fp);
+    fclose(fp);
+
+    assert_false(PolicyCacheReadFile(CACHE_FILE, INPUT_FILE));
+
+    teardown();
+}
+
+static void test_changed_after_parsing(void)
+{
+    setup();
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    Policy *original = ParserParseFileDigest(INPUT_FILE, 0, 0, digest);
+    assert_true(original);
+
+    /* The input changes before the copy is written, the copy must not pass for the new contents */
+    FILE *fp = fopen(INPUT_FILE, "a");
+    fputs("\n# changed\n", fp);
+    fclose(fp);
+
+    assert_true(PolicyCacheWriteFile(CACHE_FILE, INPUT_FILE, digest, original));
+    PolicyDestroy(original);
+
+    assert_false(PolicyCacheReadFile(CACHE_FILE, INPUT_FILE));
+
+    teardown();
+}
+
+static void test_other_input(void)
+{
+    setup();
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    Policy *original = ParserParseFileDigest(INPUT_FILE, 0, 0, digest);
+    assert_true(original);
+    assert_true(PolicyCacheWriteFile(CACHE_FILE, INPUT_FILE, digest, original));
+    PolicyDestroy(original);
+
+    /* Same contents under another name */
+    char *other = tempnam(NULL, "cfengine_test");
+    CopyTestData("benchmark.cf", other);
+
+    assert_false(PolicyCacheReadFile(CACHE_FILE, other));
+
+    unlink(other);
+    free(other);
+
+    teardown();
+}
+
+static void test_truncated_cache(void)
+{
+    setup();
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+    Policy *original = ParserParseFileDigest(INPUT_FILE, 0, 0, digest);
+    assert_true(original);
+    assert_true(PolicyCacheWriteFile(CACHE_FILE, INPUT_FILE, digest, original));
+    PolicyDestroy(original);
+
+    struct stat sb;
+    assert_int_equal(0, stat(CACHE_FILE, &sb));
+    assert_int_equal(0, truncate(CACHE_FILE, sb.st_size - 1));
+
+    assert_false(PolicyCacheReadFile(CACHE_FILE, INPUT_FILE));
+
+    teardown();
+}
+
+static void test_missing_cache(void)
+{
+    setup();
+
+    assert_false(PolicyCacheReadFile(CACHE_FILE, INPUT_FILE));
+
+    teardown();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    OpenSSL_add_all_digests();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_round_trip),
+        unit_test(test_changed_input),
+        unit_test(test_changed_after_parsing),
+        unit_test(test_other_input),
+        unit_test(test_truncated_cache),
+        unit_test(test_missing_cache),
+    };
+
+    return run_tests(tests);
+}
@@ -420,6 +420,39 @@ static void test_constraint_comment_nonscalar(void)
     SeqDestroy(errs);
 }
 
+static void test_promise_constraint_lookup(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Policy *policy = PolicyNew();
+    Bundle *bundle = PolicyAppendBundle(policy, "default", "main", "agent", NULL, NULL);
+    PromiseType *files = BundleAppendPromiseType(bundle, "files");
+    Promise *pp = PromiseTypeAppendPromise(files, "/tmp/stuff", (Rval) { NULL, RVAL_TYPE_NOPROMISEE }, "any");
+
+    PromiseAppendConstraint(pp, "create", (Rval) { xstrdup("false"), RVAL_TYPE_SCALAR }, "guard_class", false);
+    PromiseAppendConstraint(pp, "create", (Rval) { xstrdup("true"), RVAL_TYPE_SCALAR }, "any", false);
+    PromiseAppendConstraint(pp, "comment", (Rval) { xstrdup("first"), RVAL_TYPE_SCALAR }, "any", false);
+
+    assert_string_equal("true", RvalScalarValue(PromiseGetConstraint(ctx, pp, "create")->rval));
+    assert_string_equal("false", RvalScalarValue(PromiseGetImmediateConstraint(pp, "create")->rval));
+    assert_true(PromiseGetConstraintAsBoolean(ctx, "create", pp));
+    assert_false(PromiseGetConstraint(ctx, pp, "perms"));
+
+    /* Guards are re-evaluated once the set of classes changes. */
+    EvalContextClassPutHard(ctx, "guard_class");
+    assert_string_equal("false", RvalScalarValue(PromiseGetConstraint(ctx, pp, "create")->rval));
+
+    EvalContextClassRemove(ctx, "default", "guard_class");
+    assert_string_equal("true", RvalScalarValue(PromiseGetConstraint(ctx, pp, "create")->rval));
+
+    /* Constraints appended after a lookup are found too. */
+    PromiseAppendConstraint(pp, "perms", (Rval) { xstrdup("myperms"), RVAL_TYPE_SCALAR }, "any", false);
+    assert_string_equal("myperms", ConstraintGetRvalValue(ctx, "perms", pp, RVAL_TYPE_SCALAR));
+    assert_string_equal("first", ConstraintGetRvalValue(ctx, "comment", pp, RVAL_TYPE_SCALAR));
+
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+}
+
 // TODO: consider moving this into a mod_common_test
 static void test_body_action_with_log_repaired_needs_log_string(void)
 {
@@ -458,6 +491,8 @@ int main()
         unit_test(test_policy_json_to_from),
         unit_test(test_policy_json_offsets),
 
+        unit_test(test_promise_constraint_lookup),
+
         unit_test(test_util_bundle_qualified_name),
         unit_test(test_util_qualified_name_components),
 
@@ -0,0 +1,143 @@
+#include <test.h>
+
+#include <profiler.h>
+#include <writer.h>
+
+static void Spin(unsigned long usec)
+{
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    while ((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 < usec);
+}
+
+static char *Folded(void)
+{
+    Writer *w = StringWriter();
+    ProfilerWriteFolded(w);
+    return StringWriterClose(w);
+}
+
+static char *Summary(size_t top)
+{
+    Writer *w = StringWriter();
+    ProfilerWriteSummary(w, top);
+    return StringWriterClose(w);
+}
+
+static size_t CountLines(const char *str)
+{
+    size_t n = 0;
+    for (const char *c = str; *c != '\0'; c++)
+    {
+        n += (*c == '\n');
+    }
+    return n;
+}
+
+static void test_disabled(void)
+{
+    ProfilerStop();
+    assert_false(ProfilerIsEnabled());
+
+    ProfilerEnter(PROFILE_FRAME_BUNDLE, "default", "main");
+    Spin(1000);
+    ProfilerLeave();
+
+    char *folded = Folded();
+    assert_string_equal("", folded);
+    free(folded);
+}
+
+static void test_folded_paths(void)
+{
+    ProfilerStart();
+    assert_true(ProfilerIsEnabled());
+
+    ProfilerEnter(PROFILE_FRAME_BUNDLE, "default", "main");
+    Spin(1000);
+    ProfilerEnter(PROFILE_FRAME_PROMISE, "files", "/etc/motd");
+    ProfilerEnter(PROFILE_FRAME_ITERATION, NULL, "/etc/motd");
+    Spin(1000);
+    ProfilerEnter(PROFILE_FRAME_FUNCTION, NULL, "readfile");
+    Spin(1000);
+    ProfilerLeave();
+    ProfilerLeave();
+    ProfilerLeave();
+    ProfilerLeave();
+
+    char *folded = Folded();
+    assert_true(strstr(folded, "bundle default:main ") == folded);
+    assert_true(strstr(folded, "\nbundle default:main;files:/etc/motd;/etc/motd ") != NULL);
+    assert_true(strstr(folded, "\nbundle default:main;files:/etc/motd;/etc/motd;readfile() ") != NULL);
+    free(folded);
+
+    ProfilerStop();
+}
+
+static void test_aggregation(void)
+{
+    ProfilerStart();
+
+    for (int i = 0; i < 3; i++)
+    {
+        ProfilerEnter(PROFILE_FRAME_BUNDLE, "default", "main");
+        ProfilerEnter(PROFILE_FRAME_FUNCTION, NULL, "execresult");
+        Spin(1000);
+        ProfilerLeave();
+        ProfilerLeave();
+    }
+
+    ProfilerEnter(PROFILE_FRAME_BUNDLE, "default", "other");
+    ProfilerEnter(PROFILE_FRAME_FUNCTION, NULL, "execresult");
+    Spin(1000);
+    ProfilerLeave();
+    ProfilerLeave();
+
+    char *folded = Folded();
+    assert_true(strstr(folded, "bundle default:main;execresult() ") != NULL);
+    assert_true(strstr(folded, "bundle default:other;execresult() ") != NULL);
+    free(folded);
+
+    /* Calls are summed over both paths and the function comes first */
+    char *summary = Summary(1);
+    assert_int_equal(2, CountLines(summary));
+    const char *row = strchr(summary, '\n') + 1;
+    assert_true(strstr(row, " 4  function  execresult()\n") != NULL);
+    free(summary);
+
+    ProfilerStop();
+}
+
+static void test_names_escaped(void)
+{
+    ProfilerStart();
+
+    ProfilerEnter(PROFILE_FRAME_ITERATION, NULL, "a;b\nc");
+    Spin(1000);
+    ProfilerLeave();
+
+    char *folded = Folded();
+    assert_true(strncmp(folded, "a_b_c ", strlen("a_b_c ")) == 0);
+    assert_int_equal(1, CountLines(folded));
+    free(folded);
+
+    ProfilerStop();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_disabled),
+        unit_test(test_folded_paths),
+        unit_test(test_aggregation),
+        unit_test(test_names_escaped),
+    };
+
+    return run_tests(tests);
+}
@@ -129,6 +129,47 @@ static void test_iterate(void)
     RBTreeDestroy(t);
 }
 
+static void test_iterate_from(void)
+{
+    RBTree *t = IntTreeNew_();
+
+    for (int i = 0; i < 20; i += 2)
+    {
+        RBTreePut(t, &i, &i);
+    }
+
+    {
+        int from = 7;
+        RBTreeIterator *it = RBTreeIteratorNewFrom(t, &from);
+        for (int i = 8; i < 20; i += 2)
+        {
+            int *k = NULL;
+            assert_true(RBTreeIteratorNext(it, (void **)&k, NULL));
+            assert_int_equal(i, *k);
+        }
+        assert_false(RBTreeIteratorNext(it, NULL, NULL));
+        RBTreeIteratorDestroy(it);
+    }
+
+    {
+        int from = 8;
+        RBTreeIterator *it = RBTreeIteratorNewFrom(t, &from);
+        int *k = NULL;
+        assert_true(RBTreeIteratorNext(it, (void **)&k, NULL));
+        assert_int_equal(8, *k);
+        RBTreeIteratorDestroy(it);
+    }
+
+    {
+        int from = 100;
+        RBTreeIterator *it = RBTreeIteratorNewFrom(t, &from);
+        assert_false(RBTreeIteratorNext(it, NULL, NULL));
+        RBTreeIteratorDestroy(it);
+    }
+
+    RBTreeDestroy(t);
+}
+
 static void test_put_remove_random(void)
 {
     Seq *nums = SeqNew(20000, free);
@@ -233,6 +274,7 @@ int main()
         unit_test(test_put_remove_inorder),
         unit_test(test_iterate_empty),
         unit_test(test_iterate),
+        unit_test(test_iterate_from),
         unit_test(test_put_remove_random),
         unit_test(test_clear),
         unit_test(test_equal),
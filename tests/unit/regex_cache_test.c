@@ -0,0 +1,166 @@
+#include <test.h>
+
+#include <platform.h>
+#include <alloc.h>
+#include <regex_cache.h>
+#include <string_lib.h>
+
+#define BENCH_LINES 10000
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void test_hit_and_miss(void)
+{
+    RegexCacheClear();
+
+    const CompiledRegex *a = RegexCacheAcquire("ab+c", PCRE_MULTILINE, NULL, NULL);
+    assert_true(a != NULL);
+    const CompiledRegex *b = RegexCacheAcquire("ab+c", PCRE_MULTILINE, NULL, NULL);
+    assert_true(a == b);
+
+    /* Same pattern with different options is a distinct entry */
+    const CompiledRegex *c = RegexCacheAcquire("ab+c", PCRE_CASELESS, NULL, NULL);
+    assert_true(c != NULL);
+    assert_true(c != a);
+
+    RegexCacheStats stats;
+    RegexCacheGetStats(&stats);
+    assert_int_equal(stats.hits, 1);
+    assert_int_equal(stats.misses, 2);
+    assert_int_equal(stats.size, 2);
+
+    RegexCacheRelease(a);
+    RegexCacheRelease(b);
+    RegexCacheRelease(c);
+}
+
+static void test_invalid_pattern(void)
+{
+    const char *errorstr = NULL;
+    int erroffset = -1;
+
+    assert_true(RegexCacheAcquire("(unbalanced", 0, &errorstr, &erroffset) == NULL);
+    assert_true(errorstr != NULL);
+    assert_true(erroffset >= 0);
+
+    RegexCacheRelease(NULL);
+}
+
+static void test_bounded_size(void)
+{
+    RegexCacheClear();
+
+    for (int i = 0; i < 1000; i++)
+    {
+        char pattern[32];
+        snprintf(pattern, sizeof(pattern), "line%d.*", i);
+        RegexCacheRelease(RegexCacheAcquire(pattern, 0, NULL, NULL));
+    }
+
+    RegexCacheStats stats;
+    RegexCacheGetStats(&stats);
+    assert_int_equal(stats.misses, 1000);
+    assert_true(stats.size < 1000);
+    assert_int_equal(stats.size + stats.evictions, 1000);
+}
+
+static void test_string_match_uses_cache(void)
+{
+    RegexCacheClear();
+
+    assert_true(StringMatchFull("[a-z]+", "abc"));
+    assert_false(StringMatchFull("[a-z]+", "abc1"));
+    assert_true(StringMatch("[0-9]", "abc1"));
+
+    RegexCacheStats stats;
+    RegexCacheGetStats(&stats);
+    assert_int_equal(stats.misses, 2);
+    assert_int_equal(stats.hits, 1);
+}
+
+/* Mimics edit_line select_line_matching / delete_lines over a 10k line file */
+static void test_benchmark_edit_line(void)
+{
+    const char *patterns[] =
+    {
+        "^\\s*#.*", "PermitRootLogin\\s+.*", "^[a-z0-9_]+\\s*=\\s*\\d+$", ".*ssh-rsa\\s+\\S+.*"
+    };
+    const size_t num_patterns = sizeof(patterns) / sizeof(patterns[0]);
+
+    char **lines = xcalloc(BENCH_LINES, sizeof(char *));
+    for (int i = 0; i < BENCH_LINES; i++)
+    {
+        xasprintf(&lines[i], "net.ipv4.conf.eth%d.rp_filter = %d # line %d", i % 8, i % 2, i);
+    }
+
+    size_t matched_uncached = 0;
+    double start = Now();
+    for (int i = 0; i < BENCH_LINES; i++)
+    {
+        for (size_t p = 0; p < num_patterns; p++)
+        {
+            const char *errorstr;
+            int erroffset;
+            int ovector[30];
+            pcre *rx = pcre_compile(patterns[p], PCRE_MULTILINE | PCRE_DOTALL, &errorstr, &erroffset, NULL);
+            if (pcre_exec(rx, NULL, lines[i], strlen(lines[i]), 0, 0, ovector, 30) >= 0)
+            {
+                matched_uncached++;
+            }
+            pcre_free(rx);
+        }
+    }
+    double uncached = Now() - start;
+
+    RegexCacheClear();
+
+    size_t matched_cached = 0;
+    start = Now();
+    for (int i = 0; i < BENCH_LINES; i++)
+    {
+        for (size_t p = 0; p < num_patterns; p++)
+        {
+            if (StringMatch(patterns[p], lines[i]))
+            {
+                matched_cached++;
+            }
+        }
+    }
+    double cached = Now() - start;
+
+    assert_int_equal(matched_cached, matched_uncached);
+
+    RegexCacheStats stats;
+    RegexCacheGetStats(&stats);
+    assert_int_equal(stats.misses, num_patterns);
+    assert_int_equal(stats.hits, BENCH_LINES * num_patterns - num_patterns);
+
+    printf("%d lines x %zu patterns: uncached %.3fs, cached %.3fs (%.1fx)\n",
+           BENCH_LINES, num_patterns, uncached, cached, cached > 0 ? uncached / cached : 0.0);
+
+    for (int i = 0; i < BENCH_LINES; i++)
+    {
+        free(lines[i]);
+    }
+    free(lines);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_hit_and_miss),
+        unit_test(test_invalid_pattern),
+        unit_test(test_bounded_size),
+        unit_test(test_string_match_uses_cache),
+        unit_test(test_benchmark_edit_line),
+    };
+
+    return run_tests(tests);
+}
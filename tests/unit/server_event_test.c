@@ -0,0 +1,158 @@
+#include <test.h>
+
+#include <server_event.h>
+
+/*
+ * The event loop only drives ServerConnectionState through the four calls
+ * below, so replace them with an echo server over socketpairs.
+ */
+
+static int STARTED;
+static int SERVED;
+static int FINISHED;
+static pthread_mutex_t COUNT_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+static void Count(int *counter)
+{
+    pthread_mutex_lock(&COUNT_LOCK);
+    (*counter)++;
+    pthread_mutex_unlock(&COUNT_LOCK);
+}
+
+static int GetCount(int *counter)
+{
+    pthread_mutex_lock(&COUNT_LOCK);
+    int ret = *counter;
+    pthread_mutex_unlock(&COUNT_LOCK);
+    return ret;
+}
+
+bool ServerConnectionStart(ARG_UNUSED ServerConnectionState *conn)
+{
+    Count(&STARTED);
+    return true;
+}
+
+bool ServerConnectionServe(ServerConnectionState *conn)
+{
+    char buf[16];
+    ssize_t len = recv(conn->conn_info.sd, buf, sizeof(buf), 0);
+    if (len <= 0)
+    {
+        return false;
+    }
+    send(conn->conn_info.sd, buf, len, 0);
+    Count(&SERVED);
+    return true;
+}
+
+bool ServerConnectionHasPending(ARG_UNUSED const ServerConnectionState *conn)
+{
+    return false;
+}
+
+void ServerConnectionFinish(ServerConnectionState *conn)
+{
+    close(conn->conn_info.sd);
+    free(conn);
+    Count(&FINISHED);
+}
+
+void DeleteConn(ServerConnectionState *conn)
+{
+    close(conn->conn_info.sd);
+    free(conn);
+}
+
+/*********************************************************************/
+
+#define NUM_CONNS 200
+#define NUM_WORKERS 4
+
+static void WaitFor(int *counter, int expected)
+{
+    for (int i = 0; i < 500 && GetCount(counter) < expected; i++)
+    {
+        usleep(10000);
+    }
+}
+
+static void test_many_connections_few_workers(void)
+{
+    int peers[NUM_CONNS];
+
+    STARTED = SERVED = FINISHED = 0;
+
+    assert_true(ServerEventLoopStart(NUM_WORKERS));
+    assert_true(ServerEventLoopRunning());
+
+    for (int i = 0; i < NUM_CONNS; i++)
+    {
+        int sv[2];
+        assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+        ServerConnectionState *conn = xcalloc(1, sizeof(*conn));
+        conn->conn_info.sd = sv[0];
+        peers[i] = sv[1];
+        ServerEventLoopAdd(conn);
+    }
+
+    /* Every connection gets answered repeatedly although only NUM_WORKERS
+     * threads exist. */
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < NUM_CONNS; i++)
+        {
+            char out[4] = "abc";
+            char in[4] = "";
+            assert_int_equal(send(peers[i], out, 3, 0), 3);
+            assert_int_equal(recv(peers[i], in, 3, MSG_WAITALL), 3);
+            assert_memory_equal(in, out, 3);
+        }
+    }
+
+    /* The handler counts a request only after its reply has been sent. */
+    WaitFor(&SERVED, 3 * NUM_CONNS);
+    assert_int_equal(GetCount(&STARTED), NUM_CONNS);
+    assert_int_equal(GetCount(&SERVED), 3 * NUM_CONNS);
+
+    ServerEventStats stats;
+    ServerEventLoopGetStats(&stats);
+    assert_int_equal(stats.workers, NUM_WORKERS);
+    assert_int_equal(stats.connections, NUM_CONNS);
+    assert_int_equal(stats.peak_connections, NUM_CONNS);
+    assert_int_equal(stats.accepted, NUM_CONNS);
+
+    /* Clients hanging up are noticed without any thread blocking on them. */
+    for (int i = 0; i < NUM_CONNS / 2; i++)
+    {
+        close(peers[i]);
+    }
+    WaitFor(&FINISHED, NUM_CONNS / 2);
+    assert_int_equal(GetCount(&FINISHED), NUM_CONNS / 2);
+
+    ServerEventLoopGetStats(&stats);
+    assert_int_equal(stats.connections, NUM_CONNS / 2);
+    assert_int_equal(stats.queue_depth, 0);
+
+    /* Stopping closes whatever is still parked. */
+    ServerEventLoopStop();
+    assert_false(ServerEventLoopRunning());
+    assert_int_equal(GetCount(&FINISHED), NUM_CONNS);
+
+    for (int i = NUM_CONNS / 2; i < NUM_CONNS; i++)
+    {
+        close(peers[i]);
+    }
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_many_connections_few_workers),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,82 @@
+#include <cf3.defs.h>
+
+#include <warm_worker.h>
+#include <env_context.h>
+#include <generic_agent.h>
+#include <policy.h>
+
+#include <test.h>
+
+static void tests_setup(void)
+{
+    OpenSSL_add_all_digests();
+    snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/warm_worker_test.XXXXXX");
+    mkdtemp(CFWORKDIR);
+
+    char buf[CF_BUFSIZE];
+    snprintf(buf, CF_BUFSIZE, "%s/state", CFWORKDIR);
+    mkdir(buf, 0755);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static void test_persistent_class_across_runs(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Policy *policy = PolicyNew();
+    GenericAgentConfig *config = GenericAgentConfigNewDefault(AGENT_TYPE_AGENT);
+
+    /* Run N, forked from the worker, defines a persistent class */
+    EvalContextHeapPersistentSave("warm_persistent", "default", 10, CONTEXT_STATE_POLICY_RESET);
+    assert_true(EvalContextClassGet(ctx, "default", "warm_persistent") == NULL);
+
+    /* Run N+1 is forked from the worker again */
+    WarmWorkerRefreshContext(ctx, policy, config, false);
+    assert_true(EvalContextClassGet(ctx, "default", "warm_persistent") != NULL);
+
+    EvalContextHeapPersistentRemove("default:warm_persistent");
+    GenericAgentConfigDestroy(config);
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+}
+
+static void test_soft_classes_dropped(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Policy *policy = PolicyNew();
+    GenericAgentConfig *config = GenericAgentConfigNewDefault(AGENT_TYPE_AGENT);
+
+    /* Defined when the worker loaded the policy */
+    EvalContextClassPut(ctx, NULL, "warm_loaded", true, CONTEXT_SCOPE_NAMESPACE);
+
+    WarmWorkerRefreshContext(ctx, policy, config, true);
+    assert_true(EvalContextClassGet(ctx, "default", "warm_loaded") == NULL);
+    assert_true(EvalContextClassGet(ctx, "default", "scheduled_run") != NULL);
+
+    GenericAgentConfigDestroy(config);
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_persistent_class_across_runs),
+        unit_test(test_soft_classes_dropped),
+    };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+
+    return ret;
+}